@@ -0,0 +1,540 @@
+#include "../src/tls_parser.h"
+#include "../src/tls_arena.h"
+#include "../src/tls_cache.h"
+#include "../src/tls_stats.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Throughput of parse_tls_message (initialize_tls_structure through parse_*) per message type,
+// over the example corpus and a set of synthetic messages. Allocations are counted by wrapping
+// malloc/calloc/realloc at link time (see the Makefile), so only the library's calls are seen.
+
+#define MAX_BENCH_GROUPS 64
+#define DEFAULT_SECONDS_PER_GROUP 0.2
+
+typedef struct {
+    unsigned char *data;
+    int size;
+} BenchMessage;
+
+typedef struct {
+    char name[64];
+    BenchMessage *messages;
+    size_t count;
+    size_t capacity;
+    size_t bytes;
+} BenchGroup;
+
+static BenchGroup groups[MAX_BENCH_GROUPS];
+static int group_count = 0;
+
+static unsigned long allocations = 0;
+static int copy_messages = 0;
+static int classify_suites = 0;
+static int validate_only = 0;
+static int use_cache = 0;
+static int fingerprint_hellos = 0;
+static int aggregate_hellos = 0;
+static MessageCache message_cache;
+static TlsStats stats;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static BenchGroup *get_group(const char *name) {
+    int i;
+
+    for (i = 0; i < group_count; i++) {
+        if (strcmp(groups[i].name, name) == 0) {
+            return &groups[i];
+        }
+    }
+
+    if (group_count == MAX_BENCH_GROUPS) {
+        return NULL;
+    }
+
+    BenchGroup *group = &groups[group_count++];
+    snprintf(group->name, sizeof(group->name), "%s", name);
+
+    return group;
+}
+
+// Takes over data
+static void add_message(const char *group_name, unsigned char *data, int size) {
+    BenchGroup *group = get_group(group_name);
+
+    if (group == NULL) {
+        free(data);
+        return;
+    }
+
+    if (group->count == group->capacity) {
+        size_t capacity = group->capacity ? group->capacity * 2 : 16;
+        BenchMessage *messages = (BenchMessage *)realloc(group->messages, capacity * sizeof(BenchMessage));
+
+        if (messages == NULL) {
+            free(data);
+            return;
+        }
+
+        group->messages = messages;
+        group->capacity = capacity;
+    }
+
+    group->messages[group->count].data = data;
+    group->messages[group->count].size = size;
+    group->count++;
+    group->bytes += size;
+}
+
+// Example files are grouped by the handshake type byte they claim to be
+static void add_example(unsigned char *data, int size) {
+    add_message(size > RECORD_HEADER_SIZE ? get_handshake_type_name(data[RECORD_HEADER_SIZE]) : "(short record)", data, size);
+}
+
+static void load_path(char *path, size_t length, size_t capacity) {
+    struct stat sb;
+
+    if (lstat(path, &sb) != 0) {
+        fprintf(stderr, "%s: couldn't be read\n", path);
+        return;
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        DIR *dir = opendir(path);
+        struct dirent *entry;
+
+        if (dir == NULL) {
+            return;
+        }
+
+        while ((entry = readdir(dir)) != NULL) {
+            size_t name_length = strlen(entry->d_name);
+
+            if (entry->d_name[0] == '.' || length + 1 + name_length >= capacity) {
+                continue;
+            }
+
+            path[length] = '/';
+            memcpy(path + length + 1, entry->d_name, name_length + 1);
+            load_path(path, length + 1 + name_length, capacity);
+            path[length] = '\0';
+        }
+
+        closedir(dir);
+
+        return;
+    }
+
+    if (!S_ISREG(sb.st_mode) || sb.st_size == 0 || sb.st_size > 1 << 20) {
+        return;
+    }
+
+    FILE *file = fopen(path, "rb");
+    unsigned char *data = (unsigned char *)malloc(sb.st_size);
+
+    if (file != NULL && data != NULL && fread(data, 1, sb.st_size, file) == (size_t)sb.st_size) {
+        add_example(data, (int)sb.st_size);
+        data = NULL;
+    }
+
+    free(data);
+    if (file != NULL) {
+        fclose(file);
+    }
+}
+
+// Synthetic messages
+
+static uint32_t random_state = 0x2545f491;
+
+static uint8_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+
+    return (uint8_t)random_state;
+}
+
+static size_t put16(unsigned char *p, size_t pos, uint16_t value) {
+    p[pos] = value >> 8;
+    p[pos + 1] = value & 0xff;
+
+    return pos + 2;
+}
+
+static size_t put24(unsigned char *p, size_t pos, uint32_t value) {
+    p[pos] = (value >> 16) & 0xff;
+    p[pos + 1] = (value >> 8) & 0xff;
+    p[pos + 2] = value & 0xff;
+
+    return pos + 3;
+}
+
+// Fills in the record and handshake headers of a message whose body ends at end
+static int finish_record(unsigned char *p, size_t end, uint8_t hs_type) {
+    p[0] = HANDSHAKE;
+    p[1] = 0x03;
+    p[2] = 0x01;
+    put16(p, 3, end - RECORD_HEADER_SIZE);
+    p[5] = hs_type;
+    put24(p, 6, end - RECORD_HEADER_SIZE - HANDSHAKE_HEADER_SIZE);
+
+    return (int)end;
+}
+
+static size_t put_extension(unsigned char *p, size_t pos, uint16_t type, const unsigned char *data, uint16_t length) {
+    pos = put16(p, pos, type);
+    pos = put16(p, pos, length);
+    memcpy(p + pos, data, length);
+
+    return pos + length;
+}
+
+static size_t put_hello_start(unsigned char *p, size_t pos) {
+    int i;
+
+    pos = put16(p, pos, 0x0303);
+    for (i = 0; i < 32; i++) {
+        p[pos++] = next_random();
+    }
+
+    p[pos++] = 32;
+    for (i = 0; i < 32; i++) {
+        p[pos++] = next_random();
+    }
+
+    return pos;
+}
+
+static void add_synthetic_client_hello(int suites, int extensions) {
+    unsigned char *p = (unsigned char *)calloc(1, 65536);
+    unsigned char ext[512];
+    char name[64];
+    size_t pos = RECORD_HEADER_SIZE + HANDSHAKE_HEADER_SIZE;
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+
+    pos = put_hello_start(p, pos);
+
+    pos = put16(p, pos, 2 * suites);
+    for (i = 0; i < suites; i++) {
+        pos = put16(p, pos, i % 16 == 0 ? 0x0a0a : 0xc000 + i);
+    }
+
+    p[pos++] = 1;
+    p[pos++] = 0;
+
+    size_t extensions_start = pos;
+    pos += 2;
+
+    // SNI, groups, point formats, signature algorithms, ALPN, supported versions, then filler
+    const char *host = "www.example.com";
+    size_t n = 0;
+    n = put16(ext, n, strlen(host) + 3);
+    ext[n++] = 0;
+    n = put16(ext, n, strlen(host));
+    memcpy(ext + n, host, strlen(host));
+    n += strlen(host);
+    pos = put_extension(p, pos, SERVER_NAME, ext, n);
+
+    n = put16(ext, 0, 8);
+    n = put16(ext, n, 0x001d);
+    n = put16(ext, n, 0x0017);
+    n = put16(ext, n, 0x0018);
+    n = put16(ext, n, 0x0019);
+    pos = put_extension(p, pos, SUPPORTED_GROUPS, ext, n);
+
+    ext[0] = 1;
+    ext[1] = 0;
+    pos = put_extension(p, pos, EC_POINT_FORMATS, ext, 2);
+
+    n = put16(ext, 0, 2 * 16);
+    for (i = 0; i < 16; i++) {
+        n = put16(ext, n, 0x0400 + i);
+    }
+    pos = put_extension(p, pos, SIGNATURE_ALGORITHMS, ext, n);
+
+    static const unsigned char alpn[] = { 0x00, 0x0c, 0x02, 'h', '2', 0x08, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+    pos = put_extension(p, pos, APPLICATION_LAYER_PROTOCOL_NEGOTIATION, alpn, sizeof(alpn));
+
+    static const unsigned char versions[] = { 0x04, 0x03, 0x04, 0x03, 0x03 };
+    pos = put_extension(p, pos, SUPPORTED_VERSIONS, versions, sizeof(versions));
+
+    for (i = 6; i < extensions; i++) {
+        uint16_t length = next_random() % 32;
+        int j;
+
+        for (j = 0; j < length; j++) {
+            ext[j] = next_random();
+        }
+
+        pos = put_extension(p, pos, 0x1000 + i, ext, length);
+    }
+
+    put16(p, extensions_start, pos - extensions_start - 2);
+
+    snprintf(name, sizeof(name), "synthetic ClientHello %d/%d", suites, extensions);
+    add_message(name, p, finish_record(p, pos, CLIENT_HELLO));
+}
+
+static void add_synthetic_server_hello(void) {
+    unsigned char *p = (unsigned char *)calloc(1, 4096);
+    size_t pos = RECORD_HEADER_SIZE + HANDSHAKE_HEADER_SIZE;
+
+    if (p == NULL) {
+        return;
+    }
+
+    pos = put_hello_start(p, pos);
+    pos = put16(p, pos, 0xc02f);
+    p[pos++] = 0;
+
+    static const unsigned char extensions[] = {
+        0x00, 0x14,
+        0xff, 0x01, 0x00, 0x01, 0x00,                              // renegotiation_info
+        0x00, 0x10, 0x00, 0x05, 0x00, 0x03, 0x02, 'h', '2',        // ALPN
+        0x00, 0x0b, 0x00, 0x02, 0x01, 0x00                         // ec_point_formats
+    };
+    memcpy(p + pos, extensions, sizeof(extensions));
+    pos += sizeof(extensions);
+
+    add_message("synthetic ServerHello", p, finish_record(p, pos, SERVER_HELLO));
+}
+
+static void add_synthetic_certificate(int certificates, int certificate_size) {
+    unsigned char *p = (unsigned char *)calloc(1, 65536);
+    char name[64];
+    size_t pos = RECORD_HEADER_SIZE + HANDSHAKE_HEADER_SIZE + 3;
+    int i, j;
+
+    if (p == NULL) {
+        return;
+    }
+
+    for (i = 0; i < certificates; i++) {
+        pos = put24(p, pos, certificate_size);
+        for (j = 0; j < certificate_size; j++) {
+            p[pos++] = next_random();
+        }
+    }
+
+    put24(p, RECORD_HEADER_SIZE + HANDSHAKE_HEADER_SIZE, pos - RECORD_HEADER_SIZE - HANDSHAKE_HEADER_SIZE - 3);
+
+    snprintf(name, sizeof(name), "synthetic Certificate %dx%d", certificates, certificate_size);
+    add_message(name, p, finish_record(p, pos, CERTIFICATE));
+}
+
+static void add_synthetic_messages(void) {
+    add_synthetic_client_hello(16, 8);
+    add_synthetic_client_hello(256, 32);
+    add_synthetic_client_hello(2048, 64);
+    add_synthetic_client_hello(4096, 200);
+    add_synthetic_server_hello();
+    add_synthetic_certificate(3, 1500);
+    add_synthetic_certificate(8, 7000);
+}
+
+// Parses the messages of a group over and over for at least the given time
+static void run_group(BenchGroup *group, double seconds) {
+    ParsedMessage parsed;
+    MessageSummary summary;
+    unsigned long iterations = 0;
+    unsigned long ok = 0;
+    unsigned long allocations_before = allocations;
+    double start = now();
+    double elapsed;
+    volatile uint32_t sink = 0;
+
+    do {
+        // Check the clock only once per round over the group
+        size_t i;
+        for (i = 0; i < group->count; i++) {
+            if (validate_only) {
+                ok += validate_tls_message(group->messages[i].data, group->messages[i].size, &summary) == NO_ERROR;
+                sink += summary.handshake.mLength;
+
+                continue;
+            }
+
+            int err;
+
+            if (use_cache) {
+                memset(&parsed, 0, sizeof(parsed));
+                err = initialize_tls_structure(group->messages[i].data, group->messages[i].size, &parsed.handshake);
+                if (err == NO_ERROR) {
+                    err = parse_cached_handshake_body(&message_cache, &parsed);
+                }
+            } else {
+                err = parse_tls_message(group->messages[i].data, group->messages[i].size, &parsed);
+            }
+
+            ok += err == NO_ERROR;
+            sink += parsed.handshake.mLength;
+
+            if (fingerprint_hellos && err == NO_ERROR) {
+                const Fingerprint *cached = use_cache ? get_cached_fingerprint(&message_cache, &parsed) : NULL;
+                Fingerprint fingerprint;
+
+                if (cached != NULL) {
+                    sink += cached->raw;
+                } else if (parsed.handshake.hsType == CLIENT_HELLO) {
+                    compute_ja3(&parsed.clientHello, JA3_MD5 | JA3_RAW, &fingerprint);
+                    sink += fingerprint.raw;
+                } else if (parsed.handshake.hsType == SERVER_HELLO) {
+                    compute_ja3s(&parsed.serverHello, JA3_MD5 | JA3_RAW, &fingerprint);
+                    sink += fingerprint.raw;
+                }
+            }
+
+            if (aggregate_hellos && err == NO_ERROR) {
+                add_hello_stats(&stats, &parsed, use_cache && fingerprint_hellos ? get_cached_fingerprint(&message_cache, &parsed) : NULL);
+            }
+
+            if (classify_suites && err == NO_ERROR && parsed.handshake.hsType == CLIENT_HELLO) {
+                sink += classify_cipher_suites(parsed.clientHello.csCollection.cipherSuites, parsed.clientHello.csCollection.length);
+            }
+
+            // Detach the message from its input like a consumer keeping it around would
+            if (copy_messages && err == NO_ERROR) {
+                ParsedMessage copy;
+                Arena *arena = get_thread_arena();
+
+                copy_parsed_message(&parsed, arena, &copy);
+                sink += (uintptr_t)copy.handshake.body;
+                reset_arena(arena);
+            }
+        }
+
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    double messages = (double)iterations * group->count;
+
+    printf("%-38s %6zu %6.1f%% %12.0f %10.1f %9.1f %8.2f\n",
+           group->name, group->count, 100.0 * ok / messages, messages / elapsed,
+           iterations * group->bytes / elapsed / 1e6, elapsed * 1e9 / messages,
+           (allocations - allocations_before) / messages);
+
+    (void)sink;
+}
+
+static void usage(const char *program) {
+    printf("usage: %s [-c] [-k] [-v] [-f] [-r] [-a] [-t seconds_per_type] [path ...]\n\n", program);
+    printf("Loads the files below the given paths (examples/valid and examples/invalid by default)\n");
+    printf("and a set of synthetic messages, and reports the parse throughput per message type.\n");
+    printf("With -c every parsed message is also copied into the thread's arena, with -k the cipher\n");
+    printf("suites of every ClientHello are classified. -v only validates the messages\n");
+    printf("(validate_tls_message) instead of parsing them. -f computes the JA3/JA3S fingerprint of every\n");
+    printf("hello, -r parses the messages through a message cache, which returns repeated hellos (and\n");
+    printf("their fingerprints) without parsing them again. -a adds every hello to an aggregate\n");
+    printf("(tls_stats.h).\n");
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = DEFAULT_SECONDS_PER_GROUP;
+    char path[4096];
+    int first = 1;
+    int i;
+
+    while (first < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "-c") == 0) {
+            copy_messages = 1;
+            first++;
+        } else if (strcmp(argv[first], "-v") == 0) {
+            validate_only = 1;
+            first++;
+        } else if (strcmp(argv[first], "-f") == 0) {
+            fingerprint_hellos = 1;
+            first++;
+        } else if (strcmp(argv[first], "-r") == 0) {
+            use_cache = 1;
+            first++;
+        } else if (strcmp(argv[first], "-a") == 0) {
+            aggregate_hellos = 1;
+            first++;
+        } else if (strcmp(argv[first], "-k") == 0) {
+            classify_suites = 1;
+            first++;
+        } else if (strcmp(argv[first], "-t") == 0 && first + 1 < argc) {
+            seconds = atof(argv[first + 1]);
+            first += 2;
+        } else {
+            usage(argv[0]);
+
+            return 0;
+        }
+    }
+
+    const char *default_paths[] = { "examples/valid", "examples/invalid" };
+    int count = argc - first;
+    char **paths = argv + first;
+
+    if (count == 0) {
+        paths = (char **)default_paths;
+        count = 2;
+    }
+
+    for (i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s", paths[i]);
+        load_path(path, strlen(path), sizeof(path));
+    }
+
+    add_synthetic_messages();
+
+    // Created up front, so that its allocation isn't counted for the first group
+    if (copy_messages) {
+        get_thread_arena();
+    }
+
+    if (use_cache && init_message_cache(&message_cache, DEFAULT_MESSAGE_CACHE_SIZE) != 0) {
+        printf("Couldn't allocate the message cache.\n");
+        return 1;
+    }
+
+    if (aggregate_hellos && init_tls_stats(&stats) != 0) {
+        printf("Couldn't allocate the aggregate.\n");
+        return 1;
+    }
+
+    printf("%-38s %6s %7s %12s %10s %9s %8s\n", "type", "msgs", "ok", "msgs/s", "MB/s", "ns/msg", "allocs");
+
+    for (i = 0; i < group_count; i++) {
+        run_group(&groups[i], seconds);
+    }
+
+    free_thread_arena();
+    free_message_cache(&message_cache);
+    free_tls_stats(&stats);
+
+    return 0;
+}
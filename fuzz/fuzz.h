@@ -0,0 +1,21 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Entry points for the fuzzers in fuzz_targets.c. The record and stream targets take raw records,
+// the message targets take a handshake body (what follows the 4 bytes handshake header), which is
+// what fuzz/seed_corpus.sh extracts from the examples for them.
+typedef void (*FuzzFunction)(const uint8_t *data, size_t size);
+
+typedef struct {
+    const char *name;
+    FuzzFunction run;
+} FuzzTarget;
+
+extern const FuzzTarget fuzz_targets[];
+
+const FuzzTarget *find_fuzz_target(const char *name);
+
+#endif
@@ -0,0 +1,406 @@
+#include "fuzz.h"
+#include "../src/tls_parser.h"
+#include "../src/tls_stats.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Runs a target of fuzz_targets.c without libFuzzer:
+//  - on the files (or directories) given, optionally with random mutants of each, which is a
+//    cheap fuzzer for sanitizer builds where libFuzzer isn't available
+//  - on stdin, which is what AFL expects (in persistent mode when built with afl-clang-fast)
+//  - repeatedly on the same inputs (-n), as a stress benchmark of the parsers
+// With -c it splits the records given into seeds for every target instead (see write_corpus).
+// Every input is copied into a buffer of its exact size, so that ASan catches a read past its end.
+
+#define MAX_INPUT_SIZE (1 << 20)
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+} FuzzInput;
+
+static FuzzInput *inputs;
+static size_t input_count;
+static size_t input_capacity;
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_random(void) {
+    // xorshift64*
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int add_input(const unsigned char *data, size_t size) {
+    if (input_count == input_capacity) {
+        size_t capacity = input_capacity ? 2 * input_capacity : 64;
+        FuzzInput *grown = (FuzzInput *)realloc(inputs, capacity * sizeof(FuzzInput));
+
+        if (grown == NULL) {
+            return -1;
+        }
+
+        inputs = grown;
+        input_capacity = capacity;
+    }
+
+    // malloc(0) may return NULL, an empty input still gets a (1 byte) buffer
+    unsigned char *copy = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    memcpy(copy, data, size);
+    inputs[input_count].data = copy;
+    inputs[input_count].size = size;
+    input_count++;
+
+    return 0;
+}
+
+static int load_file(const char *path) {
+    FILE *file = fopen(path, "rb");
+    static unsigned char buf[MAX_INPUT_SIZE];
+
+    if (file == NULL) {
+        fprintf(stderr, "Can't open %s\n", path);
+
+        return -1;
+    }
+
+    size_t size = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+
+    return add_input(buf, size);
+}
+
+static int load_path(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Can't access %s\n", path);
+
+        return -1;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return load_file(path);
+    }
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    struct dirent *entry;
+    char child[4096];
+    int result = 0;
+
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        result = load_path(child);
+    }
+
+    closedir(dir);
+
+    return result;
+}
+
+static void run_exact(const FuzzTarget *target, const unsigned char *data, size_t size) {
+    unsigned char *copy = (unsigned char *)malloc(size > 0 ? size : 1);
+
+    if (copy == NULL) {
+        return;
+    }
+
+    memcpy(copy, data, size);
+    target->run(copy, size);
+    free(copy);
+}
+
+// Bit flips, interesting bytes, truncation, insertion and duplication, a few at a time
+static size_t mutate(const unsigned char *data, size_t size, unsigned char *out, size_t capacity) {
+    static const unsigned char interesting[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x7f, 0x80, 0xff };
+    size_t length = size < capacity ? size : capacity;
+    int steps = 1 + next_random() % 4;
+
+    memcpy(out, data, length);
+
+    for (int i = 0; i < steps; i++) {
+        uint64_t r = next_random();
+        size_t pos = length > 0 ? (r >> 8) % length : 0;
+
+        switch (r % 6) {
+        case 0:
+            if (length > 0) {
+                out[pos] ^= 1 << ((r >> 40) % 8);
+            }
+            break;
+        case 1:
+            if (length > 0) {
+                out[pos] = interesting[(r >> 40) % sizeof(interesting)];
+            }
+            break;
+        case 2:
+            if (length > 0) {
+                out[pos] = (unsigned char)(r >> 48);
+            }
+            break;
+        case 3:
+            length = pos;
+            break;
+        case 4:
+            if (length < capacity) {
+                memmove(out + pos + 1, out + pos, length - pos);
+                out[pos] = (unsigned char)(r >> 48);
+                length++;
+            }
+            break;
+        default: {
+            size_t chunk = 1 + (r >> 40) % 16;
+            if (pos + chunk <= length && length + chunk <= capacity) {
+                memmove(out + pos + chunk, out + pos, length - pos);
+                length += chunk;
+            }
+            break;
+        }
+        }
+    }
+
+    return length;
+}
+
+static int write_seed(const char *dir, const char *target, size_t index, const unsigned char *data, size_t size) {
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, target);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/seed-%zu", dir, target, index);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't write %s\n", path);
+
+        return -1;
+    }
+
+    fwrite(data, 1, size, file);
+    fclose(file);
+
+    return 0;
+}
+
+// Every input is a seed for record and stream. Messages that parse give the body to their own
+// target, hellos their extensions block and certificates the DER of every certificate in the chain.
+// The hellos of all inputs are aggregated into the one seed of the stats target.
+static int write_corpus(const char *dir) {
+    static const char *const body_targets[256] = {
+        [CLIENT_HELLO] = "client_hello",
+        [SERVER_HELLO] = "server_hello",
+        [CERTIFICATE] = "certificate",
+        [CERTIFICATE_REQUEST] = "certificate_request",
+        [CERTIFICATE_VERIFY] = "certificate_verify",
+        [CLIENT_KEY_EXCHANGE] = "client_key_exchange",
+        [FINISHED] = "finished",
+    };
+    ParsedMessage parsed;
+    TlsStats stats;
+    OutputBuffer serialized;
+
+    if (mkdir(dir, 0755) != 0 && access(dir, W_OK) != 0) {
+        fprintf(stderr, "Can't create %s\n", dir);
+
+        return -1;
+    }
+
+    if (init_tls_stats(&stats) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < input_count; i++) {
+        const unsigned char *data = inputs[i].data;
+        size_t size = inputs[i].size;
+
+        if (write_seed(dir, "record", i, data, size) != 0 || write_seed(dir, "stream", i, data, size) != 0) {
+            return -1;
+        }
+
+        memset(&parsed, 0, sizeof(parsed));
+
+        if (size > INT32_MAX || initialize_tls_structure(data, (int)size, &parsed.handshake) != NO_ERROR) {
+            continue;
+        }
+
+        const HandshakeMessage *handshake = &parsed.handshake;
+        const char *target = handshake->sslv2 ? "sslv2_client_hello" : body_targets[handshake->hsType];
+
+        if (target != NULL && write_seed(dir, target, i, handshake->body, handshake->mLength) != 0) {
+            return -1;
+        }
+
+        if (parse_handshake_body(&parsed) != NO_ERROR) {
+            continue;
+        }
+
+        add_hello_stats(&stats, &parsed, NULL);
+
+        if (handshake->hsType == CLIENT_HELLO && parsed.clientHello.hasExtensions) {
+            write_seed(dir, "extensions", i, parsed.clientHello.extensions, parsed.clientHello.extensionsLength);
+        } else if (handshake->hsType == SERVER_HELLO && parsed.serverHello.hasExtensions) {
+            write_seed(dir, "extensions", i, parsed.serverHello.extensions, parsed.serverHello.extensionsLength);
+        } else if (handshake->hsType == CERTIFICATE) {
+            for (int j = 0; j < parsed.certificate.count; j++) {
+                write_seed(dir, "x509", i * MAX_CHAIN_CERTIFICATES + j, parsed.certificate.entries[j].data, parsed.certificate.entries[j].length);
+            }
+        }
+    }
+
+    int result = -1;
+    if (init_output_buffer(&serialized, 0) == 0 && serialize_tls_stats(&serialized, &stats) == 0) {
+        result = write_seed(dir, "stats", 0, (const unsigned char *)serialized.data, serialized.length);
+    }
+
+    free_output_buffer(&serialized);
+    free_tls_stats(&stats);
+
+    return result;
+}
+
+static void print_usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t target] [-n rounds] [-m mutants] [-s seed] [path ...]\n\n", name);
+    fprintf(stderr, "  -t TARGET   Target to run (default record):");
+    for (const FuzzTarget *target = fuzz_targets; target->name != NULL; target++) {
+        fprintf(stderr, " %s", target->name);
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -n ROUNDS   Run every input ROUNDS times and report the time per input.\n");
+    fprintf(stderr, "  -m MUTANTS  Also run MUTANTS random mutations of every input.\n");
+    fprintf(stderr, "  -s SEED     Seed of the mutations.\n");
+    fprintf(stderr, "  -c DIR      Write a seed corpus for every target from the records given.\n\n");
+    fprintf(stderr, "Without a path a single input is read from stdin (AFL).\n");
+}
+
+int main(int argc, char **argv) {
+    const char *target_name = "record";
+    unsigned long rounds = 1;
+    unsigned long mutants = 0;
+    const char *corpus_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:m:s:c:h")) != -1) {
+        switch (opt) {
+        case 't':
+            target_name = optarg;
+            break;
+        case 'n':
+            rounds = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            mutants = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            random_state = strtoull(optarg, NULL, 0) | 1;
+            break;
+        case 'c':
+            corpus_dir = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const FuzzTarget *target = find_fuzz_target(target_name);
+    if (target == NULL) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (optind == argc) {
+        static unsigned char buf[MAX_INPUT_SIZE];
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+        while (__AFL_LOOP(10000)) {
+#endif
+            size_t size = fread(buf, 1, sizeof(buf), stdin);
+            run_exact(target, buf, size);
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+        }
+#endif
+
+        return 0;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (load_path(argv[i]) != 0) {
+            return 1;
+        }
+    }
+
+    if (corpus_dir != NULL) {
+        return write_corpus(corpus_dir) == 0 ? 0 : 1;
+    }
+
+    double start = now();
+    size_t bytes = 0;
+
+    for (unsigned long round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < input_count; i++) {
+            target->run(inputs[i].data, inputs[i].size);
+            bytes += inputs[i].size;
+        }
+    }
+
+    double elapsed = now() - start;
+    unsigned long runs = rounds * input_count;
+
+    if (runs > 0) {
+        printf("%s: %zu inputs x %lu rounds, %.1f ns per input, %.1f MB/s\n", target->name, input_count, rounds,
+               1e9 * elapsed / runs, elapsed > 0 ? bytes / elapsed / 1e6 : 0.0);
+    }
+
+    if (mutants > 0) {
+        unsigned char *mutant = (unsigned char *)malloc(MAX_INPUT_SIZE);
+        if (mutant == NULL) {
+            return 1;
+        }
+
+        for (size_t i = 0; i < input_count; i++) {
+            for (unsigned long m = 0; m < mutants; m++) {
+                size_t size = mutate(inputs[i].data, inputs[i].size, mutant, MAX_INPUT_SIZE);
+                run_exact(target, mutant, size);
+            }
+        }
+
+        printf("%s: %lu mutants of %zu inputs\n", target->name, mutants * input_count, input_count);
+        free(mutant);
+    }
+
+    for (size_t i = 0; i < input_count; i++) {
+        free(inputs[i].data);
+    }
+    free(inputs);
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+#include "fuzz.h"
+#include "../src/tls_arena.h"
+#include "../src/tls_cache.h"
+#include "../src/tls_output.h"
+#include "../src/tls_stats.h"
+#include "../src/tls_stream.h"
+#include "../src/tls_x509.h"
+
+// Every target runs a parser and then everything that consumes its result (accessors, fingerprints,
+// output formats, arena copies), since those trust the parser about the lengths they walk. Results
+// are folded into fuzz_sink so that nothing is optimized away when the targets are benchmarked.
+//
+// Built with libFuzzer, FUZZ_TARGET names the target of LLVMFuzzerTestOneInput (see the Makefile).
+// fuzz_driver.c runs them without libFuzzer, e.g. under AFL or as a stress benchmark.
+
+volatile uint64_t fuzz_sink;
+
+static OutputBuffer output;
+static Arena arena;
+static TlsStats stats;
+
+static void exercise_extensions(const ExtensionIndex *index) {
+    const unsigned char *data;
+    uint16_t length;
+    uint8_t count;
+    ProtocolNameList protocols;
+    KeyShareList shares;
+    Uint16List list;
+    uint64_t sink = 0;
+
+    if (get_server_name(index, &data, &length) == NO_ERROR) {
+        sink += data[0] + length;
+    }
+
+    if (get_alpn_protocols(index, &protocols) == NO_ERROR) {
+        for (int i = 0; i < protocols.count; i++) {
+            sink += protocols.names[i].name[protocols.names[i].length - 1];
+        }
+    }
+
+    if (get_supported_versions(index, &list) == NO_ERROR && list.count > 0) {
+        sink += get_uint16_list_value(&list, list.count - 1);
+    }
+
+    if (get_supported_groups(index, &list) == NO_ERROR && list.count > 0) {
+        sink += get_uint16_list_value(&list, list.count - 1);
+    }
+
+    if (get_signature_algorithms(index, &list) == NO_ERROR && list.count > 0) {
+        sink += get_uint16_list_value(&list, list.count - 1);
+    }
+
+    if (get_ec_point_formats(index, &data, &count) == NO_ERROR && count > 0) {
+        sink += data[count - 1];
+    }
+
+    if (get_key_shares(index, &shares) == NO_ERROR) {
+        for (int i = 0; i < shares.count; i++) {
+            if (shares.entries[i].keyExchange != NULL) {
+                sink += shares.entries[i].keyExchange[shares.entries[i].length - 1];
+            }
+        }
+    }
+
+    fuzz_sink += sink;
+}
+
+static void exercise_client_hello(const ClientHello *hello) {
+    Fingerprint fingerprint;
+    char ja3[1024];
+
+    compute_ja3(hello, JA3_MD5 | JA3_RAW, &fingerprint);
+    fuzz_sink += fingerprint.raw + format_ja3_string(hello, ja3, sizeof(ja3));
+    fuzz_sink += classify_cipher_suites(hello->csCollection.cipherSuites, hello->csCollection.length);
+
+    if (hello->hasExtensions) {
+        exercise_extensions(&hello->extensionIndex);
+    }
+}
+
+static void exercise_server_hello(const ServerHello *hello) {
+    Fingerprint fingerprint;
+    char ja3s[256];
+
+    compute_ja3s(hello, JA3_MD5 | JA3_RAW, &fingerprint);
+    fuzz_sink += fingerprint.raw + format_ja3s_string(hello, ja3s, sizeof(ja3s));
+
+    if (hello->hasExtensions) {
+        exercise_extensions(&hello->extensionIndex);
+    }
+}
+
+static void exercise_certificate(const unsigned char *der, uint32_t length) {
+    CertificateSummary summary;
+    X509Certificate certificate;
+    const unsigned char *value;
+    uint32_t pos = 0, value_length;
+    int type;
+
+    fuzz_sink += summarize_certificate(der, length, &summary) + summary.fingerprint[0] + strlen(summary.subject);
+
+    if (decode_x509_certificate(der, length, &certificate) == NO_ERROR) {
+        while (next_subject_alt_name(&certificate, &pos, &type, &value, &value_length)) {
+            fuzz_sink += type + value_length;
+        }
+    }
+}
+
+static void exercise_parsed_message(const ParsedMessage *parsed, int err) {
+    if (output.data == NULL && init_output_buffer(&output, DEFAULT_OUTPUT_CAPACITY) != 0) {
+        return;
+    }
+
+    reset_output_buffer(&output);
+    append_json_message(&output, "fuzz", 1, parsed, err, OUTPUT_FINGERPRINTS);
+    append_binary_message(&output, "fuzz", 1, parsed, err);
+    fuzz_sink += output.length;
+
+    if (err != NO_ERROR) {
+        return;
+    }
+
+    if (stats.top != NULL || init_tls_stats(&stats) == 0) {
+        add_hello_stats(&stats, parsed, NULL);
+    }
+
+    switch (parsed->handshake.hsType) {
+    case CLIENT_HELLO:
+        exercise_client_hello(&parsed->clientHello);
+        break;
+    case SERVER_HELLO:
+        exercise_server_hello(&parsed->serverHello);
+        break;
+    case CERTIFICATE:
+        for (int i = 0; i < parsed->certificate.count; i++) {
+            exercise_certificate(parsed->certificate.entries[i].data, parsed->certificate.entries[i].length);
+        }
+        break;
+    default:
+        break;
+    }
+
+    // The copy has to format exactly like the original, otherwise a view wasn't rebased
+    ParsedMessage copy;
+    size_t length = output.length;
+
+    if (arena.base == NULL && init_arena(&arena, 4096) != 0) {
+        return;
+    }
+
+    reset_arena(&arena);
+    if (copy_parsed_message(parsed, &arena, &copy) == 0) {
+        append_json_message(&output, "fuzz", 1, &copy, err, OUTPUT_FINGERPRINTS);
+        append_binary_message(&output, "fuzz", 1, &copy, err);
+
+        if (output.length - length != length || memcmp(output.data, output.data + length, length) != 0) {
+            abort();
+        }
+    }
+}
+
+// Validation has to come to the same verdict as parsing, and report the same version and server name
+static void check_validation(const MessageSummary *summary, int validated, const ParsedMessage *parsed, int err) {
+    const unsigned char *name = NULL;
+    uint16_t length = 0;
+
+    if (validated != err) {
+        abort();
+    }
+
+    if (err != NO_ERROR || parsed->handshake.hsType != CLIENT_HELLO) {
+        return;
+    }
+
+    if (!parsed->clientHello.sslv2 && parsed->clientHello.hasExtensions) {
+        get_server_name(&parsed->clientHello.extensionIndex, &name, &length);
+    }
+
+    if (summary->serverName != name || summary->serverNameLength != length ||
+        memcmp(&summary->version, &parsed->clientHello.maxVersion, sizeof(ProtocolVersion)) != 0) {
+        abort();
+    }
+}
+
+// Through the message cache, once when it's added and once as a hit, a message has to come to the
+// same verdict and format exactly like parsed directly. Mutants that differ in the Random or the
+// SessionID only hit the entries of earlier inputs.
+static void check_cache(const ParsedMessage *parsed, int err) {
+    static MessageCache cache;
+    ParsedMessage cached;
+
+    if (parsed->handshake.body == NULL || output.data == NULL || (cache.entries == NULL && init_message_cache(&cache, 4) != 0)) {
+        return;
+    }
+
+    reset_output_buffer(&output);
+    append_json_message(&output, "fuzz", 1, parsed, err, OUTPUT_FINGERPRINTS);
+    size_t length = output.length;
+
+    for (int round = 0; round < 2; round++) {
+        memset(&cached, 0, sizeof(cached));
+        cached.handshake = parsed->handshake;
+
+        if (parse_cached_handshake_body(&cache, &cached) != err) {
+            abort();
+        }
+
+        append_json_message(&output, "fuzz", 1, &cached, err, OUTPUT_FINGERPRINTS);
+        if (output.length - length != length || memcmp(output.data, output.data + length, length) != 0) {
+            abort();
+        }
+
+        output.length = length;
+    }
+}
+
+static void fuzz_record(const uint8_t *data, size_t size) {
+    ParsedMessage parsed;
+    MessageSummary summary;
+
+    if (size > INT32_MAX) {
+        return;
+    }
+
+    int err = parse_tls_message(data, (int)size, &parsed);
+    check_validation(&summary, validate_tls_message(data, (int)size, &summary), &parsed, err);
+    exercise_parsed_message(&parsed, err);
+    check_cache(&parsed, err);
+}
+
+static void drain_stream(RecordStream *stream) {
+    ParsedMessage parsed;
+    int err;
+
+    memset(&parsed, 0, sizeof(parsed));
+
+    while ((err = next_stream_message(stream, &parsed.handshake)) != STREAM_NEED_MORE_DATA) {
+        if (stream->error) {
+            break;
+        }
+
+        if (err == NO_ERROR) {
+            MessageSummary summary;
+
+            summary.handshake = parsed.handshake;
+            err = parse_handshake_body(&parsed);
+            check_validation(&summary, validate_handshake_body(&summary), &parsed, err);
+            exercise_parsed_message(&parsed, err);
+        }
+    }
+}
+
+// Concatenated records, once attached in place and once fed through a small ring in odd sized
+// chunks, so that records wrap around its end
+static void fuzz_stream(const uint8_t *data, size_t size) {
+    static RecordStream stream;
+    size_t chunk = size > 0 ? 1 + data[0] % 61 : 1;
+
+    if (stream.ring == NULL) {
+        if (init_record_stream(&stream, 1024) != 0) {
+            return;
+        }
+
+        // Small enough that messages over the limit are seen, but the seeds are still reassembled
+        stream.maxMessageSize = 8192;
+    }
+
+    attach_record_stream(&stream, data, size);
+    drain_stream(&stream);
+
+    reset_record_stream(&stream);
+    size_t pos = 0;
+    while (pos < size && !stream.error) {
+        size_t length = size - pos < chunk ? size - pos : chunk;
+        size_t accepted = feed_record_stream(&stream, data + pos, length);
+
+        pos += accepted;
+        drain_stream(&stream);
+
+        // A record larger than the ring can never be completed
+        if (accepted == 0 && stream.tail - stream.head == stream.capacity) {
+            break;
+        }
+    }
+}
+
+static void fuzz_client_hello(const uint8_t *data, size_t size) {
+    ClientHello hello;
+
+    if (size <= UINT32_MAX && parse_client_hello(data, size, &hello) == NO_ERROR) {
+        exercise_client_hello(&hello);
+    }
+}
+
+static void fuzz_sslv2_client_hello(const uint8_t *data, size_t size) {
+    ClientHello hello;
+
+    if (size <= UINT32_MAX && parse_sslv2_client_hello(data, size, &hello) == NO_ERROR) {
+        exercise_client_hello(&hello);
+    }
+}
+
+static void fuzz_server_hello(const uint8_t *data, size_t size) {
+    ServerHello hello;
+
+    if (size <= UINT32_MAX && parse_server_hello(data, size, &hello) == NO_ERROR) {
+        exercise_server_hello(&hello);
+    }
+}
+
+static void fuzz_extensions(const uint8_t *data, size_t size) {
+    ExtensionIndex index;
+
+    if (size > UINT32_MAX) {
+        return;
+    }
+
+    // Both formats, and the HelloRetryRequest variant of key_share
+    for (int from_server = 0; from_server <= 2; from_server++) {
+        if (build_extension_index(data, size, from_server > 0, &index) == NO_ERROR) {
+            index.helloRetryRequest = from_server == 2;
+            exercise_extensions(&index);
+        }
+    }
+}
+
+static void fuzz_certificate(const uint8_t *data, size_t size) {
+    CertificateChain chain;
+
+    if (size <= UINT32_MAX && parse_certificate(data, size, &chain) == NO_ERROR) {
+        for (int i = 0; i < chain.count; i++) {
+            exercise_certificate(chain.entries[i].data, chain.entries[i].length);
+        }
+    }
+}
+
+static void fuzz_x509(const uint8_t *data, size_t size) {
+    if (size <= UINT32_MAX) {
+        exercise_certificate(data, size);
+    }
+}
+
+static void fuzz_certificate_request(const uint8_t *data, size_t size) {
+    CertificateRequest request;
+    char name[CERTIFICATE_NAME_SIZE];
+
+    if (size > UINT32_MAX) {
+        return;
+    }
+
+    for (int tls12 = 0; tls12 <= 1; tls12++) {
+        if (parse_certificate_request(data, size, tls12, &request) != NO_ERROR) {
+            continue;
+        }
+
+        // Every authority is a DER encoded Name with a 2 bytes length
+        uint32_t pos = 0;
+        while (pos < request.authoritiesLength) {
+            uint16_t length = (request.authorities[pos] << 8) | request.authorities[pos + 1];
+
+            fuzz_sink += format_x509_name(request.authorities + pos + 2, length, name, sizeof(name));
+            pos += 2 + length;
+        }
+
+        if (request.signatureAlgorithms.count > 0) {
+            fuzz_sink += get_uint16_list_value(&request.signatureAlgorithms, request.signatureAlgorithms.count - 1);
+        }
+    }
+}
+
+static void fuzz_certificate_verify(const uint8_t *data, size_t size) {
+    CertificateVerify verify;
+
+    if (size > UINT32_MAX) {
+        return;
+    }
+
+    for (int tls12 = 0; tls12 <= 1; tls12++) {
+        if (parse_certificate_verify(data, size, tls12, &verify) == NO_ERROR && verify.signatureLength > 0) {
+            fuzz_sink += verify.signature[verify.signatureLength - 1];
+        }
+    }
+}
+
+static void fuzz_finished(const uint8_t *data, size_t size) {
+    Finished finished;
+
+    if (size <= UINT32_MAX && parse_finished(data, size, &finished) == NO_ERROR) {
+        fuzz_sink += finished.verifyData[finished.length - 1];
+    }
+}
+
+static void fuzz_client_key_exchange(const uint8_t *data, size_t size) {
+    if (size <= UINT32_MAX) {
+        fuzz_sink += parse_client_key_exchange(data, size);
+    }
+}
+
+// Serialized aggregates come from other processes. One that is accepted has to come out the same
+// after another round trip, and merge and report like any other.
+static void fuzz_stats(const uint8_t *data, size_t size) {
+    static TlsStats loaded, total;
+
+    if (output.data == NULL && init_output_buffer(&output, DEFAULT_OUTPUT_CAPACITY) != 0) {
+        return;
+    }
+
+    if (loaded.top == NULL && (init_tls_stats(&loaded) != 0 || init_tls_stats(&total) != 0)) {
+        return;
+    }
+
+    if (deserialize_tls_stats(&loaded, data, size) != 0) {
+        return;
+    }
+
+    reset_output_buffer(&output);
+    if (serialize_tls_stats(&output, &loaded) != 0) {
+        return;
+    }
+
+    size_t length = output.length;
+
+    if (deserialize_tls_stats(&loaded, (const unsigned char *)output.data, length) != 0 || serialize_tls_stats(&output, &loaded) != 0 ||
+        output.length - length != length || memcmp(output.data, output.data + length, length) != 0) {
+        abort();
+    }
+
+    merge_tls_stats(&total, &loaded);
+
+    reset_output_buffer(&output);
+    append_stats_json(&output, &total);
+    fuzz_sink += output.length;
+}
+
+const FuzzTarget fuzz_targets[] = {
+    { "record", fuzz_record },
+    { "stream", fuzz_stream },
+    { "client_hello", fuzz_client_hello },
+    { "sslv2_client_hello", fuzz_sslv2_client_hello },
+    { "server_hello", fuzz_server_hello },
+    { "extensions", fuzz_extensions },
+    { "certificate", fuzz_certificate },
+    { "x509", fuzz_x509 },
+    { "certificate_request", fuzz_certificate_request },
+    { "certificate_verify", fuzz_certificate_verify },
+    { "finished", fuzz_finished },
+    { "client_key_exchange", fuzz_client_key_exchange },
+    { "stats", fuzz_stats },
+    { NULL, NULL }
+};
+
+const FuzzTarget *find_fuzz_target(const char *name) {
+    for (const FuzzTarget *target = fuzz_targets; target->name != NULL; target++) {
+        if (strcmp(target->name, name) == 0) {
+            return target;
+        }
+    }
+
+    return NULL;
+}
+
+#ifdef FUZZ_TARGET
+#define FUZZ_STRING(name) #name
+#define FUZZ_NAME(name) FUZZ_STRING(name)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static const FuzzTarget *target;
+
+    if (target == NULL) {
+        target = find_fuzz_target(FUZZ_NAME(FUZZ_TARGET));
+    }
+
+    target->run(data, size);
+
+    return 0;
+}
+#endif
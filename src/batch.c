@@ -0,0 +1,430 @@
+#include "tls_parser_cli.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void batch_process_directory(char *path, size_t length, size_t capacity, BatchContext *ctx);
+
+int run_batch(char **paths, int count, const char *list_path, int workers, int use_mmap, int use_uring) {
+    BatchContext *ctx = (BatchContext *)calloc(1, sizeof(BatchContext));
+    JobList jobs;
+    memset(&jobs, 0, sizeof(jobs));
+
+    if (ctx == NULL) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    ctx->useMmap = use_mmap;
+    ctx->stats = get_message_stats();
+
+    // With several workers the paths are only collected here and parsed by run_parallel_batch,
+    // with io_uring by run_uring_batch
+    if (workers > 1 || use_uring) {
+        ctx->jobs = &jobs;
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        if (strcmp(paths[i], "-") == 0) {
+            batch_process_list(stdin, ctx);
+        } else {
+            batch_process_path(paths[i], ctx);
+        }
+    }
+
+    if (list_path) {
+        FILE *list = fopen(list_path, "r");
+        if (list == NULL) {
+            batch_write(ctx, "The list file '%s' couldn't be opened.\n", list_path);
+        } else {
+            batch_process_list(list, ctx);
+            fclose_safe(list);
+        }
+    }
+
+    if (workers > 1) {
+        flush_batch_output(ctx);
+        run_parallel_batch(&jobs, workers, use_mmap, &ctx->summary, ctx->stats);
+        free_job_list(&jobs);
+    } else if (use_uring) {
+        ctx->jobs = NULL;
+
+        // Without io_uring (old kernel, seccomp filter) the files are read one by one as usual
+        if (run_uring_batch(&jobs, ctx) != 0) {
+            size_t j;
+
+            for (j = 0; j < jobs.count; j++) {
+                batch_process_file(jobs.paths + jobs.offsets[j], ctx);
+            }
+        }
+
+        free_job_list(&jobs);
+    }
+
+    flush_batch_output(ctx);
+    print_batch_summary(&ctx->summary);
+    print_message_stats();
+
+    int result = ctx->summary.ok == ctx->summary.files ? 0 : 1;
+
+    free_batch_context(ctx);
+
+    return result;
+}
+
+void batch_write(BatchContext *ctx, const char *format, ...) {
+    // Lines are collected in the context and written out in large blocks. This keeps the
+    // workers of a parallel run from contending on stdout for every single line.
+    va_list args;
+    int length;
+
+    // Only the records go to stdout in the machine readable formats
+    if (output_format != OUTPUT_TEXT) {
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+
+        return;
+    }
+
+    va_start(args, format);
+    length = vsnprintf(ctx->output + ctx->outputLength, sizeof(ctx->output) - ctx->outputLength, format, args);
+    va_end(args);
+
+    if (length < 0) {
+        return;
+    }
+
+    if ((size_t)length >= sizeof(ctx->output) - ctx->outputLength) {
+        flush_batch_output(ctx);
+
+        va_start(args, format);
+        length = vsnprintf(ctx->output, sizeof(ctx->output), format, args);
+        va_end(args);
+
+        if (length < 0) {
+            return;
+        }
+
+        if ((size_t)length >= sizeof(ctx->output)) {
+            length = sizeof(ctx->output) - 1;
+        }
+    }
+
+    ctx->outputLength += length;
+}
+
+void flush_batch_output(BatchContext *ctx) {
+    if (ctx->outputLength) {
+        fwrite(ctx->output, 1, ctx->outputLength, stdout);
+        fflush(stdout);
+        ctx->outputLength = 0;
+    }
+
+    if (ctx->records.length) {
+        fwrite(ctx->records.data, 1, ctx->records.length, stdout);
+        fflush(stdout);
+        reset_output_buffer(&ctx->records);
+    }
+}
+
+void free_batch_context(BatchContext *ctx) {
+    free(ctx->input.data);
+    free_output_buffer(&ctx->records);
+    free(ctx);
+}
+
+void batch_process_list(FILE *list, BatchContext *ctx) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+
+    // One path per line, empty lines are ignored
+    while ((length = getline(&line, &line_capacity, list)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+
+        if (length > 0) {
+            batch_process_path(line, ctx);
+        }
+    }
+
+    free(line);
+}
+
+void batch_process_path(const char *path, BatchContext *ctx) {
+    struct stat sb;
+
+    if (lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        // The directory walk appends to a single path buffer instead of allocating per entry
+        char buf[PATH_MAX];
+        size_t length = strlen(path);
+
+        if (length >= sizeof(buf)) {
+            batch_write(ctx, "%s: [SKIPPED] The path is too long.\n", path);
+            return;
+        }
+
+        memcpy(buf, path, length + 1);
+        batch_process_directory(buf, length, sizeof(buf), ctx);
+
+        return;
+    }
+
+    batch_process_file(path, ctx);
+}
+
+static void batch_process_directory(char *path, size_t length, size_t capacity, BatchContext *ctx) {
+    DIR *dir = opendir(path);
+
+    if (dir == NULL) {
+        batch_write(ctx, "%s: [SKIPPED] The directory couldn't be opened.\n", path);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t name_length = strlen(entry->d_name);
+        if (length + 1 + name_length >= capacity) {
+            batch_write(ctx, "%s/%s: [SKIPPED] The path is too long.\n", path, entry->d_name);
+            continue;
+        }
+
+        path[length] = '/';
+        memcpy(path + length + 1, entry->d_name, name_length + 1);
+
+        // Symbolic links are never followed, the same as for single files
+        if (entry->d_type == DT_DIR) {
+            batch_process_directory(path, length + 1 + name_length, capacity, ctx);
+        } else if (entry->d_type == DT_UNKNOWN) {
+            batch_process_path(path, ctx);
+        } else {
+            batch_process_file(path, ctx);
+        }
+
+        path[length] = '\0';
+    }
+
+    closedir(dir);
+}
+
+void batch_process_file(const char *path, BatchContext *ctx) {
+    if (ctx->jobs) {
+        if (add_job(ctx->jobs, path) != 0) {
+            batch_write(ctx, "%s: [SKIPPED] Out of memory.\n", path);
+            ctx->summary.skipped++;
+        }
+
+        return;
+    }
+
+    int file_size = -1;
+    const unsigned char *data;
+    const char *reason;
+    MappedFile mapped;
+
+    if (ctx->useMmap) {
+        reason = map_input_file(path, &mapped, MADV_WILLNEED);
+        data = mapped.data;
+        file_size = mapped.size > MAXIMUM_FILE_SIZE ? MAXIMUM_FILE_SIZE : (int)mapped.size;
+    } else {
+        reason = read_input_file(path, &ctx->input, &file_size);
+        data = ctx->input.data;
+    }
+
+    if (reason != NULL) {
+        batch_write(ctx, "%s: [SKIPPED] %s\n", path, reason);
+        ctx->summary.skipped++;
+
+        return;
+    }
+
+    // A mapped file larger than any record can't be valid, the clamped size fails the length checks
+    batch_process_data(path, data, file_size, ctx);
+
+    if (ctx->useMmap) {
+        unmap_input_file(&mapped);
+    }
+}
+
+// Parses the content of one file and reports the result, however the file was read
+void batch_process_data(const char *path, const unsigned char *data, int file_size, BatchContext *ctx) {
+    ParsedMessage parsed;
+    int err;
+
+    if (screen_messages) {
+        MessageSummary message;
+
+        err = validate_tls_message(data, file_size, &message);
+        if (!screen_message(&ctx->summary, &message, err)) {
+            return;
+        }
+    }
+
+    err = parse_tls_message(data, file_size, &parsed);
+
+    record_batch_result(&ctx->summary, &parsed.handshake, err);
+    record_message_stats(ctx->stats, &parsed, err);
+
+    METRIC_START(output_start);
+    if (output_format != OUTPUT_TEXT) {
+        // Records are collected like the text lines and written in blocks of BATCH_OUTPUT_SIZE
+        append_message_record(&ctx->records, path, 0, &parsed, err);
+        if (ctx->records.length >= BATCH_OUTPUT_SIZE) {
+            flush_batch_output(ctx);
+        }
+    } else if (err) {
+        batch_write(ctx, "%s: [ERROR] %s\n", path, get_error_description(err));
+    } else {
+        char fingerprint[FINGERPRINT_SUFFIX_SIZE];
+        format_fingerprint_suffix(&parsed, fingerprint);
+        batch_write(ctx, "%s: [OK] %s%s\n", path, get_handshake_type_name(parsed.handshake.hsType), fingerprint);
+    }
+    METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+}
+
+void record_batch_result(BatchSummary *summary, const HandshakeMessage *handshake, int err) {
+    summary->files++;
+
+    if (err == NO_ERROR) {
+        summary->ok++;
+    }
+
+    summary->errors[err < NUMBER_OF_ERROR_CODES ? err : NUMBER_OF_ERROR_CODES]++;
+
+    // The body is only set once the record layer is valid, before that the handshake type is unknown
+    if (handshake->body != NULL) {
+        uint8_t type = handshake->hsType;
+
+        if (err == NO_ERROR) {
+            summary->typeOk[type]++;
+        } else {
+            summary->typeErrors[type]++;
+        }
+    } else {
+        summary->noTypeErrors++;
+    }
+}
+
+void merge_batch_summary(BatchSummary *into, const BatchSummary *from) {
+    int i;
+
+    into->files += from->files;
+    into->ok += from->ok;
+    into->skipped += from->skipped;
+    into->noTypeErrors += from->noTypeErrors;
+    into->filtered += from->filtered;
+
+    for (i = 0; i <= NUMBER_OF_ERROR_CODES; i++) {
+        into->errors[i] += from->errors[i];
+    }
+
+    for (i = 0; i < 256; i++) {
+        into->typeOk[i] += from->typeOk[i];
+        into->typeErrors[i] += from->typeErrors[i];
+    }
+}
+
+void print_batch_summary(BatchSummary *summary) {
+    FILE *out = report_stream();
+
+    int i;
+
+    fprintf(out, "\nSummary: %lu messages, %lu parsed, %lu failed, %lu skipped\n",
+           summary->files, summary->ok, summary->files - summary->ok, summary->skipped);
+
+    if (summary->filtered) {
+        fprintf(out, "Filtered out: %lu valid messages\n", summary->filtered);
+    }
+
+    fprintf(out, "\nBy error code:\n");
+    for (i = 0; i <= NUMBER_OF_ERROR_CODES; i++) {
+        if (summary->errors[i]) {
+            fprintf(out, "%3d %-45s %lu\n", i, i < NUMBER_OF_ERROR_CODES ? get_error_name(i) : "UNKNOWN", summary->errors[i]);
+        }
+    }
+
+    fprintf(out, "\nBy handshake type (parsed / failed):\n");
+    for (i = 0; i < 256; i++) {
+        if (summary->typeOk[i] || summary->typeErrors[i]) {
+            fprintf(out, "%3d %-45s %lu / %lu\n", i, get_handshake_type_name(i), summary->typeOk[i], summary->typeErrors[i]);
+        }
+    }
+
+    if (summary->noTypeErrors) {
+        fprintf(out, "  - %-45s 0 / %lu\n", "(invalid record layer)", summary->noTypeErrors);
+    }
+}
+
+const char *read_input_file(const char *path, InputBuffer *input, int *file_size) {
+    // Returns NULL on success, otherwise the reason why the file was skipped.
+    // O_NOFOLLOW + fstat replaces the lstat/fopen/fseeko sequence of get_safe_input_file,
+    // symbolic links are still rejected and only regular files are processed
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+
+    if (fd == -1) {
+        return "The file couldn't be opened.";
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+
+        return "The path is not a regular file.";
+    }
+
+    if (sb.st_size > MAXIMUM_FILE_SIZE) {
+        close(fd);
+
+        return "The file is larger then 20 MB.";
+    }
+
+    // The buffer is only ever grown, so a batch run settles on a single allocation
+    if ((size_t)sb.st_size > input->capacity) {
+        size_t capacity = input->capacity ? input->capacity : 4096;
+        while (capacity < (size_t)sb.st_size) {
+            capacity *= 2;
+        }
+
+        unsigned char *data = (unsigned char *)realloc(input->data, capacity);
+        if (data == NULL) {
+            close(fd);
+
+            return "Out of memory.";
+        }
+
+        input->data = data;
+        input->capacity = capacity;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)sb.st_size) {
+        ssize_t n = read(fd, input->data + done, sb.st_size - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            break;
+        }
+
+        done += n;
+    }
+
+    close(fd);
+
+    *file_size = (int)done;
+
+    return NULL;
+}
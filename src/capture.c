@@ -0,0 +1,180 @@
+#include "tls_parser_cli.h"
+
+#include <sys/mman.h>
+
+typedef struct {
+    BatchSummary *summary;
+    SessionTable *sessions;   // Only with --sessions
+} CaptureContext;
+
+static void on_capture_session(void *user, const HandshakeSession *session) {
+    FlowKey key;
+    char name[128];
+
+    (void)user;
+
+    get_session_client_key(session, &key);
+    format_flow_key(&key, name, sizeof(name));
+
+    if (output_format == OUTPUT_JSON) {
+        emit_session_record(name, session);
+        return;
+    }
+
+    FILE *out = report_stream();
+    fprintf(out, "%s: [SESSION] %s", name, get_session_outcome_name(session->outcome));
+
+    if (session->offsets[HS_STATE_SERVER_HELLO] != SESSION_NOT_SEEN) {
+        fprintf(out, ", version 0x%02x%02x, cipher suite 0x%04x (%s)", session->version.major, session->version.minor, session->cipherSuite,
+                session->cipherSuiteOffered < 0 ? "offer unknown" : session->cipherSuiteOffered ? "offered" : "not offered");
+    }
+
+    fprintf(out, ", %u messages, last %s", session->messages, get_handshake_state_name(session->state));
+
+    int i;
+    for (i = HS_STATE_SERVER_HELLO; i < HS_STAGES; i++) {
+        if (session->offsets[i] != SESSION_NOT_SEEN) {
+            fprintf(out, ", %s +%.3f ms", get_handshake_state_name(i), session->offsets[i] / 1000.0);
+        }
+    }
+
+    if (session->error != NO_ERROR) {
+        fprintf(out, ", error: %s", get_error_description(session->error));
+    }
+
+    fprintf(out, "\n");
+}
+
+static void report_capture_message(CaptureContext *ctx, const TcpFlow *flow, ParsedMessage *parsed, int err) {
+    char name[128];
+
+    record_batch_result(ctx->summary, &parsed->handshake, err);
+    format_flow_key(&flow->key, name, sizeof(name));
+
+    // The sender of a ClientHello is the client, its address tells the clients apart
+    TlsStats *stats = get_message_stats();
+    if (stats != NULL && err == NO_ERROR) {
+        record_message_stats(stats, parsed, err);
+
+        if (parsed->handshake.hsType == CLIENT_HELLO) {
+            add_stats_client(stats, flow->key.srcAddr, flow->key.family == 4 ? 4 : 16);
+        }
+    }
+
+    METRIC_START(output_start);
+    if (emit_message_record(name, flow->messages, parsed, err)) {
+        // Written as a JSON/binary record
+    } else if (err) {
+        printf("%s #%lu: [ERROR] %s\n", name, flow->messages, get_error_description(err));
+    } else {
+        char fingerprint[FINGERPRINT_SUFFIX_SIZE];
+        format_fingerprint_suffix(parsed, fingerprint);
+        printf("%s #%lu: [OK] %s%s\n", name, flow->messages, get_handshake_type_name(parsed->handshake.hsType), fingerprint);
+    }
+
+    emit_certificate_records(name, flow->messages, parsed, err);
+    METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+}
+
+static void on_capture_message(void *user, const TcpFlow *flow, HandshakeMessage *tls_message, int err, uint64_t timestamp) {
+    CaptureContext *ctx = (CaptureContext *)user;
+    ParsedMessage parsed;
+
+    // Session tracking needs every message parsed, the screening then only decides what is reported
+    int report = 1;
+    if (screen_messages) {
+        MessageSummary message;
+
+        message.handshake = *tls_message;
+        report = screen_message(ctx->summary, &message, err == NO_ERROR ? validate_handshake_body(&message) : err);
+
+        if (!report && ctx->sessions == NULL) {
+            return;
+        }
+    }
+
+    parsed.handshake = *tls_message;
+    if (err == NO_ERROR) {
+        err = parse_message_body(&parsed);
+    }
+
+    if (report) {
+        report_capture_message(ctx, flow, &parsed, err);
+    }
+
+    // A session completed (or broken) by this message is reported right after it
+    if (ctx->sessions != NULL) {
+        track_handshake_message(ctx->sessions, &flow->key, &parsed, err, timestamp);
+    }
+}
+
+int run_capture(char **paths, int count, int track_sessions) {
+    BatchSummary summary;
+    CaptureContext ctx;
+    FlowTable table;
+    SessionTable sessions;
+    int i;
+
+    memset(&summary, 0, sizeof(summary));
+    ctx.summary = &summary;
+    ctx.sessions = NULL;
+
+    if (init_flow_table(&table, DEFAULT_MAX_FLOWS, DEFAULT_FLOW_STREAM_CAPACITY, DEFAULT_FLOW_TIMEOUT, on_capture_message, &ctx) != 0) {
+        printf("Couldn't allocate the flow table.\n");
+        return 1;
+    }
+
+    if (track_sessions) {
+        if (init_session_table(&sessions, DEFAULT_MAX_SESSIONS, DEFAULT_SESSION_TIMEOUT, on_capture_session, NULL) != 0) {
+            printf("Couldn't allocate the session table.\n");
+            free_flow_table(&table);
+
+            return 1;
+        }
+
+        ctx.sessions = &sessions;
+    }
+
+    for (i = 0; i < count; i++) {
+        MappedFile file;
+        const char *reason = map_input_file(paths[i], &file, MADV_SEQUENTIAL);
+
+        if (reason != NULL) {
+            fprintf(report_stream(), "%s: [SKIPPED] %s\n", paths[i], reason);
+            summary.skipped++;
+            continue;
+        }
+
+        // Flows may continue in the next capture file, so the table is shared by all of them
+        int err = read_capture(file.data, file.size, &table);
+        if (err) {
+            fprintf(report_stream(), "%s: [ERROR] %s\n", paths[i], get_error_description(err));
+        }
+
+        unmap_input_file(&file);
+    }
+
+    // Handshakes still in progress at the end of the captures are reported as incomplete
+    if (ctx.sessions != NULL) {
+        flush_session_table(&sessions);
+    }
+
+    print_batch_summary(&summary);
+    fprintf(report_stream(), "\nCapture: %lu packets, %lu TCP segments with payload, %lu flows (%lu not TLS), %lu segments dropped\n",
+           table.packets, table.segments, table.flowsCreated, table.flowsIgnored, table.segmentsDropped);
+
+    if (ctx.sessions != NULL) {
+        fprintf(report_stream(), "Sessions: %lu complete, %lu resumed, %lu incomplete (%lu evicted), %lu invalid, %lu with a cipher suite that wasn't offered\n",
+                sessions.reported[SESSION_COMPLETE], sessions.reported[SESSION_RESUMED], sessions.reported[SESSION_INCOMPLETE],
+                sessions.evicted, sessions.reported[SESSION_INVALID], sessions.cipherSuitesNotOffered);
+        free_session_table(&sessions);
+    }
+
+    print_certificate_cache_stats();
+    print_message_cache_stats();
+    print_message_stats();
+
+    free_flow_table(&table);
+
+    return summary.ok == summary.files ? 0 : 1;
+}
@@ -0,0 +1,644 @@
+#include "tls_parser_cli.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DAEMON_MAX_CONNECTIONS 256
+#define DAEMON_READ_SIZE 16384
+#define DAEMON_OUTPUT_LIMIT 262144   // Pending results at which a connection stops being read
+#define DAEMON_MAX_FRAME_SIZE 131072 // Larger frames are skipped and answered with RECORD_TOO_LARGE, larger
+                                     // messages of a raw stream with MESSAGE_TOO_LARGE
+#define DAEMON_MAX_EVENTS 64
+#define DAEMON_ACCEPT_RETRY 1000     // Milliseconds until accepting is tried again after it failed
+
+// epoll data of the two descriptors that aren't connections, which use their slot
+#define DAEMON_LISTENER DAEMON_MAX_CONNECTIONS
+#define DAEMON_SIGNALS (DAEMON_MAX_CONNECTIONS + 1)
+
+// Decided by the first byte a client sends: a frame length (below 16 MB) starts with 0, which no
+// TLS or SSLv2 record does
+#define MODE_UNKNOWN 0
+#define MODE_FRAMED 1
+#define MODE_RAW 2
+
+typedef struct {
+    int fd;
+    int mode;
+    uint32_t events;                 // Registered with epoll
+    char name[24];                   // Source of the results, "conn<N>"
+    unsigned long index;             // Messages answered so far
+    unsigned char input[DAEMON_READ_SIZE]; // Read but not yet consumed, only read again once it's empty
+    size_t inputStart;
+    size_t inputLength;
+    RecordStream stream;             // MODE_RAW, the ring is allocated when the mode is known, messages
+                                     // are reassembled up to DAEMON_MAX_FRAME_SIZE
+    unsigned char *frame;            // MODE_FRAMED, grown up to DAEMON_MAX_FRAME_SIZE
+    uint32_t frameCapacity;
+    uint32_t frameSize;              // Payload length of the current frame
+    uint32_t frameLength;            // Payload collected so far
+    uint32_t frameSkip;              // Bytes of an oversized frame still to be dropped
+    unsigned char frameHeader[4];
+    uint8_t frameHeaderLength;
+    uint8_t inputClosed;             // The client shut down its side
+    uint8_t failed;                  // The input can't be followed anymore, only the results are sent
+    uint8_t finished;                // The end of the input was handled
+    OutputBuffer output;             // Results waiting to be sent
+} DaemonConnection;
+
+typedef struct {
+    int epollFd;
+    int listenFd;
+    int signalFd;
+    int listening;                   // The listener is registered, it's taken out while all slots are used
+    DaemonConnection *connections[DAEMON_MAX_CONNECTIONS];
+    int count;
+    unsigned long accepted;
+    BatchSummary summary;
+} Daemon;
+
+static int update_events(Daemon *daemon, int slot) {
+    DaemonConnection *conn = daemon->connections[slot];
+    uint32_t events = 0;
+
+    // Backpressure: nothing more is read while the input isn't consumed or the results pile up
+    if (!conn->inputClosed && !conn->failed && conn->inputStart == conn->inputLength && conn->output.length < DAEMON_OUTPUT_LIMIT) {
+        events |= EPOLLIN;
+    }
+
+    if (conn->output.length > 0) {
+        events |= EPOLLOUT;
+    }
+
+    if (events == conn->events) {
+        return 0;
+    }
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = slot;
+    conn->events = events;
+
+    return epoll_ctl(daemon->epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+static void set_listening(Daemon *daemon, int listening) {
+    struct epoll_event event;
+
+    if (daemon->listening == listening) {
+        return;
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = DAEMON_LISTENER;
+    epoll_ctl(daemon->epollFd, listening ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, daemon->listenFd, &event);
+    daemon->listening = listening;
+}
+
+static void close_connection(Daemon *daemon, int slot) {
+    DaemonConnection *conn = daemon->connections[slot];
+
+    epoll_ctl(daemon->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free_record_stream(&conn->stream);
+    free_output_buffer(&conn->output);
+    free(conn->frame);
+    free(conn);
+
+    daemon->connections[slot] = NULL;
+    daemon->count--;
+    set_listening(daemon, 1);
+}
+
+// Framed results are prefixed with their length like the requests, the position of which is returned
+static size_t begin_response(DaemonConnection *conn) {
+    size_t start = conn->output.length;
+
+    if (conn->mode == MODE_FRAMED && append_output(&conn->output, "\0\0\0\0", 4) != 0) {
+        conn->failed = 1;
+    }
+
+    return start;
+}
+
+static void end_response(DaemonConnection *conn, size_t start) {
+    if (conn->mode != MODE_FRAMED || conn->output.length < start + 4) {
+        return;
+    }
+
+    uint32_t length = (uint32_t)(conn->output.length - start - 4);
+    unsigned char *header = (unsigned char *)conn->output.data + start;
+
+    header[0] = length >> 24;
+    header[1] = length >> 16;
+    header[2] = length >> 8;
+    header[3] = length;
+}
+
+static void respond_message(Daemon *daemon, DaemonConnection *conn, const ParsedMessage *parsed, int err) {
+    record_batch_result(&daemon->summary, &parsed->handshake, err);
+    record_message_stats(get_message_stats(), parsed, err);
+
+    METRIC_START(output_start);
+    size_t start = begin_response(conn);
+    int failed;
+
+    if (output_format != OUTPUT_TEXT) {
+        failed = append_message_record(&conn->output, conn->name, conn->index, parsed, err);
+    } else if (err) {
+        failed = append_formatted(&conn->output, "%s#%lu: [ERROR] %s\n", conn->name, conn->index, get_error_description(err));
+    } else {
+        char fingerprint[FINGERPRINT_SUFFIX_SIZE];
+        format_fingerprint_suffix(parsed, fingerprint);
+        failed = append_formatted(&conn->output, "%s#%lu: [OK] %s%s\n", conn->name, conn->index,
+                                  get_handshake_type_name(parsed->handshake.hsType), fingerprint);
+    }
+
+    if (failed) {
+        conn->failed = 1;
+    }
+
+    end_response(conn, start);
+    METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+}
+
+// Answers a message of a frame that screen_message didn't let through. The JSON and binary formats
+// have no record for it, the frame stays empty so that every request still gets its response.
+static void respond_screened(DaemonConnection *conn, const MessageSummary *message, int err) {
+    size_t start = begin_response(conn);
+    const char *type = get_handshake_type_name(message->handshake.hsType);
+
+    if (output_format != OUTPUT_TEXT) {
+        // Nothing but the frame header
+    } else if (err) {
+        append_formatted(&conn->output, "%s#%lu: [ERROR] %s\n", conn->name, conn->index, get_error_description(err));
+    } else if (!match_message_filter(&message_filter, message)) {
+        append_formatted(&conn->output, "%s#%lu: [FILTERED] %s\n", conn->name, conn->index, type);
+    } else {
+        append_formatted(&conn->output, "%s#%lu: [VALID] %s\n", conn->name, conn->index, type);
+    }
+
+    end_response(conn, start);
+}
+
+static void process_frame(Daemon *daemon, DaemonConnection *conn, const unsigned char *data, int size) {
+    ParsedMessage parsed;
+    int err;
+
+    conn->index++;
+
+    if (screen_messages) {
+        MessageSummary message;
+
+        err = validate_tls_message(data, size, &message);
+        if (!screen_message(&daemon->summary, &message, err)) {
+            respond_screened(conn, &message, err);
+            return;
+        }
+    }
+
+    memset(&parsed, 0, sizeof(parsed));
+    err = initialize_tls_structure(data, size, &parsed.handshake);
+    if (err == NO_ERROR) {
+        err = parse_message_body(&parsed);
+    }
+
+    respond_message(daemon, conn, &parsed, err);
+}
+
+// Consumes buffered input of a framed connection, returns 0 if there was nothing to do
+static int process_framed_input(Daemon *daemon, DaemonConnection *conn) {
+    const unsigned char *input = conn->input + conn->inputStart;
+    size_t available = conn->inputLength - conn->inputStart;
+    size_t used;
+
+    if (conn->frameSkip > 0) {
+        used = available < conn->frameSkip ? available : conn->frameSkip;
+        conn->frameSkip -= used;
+        conn->inputStart += used;
+
+        return used > 0;
+    }
+
+    if (conn->frameHeaderLength < sizeof(conn->frameHeader)) {
+        used = sizeof(conn->frameHeader) - conn->frameHeaderLength;
+        used = available < used ? available : used;
+        memcpy(conn->frameHeader + conn->frameHeaderLength, input, used);
+        conn->frameHeaderLength += used;
+        conn->inputStart += used;
+
+        if (conn->frameHeaderLength < sizeof(conn->frameHeader)) {
+            return used > 0;
+        }
+
+        conn->frameSize = ((uint32_t)conn->frameHeader[0] << 24) | (conn->frameHeader[1] << 16) |
+                          (conn->frameHeader[2] << 8) | conn->frameHeader[3];
+        conn->frameLength = 0;
+
+        if (conn->frameSize > DAEMON_MAX_FRAME_SIZE) {
+            ParsedMessage parsed;
+            memset(&parsed, 0, sizeof(parsed));
+
+            conn->index++;
+            conn->frameSkip = conn->frameSize;
+            conn->frameHeaderLength = 0;
+            respond_message(daemon, conn, &parsed, RECORD_TOO_LARGE);
+
+            return 1;
+        }
+
+        if (conn->frameCapacity < conn->frameSize) {
+            unsigned char *frame = (unsigned char *)realloc(conn->frame, conn->frameSize);
+
+            if (frame == NULL) {
+                conn->failed = 1;
+                return 0;
+            }
+
+            conn->frame = frame;
+            conn->frameCapacity = conn->frameSize;
+        }
+    } else {
+        used = conn->frameSize - conn->frameLength;
+        used = available < used ? available : used;
+        memcpy(conn->frame + conn->frameLength, input, used);
+        conn->frameLength += used;
+        conn->inputStart += used;
+
+        if (conn->frameLength < conn->frameSize) {
+            return used > 0;
+        }
+    }
+
+    if (conn->frameLength < conn->frameSize) {
+        return 1;
+    }
+
+    process_frame(daemon, conn, conn->frame, (int)conn->frameSize);
+    conn->frameHeaderLength = 0;
+
+    return 1;
+}
+
+// Answers the next message of a raw connection, or feeds it more input if none is complete.
+// Returns 0 if there was nothing to do.
+static int process_raw_input(Daemon *daemon, DaemonConnection *conn) {
+    RecordStream *stream = &conn->stream;
+    ParsedMessage parsed;
+    int err;
+
+    while ((err = next_stream_message(stream, &parsed.handshake)) != STREAM_NEED_MORE_DATA) {
+        conn->index++;
+
+        if (stream->error) {
+            conn->failed = 1;
+        }
+
+        // The same as the stream mode, messages that aren't let through have no result
+        if (screen_messages) {
+            MessageSummary message;
+
+            message.handshake = parsed.handshake;
+            if (!screen_message(&daemon->summary, &message, err == NO_ERROR ? validate_handshake_body(&message) : err)) {
+                if (conn->failed) {
+                    return 1;
+                }
+
+                continue;
+            }
+        }
+
+        if (err == NO_ERROR) {
+            err = parse_message_body(&parsed);
+        }
+
+        respond_message(daemon, conn, &parsed, err);
+
+        return 1;
+    }
+
+    size_t used = feed_record_stream(stream, conn->input + conn->inputStart, conn->inputLength - conn->inputStart);
+    conn->inputStart += used;
+
+    return used > 0;
+}
+
+// Reports what's left of an incomplete record, message or frame once the client closed its side
+static void finish_input(Daemon *daemon, DaemonConnection *conn) {
+    ParsedMessage parsed;
+    int incomplete;
+
+    conn->finished = 1;
+
+    if (conn->mode == MODE_RAW) {
+        incomplete = conn->stream.tail != conn->stream.head || conn->stream.reassembling;
+    } else {
+        incomplete = conn->mode == MODE_FRAMED && conn->frameSkip == 0 && conn->frameHeaderLength > 0;
+    }
+
+    if (incomplete) {
+        memset(&parsed, 0, sizeof(parsed));
+        conn->index++;
+        respond_message(daemon, conn, &parsed, INVALID_FILE_LENGTH);
+    }
+}
+
+static void process_connection(Daemon *daemon, DaemonConnection *conn) {
+    while (!conn->failed && conn->output.length < DAEMON_OUTPUT_LIMIT) {
+        int progress;
+
+        if (conn->mode == MODE_UNKNOWN) {
+            if (conn->inputStart == conn->inputLength) {
+                break;
+            }
+
+            conn->mode = conn->input[conn->inputStart] == 0 ? MODE_FRAMED : MODE_RAW;
+
+            if (conn->mode == MODE_RAW) {
+                if (init_record_stream(&conn->stream, DEFAULT_STREAM_CAPACITY) != 0) {
+                    conn->failed = 1;
+                    break;
+                }
+
+                conn->stream.maxMessageSize = DAEMON_MAX_FRAME_SIZE;
+            }
+
+            continue;
+        }
+
+        progress = conn->mode == MODE_FRAMED ? process_framed_input(daemon, conn) : process_raw_input(daemon, conn);
+        if (!progress) {
+            break;
+        }
+    }
+
+    if (conn->inputClosed && !conn->finished && !conn->failed && conn->inputStart == conn->inputLength &&
+        conn->output.length < DAEMON_OUTPUT_LIMIT) {
+        finish_input(daemon, conn);
+    }
+}
+
+// Returns -1 if the connection is gone
+static int read_connection(DaemonConnection *conn) {
+    ssize_t n = read(conn->fd, conn->input, sizeof(conn->input));
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    conn->inputStart = 0;
+    conn->inputLength = n;
+
+    if (n == 0) {
+        conn->inputClosed = 1;
+    }
+
+    return 0;
+}
+
+static int write_connection(DaemonConnection *conn) {
+    ssize_t n = send(conn->fd, conn->output.data, conn->output.length, MSG_NOSIGNAL);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+
+    // What's left moves to the front, so the buffer never holds more than the limit and a result
+    memmove(conn->output.data, conn->output.data + n, conn->output.length - n);
+    conn->output.length -= n;
+
+    return 0;
+}
+
+static void handle_connection(Daemon *daemon, int slot, uint32_t events) {
+    DaemonConnection *conn = daemon->connections[slot];
+
+    if ((events & EPOLLOUT) && write_connection(conn) != 0) {
+        close_connection(daemon, slot);
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && (conn->events & EPOLLIN) && read_connection(conn) != 0) {
+        close_connection(daemon, slot);
+        return;
+    }
+
+    process_connection(daemon, conn);
+
+    if (conn->output.length == 0 && (conn->failed || conn->finished)) {
+        close_connection(daemon, slot);
+        return;
+    }
+
+    if (events & EPOLLERR) {
+        close_connection(daemon, slot);
+        return;
+    }
+
+    if (update_events(daemon, slot) != 0) {
+        close_connection(daemon, slot);
+    }
+}
+
+static void accept_connections(Daemon *daemon) {
+    while (daemon->count < DAEMON_MAX_CONNECTIONS) {
+        // accept4 would need _GNU_SOURCE
+        int fd = accept(daemon->listenFd, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno == ECONNABORTED || errno == EINTR) {
+                continue;
+            }
+
+            // Out of descriptors or memory (EMFILE, ENFILE, ENOMEM, ...), the waiting client would wake
+            // epoll again right away. The listener comes back once a connection is closed or a while
+            // passed without any events.
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                set_listening(daemon, 0);
+            }
+
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        int slot = 0;
+        while (daemon->connections[slot] != NULL) {
+            slot++;
+        }
+
+        DaemonConnection *conn = (DaemonConnection *)calloc(1, sizeof(DaemonConnection));
+        struct epoll_event event;
+
+        event.events = EPOLLIN;
+        event.data.u64 = slot;
+
+        if (conn == NULL || epoll_ctl(daemon->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(conn);
+            close(fd);
+            continue;
+        }
+
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        snprintf(conn->name, sizeof(conn->name), "conn%lu", ++daemon->accepted);
+
+        daemon->connections[slot] = conn;
+        daemon->count++;
+    }
+
+    // The next client waits in the backlog until a connection is closed
+    set_listening(daemon, 0);
+}
+
+// Only a socket nobody listens on anymore is removed
+static int remove_stale_socket(const struct sockaddr_un *address) {
+    struct stat sb;
+    int err = -1;
+
+    if (lstat(address->sun_path, &sb) != 0 || !S_ISSOCK(sb.st_mode)) {
+        return -1;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe == -1) {
+        return -1;
+    }
+
+    if (connect(probe, (const struct sockaddr *)address, sizeof(*address)) != 0 && errno == ECONNREFUSED) {
+        err = unlink(address->sun_path);
+    }
+
+    close(probe);
+
+    return err;
+}
+
+// Binds the socket, replacing one left behind by a daemon that is gone
+static int open_listener(const char *path) {
+    struct sockaddr_un address;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "The socket path '%s' is too long.\n", path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't create the socket.\n");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        if (errno != EADDRINUSE || remove_stale_socket(&address) != 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+            fprintf(stderr, "Couldn't bind the socket '%s'.\n", path);
+            close(fd);
+
+            return -1;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Couldn't listen on the socket '%s'.\n", path);
+        close(fd);
+        unlink(path);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+int run_daemon(const char *socket_path) {
+    Daemon daemon;
+    sigset_t signals;
+    struct epoll_event event;
+    struct epoll_event events[DAEMON_MAX_EVENTS];
+    int i;
+
+    memset(&daemon, 0, sizeof(daemon));
+
+    // SIGINT and SIGTERM stop the loop through the signalfd, the results of a run are reported then
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    daemon.listenFd = open_listener(socket_path);
+    if (daemon.listenFd == -1) {
+        return 1;
+    }
+
+    daemon.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    daemon.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    event.events = EPOLLIN;
+    event.data.u64 = DAEMON_SIGNALS;
+
+    if (daemon.epollFd == -1 || daemon.signalFd == -1 || epoll_ctl(daemon.epollFd, EPOLL_CTL_ADD, daemon.signalFd, &event) != 0) {
+        fprintf(stderr, "Couldn't set up epoll.\n");
+        close(daemon.listenFd);
+        unlink(socket_path);
+
+        return 1;
+    }
+
+    set_listening(&daemon, 1);
+    fprintf(report_stream(), "Listening on %s\n", socket_path);
+    fflush(report_stream());
+
+    int running = 1;
+    while (running) {
+        int count = epoll_wait(daemon.epollFd, events, DAEMON_MAX_EVENTS, daemon.listening ? -1 : DAEMON_ACCEPT_RETRY);
+
+        if (count < 0 && errno != EINTR) {
+            fprintf(stderr, "epoll_wait failed.\n");
+            break;
+        }
+
+        if (count == 0 && daemon.count < DAEMON_MAX_CONNECTIONS) {
+            set_listening(&daemon, 1);
+        }
+
+        for (i = 0; i < count; i++) {
+            uint64_t slot = events[i].data.u64;
+
+            if (slot == DAEMON_SIGNALS) {
+                running = 0;
+            } else if (slot == DAEMON_LISTENER) {
+                accept_connections(&daemon);
+            } else if (daemon.connections[slot] != NULL) {
+                handle_connection(&daemon, (int)slot, events[i].events);
+            }
+        }
+    }
+
+    // Results still waiting for a client are dropped
+    for (i = 0; i < DAEMON_MAX_CONNECTIONS; i++) {
+        if (daemon.connections[i] != NULL) {
+            close_connection(&daemon, i);
+        }
+    }
+
+    close(daemon.listenFd);
+    close(daemon.signalFd);
+    close(daemon.epollFd);
+    unlink(socket_path);
+
+    fprintf(report_stream(), "\nConnections: %lu\n", daemon.accepted);
+    print_batch_summary(&daemon.summary);
+    print_message_cache_stats();
+    print_message_stats();
+
+    return 0;
+}
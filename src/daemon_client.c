@@ -0,0 +1,242 @@
+#include "tls_parser_cli.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CLIENT_CHUNK_SIZE 65536
+
+// Sends the files to a daemon started with --daemon and writes its results to stdout. Every file is
+// a frame of its own, or with raw set, the files (stdin if there are none) are sent as one stream
+// of records. Requests and results are interleaved, so the daemon never waits for the client to read.
+typedef struct {
+    char **paths;
+    int count;
+    int next;                    // Next path to send
+    int raw;
+    int fd;                      // File being streamed in raw mode, -1 if none
+    InputBuffer input;
+    OutputBuffer request;        // Waiting to be sent
+    size_t requestSent;
+    unsigned char *response;     // Framed mode, the incomplete frame received last
+    size_t responseLength;
+    size_t responseCapacity;
+} DaemonClient;
+
+static int connect_daemon(const char *socket_path) {
+    struct sockaddr_un address;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "The socket path '%s' is too long.\n", socket_path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Couldn't connect to '%s'.\n", socket_path);
+        if (fd != -1) {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+// Fills the request buffer with the next frame or chunk, returns 0 once everything was sent
+static int next_request(DaemonClient *client) {
+    reset_output_buffer(&client->request);
+    client->requestSent = 0;
+
+    while (client->raw) {
+        if (client->fd == -1) {
+            if (client->next >= (client->count > 0 ? client->count : 1)) {
+                return 0;
+            }
+
+            const char *path = client->count > 0 ? client->paths[client->next] : "-";
+            client->next++;
+
+            client->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+            if (client->fd == -1) {
+                fprintf(stderr, "%s: [SKIPPED] The file couldn't be opened.\n", path);
+                continue;
+            }
+        }
+
+        if (reserve_output_buffer(&client->request, CLIENT_CHUNK_SIZE) != 0) {
+            return 0;
+        }
+
+        ssize_t n = read(client->fd, client->request.data, CLIENT_CHUNK_SIZE);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n > 0) {
+            client->request.length = n;
+            return 1;
+        }
+
+        if (client->fd != STDIN_FILENO) {
+            close(client->fd);
+        }
+
+        client->fd = -1;
+    }
+
+    while (client->next < client->count) {
+        const char *path = client->paths[client->next++];
+        int file_size = -1;
+        const char *reason = read_input_file(path, &client->input, &file_size);
+
+        if (reason != NULL) {
+            fprintf(stderr, "%s: [SKIPPED] %s\n", path, reason);
+            continue;
+        }
+
+        unsigned char header[4] = { file_size >> 24, file_size >> 16, file_size >> 8, file_size };
+
+        if (append_output(&client->request, header, sizeof(header)) != 0 ||
+            append_output(&client->request, client->input.data, file_size) != 0) {
+            return 0;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Writes the payload of every complete frame, raw results are written as they come
+static void write_responses(DaemonClient *client, const unsigned char *data, size_t length) {
+    if (client->raw) {
+        fwrite(data, 1, length, stdout);
+        return;
+    }
+
+    if (client->responseCapacity < client->responseLength + length) {
+        size_t capacity = client->responseLength + length;
+        unsigned char *response = (unsigned char *)realloc(client->response, capacity);
+
+        if (response == NULL) {
+            return;
+        }
+
+        client->response = response;
+        client->responseCapacity = capacity;
+    }
+
+    memcpy(client->response + client->responseLength, data, length);
+    client->responseLength += length;
+
+    size_t pos = 0;
+    while (client->responseLength - pos >= 4) {
+        const unsigned char *frame = client->response + pos;
+        size_t size = ((uint32_t)frame[0] << 24) | (frame[1] << 16) | (frame[2] << 8) | frame[3];
+
+        if (client->responseLength - pos - 4 < size) {
+            break;
+        }
+
+        fwrite(frame + 4, 1, size, stdout);
+        pos += 4 + size;
+    }
+
+    memmove(client->response, client->response + pos, client->responseLength - pos);
+    client->responseLength -= pos;
+}
+
+int run_daemon_client(const char *socket_path, char **paths, int count, int raw) {
+    DaemonClient client;
+    unsigned char buf[CLIENT_CHUNK_SIZE];
+    int err = 0;
+
+    if (!raw && count == 0) {
+        fprintf(stderr, "No files to send.\n");
+        return 1;
+    }
+
+    memset(&client, 0, sizeof(client));
+    client.paths = paths;
+    client.count = count;
+    client.raw = raw;
+    client.fd = -1;
+
+    int sock = connect_daemon(socket_path);
+    if (sock == -1) {
+        return 1;
+    }
+
+    int sending = next_request(&client);
+    if (!sending) {
+        shutdown(sock, SHUT_WR);
+    }
+
+    for (;;) {
+        struct pollfd pfd = { sock, POLLIN | (sending ? POLLOUT : 0), 0 };
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            err = 1;
+            break;
+        }
+
+        if (sending && (pfd.revents & (POLLOUT | POLLERR | POLLHUP))) {
+            ssize_t n = send(sock, client.request.data + client.requestSent, client.request.length - client.requestSent, MSG_NOSIGNAL);
+
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                // The daemon gave up on the connection, its results are still read below
+                fprintf(stderr, "The daemon closed the connection.\n");
+                sending = 0;
+                err = 1;
+            } else if (n > 0 && (client.requestSent += n) == client.request.length) {
+                sending = next_request(&client);
+                if (!sending) {
+                    shutdown(sock, SHUT_WR);
+                }
+            }
+        }
+
+        if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+            ssize_t n = recv(sock, buf, sizeof(buf), 0);
+
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+
+            if (n <= 0) {
+                err |= n < 0;
+                break;
+            }
+
+            write_responses(&client, buf, n);
+        }
+    }
+
+    if (client.fd != -1 && client.fd != STDIN_FILENO) {
+        close(client.fd);
+    }
+
+    close(sock);
+    fflush(stdout);
+    free(client.input.data);
+    free_output_buffer(&client.request);
+    free(client.response);
+
+    return err;
+}
@@ -0,0 +1,85 @@
+#ifndef TLS_HASH_H
+#define TLS_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Minimal hash implementations, so the library doesn't need to depend on a crypto library
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;           // Total number of bytes hashed
+    unsigned char block[64];
+    size_t blockLength;
+} Md5Context;
+
+void md5_init(Md5Context *ctx);
+void md5_update(Md5Context *ctx, const unsigned char *data, size_t length);
+void md5_final(Md5Context *ctx, unsigned char digest[16]);
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t blockLength;
+} Sha256Context;
+
+void sha256_init(Sha256Context *ctx);
+void sha256_update(Sha256Context *ctx, const unsigned char *data, size_t length);
+void sha256_final(Sha256Context *ctx, unsigned char digest[32]);
+void sha256(const unsigned char *data, size_t length, unsigned char digest[32]);
+
+// Fast non-cryptographic hash for hash table keys, a match still has to be confirmed by comparing
+// the data. The input can be fed in pieces (e.g. to leave out some fields), the same pieces always
+// give the same hash. Four independent lanes take 32 bytes per step.
+typedef struct {
+    uint64_t lanes[4];
+} FastHash;
+
+static inline void fast_hash_init(FastHash *hash, uint64_t seed) {
+    hash->lanes[0] = seed;
+    hash->lanes[1] = seed ^ 0x9e3779b97f4a7c15ULL;
+    hash->lanes[2] = seed ^ 0xbf58476d1ce4e5b9ULL;
+    hash->lanes[3] = seed ^ 0x94d049bb133111ebULL;
+}
+
+static inline uint64_t fast_hash_mix(uint64_t lane, uint64_t word) {
+    lane = (lane ^ word) * 0xff51afd7ed558ccdULL;
+
+    return lane ^ (lane >> 32);
+}
+
+static inline void fast_hash_update(FastHash *hash, const unsigned char *data, size_t length) {
+    uint64_t words[4];
+    size_t i = 0;
+
+    for (; i + sizeof(words) <= length; i += sizeof(words)) {
+        memcpy(words, data + i, sizeof(words));
+        hash->lanes[0] = fast_hash_mix(hash->lanes[0], words[0]);
+        hash->lanes[1] = fast_hash_mix(hash->lanes[1], words[1]);
+        hash->lanes[2] = fast_hash_mix(hash->lanes[2], words[2]);
+        hash->lanes[3] = fast_hash_mix(hash->lanes[3], words[3]);
+    }
+
+    for (; i + 8 <= length; i += 8) {
+        memcpy(words, data + i, 8);
+        hash->lanes[0] = fast_hash_mix(hash->lanes[0], words[0]);
+    }
+
+    for (; i < length; i++) {
+        hash->lanes[0] = (hash->lanes[0] ^ data[i]) * 0x100000001b3ULL;
+    }
+}
+
+static inline uint64_t fast_hash_final(const FastHash *hash) {
+    uint64_t result = hash->lanes[0] ^ fast_hash_mix(hash->lanes[1], hash->lanes[2] + hash->lanes[3]);
+
+    result ^= result >> 33;
+    result *= 0xc4ceb9fe1a85ec53ULL;
+    result ^= result >> 33;
+
+    return result;
+}
+
+#endif
@@ -0,0 +1,384 @@
+#include "tls_parser_cli.h"
+
+#include <getopt.h>
+#include <sys/mman.h>
+
+#ifdef TLS_PARSER_METRICS
+#define METRICS_OPTION "M:"
+
+static const char *metrics_path;
+
+static void write_metrics_at_exit(void) {
+    write_metrics_file(metrics_path);
+}
+#else
+#define METRICS_OPTION ""
+#endif
+
+static void print_usage(const char *program) {
+    printf("usage: %s path_to_file\n", program);
+    printf("       %s --batch [--jobs N] [--list list_file] [path ...]\n", program);
+    printf("       %s --stream [path ...]\n", program);
+    printf("       %s --pcap capture_file ...\n", program);
+    printf("       %s --merge-stats stats_file ...\n", program);
+    printf("       %s --daemon socket_path\n", program);
+    printf("       %s --connect socket_path [--stream] [path ...]\n\n", program);
+    printf("  -b, --batch        Parse every file given as a path, directories are walked recursively.\n");
+    printf("                     A path of '-' reads one path per line from stdin.\n");
+    printf("  -l, --list FILE    Read the paths to parse from FILE, one per line (implies --batch).\n");
+    printf("  -j, --jobs N       Parse the files of a batch run with N threads.\n");
+    printf("  -u, --uring        Read the files of a batch run through io_uring, with many opens and reads\n");
+    printf("                     in flight. Falls back to plain reads where io_uring isn't available.\n");
+    printf("  -m, --mmap         Map the input files into memory instead of reading them. In stream mode\n");
+    printf("                     this parses files of any size in place.\n");
+    printf("  -p, --pcap         Read pcap/pcapng captures, reassemble the TCP flows and parse every\n");
+    printf("                     handshake message in them.\n");
+    printf("  -F, --format FMT   Write the results as 'text' (default), 'json' (one object per line) or\n");
+    printf("                     'binary' (length prefixed records, see src/tls_output.h). The summary\n");
+    printf("                     goes to stderr for the last two.\n");
+    printf("  -f, --ja3          Add the JA3 (ClientHello) or JA3S (ServerHello) fingerprint to the results,\n");
+    printf("                     together with a 64 bit hash of the same fields.\n");
+    printf("  -c, --certs        With --stream, --pcap or a structured --format, report subject, issuer,\n");
+    printf("                     validity, alternative names and SHA-256 of every certificate of a chain.\n");
+    printf("  -S, --sessions     With --pcap, follow the handshake of every connection, validate the order of\n");
+    printf("                     its messages and the chosen cipher suite and report it with its timings.\n");
+    printf("  -s, --stream       Treat each path (stdin by default) as a stream of concatenated records\n");
+    printf("                     and parse every handshake message in it.\n");
+    printf("  -C, --cache N      With --stream or --pcap, keep the parse results and fingerprints of N\n");
+    printf("                     distinct hellos (Random and SessionID aside) and reuse them for identical\n");
+    printf("                     messages. Pays off most with --ja3.\n");
+    printf("  -a, --aggregate    Aggregate the hellos of a batch, stream or capture run: versions and cipher\n");
+    printf("                     suites exactly, top server names and JA3/JA3S fingerprints and distinct\n");
+    printf("                     counts in sketches of a fixed size. Reported after the summary.\n");
+    printf("  -o, --stats-out F  Write the aggregate to F (implies --aggregate), as JSON if it ends in .json,\n");
+    printf("                     otherwise in a binary format that --merge-stats reads.\n");
+    printf("  -R, --merge-stats  Merge the aggregates written by --stats-out given as paths and report them.\n");
+    printf("  -D, --daemon SOCK  Listen on the Unix socket SOCK and parse what clients send: one message per\n");
+    printf("                     frame (uint32 big endian length + the message as in a file) or a stream of\n");
+    printf("                     records. The results go back on the same connection, in frames for the\n");
+    printf("                     former. SIGINT or SIGTERM stop the daemon and print the summary.\n");
+    printf("  -k, --connect SOCK Send every path as a frame to a daemon and write its results to stdout.\n");
+    printf("                     With --stream the paths (stdin by default) are sent as a stream instead.\n");
+    printf("  -V, --validate     Only check that the messages are valid, without extracting or reporting\n");
+    printf("                     them. The summary (or a single line) gives the result.\n");
+    printf("  -t, --type LIST    Only parse and report messages of these handshake types (names or numbers,\n");
+    printf("                     comma separated).\n");
+    printf("  -v, --version V    Only parse and report hellos negotiating (other messages: records of) TLS\n");
+    printf("                     version V, e.g. 1.2, or a range such as 1.0-1.2 or 1.2-.\n");
+    printf("  -n, --sni PREFIX   Only parse and report ClientHellos whose server name starts with PREFIX.\n");
+    printf("                     Messages are validated first, those not selected are only counted.\n");
+#ifdef TLS_PARSER_METRICS
+    printf("  -M, --metrics FILE Write the message, error and byte counters and the time spent per stage to\n");
+    printf("                     FILE at exit, as JSON if it ends in .json and in Prometheus format otherwise.\n");
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    int err = 0;
+    int batch = 0;
+    int stream = 0;
+    int workers = 1;
+    int use_mmap = 0;
+    int use_uring = 0;
+    int capture = 0;
+    int track_sessions = 0;
+    int merge_stats = 0;
+    const char *daemon_socket = NULL;
+    const char *connect_socket = NULL;
+    const char *list_path = NULL;
+
+    static struct option long_options[] = {
+        {"batch", no_argument, NULL, 'b'},
+        {"list", required_argument, NULL, 'l'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"mmap", no_argument, NULL, 'm'},
+        {"uring", no_argument, NULL, 'u'},
+        {"pcap", no_argument, NULL, 'p'},
+        {"stream", no_argument, NULL, 's'},
+        {"ja3", no_argument, NULL, 'f'},
+        {"certs", no_argument, NULL, 'c'},
+        {"format", required_argument, NULL, 'F'},
+        {"sessions", no_argument, NULL, 'S'},
+        {"cache", required_argument, NULL, 'C'},
+        {"aggregate", no_argument, NULL, 'a'},
+        {"stats-out", required_argument, NULL, 'o'},
+        {"merge-stats", no_argument, NULL, 'R'},
+        {"daemon", required_argument, NULL, 'D'},
+        {"connect", required_argument, NULL, 'k'},
+        {"validate", no_argument, NULL, 'V'},
+        {"type", required_argument, NULL, 't'},
+        {"version", required_argument, NULL, 'v'},
+        {"sni", required_argument, NULL, 'n'},
+        {"help", no_argument, NULL, 'h'},
+#ifdef TLS_PARSER_METRICS
+        {"metrics", required_argument, NULL, 'M'},
+#endif
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "bl:j:mupsSfcF:C:ao:RD:k:Vt:v:n:h" METRICS_OPTION, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'b': batch = 1; break;
+            case 'l': batch = 1; list_path = optarg; break;
+            case 'j': batch = 1; workers = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+            case 'm': use_mmap = 1; break;
+            case 'u': batch = 1; use_uring = 1; break;
+            case 'p': capture = 1; break;
+            case 's': stream = 1; break;
+            case 'f': show_fingerprints = 1; break;
+            case 'c': show_certificates = 1; break;
+            case 'S': capture = 1; track_sessions = 1; break;
+#ifdef TLS_PARSER_METRICS
+            case 'M':
+                if (metrics_path == NULL) {
+                    atexit(write_metrics_at_exit);
+                }
+                metrics_path = optarg;
+                break;
+#endif
+            case 'C': message_cache_size = atoi(optarg) > 0 ? (size_t)atoi(optarg) : DEFAULT_MESSAGE_CACHE_SIZE; break;
+            case 'a': aggregate_stats = 1; break;
+            case 'o': aggregate_stats = 1; stats_path = optarg; break;
+            case 'R': aggregate_stats = 1; merge_stats = 1; break;
+            case 'D': daemon_socket = optarg; break;
+            case 'k': connect_socket = optarg; break;
+            case 'V': validate_only = 1; break;
+            case 'n': set_filter_server_name(&message_filter, optarg); break;
+            case 't':
+                if (parse_filter_types(optarg) != 0) {
+                    print_usage(argv[0]);
+
+                    return 0;
+                }
+                break;
+            case 'v':
+                if (parse_filter_versions(optarg) != 0) {
+                    print_usage(argv[0]);
+
+                    return 0;
+                }
+                break;
+            case 'F':
+                if ((output_format = parse_output_format(optarg)) < 0) {
+                    print_usage(argv[0]);
+
+                    return 0;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+
+                return 0;
+        }
+    }
+
+    screen_messages = validate_only || !is_message_filter_empty(&message_filter);
+
+    if (merge_stats) {
+        return run_stats_merge(argv + optind, argc - optind);
+    }
+
+    if (connect_socket != NULL) {
+        return run_daemon_client(connect_socket, argv + optind, argc - optind, stream);
+    }
+
+    if (daemon_socket != NULL) {
+        return run_daemon(daemon_socket);
+    }
+
+    if (capture) {
+        return run_capture(argv + optind, argc - optind, track_sessions);
+    }
+
+    if (stream) {
+        return run_stream(argv + optind, argc - optind, use_mmap);
+    }
+
+    if (batch) {
+        return run_batch(argv + optind, argc - optind, list_path, workers, use_mmap, use_uring);
+    }
+
+    // Check command line parameters and print usages in case they are not valid
+    if (argc - optind != 1) {
+        print_usage(argv[0]);
+
+        return 0;
+    }
+
+    const unsigned char *buf;
+    unsigned char *allocated = NULL;
+    int file_size = -1;
+    MappedFile mapped;
+    memset(&mapped, 0, sizeof(mapped));
+
+    if (use_mmap) {
+        const char *reason = map_input_file(argv[optind], &mapped, MADV_WILLNEED);
+
+        if (reason != NULL) {
+            printf("%s\n", reason);
+            return 0;
+        }
+
+        // Anything above the limit can't be a single valid record, the length check rejects it
+        buf = mapped.data;
+        file_size = mapped.size > MAXIMUM_FILE_SIZE ? MAXIMUM_FILE_SIZE : (int)mapped.size;
+    } else {
+        // Check whether the path provided links to a reguler file and checks it's size
+        if (((allocated = get_safe_input_file(argv[optind], &file_size)) == NULL) || (file_size == -1)) {
+            return 0;
+        }
+
+        buf = allocated;
+    }
+
+    // Parse the record layer headers, parsed.handshake.body points into buf afterwards
+    ParsedMessage parsed;
+    memset(&parsed, 0, sizeof(parsed));
+
+    if (screen_messages) {
+        MessageSummary message;
+        FILE *out = report_stream();
+
+        err = validate_tls_message(buf, file_size, &message);
+        int selected = err == NO_ERROR && match_message_filter(&message_filter, &message);
+
+        if (err) {
+            fprintf(out, "[ERROR]: %s\n", get_error_description(err));
+        } else if (!selected) {
+            fprintf(out, "[FILTERED]: The %s message doesn't match the filter.\n", get_handshake_type_name(message.handshake.hsType));
+        } else if (validate_only) {
+            fprintf(out, "[OK]: Valid %s message.\n", get_handshake_type_name(message.handshake.hsType));
+        }
+
+        if (!selected || validate_only) {
+            free(allocated);
+            unmap_input_file(&mapped);
+
+            return 0;
+        }
+    }
+
+    if (output_format != OUTPUT_TEXT) {
+        err = parse_tls_message(buf, file_size, &parsed);
+
+        METRIC_START(output_start);
+        emit_message_record(argv[optind], 0, &parsed, err);
+        emit_certificate_records(argv[optind], 0, &parsed, err);
+        METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+
+        free(allocated);
+        unmap_input_file(&mapped);
+
+        return 0;
+    }
+    err = initialize_tls_structure(buf, file_size, &parsed.handshake);
+
+    // Stop processing in case there was an error
+    if (handle_errors(err)) {
+        free(allocated);
+        unmap_input_file(&mapped);
+
+        return 0;
+    }
+
+    print_tls_record_layer_info(&parsed.handshake);
+
+    // Process the actual handshake message
+    err = parse_handshake_body(&parsed);
+    if (!err) {
+        METRIC_START(output_start);
+        print_handshake_details(&parsed);
+
+        char fingerprint[FINGERPRINT_SUFFIX_SIZE];
+        format_fingerprint_suffix(&parsed, fingerprint);
+        if (fingerprint[0] != '\0') {
+            printf("\nFingerprint:%s\n", fingerprint);
+        }
+        METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+    }
+
+    // All parsed structures are views into buf, so it can only be released now
+    free(allocated);
+    unmap_input_file(&mapped);
+
+    if (handle_errors(err)) {
+        return 0;
+    }
+
+    printf("\n[OK]: Finished parsing of message!\n");
+
+    return 0;
+}
+
+unsigned char* get_safe_input_file(char *path, int *file_size) {
+    struct stat sb;
+
+    // Only regular files are processed. No symbolic links, sockets, dirs, etc.
+    if (lstat(path, &sb) == 0 && !S_ISREG(sb.st_mode))
+    {
+        printf("The path '%s' is not a regular file.\n", path);
+
+        return NULL;
+    }
+
+    // Try to open provided file
+    FILE *stream;
+    stream = fopen(path, "rb");
+
+    if (stream == NULL) {
+        printf("The file '%s' couldn't be opened.\n", path);
+        return NULL;
+    }
+
+    // Get the actual file length
+    if (fseeko(stream, 0, SEEK_END) != 0) {
+        printf("Couldn't read the file '%s' (fseeko).\n", path);
+        fclose_safe(stream);
+
+        return NULL;
+    }
+
+    *file_size = ftello(stream);
+    if (*file_size == -1) {
+        printf("Couldn't read the file '%s' (ftello).\n", path);
+        fclose_safe(stream);
+
+        return NULL;
+    }
+
+    // Prevent hangs when a very large file is given by the user
+    if (*file_size > MAXIMUM_FILE_SIZE) {
+        printf("The file '%s' is larger then 20 MB.\n", path);
+        fclose_safe(stream);
+
+        return NULL;
+    }
+
+    fseek(stream, 0, SEEK_SET);
+
+    // Copy file content into buffer and close file stream
+    unsigned char *buf = (unsigned char *)malloc(*file_size);
+    fread(buf, *file_size, 1, stream);
+
+    fclose_safe(stream);
+
+    return buf;
+}
+
+void fclose_safe(FILE * stream) {
+    if (stream != NULL) {
+        fclose(stream);
+    }
+}
+
+int handle_errors(int error_code) {
+    if (!error_code) {
+        // In case there is no error, continue.
+        return 0;
+    }
+
+    printf("[ERROR]: %s\n", get_error_description(error_code));
+
+    return error_code;
+}
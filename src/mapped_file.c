@@ -0,0 +1,63 @@
+#include "tls_parser_cli.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+const char *map_input_file(const char *path, MappedFile *file, int advice) {
+    memset(file, 0, sizeof(*file));
+
+    // Same rules as for read_input_file: no symbolic links, only regular files
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd == -1) {
+        return "The file couldn't be opened.";
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+        close(fd);
+
+        return "The path is not a regular file.";
+    }
+
+    // There is no size limit, only the pages that are actually parsed get touched.
+    // Empty files can't be mapped, they are passed on as an empty buffer.
+    if (sb.st_size > 0) {
+        void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data == MAP_FAILED) {
+            close(fd);
+
+            return "The file couldn't be mapped.";
+        }
+
+        madvise(data, sb.st_size, advice);
+
+        file->data = (const unsigned char *)data;
+        file->size = sb.st_size;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+
+    return NULL;
+}
+
+void release_mapped_pages(MappedFile *file, size_t offset) {
+    // Drop the pages below offset, so that scanning a huge dump doesn't keep all of it resident
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t end = offset - offset % page_size;
+
+    if (file->data != NULL && end > file->released) {
+        madvise((void *)(file->data + file->released), end - file->released, MADV_DONTNEED);
+        file->released = end;
+    }
+}
+
+void unmap_input_file(MappedFile *file) {
+    if (file->data != NULL) {
+        munmap((void *)file->data, file->size);
+    }
+
+    memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,507 @@
+#include "tls_parser_cli.h"
+
+#include <strings.h>
+#include <sys/mman.h>
+
+#define STATS_REPORT_ENTRIES 10 // Keys and cipher suites listed per dimension in the text report
+
+int output_format = OUTPUT_TEXT;
+int show_fingerprints = 0;
+int show_certificates = 0;
+int validate_only = 0;
+int screen_messages = 0;
+size_t message_cache_size = 0;
+int aggregate_stats = 0;
+const char *stats_path = NULL;
+MessageFilter message_filter;
+
+// Used by the single threaded modes (single file, stream, capture), batch contexts have their own
+static OutputBuffer message_output;
+
+// Servers send the same chain on every connection, so a capture decodes each certificate only once
+static CertificateCache certificate_cache;
+
+// Set up by the first parse_message_body with --cache, used by the stream and capture mode only
+static MessageCache message_cache;
+
+// Aggregate of the single threaded modes, the workers of a parallel batch are merged into it
+static TlsStats message_stats;
+
+int parse_output_format(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        return OUTPUT_TEXT;
+    }
+
+    if (strcmp(name, "json") == 0) {
+        return OUTPUT_JSON;
+    }
+
+    if (strcmp(name, "binary") == 0) {
+        return OUTPUT_BINARY;
+    }
+
+    return -1;
+}
+
+// Comma separated list of handshake type names (as in get_handshake_type_name, any case) or numbers
+int parse_filter_types(char *list) {
+    char *saved;
+
+    for (char *name = strtok_r(list, ",", &saved); name != NULL; name = strtok_r(NULL, ",", &saved)) {
+        char *end;
+        long value = strtol(name, &end, 10);
+        int type = -1;
+
+        if (end != name && *end == '\0') {
+            type = value >= 0 && value <= 255 ? (int)value : -1;
+        } else if (strcasecmp(name, "unknown") != 0) {
+            for (int i = 0; i < 256 && type < 0; i++) {
+                type = strcasecmp(name, get_handshake_type_name(i)) == 0 ? i : -1;
+            }
+        }
+
+        if (type < 0) {
+            return -1;
+        }
+
+        add_filter_type(&message_filter, type);
+    }
+
+    return 0;
+}
+
+static int parse_tls_version(const char *text, const char **end) {
+    if (text[0] != '1' || text[1] != '.' || text[2] < '0' || text[2] > '3') {
+        return -1;
+    }
+
+    *end = text + 3;
+
+    return 0x0301 + (text[2] - '0');
+}
+
+// "1.2" selects a single version, "1.0-1.2" a range and "1.2-" or "-1.1" an open one
+int parse_filter_versions(const char *range) {
+    const char *end = range;
+    int min = 0, max = 0;
+
+    if (*end != '-' && (min = parse_tls_version(end, &end)) < 0) {
+        return -1;
+    }
+
+    if (*end == '\0') {
+        max = min;
+    } else if (*end++ != '-' || (*end != '\0' && ((max = parse_tls_version(end, &end)) < 0 || *end != '\0'))) {
+        return -1;
+    }
+
+    if (min == 0 && max == 0) {
+        return -1;
+    }
+
+    message_filter.minVersion = min;
+    message_filter.maxVersion = max;
+
+    return 0;
+}
+
+// Decides after validate_tls_message whether a message goes on to be parsed and reported. The ones
+// that don't are only counted: invalid ones as errors, the valid ones of --validate as parsed and
+// the ones the filter rejects as filtered.
+int screen_message(BatchSummary *summary, const MessageSummary *message, int err) {
+    if (err == NO_ERROR && !match_message_filter(&message_filter, message)) {
+        summary->filtered++;
+
+        return 0;
+    }
+
+    if (err != NO_ERROR || validate_only) {
+        record_batch_result(summary, &message->handshake, err);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+FILE *report_stream(void) {
+    // Stdout only carries the records in the machine readable formats
+    return output_format == OUTPUT_TEXT ? stdout : stderr;
+}
+
+int append_message_record(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err) {
+    if (output_format == OUTPUT_BINARY) {
+        return append_binary_message(out, source, index, parsed, err);
+    }
+
+    return append_json_message(out, source, index, parsed, err, show_fingerprints ? OUTPUT_FINGERPRINTS : 0);
+}
+
+int emit_message_record(const char *source, unsigned long index, const ParsedMessage *parsed, int err) {
+    if (output_format == OUTPUT_TEXT) {
+        return 0;
+    }
+
+    // A single write per message, the buffer is kept for the next one
+    if (append_message_record(&message_output, source, index, parsed, err) == 0) {
+        fwrite(message_output.data, 1, message_output.length, stdout);
+    }
+
+    reset_output_buffer(&message_output);
+
+    return 1;
+}
+
+void emit_session_record(const char *source, const HandshakeSession *session) {
+    if (append_json_session(&message_output, source, session) == 0) {
+        fwrite(message_output.data, 1, message_output.length, stdout);
+    }
+
+    reset_output_buffer(&message_output);
+}
+
+// Parses the body of a message from the stream or capture mode, through the message cache with --cache
+int parse_message_body(ParsedMessage *parsed) {
+    if (message_cache_size > 0 && message_cache.entries == NULL && init_message_cache(&message_cache, message_cache_size) != 0) {
+        message_cache_size = 0;
+    }
+
+    return message_cache.entries != NULL ? parse_cached_handshake_body(&message_cache, parsed) : parse_handshake_body(parsed);
+}
+
+void format_fingerprint_suffix(const ParsedMessage *parsed, char buf[FINGERPRINT_SUFFIX_SIZE]) {
+    Fingerprint fingerprint;
+    const Fingerprint *cached = NULL;
+    char digest[JA3_DIGEST_HEX_SIZE];
+    const char *name;
+
+    buf[0] = '\0';
+
+    if (!show_fingerprints) {
+        return;
+    }
+
+    // A hello the cache returned has its fingerprint computed only once
+    if (message_cache.entries != NULL) {
+        cached = get_cached_fingerprint(&message_cache, parsed);
+    }
+
+    if (parsed->handshake.hsType == CLIENT_HELLO) {
+        if (cached == NULL) {
+            compute_ja3(&parsed->clientHello, JA3_MD5 | JA3_RAW, &fingerprint);
+        }
+        name = "ja3";
+    } else if (parsed->handshake.hsType == SERVER_HELLO) {
+        if (cached == NULL) {
+            compute_ja3s(&parsed->serverHello, JA3_MD5 | JA3_RAW, &fingerprint);
+        }
+        name = "ja3s";
+    } else {
+        return;
+    }
+
+    if (cached != NULL) {
+        fingerprint = *cached;
+    }
+
+    format_ja3_digest(&fingerprint, digest);
+    snprintf(buf, FINGERPRINT_SUFFIX_SIZE, " %s=%s raw=%016llx", name, digest, (unsigned long long)fingerprint.raw);
+}
+
+void emit_certificate_records(const char *source, unsigned long index, const ParsedMessage *parsed, int err) {
+    const CertificateChain *chain = &parsed->certificate;
+    int i;
+
+    // The binary records have no layout for certificates
+    if (!show_certificates || err || parsed->handshake.hsType != CERTIFICATE || output_format == OUTPUT_BINARY) {
+        return;
+    }
+
+    if (certificate_cache.entries == NULL && init_certificate_cache(&certificate_cache, DEFAULT_CERTIFICATE_CACHE_SIZE) != 0) {
+        return;
+    }
+
+    for (i = 0; i < chain->count; i++) {
+        const CertificateSummary *summary = get_certificate_summary(&certificate_cache, chain->entries[i].data, chain->entries[i].length);
+        char fingerprint[2 * CERTIFICATE_FINGERPRINT_SIZE + 1];
+        char not_before[32], not_after[32];
+
+        if (summary == NULL) {
+            continue;
+        }
+
+        if (output_format == OUTPUT_JSON) {
+            append_json_certificate(&message_output, source, index, i, summary);
+            continue;
+        }
+
+        format_hex(summary->fingerprint, CERTIFICATE_FINGERPRINT_SIZE, fingerprint);
+        fingerprint[2 * CERTIFICATE_FINGERPRINT_SIZE] = '\0';
+
+        if (summary->error != NO_ERROR) {
+            printf("%s #%lu/%d: [CERT] sha256=%s error: %s\n", source, index, i, fingerprint, get_error_description(summary->error));
+            continue;
+        }
+
+        format_x509_time(summary->notBefore, not_before, sizeof(not_before));
+        format_x509_time(summary->notAfter, not_after, sizeof(not_after));
+        printf("%s #%lu/%d: [CERT] sha256=%s subject=\"%s\" issuer=\"%s\" valid %s - %s", source, index, i, fingerprint,
+               summary->subject, summary->issuer, not_before, not_after);
+
+        if (summary->altNames[0] != '\0') {
+            printf(" names=%s", summary->altNames);
+        }
+
+        printf("\n");
+    }
+
+    if (message_output.length > 0) {
+        fwrite(message_output.data, 1, message_output.length, stdout);
+        reset_output_buffer(&message_output);
+    }
+}
+
+void print_certificate_cache_stats(void) {
+    if (certificate_cache.entries == NULL) {
+        return;
+    }
+
+    fprintf(report_stream(), "Certificates: %lu decoded, %lu cache hits, %lu evicted\n",
+            certificate_cache.misses, certificate_cache.hits, certificate_cache.evictions);
+    free_certificate_cache(&certificate_cache);
+}
+
+void print_message_cache_stats(void) {
+    if (message_cache.entries == NULL) {
+        return;
+    }
+
+    unsigned long lookups = message_cache.hits + message_cache.misses;
+
+    fprintf(report_stream(), "Message cache: %lu parsed, %lu hits (%.1f%%), %lu evicted, %lu not cacheable\n",
+            message_cache.misses, message_cache.hits, lookups > 0 ? 100.0 * message_cache.hits / lookups : 0.0,
+            message_cache.evictions, message_cache.uncached);
+    free_message_cache(&message_cache);
+}
+
+// Set up by the first call with --aggregate, NULL without it
+TlsStats *get_message_stats(void) {
+    if (!aggregate_stats) {
+        return NULL;
+    }
+
+    if (message_stats.top == NULL && init_tls_stats(&message_stats) != 0) {
+        fprintf(stderr, "Couldn't allocate the aggregate, --aggregate is ignored.\n");
+        aggregate_stats = 0;
+
+        return NULL;
+    }
+
+    return &message_stats;
+}
+
+void record_message_stats(TlsStats *stats, const ParsedMessage *parsed, int err) {
+    if (stats == NULL || err != NO_ERROR) {
+        return;
+    }
+
+    // With --ja3 the cache has the fingerprint of a hello anyway, otherwise the aggregate only
+    // computes the MD5 digest for the labels it keeps
+    const Fingerprint *fingerprint = NULL;
+    if (show_fingerprints && message_cache.entries != NULL) {
+        fingerprint = get_cached_fingerprint(&message_cache, parsed);
+    }
+
+    add_hello_stats(stats, parsed, fingerprint);
+}
+
+typedef struct {
+    uint16_t suite;
+    uint64_t count;
+} SuiteCount;
+
+static void print_stats_versions(FILE *out, const char *title, const uint64_t *versions) {
+    const char *separator = ":";
+
+    fprintf(out, "%s", title);
+
+    for (int i = 0; i < STATS_VERSIONS; i++) {
+        if (versions[i] > 0) {
+            fprintf(out, "%s %s %llu", separator, get_stats_version_name(i), (unsigned long long)versions[i]);
+            separator = ",";
+        }
+    }
+
+    fprintf(out, "%s\n", separator[0] == ':' ? ": none" : "");
+}
+
+static void print_stats_suites(FILE *out, const char *title, const uint64_t *suites) {
+    SuiteCount top[STATS_REPORT_ENTRIES];
+    int count = 0;
+    int distinct = 0;
+
+    // Insertion into a short list sorted by count, a full list drops its last entry for a larger one.
+    // The suites come in ascending order, so equal counts keep the smaller suite first.
+    for (int i = 0; i < 65536; i++) {
+        if (suites[i] == 0) {
+            continue;
+        }
+
+        distinct++;
+
+        if (count == STATS_REPORT_ENTRIES && suites[i] <= top[count - 1].count) {
+            continue;
+        }
+
+        int j = count < STATS_REPORT_ENTRIES ? count++ : count - 1;
+
+        while (j > 0 && top[j - 1].count < suites[i]) {
+            top[j] = top[j - 1];
+            j--;
+        }
+
+        top[j].suite = (uint16_t)i;
+        top[j].count = suites[i];
+    }
+
+    fprintf(out, "%s (%d distinct)", title, distinct);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s 0x%04x %llu", i > 0 ? "," : ":", top[i].suite, (unsigned long long)top[i].count);
+    }
+
+    fprintf(out, "\n");
+}
+
+static void print_stats_top_keys(FILE *out, const TlsStats *stats, int dimension, const char *title) {
+    StatsTopKey keys[STATS_REPORT_ENTRIES];
+    int count = get_stats_top_keys(stats, dimension, keys, STATS_REPORT_ENTRIES);
+
+    fprintf(out, "%s: %llu, about %.0f distinct\n", title, (unsigned long long)stats->top[dimension].total,
+            estimate_stats_distinct(stats, dimension));
+
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "  %12llu %s", (unsigned long long)keys[i].count, keys[i].label);
+
+        // Keys that got into the summary late only have a range
+        if (keys[i].minimum != keys[i].count) {
+            fprintf(out, " (at least %llu)", (unsigned long long)keys[i].minimum);
+        }
+
+        fprintf(out, "\n");
+    }
+}
+
+static void write_stats_file(const TlsStats *stats, const char *path) {
+    OutputBuffer buffer;
+    size_t length = strlen(path);
+    int json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+
+    if (init_output_buffer(&buffer, DEFAULT_OUTPUT_CAPACITY) != 0) {
+        return;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "The stats file '%s' couldn't be opened.\n", path);
+    } else {
+        if ((json ? append_stats_json(&buffer, stats) : serialize_tls_stats(&buffer, stats)) == 0) {
+            fwrite(buffer.data, 1, buffer.length, file);
+        }
+
+        fclose(file);
+    }
+
+    free_output_buffer(&buffer);
+}
+
+// Reports the aggregate with the summary and writes it to --stats-out
+void print_message_stats(void) {
+    if (message_stats.top == NULL) {
+        return;
+    }
+
+    FILE *out = report_stream();
+    const TlsStats *stats = &message_stats;
+
+    fprintf(out, "\nAggregate: %llu ClientHellos (%llu SSLv2, %llu without a server name), %llu ServerHellos, %llu HelloRetryRequests\n",
+            (unsigned long long)stats->clientHellos, (unsigned long long)stats->sslv2Hellos, (unsigned long long)stats->noServerName,
+            (unsigned long long)stats->serverHellos, (unsigned long long)stats->helloRetryRequests);
+    print_stats_versions(out, "Offered versions (highest)", stats->clientVersions);
+    print_stats_versions(out, "Selected versions", stats->serverVersions);
+    print_stats_suites(out, "Offered cipher suites", stats->offeredSuites);
+    print_stats_suites(out, "Chosen cipher suites", stats->chosenSuites);
+    print_stats_top_keys(out, stats, STATS_SNI, "Server names");
+    print_stats_top_keys(out, stats, STATS_JA3, "JA3");
+    print_stats_top_keys(out, stats, STATS_JA3S, "JA3S");
+
+    double clients = estimate_stats_distinct(stats, STATS_CLIENTS);
+    if (clients > 0) {
+        fprintf(out, "Clients: about %.0f distinct addresses\n", clients);
+    }
+
+    if (stats_path != NULL) {
+        write_stats_file(stats, stats_path);
+    }
+
+    free_tls_stats(&message_stats);
+}
+
+// --merge-stats: the paths are files written by --stats-out, e.g. by several sensors or runs
+int run_stats_merge(char **paths, int count) {
+    TlsStats *total = get_message_stats();
+    TlsStats stats;
+    int failed = 0;
+
+    if (total == NULL || init_tls_stats(&stats) != 0) {
+        printf("Out of memory.\n");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        MappedFile file;
+        const char *reason = map_input_file(paths[i], &file, MADV_SEQUENTIAL);
+
+        if (reason == NULL && deserialize_tls_stats(&stats, file.data, file.size) != 0) {
+            reason = "The file isn't an aggregate written by --stats-out.";
+        }
+
+        if (reason != NULL) {
+            fprintf(report_stream(), "%s: [SKIPPED] %s\n", paths[i], reason);
+            failed++;
+        } else {
+            merge_tls_stats(total, &stats);
+        }
+
+        unmap_input_file(&file);
+    }
+
+    free_tls_stats(&stats);
+    print_message_stats();
+
+    return failed > 0 ? 1 : 0;
+}
+
+#ifdef TLS_PARSER_METRICS
+void write_metrics_file(const char *path) {
+    OutputBuffer metrics;
+    size_t length = strlen(path);
+    int json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+
+    if (init_output_buffer(&metrics, DEFAULT_OUTPUT_CAPACITY) != 0) {
+        return;
+    }
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "The metrics file '%s' couldn't be opened.\n", path);
+    } else {
+        if ((json ? append_metrics_json(&metrics) : append_metrics_prometheus(&metrics)) == 0) {
+            fwrite(metrics.data, 1, metrics.length, file);
+        }
+
+        fclose(file);
+    }
+
+    free_output_buffer(&metrics);
+}
+#endif
@@ -0,0 +1,279 @@
+#include "tls_parser_cli.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Every worker owns a deque of job indexes. The owner takes jobs from the bottom, idle workers
+// steal from the top. All jobs are distributed before the workers start, so the deques never
+// grow and the only shared writes are the index updates of a deque that is being stolen from.
+typedef struct {
+    long *items;
+    atomic_long top;
+    atomic_long bottom;
+} WorkDeque;
+
+typedef struct {
+    int id;
+    int count;
+    WorkDeque *deques;
+    JobList *jobs;
+    BatchContext *ctx;
+    unsigned long steals;
+    pthread_t thread;
+} Worker;
+
+int add_job(JobList *jobs, const char *path) {
+    size_t length = strlen(path) + 1;
+
+    // Paths are packed into one growing buffer, the jobs only keep offsets into it
+    if (jobs->pathsLength + length > jobs->pathsCapacity) {
+        size_t capacity = jobs->pathsCapacity ? jobs->pathsCapacity : 65536;
+        while (capacity < jobs->pathsLength + length) {
+            capacity *= 2;
+        }
+
+        char *paths = (char *)realloc(jobs->paths, capacity);
+        if (paths == NULL) {
+            return -1;
+        }
+
+        jobs->paths = paths;
+        jobs->pathsCapacity = capacity;
+    }
+
+    if (jobs->count == jobs->capacity) {
+        size_t capacity = jobs->capacity ? jobs->capacity * 2 : 4096;
+
+        size_t *offsets = (size_t *)realloc(jobs->offsets, capacity * sizeof(size_t));
+        if (offsets == NULL) {
+            return -1;
+        }
+
+        jobs->offsets = offsets;
+        jobs->capacity = capacity;
+    }
+
+    memcpy(jobs->paths + jobs->pathsLength, path, length);
+    jobs->offsets[jobs->count++] = jobs->pathsLength;
+    jobs->pathsLength += length;
+
+    return 0;
+}
+
+void free_job_list(JobList *jobs) {
+    free(jobs->paths);
+    free(jobs->offsets);
+    memset(jobs, 0, sizeof(*jobs));
+}
+
+static long take_job(WorkDeque *deque) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // Empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return -1;
+    }
+
+    long item = deque->items[bottom];
+
+    if (top == bottom) {
+        // Last job, race against the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            item = -1;
+        }
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return item;
+}
+
+static long steal_job(WorkDeque *deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return -1;
+    }
+
+    long item = deque->items[top];
+
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return -1;
+    }
+
+    return item;
+}
+
+static long next_job(Worker *worker) {
+    long job = take_job(&worker->deques[worker->id]);
+    if (job != -1) {
+        return job;
+    }
+
+    // Own deque is empty, try every other worker once per round until nothing is left anywhere
+    int i;
+    for (;;) {
+        int pending = 0;
+
+        for (i = 1; i < worker->count; i++) {
+            WorkDeque *victim = &worker->deques[(worker->id + i) % worker->count];
+
+            if (atomic_load_explicit(&victim->top, memory_order_relaxed) < atomic_load_explicit(&victim->bottom, memory_order_relaxed)) {
+                pending = 1;
+
+                job = steal_job(victim);
+                if (job != -1) {
+                    worker->steals++;
+                    return job;
+                }
+            }
+        }
+
+        if (!pending) {
+            return -1;
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = (Worker *)arg;
+    long job;
+
+    while ((job = next_job(worker)) != -1) {
+        batch_process_file(worker->jobs->paths + worker->jobs->offsets[job], worker->ctx);
+    }
+
+    flush_batch_output(worker->ctx);
+
+    return NULL;
+}
+
+// With --aggregate every worker counts into a stats structure of its own, merged after the join
+static TlsStats *create_worker_stats(void) {
+    TlsStats *stats = (TlsStats *)malloc(sizeof(TlsStats));
+
+    if (stats != NULL && init_tls_stats(stats) != 0) {
+        free(stats);
+        stats = NULL;
+    }
+
+    return stats;
+}
+
+static void merge_worker_stats(TlsStats *into, TlsStats *stats) {
+    if (stats != NULL && stats != into) {
+        merge_tls_stats(into, stats);
+        free_tls_stats(stats);
+        free(stats);
+    }
+}
+
+int run_parallel_batch(JobList *jobs, int count, int use_mmap, BatchSummary *summary, TlsStats *stats) {
+    WorkDeque *deques = (WorkDeque *)calloc(count, sizeof(WorkDeque));
+    Worker *workers = (Worker *)calloc(count, sizeof(Worker));
+    long *items = (long *)malloc((jobs->count ? jobs->count : 1) * sizeof(long));
+    int i, started = 0;
+
+    if (deques == NULL || workers == NULL || items == NULL) {
+        printf("Out of memory.\n");
+        free(deques);
+        free(workers);
+        free(items);
+
+        return -1;
+    }
+
+    // Split the jobs into contiguous ranges, one per worker. Stealing evens out the
+    // differences in file sizes and parse costs.
+    size_t next = 0;
+    for (i = 0; i < count; i++) {
+        size_t share = jobs->count / count + ((size_t)i < jobs->count % count ? 1 : 0);
+
+        deques[i].items = items + next;
+        atomic_init(&deques[i].top, 0);
+        atomic_init(&deques[i].bottom, (long)share);
+
+        size_t j;
+        for (j = 0; j < share; j++) {
+            deques[i].items[j] = (long)(next + j);
+        }
+
+        next += share;
+    }
+
+    for (i = 0; i < count; i++) {
+        workers[i].id = i;
+        workers[i].count = count;
+        workers[i].deques = deques;
+        workers[i].jobs = jobs;
+
+        // Each worker has its own input buffer, output buffer and counters
+        workers[i].ctx = (BatchContext *)calloc(1, sizeof(BatchContext));
+        if (workers[i].ctx != NULL) {
+            workers[i].ctx->useMmap = use_mmap;
+            workers[i].ctx->stats = stats != NULL ? create_worker_stats() : NULL;
+        }
+
+        if (workers[i].ctx == NULL || (stats != NULL && workers[i].ctx->stats == NULL) ||
+            pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            break;
+        }
+
+        started++;
+    }
+
+    // Whatever couldn't be handed to a thread is processed right here
+    int unprocessed = 0;
+    if (started < count) {
+        Worker fallback = workers[started];
+        BatchContext *ctx = fallback.ctx ? fallback.ctx : (BatchContext *)calloc(1, sizeof(BatchContext));
+
+        if (ctx != NULL) {
+            // The other workers only touch stats after they were joined, so this one can count into it directly
+            merge_worker_stats(stats, ctx->stats);
+            ctx->useMmap = use_mmap;
+            ctx->stats = stats;
+            fallback.ctx = ctx;
+            worker_main(&fallback);
+            merge_batch_summary(summary, &ctx->summary);
+            free_batch_context(ctx);
+        } else {
+            unprocessed = 1;
+        }
+
+        workers[started].ctx = NULL;
+    }
+
+    // The per-worker counters are only merged once all threads are done
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        merge_batch_summary(summary, &workers[i].ctx->summary);
+        merge_worker_stats(stats, workers[i].ctx->stats);
+        free_batch_context(workers[i].ctx);
+    }
+
+    // The started workers steal every job they can reach, so jobs are only left over if none of
+    // them ran. They are still reported one by one.
+    if (unprocessed) {
+        for (i = 0; i < count; i++) {
+            long job;
+
+            while ((job = steal_job(&deques[i])) != -1) {
+                fprintf(report_stream(), "%s: [SKIPPED] Out of memory.\n", jobs->paths + jobs->offsets[job]);
+                summary->skipped++;
+            }
+        }
+    }
+
+    free(items);
+    free(deques);
+    free(workers);
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include "tls_parser_cli.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STREAM_READ_SIZE 16384
+#define MMAP_RELEASE_INTERVAL (64 * 1024 * 1024) // Give back mapped pages every 64 MB
+
+#define MMAP_MESSAGES_PER_ROUND 4096
+
+// Parses up to max_messages (0 means all) buffered messages and returns how many were processed
+static unsigned long stream_process_messages(RecordStream *stream, const char *name, unsigned long *index, BatchSummary *summary, unsigned long max_messages) {
+    ParsedMessage parsed;
+    unsigned long processed = 0;
+    int err;
+
+    while ((max_messages == 0 || processed < max_messages) && (err = next_stream_message(stream, &parsed.handshake)) != STREAM_NEED_MORE_DATA) {
+        (*index)++;
+        processed++;
+
+        if (screen_messages) {
+            MessageSummary message;
+
+            message.handshake = parsed.handshake;
+            if (!screen_message(summary, &message, err == NO_ERROR ? validate_handshake_body(&message) : err)) {
+                if (stream->error) {
+                    break;
+                }
+
+                continue;
+            }
+        }
+
+        if (err == NO_ERROR) {
+            err = parse_message_body(&parsed);
+        }
+
+        record_batch_result(summary, &parsed.handshake, err);
+        record_message_stats(get_message_stats(), &parsed, err);
+
+        METRIC_START(output_start);
+        if (emit_message_record(name, *index, &parsed, err)) {
+            // Written as a JSON/binary record
+        } else if (err) {
+            printf("%s#%lu: [ERROR] %s\n", name, *index, get_error_description(err));
+        } else {
+            char fingerprint[FINGERPRINT_SUFFIX_SIZE];
+            format_fingerprint_suffix(&parsed, fingerprint);
+            printf("%s#%lu: [OK] %s%s\n", name, *index, get_handshake_type_name(parsed.handshake.hsType), fingerprint);
+        }
+
+        emit_certificate_records(name, *index, &parsed, err);
+        METRIC_STOP(METRIC_STAGE_OUTPUT, output_start);
+
+        if (stream->error) {
+            break;
+        }
+    }
+
+    return processed;
+}
+
+int stream_process_fd(int fd, const char *name, RecordStream *stream, BatchSummary *summary) {
+    unsigned char chunk[STREAM_READ_SIZE];
+    unsigned long index = 0;
+
+    reset_record_stream(stream);
+
+    while (!stream->error) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            fprintf(report_stream(), "%s: [SKIPPED] Couldn't read the input.\n", name);
+            return -1;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        // The chunk is fed in parts when the ring is full, messages are pulled in between
+        size_t done = 0;
+        while (done < (size_t)n && !stream->error) {
+            done += feed_record_stream(stream, chunk + done, n - done);
+            stream_process_messages(stream, name, &index, summary, 0);
+        }
+    }
+
+    // Whatever is left over at the end of the input is an incomplete record or message
+    if (!stream->error && (stream->tail != stream->head || stream->reassembling)) {
+        ParsedMessage parsed;
+        memset(&parsed, 0, sizeof(parsed));
+        record_batch_result(summary, &parsed.handshake, INVALID_FILE_LENGTH);
+
+        if (!emit_message_record(name, index + 1, &parsed, INVALID_FILE_LENGTH)) {
+            printf("%s#%lu: [ERROR] %s\n", name, index + 1, get_error_description(INVALID_FILE_LENGTH));
+        }
+    }
+
+    return 0;
+}
+
+int stream_process_mapped(const char *path, BatchSummary *summary) {
+    MappedFile file;
+    const char *reason = map_input_file(path, &file, MADV_SEQUENTIAL);
+
+    if (reason != NULL) {
+        fprintf(report_stream(), "%s: [SKIPPED] %s\n", path, reason);
+        summary->skipped++;
+
+        return -1;
+    }
+
+    // The records are parsed in place, nothing of the file is copied
+    RecordStream stream;
+    memset(&stream, 0, sizeof(stream));
+    attach_record_stream(&stream, file.data, file.size);
+
+    unsigned long index = 0;
+    size_t released = 0;
+
+    while (stream_process_messages(&stream, path, &index, summary, MMAP_MESSAGES_PER_ROUND) == MMAP_MESSAGES_PER_ROUND && !stream.error) {
+        if (stream.head - released >= MMAP_RELEASE_INTERVAL) {
+            release_mapped_pages(&file, stream.head);
+            released = stream.head;
+        }
+    }
+
+    if (!stream.error && (stream.tail != stream.head || stream.reassembling)) {
+        ParsedMessage parsed;
+        memset(&parsed, 0, sizeof(parsed));
+        record_batch_result(summary, &parsed.handshake, INVALID_FILE_LENGTH);
+
+        if (!emit_message_record(path, index + 1, &parsed, INVALID_FILE_LENGTH)) {
+            printf("%s#%lu: [ERROR] %s\n", path, index + 1, get_error_description(INVALID_FILE_LENGTH));
+        }
+    }
+
+    // Only a message reassembled from several records was ever copied
+    free_record_stream(&stream);
+    unmap_input_file(&file);
+
+    return 0;
+}
+
+int run_stream(char **paths, int count, int use_mmap) {
+    RecordStream stream;
+    BatchSummary summary;
+    memset(&summary, 0, sizeof(summary));
+
+    if (init_record_stream(&stream, DEFAULT_STREAM_CAPACITY) != 0) {
+        printf("Couldn't allocate the stream buffer.\n");
+        return 1;
+    }
+
+    if (count == 0) {
+        stream_process_fd(STDIN_FILENO, "stdin", &stream, &summary);
+    }
+
+    int i;
+    for (i = 0; i < count; i++) {
+        if (strcmp(paths[i], "-") == 0) {
+            stream_process_fd(STDIN_FILENO, "stdin", &stream, &summary);
+            continue;
+        }
+
+        if (use_mmap) {
+            stream_process_mapped(paths[i], &summary);
+            continue;
+        }
+
+        int fd = open(paths[i], O_RDONLY);
+        if (fd == -1) {
+            fprintf(report_stream(), "%s: [SKIPPED] The file couldn't be opened.\n", paths[i]);
+            summary.skipped++;
+            continue;
+        }
+
+        stream_process_fd(fd, paths[i], &stream, &summary);
+        close(fd);
+    }
+
+    print_batch_summary(&summary);
+    print_certificate_cache_stats();
+    print_message_cache_stats();
+    print_message_stats();
+
+    free_record_stream(&stream);
+
+    return summary.ok == summary.files ? 0 : 1;
+}
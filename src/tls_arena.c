@@ -0,0 +1,209 @@
+#include "tls_arena.h"
+#include "tls_metrics.h"
+
+static _Thread_local Arena thread_arena;
+static _Thread_local int thread_arena_ready = 0;
+
+static size_t align_size(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+int init_arena(Arena *arena, size_t capacity) {
+    memset(arena, 0, sizeof(*arena));
+
+    capacity = align_size(capacity > 0 ? capacity : DEFAULT_ARENA_CAPACITY);
+    arena->base = (unsigned char *)malloc(capacity);
+    if (arena->base == NULL) {
+        return -1;
+    }
+
+    arena->capacity = capacity;
+    arena->ownsBase = 1;
+
+    return 0;
+}
+
+void init_arena_with_buffer(Arena *arena, void *buffer, size_t size) {
+    memset(arena, 0, sizeof(*arena));
+
+    // Only the aligned part of the buffer is used
+    uintptr_t start = align_size((uintptr_t)buffer);
+    uintptr_t end = (uintptr_t)buffer + size;
+
+    if (start < end) {
+        arena->base = (unsigned char *)start;
+        arena->capacity = (end - start) & ~(uintptr_t)(ARENA_ALIGNMENT - 1);
+    }
+}
+
+static void free_overflow(Arena *arena) {
+    while (arena->overflow != NULL) {
+        ArenaChunk *next = arena->overflow->next;
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+
+    arena->overflowUsed = 0;
+}
+
+void free_arena(Arena *arena) {
+    free_overflow(arena);
+
+    if (arena->ownsBase) {
+        free(arena->base);
+    }
+
+    memset(arena, 0, sizeof(*arena));
+}
+
+void reset_arena(Arena *arena) {
+    // The overflow of this round tells how large the base block has to be
+    if (arena->overflow != NULL && arena->ownsBase) {
+        size_t capacity = align_size(arena->used + arena->overflowUsed);
+        unsigned char *base = (unsigned char *)malloc(capacity);
+
+        if (base != NULL) {
+            free(arena->base);
+            arena->base = base;
+            arena->capacity = capacity;
+        }
+    }
+
+    free_overflow(arena);
+    arena->used = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_size(size > 0 ? size : 1);
+
+    if (arena->capacity - arena->used >= size) {
+        void *result = arena->base + arena->used;
+        arena->used += size;
+
+        return result;
+    }
+
+    if (!arena->ownsBase) {
+        return NULL;
+    }
+
+    ArenaChunk *chunk = arena->overflow;
+    if (chunk == NULL || chunk->capacity - chunk->used < size) {
+        size_t capacity = size > arena->capacity ? size : arena->capacity;
+
+        chunk = (ArenaChunk *)malloc(align_size(sizeof(ArenaChunk)) + capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+
+        chunk->next = arena->overflow;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        arena->overflow = chunk;
+    }
+
+    void *result = (unsigned char *)chunk + align_size(sizeof(ArenaChunk)) + chunk->used;
+    chunk->used += size;
+    arena->overflowUsed += size;
+
+    return result;
+}
+
+void *arena_copy(Arena *arena, const void *data, size_t size) {
+    void *copy = arena_alloc(arena, size);
+
+    if (copy != NULL && size > 0) {
+        memcpy(copy, data, size);
+    }
+
+    return copy;
+}
+
+Arena *get_thread_arena(void) {
+    if (!thread_arena_ready) {
+        if (init_arena(&thread_arena, DEFAULT_ARENA_CAPACITY) != 0) {
+            return NULL;
+        }
+
+        thread_arena_ready = 1;
+    }
+
+    return &thread_arena;
+}
+
+void free_thread_arena(void) {
+    if (thread_arena_ready) {
+        free_arena(&thread_arena);
+        thread_arena_ready = 0;
+    }
+}
+
+#define REBASE(field) ((field) ? body + ((const unsigned char *)(field) - old_body) : NULL)
+
+void rebase_parsed_message(ParsedMessage *message, const unsigned char *old_body) {
+    const unsigned char *body = message->handshake.body;
+
+    // Everything a hello message points to is inside its body
+    if (message->handshake.hsType == CLIENT_HELLO) {
+        ClientHello *hello = &message->clientHello;
+
+        hello->random.random_bytes = REBASE(hello->random.random_bytes);
+        hello->sessionId.sessionId = REBASE(hello->sessionId.sessionId);
+        hello->csCollection.cipherSuites = REBASE(hello->csCollection.cipherSuites);
+        hello->extensions = REBASE(hello->extensions);
+        hello->extensionIndex.data = REBASE(hello->extensionIndex.data);
+        hello->cipherSpecs = REBASE(hello->cipherSpecs);
+        hello->challenge = REBASE(hello->challenge);
+    } else if (message->handshake.hsType == SERVER_HELLO) {
+        ServerHello *hello = &message->serverHello;
+
+        hello->random.random_bytes = REBASE(hello->random.random_bytes);
+        hello->sessionId.sessionId = REBASE(hello->sessionId.sessionId);
+        hello->extensions = REBASE(hello->extensions);
+        hello->extensionIndex.data = REBASE(hello->extensionIndex.data);
+    } else if (message->handshake.hsType == CERTIFICATE) {
+        CertificateChain *chain = &message->certificate;
+
+        uint16_t i;
+
+        for (i = 0; i < chain->count; i++) {
+            chain->entries[i].data = REBASE(chain->entries[i].data);
+        }
+    } else if (message->handshake.hsType == CERTIFICATE_REQUEST) {
+        CertificateRequest *request = &message->certificateRequest;
+
+        request->certificateTypes = REBASE(request->certificateTypes);
+        request->signatureAlgorithms.data = REBASE(request->signatureAlgorithms.data);
+        request->authorities = REBASE(request->authorities);
+    } else if (message->handshake.hsType == CERTIFICATE_VERIFY) {
+        message->certificateVerify.signature = REBASE(message->certificateVerify.signature);
+    } else if (message->handshake.hsType == FINISHED) {
+        message->finished.verifyData = REBASE(message->finished.verifyData);
+    }
+}
+
+static int copy_message(const ParsedMessage *parsed, Arena *arena, ParsedMessage *copy) {
+    *copy = *parsed;
+
+    if (parsed->handshake.body == NULL) {
+        return 0;
+    }
+
+    const unsigned char *body = (const unsigned char *)arena_copy(arena, parsed->handshake.body, parsed->handshake.mLength);
+    if (body == NULL) {
+        return -1;
+    }
+
+    copy->handshake.body = body;
+    rebase_parsed_message(copy, parsed->handshake.body);
+
+    return 0;
+}
+
+int copy_parsed_message(const ParsedMessage *parsed, Arena *arena, ParsedMessage *copy) {
+    METRIC_START(start);
+    int result = copy_message(parsed, arena, copy);
+    METRIC_STOP(METRIC_STAGE_COPY, start);
+
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef TLS_ARENA_H
+#define TLS_ARENA_H
+
+#include "tls_parser.h"
+
+#define DEFAULT_ARENA_CAPACITY 65536
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t capacity;
+    size_t used;
+    unsigned char data[];
+} ArenaChunk;
+
+// Bump allocator for state that lives as long as one message (or one batch of messages). There
+// is no per allocation free, reset_arena releases everything at once. Memory comes from a single
+// base block; allocations that don't fit go to overflow chunks, and the next reset grows the base
+// block so that the steady state needs a single block and no malloc at all.
+// An arena set up with init_arena_with_buffer uses the caller's memory and never allocates,
+// arena_alloc returns NULL once that buffer is full.
+typedef struct {
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+    int ownsBase;             // base was allocated by the arena (and may be grown by it)
+    ArenaChunk *overflow;     // Most recent chunk first
+    size_t overflowUsed;      // Bytes handed out from overflow chunks since the last reset
+} Arena;
+
+int init_arena(Arena *arena, size_t capacity);
+void init_arena_with_buffer(Arena *arena, void *buffer, size_t size);
+void free_arena(Arena *arena);
+void reset_arena(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_copy(Arena *arena, const void *data, size_t size);
+
+// Arena of the calling thread, created on first use. free_thread_arena has to be called by every
+// thread that used it before the thread exits.
+Arena *get_thread_arena(void);
+void free_thread_arena(void);
+
+// Copies the handshake body of a successfully parsed message into the arena and points all fields
+// of copy at it, so the message stays valid after the input buffer is reused (e.g. by a RecordStream).
+// Returns -1 if the arena is out of memory.
+int copy_parsed_message(const ParsedMessage *parsed, Arena *arena, ParsedMessage *copy);
+
+// Moves all pointers of a parsed message from old_body to message->handshake.body, which has to
+// hold the same bytes at least where the fields point to
+void rebase_parsed_message(ParsedMessage *message, const unsigned char *old_body);
+
+#endif
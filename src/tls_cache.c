@@ -0,0 +1,289 @@
+#include "tls_cache.h"
+#include "tls_arena.h"
+#include "tls_metrics.h"
+#include "hash.h"
+
+// Version (2 bytes), Random (32 bytes) and the SessionID length start every ClientHello and ServerHello
+#define HELLO_RANDOM_OFFSET 2
+#define HELLO_SESSION_ID_OFFSET 35
+
+int init_message_cache(MessageCache *cache, size_t max_entries) {
+    memset(cache, 0, sizeof(*cache));
+
+    cache->maxEntries = max_entries > 0 ? max_entries : 1;
+    cache->slotCount = 16;
+    while (cache->slotCount * 3 / 4 < cache->maxEntries) {
+        cache->slotCount <<= 1;
+    }
+
+    cache->entries = (MessageCacheEntry *)calloc(cache->maxEntries, sizeof(MessageCacheEntry));
+    cache->slots = (uint32_t *)calloc(cache->slotCount, sizeof(uint32_t));
+    if (cache->entries == NULL || cache->slots == NULL) {
+        free_message_cache(cache);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void free_message_cache(MessageCache *cache) {
+    size_t i;
+
+    if (cache->entries != NULL) {
+        for (i = 0; i < cache->count; i++) {
+            free(cache->entries[i].body);
+        }
+    }
+
+    free(cache->entries);
+    free(cache->slots);
+    cache->entries = NULL;
+    cache->slots = NULL;
+    cache->count = 0;
+    cache->current = NULL;
+}
+
+// Where the Random and the SessionID of a hello are, 0 if the body is too short to have them
+static uint32_t get_hello_session_id_end(const HandshakeMessage *handshake) {
+    if (handshake->mLength < HELLO_SESSION_ID_OFFSET) {
+        return 0;
+    }
+
+    uint32_t end = HELLO_SESSION_ID_OFFSET + handshake->body[HELLO_SESSION_ID_OFFSET - 1];
+
+    return end <= handshake->mLength ? end : 0;
+}
+
+// Returns -1 if the message isn't cached at all. The key leaves out the Random and the SessionID
+// of a hello, but not the SessionID length, so the layout of the rest is the same on a match.
+static int hash_message_body(const HandshakeMessage *handshake, uint64_t *hash) {
+    const unsigned char *body = handshake->body;
+    FastHash state;
+
+    if (handshake->sslv2 || body == NULL || handshake->mLength > MAX_CACHED_MESSAGE_SIZE) {
+        return -1;
+    }
+
+    // A Certificate isn't worth it, parse_certificate only follows the length of each certificate
+    // while the key would have to cover all of them. Decoded certificates have a cache of their own.
+    if (handshake->hsType != CLIENT_HELLO && handshake->hsType != SERVER_HELLO) {
+        return -1;
+    }
+
+    uint32_t end = get_hello_session_id_end(handshake);
+
+    if (end == 0) {
+        return -1;
+    }
+
+    fast_hash_init(&state, handshake->mLength ^ ((uint64_t)handshake->hsType << 32) ^ ((uint64_t)handshake->version.minor << 40));
+    fast_hash_update(&state, body, HELLO_RANDOM_OFFSET);
+    fast_hash_update(&state, body + HELLO_SESSION_ID_OFFSET - 1, 1);
+    fast_hash_update(&state, body + end, handshake->mLength - end);
+
+    *hash = fast_hash_final(&state);
+
+    return 0;
+}
+
+static int is_same_message(const MessageCacheEntry *entry, const HandshakeMessage *handshake, uint64_t hash) {
+    const unsigned char *body = handshake->body;
+
+    if (entry->hash != hash || entry->length != handshake->mLength || entry->hsType != handshake->hsType ||
+        entry->recordVersion.major != handshake->version.major || entry->recordVersion.minor != handshake->version.minor) {
+        return 0;
+    }
+
+    // The SessionID lengths are equal, both were hashed
+    uint32_t end = get_hello_session_id_end(handshake);
+
+    if (memcmp(entry->body, body, HELLO_RANDOM_OFFSET) != 0 ||
+        entry->body[HELLO_SESSION_ID_OFFSET - 1] != body[HELLO_SESSION_ID_OFFSET - 1] ||
+        memcmp(entry->body + end, body + end, entry->length - end) != 0) {
+        return 0;
+    }
+
+    // A HelloRetryRequest is told apart by its Random alone
+    return entry->hsType != SERVER_HELLO ||
+           entry->result.serverHello.helloRetryRequest == is_hello_retry_request_random(body + HELLO_RANDOM_OFFSET);
+}
+
+// Entries that failed to get a body were never added to the slots, they are simply not found
+static void remove_slot(MessageCache *cache, uint32_t index) {
+    uint32_t mask = cache->slotCount - 1;
+    uint32_t i = cache->entries[index].hash & mask;
+
+    while (cache->slots[i] != 0 && cache->slots[i] != index + 1) {
+        i = (i + 1) & mask;
+    }
+
+    if (cache->slots[i] == 0) {
+        return;
+    }
+
+    // Backward shift deletion
+    uint32_t hole = i;
+
+    cache->slots[i] = 0;
+    i = (i + 1) & mask;
+
+    while (cache->slots[i] != 0) {
+        uint32_t home = cache->entries[cache->slots[i] - 1].hash & mask;
+
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            cache->slots[hole] = cache->slots[i];
+            cache->slots[i] = 0;
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+// The hand passes over referenced entries once, clearing their bit, and takes the first one without
+static MessageCacheEntry *claim_entry(MessageCache *cache) {
+    if (cache->count < cache->maxEntries) {
+        return &cache->entries[cache->count++];
+    }
+
+    for (;;) {
+        uint32_t index = cache->hand;
+        MessageCacheEntry *entry = &cache->entries[index];
+
+        cache->hand = (cache->hand + 1) % cache->maxEntries;
+
+        if (entry->referenced) {
+            entry->referenced = 0;
+            continue;
+        }
+
+        remove_slot(cache, index);
+        cache->evictions++;
+
+        return entry;
+    }
+}
+
+static void add_entry(MessageCache *cache, const ParsedMessage *parsed, uint64_t hash) {
+    uint32_t length = parsed->handshake.mLength;
+    MessageCacheEntry *entry = claim_entry(cache);
+
+    if (entry->bodyCapacity < length || entry->body == NULL) {
+        unsigned char *body = (unsigned char *)realloc(entry->body, length > 0 ? length : 1);
+
+        if (body == NULL) {
+            return;
+        }
+
+        entry->body = body;
+        entry->bodyCapacity = length;
+    }
+
+    memcpy(entry->body, parsed->handshake.body, length);
+    entry->hash = hash;
+    entry->length = length;
+    entry->hsType = parsed->handshake.hsType;
+    entry->recordVersion = parsed->handshake.version;
+    entry->referenced = 0;
+    entry->hasFingerprint = 0;
+    entry->result = *parsed;
+    entry->result.handshake.body = entry->body;
+    rebase_parsed_message(&entry->result, parsed->handshake.body);
+
+    uint32_t mask = cache->slotCount - 1;
+    uint32_t i = hash & mask;
+
+    while (cache->slots[i] != 0) {
+        i = (i + 1) & mask;
+    }
+
+    cache->slots[i] = (uint32_t)(entry - cache->entries) + 1;
+    cache->current = entry;
+    cache->currentBody = parsed->handshake.body;
+}
+
+static int take_cached_result(MessageCache *cache, MessageCacheEntry *entry, ParsedMessage *parsed) {
+    HandshakeMessage handshake = parsed->handshake;
+    const unsigned char *random = handshake.body + HELLO_RANDOM_OFFSET;
+
+    cache->hits++;
+    entry->referenced = 1;
+
+    *parsed = entry->result;
+    parsed->handshake = handshake;
+    rebase_parsed_message(parsed, entry->body);
+
+    // The only value copied out of the Random
+    if (handshake.hsType == CLIENT_HELLO) {
+        parsed->clientHello.random.time = ((uint32_t)random[0] << 24) | (random[1] << 16) | (random[2] << 8) | random[3];
+    } else if (handshake.hsType == SERVER_HELLO) {
+        parsed->serverHello.random.time = ((uint32_t)random[0] << 24) | (random[1] << 16) | (random[2] << 8) | random[3];
+    }
+
+    cache->current = entry;
+    cache->currentBody = handshake.body;
+
+    return NO_ERROR;
+}
+
+// Same as parse_handshake_body. Only messages that parsed without an error are cached.
+int parse_cached_handshake_body(MessageCache *cache, ParsedMessage *parsed) {
+    uint64_t hash;
+
+    cache->current = NULL;
+
+    if (hash_message_body(&parsed->handshake, &hash) != 0) {
+        cache->uncached++;
+
+        return parse_handshake_body(parsed);
+    }
+
+    METRIC_START(start);
+    uint32_t mask = cache->slotCount - 1;
+
+    for (uint32_t i = hash & mask; cache->slots[i] != 0; i = (i + 1) & mask) {
+        MessageCacheEntry *entry = &cache->entries[cache->slots[i] - 1];
+
+        if (is_same_message(entry, &parsed->handshake, hash)) {
+            int err = take_cached_result(cache, entry, parsed);
+            METRIC_STOP(METRIC_STAGE_PARSE, start);
+            METRIC_MESSAGE(parsed->handshake.hsType);
+
+            return err;
+        }
+    }
+
+    cache->misses++;
+
+    int err = parse_handshake_body(parsed);
+    if (err == NO_ERROR) {
+        add_entry(cache, parsed, hash);
+    }
+
+    return err;
+}
+
+// JA3 or JA3S of the message parse_cached_handshake_body returned last, computed once per entry.
+// NULL if that message isn't a cached hello.
+const Fingerprint *get_cached_fingerprint(MessageCache *cache, const ParsedMessage *parsed) {
+    MessageCacheEntry *entry = cache->current;
+
+    if (entry == NULL || cache->currentBody != parsed->handshake.body) {
+        return NULL;
+    }
+
+    if (!entry->hasFingerprint) {
+        if (entry->hsType == CLIENT_HELLO) {
+            compute_ja3(&parsed->clientHello, JA3_MD5 | JA3_RAW, &entry->fingerprint);
+        } else if (entry->hsType == SERVER_HELLO) {
+            compute_ja3s(&parsed->serverHello, JA3_MD5 | JA3_RAW, &entry->fingerprint);
+        } else {
+            return NULL;
+        }
+
+        entry->hasFingerprint = 1;
+    }
+
+    return &entry->fingerprint;
+}
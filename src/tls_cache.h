@@ -0,0 +1,49 @@
+#ifndef TLS_CACHE_H
+#define TLS_CACHE_H
+
+#include "tls_parser.h"
+
+#define DEFAULT_MESSAGE_CACHE_SIZE 1024
+#define MAX_CACHED_MESSAGE_SIZE 65536 // Larger bodies are always parsed
+
+typedef struct {
+    uint64_t hash;            // Of the body without the volatile fields, see hash_message_body
+    uint32_t length;          // Of the body
+    uint8_t hsType;
+    ProtocolVersion recordVersion;
+    uint8_t referenced;       // CLOCK bit, set by a hit and cleared when the hand passes by
+    uint8_t hasFingerprint;
+    unsigned char *body;      // Copy of the body the entry was created from
+    uint32_t bodyCapacity;
+    ParsedMessage result;     // Points into body
+    Fingerprint fingerprint;  // JA3/JA3S, computed on the first request
+} MessageCacheEntry;
+
+// Parse results and JA3/JA3S fingerprints of ClientHello and ServerHello messages, keyed by their
+// body without the Random and the SessionID: clients of the same stack send byte identical hellos
+// apart from them. A hit costs a hash over the body and a memcmp, the structures are copied from
+// the entry and pointed at the new body. That's cheaper than parsing hellos of up to a few KB, and
+// much cheaper than computing their fingerprint again. Entries are recycled with the CLOCK
+// algorithm. Not thread safe, every thread needs its own cache.
+typedef struct {
+    MessageCacheEntry *entries; // maxEntries, filled in order, then recycled by the clock hand
+    uint32_t *slots;          // Open addressing table of entry index + 1, 0 for an empty slot
+    size_t slotCount;         // Power of two
+    size_t maxEntries;
+    size_t count;
+    size_t hand;
+    MessageCacheEntry *current; // Entry of the last message parse_cached_handshake_body returned
+    const unsigned char *currentBody;
+
+    unsigned long hits;
+    unsigned long misses;     // Parsed and added (or tried to)
+    unsigned long evictions;
+    unsigned long uncached;   // Types and sizes that are not cached, parsed as usual
+} MessageCache;
+
+int init_message_cache(MessageCache *cache, size_t max_entries);
+void free_message_cache(MessageCache *cache);
+int parse_cached_handshake_body(MessageCache *cache, ParsedMessage *parsed);
+const Fingerprint *get_cached_fingerprint(MessageCache *cache, const ParsedMessage *parsed);
+
+#endif
@@ -0,0 +1,265 @@
+#include "tls_parser.h"
+
+#if !defined(TLS_PARSER_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define CIPHER_SUITES_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Every suite with a class bit has 0x00 or 0xc0 as its first byte, so the classes are looked up in
+// suite_classes[(first byte == 0xc0) * 256 + second byte]. GREASE and TLS_FALLBACK_SCSV are
+// recognized by value. The tables are filled in by the compiler from the lists below.
+
+#define W CIPHER_SUITE_WEAK
+#define E (CIPHER_SUITE_WEAK | CIPHER_SUITE_EXPORT)
+#define C CIPHER_SUITE_CBC
+
+#define FALLBACK_SCSV 0x5600
+#define EMPTY_RENEGOTIATION_INFO_SCSV 0x00ff
+
+#define NO_CLASS_INDEX 512 // Always 0, used for the suites outside of the two table halves
+
+static const uint8_t suite_classes[513] = {
+    // 0x00xx: RFC 2246, 4346, 4492, 5246, 4279 (PSK), 4132/5932 (Camellia), 4162 (SEED) and the
+    // Kerberos and EXPORT1024 suites
+    [0x00] = W,     [0x01] = W,     [0x02] = W,     [0x03] = E,     [0x04] = W,     [0x05] = W,
+    [0x06] = E | C, [0x07] = W | C, [0x08] = E | C, [0x09] = W | C, [0x0a] = W | C, [0x0b] = E | C,
+    [0x0c] = W | C, [0x0d] = W | C, [0x0e] = E | C, [0x0f] = W | C, [0x10] = W | C, [0x11] = E | C,
+    [0x12] = W | C, [0x13] = W | C, [0x14] = E | C, [0x15] = W | C, [0x16] = W | C, [0x17] = E,
+    [0x18] = W,     [0x19] = E | C, [0x1a] = W | C, [0x1b] = W | C,
+    [0x1e] = W | C, [0x1f] = W | C, [0x20] = W,     [0x21] = W | C, [0x22] = W | C, [0x23] = W | C,
+    [0x24] = W,     [0x25] = W | C, [0x26] = E | C, [0x27] = E | C, [0x28] = E,     [0x29] = E | C,
+    [0x2a] = E | C, [0x2b] = E,     [0x2c] = W,     [0x2d] = W,     [0x2e] = W,
+    [0x2f] = C,     [0x30] = C,     [0x31] = C,     [0x32] = C,     [0x33] = C,     [0x34] = W | C,
+    [0x35] = C,     [0x36] = C,     [0x37] = C,     [0x38] = C,     [0x39] = C,     [0x3a] = W | C,
+    [0x3b] = W,     [0x3c] = C,     [0x3d] = C,     [0x3e] = C,     [0x3f] = C,     [0x40] = C,
+    [0x41] = C,     [0x42] = C,     [0x43] = C,     [0x44] = C,     [0x45] = C,     [0x46] = W | C,
+    [0x60] = E,     [0x61] = E | C, [0x62] = E | C, [0x63] = E | C, [0x64] = E,     [0x65] = E,
+    [0x66] = W,     [0x67] = C,     [0x68] = C,     [0x69] = C,     [0x6a] = C,     [0x6b] = C,
+    [0x6c] = W | C, [0x6d] = W | C,
+    [0x84] = C,     [0x85] = C,     [0x86] = C,     [0x87] = C,     [0x88] = C,     [0x89] = W | C,
+    [0x8a] = W,     [0x8b] = W | C, [0x8c] = C,     [0x8d] = C,     [0x8e] = W,     [0x8f] = W | C,
+    [0x90] = C,     [0x91] = C,     [0x92] = W,     [0x93] = W | C, [0x94] = C,     [0x95] = C,
+    [0x96] = C,     [0x97] = C,     [0x98] = C,     [0x99] = C,     [0x9a] = C,     [0x9b] = W | C,
+    [0xa6] = W,     [0xa7] = W,
+    [0xae] = C,     [0xaf] = C,     [0xb0] = W,     [0xb1] = W,     [0xb2] = C,     [0xb3] = C,
+    [0xb4] = W,     [0xb5] = W,     [0xb6] = C,     [0xb7] = C,     [0xb8] = W,     [0xb9] = W,
+    [0xba] = C,     [0xbb] = C,     [0xbc] = C,     [0xbd] = C,     [0xbe] = C,     [0xbf] = W | C,
+    [0xc0] = C,     [0xc1] = C,     [0xc2] = C,     [0xc3] = C,     [0xc4] = C,     [0xc5] = W | C,
+
+    // 0xc0xx: RFC 4492/8422 (ECC), 5054 (SRP), 5289, 5489 (ECDHE_PSK), 6209 (ARIA), 6367 (Camellia)
+    [0x100 + 0x01] = W,     [0x100 + 0x02] = W,     [0x100 + 0x03] = W | C, [0x100 + 0x04] = C,
+    [0x100 + 0x05] = C,     [0x100 + 0x06] = W,     [0x100 + 0x07] = W,     [0x100 + 0x08] = W | C,
+    [0x100 + 0x09] = C,     [0x100 + 0x0a] = C,     [0x100 + 0x0b] = W,     [0x100 + 0x0c] = W,
+    [0x100 + 0x0d] = W | C, [0x100 + 0x0e] = C,     [0x100 + 0x0f] = C,     [0x100 + 0x10] = W,
+    [0x100 + 0x11] = W,     [0x100 + 0x12] = W | C, [0x100 + 0x13] = C,     [0x100 + 0x14] = C,
+    [0x100 + 0x15] = W,     [0x100 + 0x16] = W,     [0x100 + 0x17] = W | C, [0x100 + 0x18] = W | C,
+    [0x100 + 0x19] = W | C, [0x100 + 0x1a] = W | C, [0x100 + 0x1b] = W | C, [0x100 + 0x1c] = W | C,
+    [0x100 + 0x1d] = C,     [0x100 + 0x1e] = C,     [0x100 + 0x1f] = C,     [0x100 + 0x20] = C,
+    [0x100 + 0x21] = C,     [0x100 + 0x22] = C,     [0x100 + 0x23] = C,     [0x100 + 0x24] = C,
+    [0x100 + 0x25] = C,     [0x100 + 0x26] = C,     [0x100 + 0x27] = C,     [0x100 + 0x28] = C,
+    [0x100 + 0x29] = C,     [0x100 + 0x2a] = C,
+    [0x100 + 0x33] = W,     [0x100 + 0x34] = W | C, [0x100 + 0x35] = C,     [0x100 + 0x36] = C,
+    [0x100 + 0x37] = C,     [0x100 + 0x38] = C,     [0x100 + 0x39] = W,     [0x100 + 0x3a] = W,
+    [0x100 + 0x3b] = W,
+    [0x100 + 0x3c] = C,     [0x100 + 0x3d] = C,     [0x100 + 0x3e] = C,     [0x100 + 0x3f] = C,
+    [0x100 + 0x40] = C,     [0x100 + 0x41] = C,     [0x100 + 0x42] = C,     [0x100 + 0x43] = C,
+    [0x100 + 0x44] = C,     [0x100 + 0x45] = C,     [0x100 + 0x46] = W | C, [0x100 + 0x47] = W | C,
+    [0x100 + 0x48] = C,     [0x100 + 0x49] = C,     [0x100 + 0x4a] = C,     [0x100 + 0x4b] = C,
+    [0x100 + 0x4c] = C,     [0x100 + 0x4d] = C,     [0x100 + 0x4e] = C,     [0x100 + 0x4f] = C,
+    [0x100 + 0x5a] = W,     [0x100 + 0x5b] = W,
+    [0x100 + 0x64] = C,     [0x100 + 0x65] = C,     [0x100 + 0x66] = C,     [0x100 + 0x67] = C,
+    [0x100 + 0x68] = C,     [0x100 + 0x69] = C,     [0x100 + 0x70] = C,     [0x100 + 0x71] = C,
+    [0x100 + 0x72] = C,     [0x100 + 0x73] = C,     [0x100 + 0x74] = C,     [0x100 + 0x75] = C,
+    [0x100 + 0x76] = C,     [0x100 + 0x77] = C,     [0x100 + 0x78] = C,     [0x100 + 0x79] = C,
+    [0x100 + 0x84] = W,     [0x100 + 0x85] = W,
+    [0x100 + 0x94] = C,     [0x100 + 0x95] = C,     [0x100 + 0x96] = C,     [0x100 + 0x97] = C,
+    [0x100 + 0x98] = C,     [0x100 + 0x99] = C,     [0x100 + 0x9a] = C,     [0x100 + 0x9b] = C,
+};
+
+#undef W
+#undef E
+#undef C
+
+uint32_t classify_cipher_suite(uint16_t suite) {
+    uint8_t first = suite >> 8;
+    unsigned index = first == 0x00 || first == 0xc0 ? (unsigned)((first & 0x40) << 2) | (suite & 0xff) : NO_CLASS_INDEX;
+
+    // Comparisons instead of branches, the scalar loop below runs over this for every suite
+    return suite_classes[index] |
+           (suite == FALLBACK_SCSV) * CIPHER_SUITE_FALLBACK_SCSV |
+           (suite == EMPTY_RENEGOTIATION_INFO_SCSV) * CIPHER_SUITE_RENEGOTIATION_SCSV |
+           ((suite & 0x0f0f) == 0x0a0a && (suite >> 8) == (suite & 0xff)) * CIPHER_SUITE_GREASE; // is_grease_value
+}
+
+static uint32_t classify_scalar(const unsigned char *suites, size_t count) {
+    uint32_t classes = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        classes |= classify_cipher_suite((suites[2 * i] << 8) | suites[2 * i + 1]);
+    }
+
+    return classes;
+}
+
+#ifdef CIPHER_SUITES_SIMD
+
+// The kernels handle a whole vector of suites at once. The 16 bit lanes hold the suites byte
+// swapped (the list is big endian), so the first byte of a suite is the low byte of its lane.
+// GREASE and the SCSVs come straight out of the compares. For the table the index of each lane
+// is computed in the vector as well, lanes with a first byte other than 0x00 or 0xc0 get
+// NO_CLASS_INDEX. The lookups are then plain independent loads without any branches.
+
+static uint32_t lookup_indexes(const uint16_t *indexes, int count) {
+    uint32_t classes = 0;
+    int lane;
+
+    for (lane = 0; lane < count; lane++) {
+        classes |= suite_classes[indexes[lane]];
+    }
+
+    return classes;
+}
+
+static uint32_t classify_sse2(const unsigned char *suites, size_t count, size_t *done) {
+    const __m128i low_byte = _mm_set1_epi16(0x00ff);
+    const __m128i half_bit = _mm_set1_epi16(0x0040);
+    const __m128i grease_mask = _mm_set1_epi16(0x0f0f);
+    const __m128i grease_value = _mm_set1_epi16(0x0a0a);
+    const __m128i fallback = _mm_set1_epi16(0x0056);
+    const __m128i renegotiation = _mm_set1_epi16((short)0xff00);
+    const __m128i ecc_first = _mm_set1_epi16(0x00c0);
+    const __m128i no_class = _mm_set1_epi16(NO_CLASS_INDEX);
+    __m128i special = _mm_setzero_si128();
+    uint16_t indexes[8];
+    uint32_t classes = 0;
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(suites + 2 * i));
+        __m128i first = _mm_and_si128(v, low_byte);
+        __m128i second = _mm_srli_epi16(v, 8);
+        __m128i grease = _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(v, grease_mask), grease_value),
+                                       _mm_cmpeq_epi16(second, first));
+
+        special = _mm_or_si128(special, _mm_and_si128(grease, _mm_set1_epi16(CIPHER_SUITE_GREASE)));
+        special = _mm_or_si128(special, _mm_and_si128(_mm_cmpeq_epi16(v, fallback), _mm_set1_epi16(CIPHER_SUITE_FALLBACK_SCSV)));
+        special = _mm_or_si128(special, _mm_and_si128(_mm_cmpeq_epi16(v, renegotiation), _mm_set1_epi16(CIPHER_SUITE_RENEGOTIATION_SCSV)));
+
+        __m128i in_table = _mm_or_si128(_mm_cmpeq_epi16(first, _mm_setzero_si128()), _mm_cmpeq_epi16(first, ecc_first));
+        __m128i index = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, half_bit), 2), second);
+
+        index = _mm_or_si128(_mm_and_si128(in_table, index), _mm_andnot_si128(in_table, no_class));
+        _mm_storeu_si128((__m128i *)indexes, index);
+        classes |= lookup_indexes(indexes, 8);
+    }
+
+    uint16_t flags[8];
+    _mm_storeu_si128((__m128i *)flags, special);
+    for (int lane = 0; lane < 8; lane++) {
+        classes |= flags[lane];
+    }
+
+    *done = i;
+
+    return classes;
+}
+
+__attribute__((target("avx2")))
+static uint32_t classify_avx2(const unsigned char *suites, size_t count, size_t *done) {
+    const __m256i low_byte = _mm256_set1_epi16(0x00ff);
+    const __m256i half_bit = _mm256_set1_epi16(0x0040);
+    const __m256i grease_mask = _mm256_set1_epi16(0x0f0f);
+    const __m256i grease_value = _mm256_set1_epi16(0x0a0a);
+    const __m256i fallback = _mm256_set1_epi16(0x0056);
+    const __m256i renegotiation = _mm256_set1_epi16((short)0xff00);
+    const __m256i ecc_first = _mm256_set1_epi16(0x00c0);
+    const __m256i no_class = _mm256_set1_epi16(NO_CLASS_INDEX);
+    __m256i special = _mm256_setzero_si256();
+    uint16_t indexes[16];
+    uint32_t classes = 0;
+    size_t i;
+
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(suites + 2 * i));
+        __m256i first = _mm256_and_si256(v, low_byte);
+        __m256i second = _mm256_srli_epi16(v, 8);
+        __m256i grease = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_and_si256(v, grease_mask), grease_value),
+                                          _mm256_cmpeq_epi16(second, first));
+
+        special = _mm256_or_si256(special, _mm256_and_si256(grease, _mm256_set1_epi16(CIPHER_SUITE_GREASE)));
+        special = _mm256_or_si256(special, _mm256_and_si256(_mm256_cmpeq_epi16(v, fallback), _mm256_set1_epi16(CIPHER_SUITE_FALLBACK_SCSV)));
+        special = _mm256_or_si256(special, _mm256_and_si256(_mm256_cmpeq_epi16(v, renegotiation), _mm256_set1_epi16(CIPHER_SUITE_RENEGOTIATION_SCSV)));
+
+        __m256i in_table = _mm256_or_si256(_mm256_cmpeq_epi16(first, _mm256_setzero_si256()), _mm256_cmpeq_epi16(first, ecc_first));
+        __m256i index = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, half_bit), 2), second);
+
+        index = _mm256_blendv_epi8(no_class, index, in_table);
+        _mm256_storeu_si256((__m256i *)indexes, index);
+        classes |= lookup_indexes(indexes, 16);
+    }
+
+    uint16_t flags[16];
+    _mm256_storeu_si256((__m256i *)flags, special);
+    for (int lane = 0; lane < 16; lane++) {
+        classes |= flags[lane];
+    }
+
+    *done = i;
+
+    return classes;
+}
+
+#endif
+
+// Classes of all suites of a cipher_suites list (big endian, length in bytes) as one bit mask of
+// CIPHER_SUITE_*. A trailing odd byte is ignored.
+uint32_t classify_cipher_suites(const unsigned char *suites, uint16_t length) {
+    size_t count = length / 2;
+    size_t done = 0;
+    uint32_t classes = 0;
+
+#ifdef CIPHER_SUITES_SIMD
+    if (count >= 16 && __builtin_cpu_supports("avx2")) {
+        classes = classify_avx2(suites, count, &done);
+    }
+
+    if (count - done >= 8) {
+        size_t more;
+
+        classes |= classify_sse2(suites + 2 * done, count - done, &more);
+        done += more;
+    }
+#endif
+
+    return classes | classify_scalar(suites + 2 * done, count - done);
+}
+
+// Classes of the suites a ClientHello offers. An SSLv2 hello has no cipher_suites list, only the
+// specs with a TLS equivalent are classified.
+uint32_t classify_client_hello_cipher_suites(const ClientHello *client_hello) {
+    uint32_t classes = 0;
+    uint16_t pos = 0, suite;
+
+    if (!client_hello->sslv2) {
+        return classify_cipher_suites(client_hello->csCollection.cipherSuites, client_hello->csCollection.length);
+    }
+
+    while (next_sslv2_cipher_suite(client_hello, &pos, &suite)) {
+        classes |= classify_cipher_suite(suite);
+    }
+
+    return classes;
+}
+
+const char *get_cipher_suite_class_name(uint32_t class) {
+    switch (class) {
+        case CIPHER_SUITE_WEAK: return "weak";
+        case CIPHER_SUITE_EXPORT: return "export";
+        case CIPHER_SUITE_CBC: return "cbc";
+        case CIPHER_SUITE_GREASE: return "grease";
+        case CIPHER_SUITE_FALLBACK_SCSV: return "fallback_scsv";
+        case CIPHER_SUITE_RENEGOTIATION_SCSV: return "renegotiation_scsv";
+        default: return "unknown";
+    }
+}
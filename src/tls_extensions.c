@@ -0,0 +1,318 @@
+#include "tls_parser.h"
+
+// Validates the block and indexes the first MAX_INDEXED_EXTENSIONS extensions, all of them or only
+// server_name and supported_versions (the ones validate_tls_message looks at)
+static int index_extensions(const unsigned char *extensions, uint32_t length, int from_server, int index_all, ExtensionIndex *index) {
+    index->data = NULL;
+    index->length = 0;
+    index->count = 0;
+    index->truncated = 0;
+    index->fromServer = from_server ? 1 : 0;
+    index->helloRetryRequest = 0;
+    index->present = 0;
+
+    // The block starts with its own 2 bytes length, which has to cover the rest exactly
+    if (length < 2 || (uint32_t)((extensions[0] << 8) | extensions[1]) != length - 2) {
+        return INVALID_EXTENSIONS;
+    }
+
+    const unsigned char *data = extensions + 2;
+    uint16_t size = length - 2;
+    uint16_t pos = 0;
+    int seen = 0;
+
+    while (pos < size) {
+        // Every extension is type (2 bytes) + length (2 bytes) + data
+        if (size - pos < 4) {
+            return INVALID_EXTENSIONS;
+        }
+
+        uint16_t type = (data[pos] << 8) | data[pos + 1];
+        uint16_t extension_length = (data[pos + 2] << 8) | data[pos + 3];
+        pos += 4;
+
+        if (extension_length > size - pos) {
+            return INVALID_EXTENSIONS;
+        }
+
+        if (seen++ >= MAX_INDEXED_EXTENSIONS) {
+            index->truncated = 1;
+        } else if (index_all || type == SERVER_NAME || type == SUPPORTED_VERSIONS) {
+            ExtensionEntry *entry = &index->entries[index->count++];
+            entry->type = type;
+            entry->offset = pos;
+            entry->length = extension_length;
+
+            if (type < 64) {
+                index->present |= (uint64_t)1 << type;
+            }
+        }
+
+        pos += extension_length;
+    }
+
+    index->data = data;
+    index->length = size;
+
+    return NO_ERROR;
+}
+
+int build_extension_index(const unsigned char *extensions, uint32_t length, int from_server, ExtensionIndex *index) {
+    return index_extensions(extensions, length, from_server, 1, index);
+}
+
+int scan_extension_block(const unsigned char *extensions, uint32_t length, int from_server, ExtensionIndex *index) {
+    return index_extensions(extensions, length, from_server, 0, index);
+}
+
+int get_extension(const ExtensionIndex *index, uint16_t type, const unsigned char **data, uint16_t *length) {
+    // Most lookups are for types below 64, absent ones are answered without touching the entries
+    if (type < 64 && !(index->present & ((uint64_t)1 << type))) {
+        return 0;
+    }
+
+    int i;
+    for (i = 0; i < index->count; i++) {
+        if (index->entries[i].type == type) {
+            *data = index->data + index->entries[i].offset;
+            *length = index->entries[i].length;
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint16_t get_uint16_list_value(const Uint16List *list, int i) {
+    return (list->data[2 * i] << 8) | list->data[2 * i + 1];
+}
+
+static int get_uint16_list(const ExtensionIndex *index, uint16_t type, Uint16List *list) {
+    const unsigned char *data;
+    uint16_t length;
+
+    list->data = NULL;
+    list->count = 0;
+
+    if (!get_extension(index, type, &data, &length)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // 2 bytes length of the list followed by the 16 bit values
+    if (length < 2) {
+        return INVALID_EXTENSIONS;
+    }
+
+    uint16_t list_length = (data[0] << 8) | data[1];
+    if (list_length != length - 2 || list_length % 2 != 0) {
+        return INVALID_EXTENSIONS;
+    }
+
+    list->data = data + 2;
+    list->count = list_length / 2;
+
+    return NO_ERROR;
+}
+
+int get_server_name(const ExtensionIndex *index, const unsigned char **name, uint16_t *length) {
+    const unsigned char *data;
+    uint16_t size;
+
+    if (!get_extension(index, SERVER_NAME, &data, &size)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // ServerNameList: 2 bytes length, then entries of name type (1 byte) + 2 bytes length + name
+    if (size < 2 || ((data[0] << 8) | data[1]) != size - 2) {
+        return INVALID_EXTENSIONS;
+    }
+
+    uint16_t pos = 2;
+    while (size - pos >= 3) {
+        uint8_t name_type = data[pos];
+        uint16_t name_length = (data[pos + 1] << 8) | data[pos + 2];
+        pos += 3;
+
+        if (name_length > size - pos) {
+            return INVALID_EXTENSIONS;
+        }
+
+        // Only host_name (0) is defined
+        if (name_type == 0) {
+            *name = data + pos;
+            *length = name_length;
+
+            return NO_ERROR;
+        }
+
+        pos += name_length;
+    }
+
+    return pos == size ? EXTENSION_NOT_PRESENT : INVALID_EXTENSIONS;
+}
+
+int get_alpn_protocols(const ExtensionIndex *index, ProtocolNameList *protocols) {
+    const unsigned char *data;
+    uint16_t size;
+
+    protocols->count = 0;
+
+    if (!get_extension(index, APPLICATION_LAYER_PROTOCOL_NEGOTIATION, &data, &size)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // ProtocolNameList: 2 bytes length, then names with a 1 byte length each
+    if (size < 2 || ((data[0] << 8) | data[1]) != size - 2) {
+        return INVALID_EXTENSIONS;
+    }
+
+    uint16_t pos = 2;
+    while (pos < size) {
+        uint8_t name_length = data[pos++];
+
+        if (name_length == 0 || name_length > size - pos) {
+            return INVALID_EXTENSIONS;
+        }
+
+        if (protocols->count < MAX_PROTOCOL_NAMES) {
+            protocols->names[protocols->count].name = data + pos;
+            protocols->names[protocols->count].length = name_length;
+            protocols->count++;
+        }
+
+        pos += name_length;
+    }
+
+    return NO_ERROR;
+}
+
+int get_supported_versions(const ExtensionIndex *index, Uint16List *versions) {
+    const unsigned char *data;
+    uint16_t size;
+
+    versions->data = NULL;
+    versions->count = 0;
+
+    if (!get_extension(index, SUPPORTED_VERSIONS, &data, &size)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // The server sends the selected version only, the client a list with a 1 byte length
+    if (index->fromServer) {
+        if (size != 2) {
+            return INVALID_EXTENSIONS;
+        }
+
+        versions->data = data;
+        versions->count = 1;
+
+        return NO_ERROR;
+    }
+
+    if (size < 1 || data[0] != size - 1 || data[0] % 2 != 0) {
+        return INVALID_EXTENSIONS;
+    }
+
+    versions->data = data + 1;
+    versions->count = data[0] / 2;
+
+    return NO_ERROR;
+}
+
+int get_supported_groups(const ExtensionIndex *index, Uint16List *groups) {
+    return get_uint16_list(index, SUPPORTED_GROUPS, groups);
+}
+
+int get_signature_algorithms(const ExtensionIndex *index, Uint16List *algorithms) {
+    return get_uint16_list(index, SIGNATURE_ALGORITHMS, algorithms);
+}
+
+int get_ec_point_formats(const ExtensionIndex *index, const unsigned char **formats, uint8_t *count) {
+    const unsigned char *data;
+    uint16_t size;
+
+    *count = 0;
+
+    if (!get_extension(index, EC_POINT_FORMATS, &data, &size)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // 1 byte length followed by one byte per format
+    if (size < 1 || data[0] != size - 1) {
+        return INVALID_EXTENSIONS;
+    }
+
+    *formats = data + 1;
+    *count = data[0];
+
+    return NO_ERROR;
+}
+
+int get_key_shares(const ExtensionIndex *index, KeyShareList *shares) {
+    const unsigned char *data;
+    uint16_t size;
+
+    shares->count = 0;
+    shares->truncated = 0;
+
+    if (!get_extension(index, KEY_SHARE, &data, &size)) {
+        return EXTENSION_NOT_PRESENT;
+    }
+
+    // A HelloRetryRequest only names the group the client should send a share for
+    if (index->helloRetryRequest) {
+        if (size != 2) {
+            return INVALID_EXTENSIONS;
+        }
+
+        shares->entries[0].group = (data[0] << 8) | data[1];
+        shares->entries[0].length = 0;
+        shares->entries[0].keyExchange = NULL;
+        shares->count = 1;
+
+        return NO_ERROR;
+    }
+
+    // The server sends a single KeyShareEntry, the client a list of them with a 2 bytes length
+    uint16_t pos = 0;
+    if (!index->fromServer) {
+        if (size < 2 || ((data[0] << 8) | data[1]) != size - 2) {
+            return INVALID_EXTENSIONS;
+        }
+
+        pos = 2;
+    }
+
+    // Every entry is group (2 bytes) + 2 bytes length + key_exchange
+    while (pos < size) {
+        if (size - pos < 4) {
+            return INVALID_EXTENSIONS;
+        }
+
+        uint16_t group = (data[pos] << 8) | data[pos + 1];
+        uint16_t length = (data[pos + 2] << 8) | data[pos + 3];
+        pos += 4;
+
+        if (length == 0 || length > size - pos) {
+            return INVALID_EXTENSIONS;
+        }
+
+        if (shares->count < MAX_KEY_SHARES) {
+            shares->entries[shares->count].group = group;
+            shares->entries[shares->count].length = length;
+            shares->entries[shares->count].keyExchange = data + pos;
+            shares->count++;
+        } else {
+            shares->truncated = 1;
+        }
+
+        pos += length;
+    }
+
+    if (index->fromServer && shares->count != 1) {
+        return INVALID_EXTENSIONS;
+    }
+
+    return NO_ERROR;
+}
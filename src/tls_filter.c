@@ -0,0 +1,43 @@
+#include "tls_filter.h"
+
+#include <strings.h>
+
+void init_message_filter(MessageFilter *filter) {
+    memset(filter, 0, sizeof(*filter));
+}
+
+void add_filter_type(MessageFilter *filter, uint8_t type) {
+    filter->types[type >> 6] |= (uint64_t)1 << (type & 63);
+}
+
+void set_filter_server_name(MessageFilter *filter, const char *prefix) {
+    filter->serverNamePrefix = prefix;
+    filter->serverNamePrefixLength = prefix != NULL ? strlen(prefix) : 0;
+}
+
+int is_message_filter_empty(const MessageFilter *filter) {
+    return (filter->types[0] | filter->types[1] | filter->types[2] | filter->types[3]) == 0 &&
+           filter->minVersion == 0 && filter->maxVersion == 0 && filter->serverNamePrefix == NULL;
+}
+
+// The cheapest tests come first, the server name is only compared for ClientHellos of the right version
+int match_message_filter(const MessageFilter *filter, const MessageSummary *summary) {
+    uint8_t type = summary->handshake.hsType;
+
+    if ((filter->types[0] | filter->types[1] | filter->types[2] | filter->types[3]) != 0 &&
+        !(filter->types[type >> 6] & ((uint64_t)1 << (type & 63)))) {
+        return 0;
+    }
+
+    uint16_t version = (summary->version.major << 8) | summary->version.minor;
+    if ((filter->minVersion != 0 && version < filter->minVersion) || (filter->maxVersion != 0 && version > filter->maxVersion)) {
+        return 0;
+    }
+
+    if (filter->serverNamePrefix != NULL) {
+        return summary->serverName != NULL && summary->serverNameLength >= filter->serverNamePrefixLength &&
+               strncasecmp((const char *)summary->serverName, filter->serverNamePrefix, filter->serverNamePrefixLength) == 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef TLS_FILTER_H
+#define TLS_FILTER_H
+
+#include "tls_parser.h"
+
+// Selects the messages worth extracting from what validate_tls_message reports, so that a
+// pipeline only pays for a full parse (and output) of the ones it is after:
+//
+//   MessageSummary summary;
+//   if (validate_tls_message(raw, size, &summary) == NO_ERROR && match_message_filter(&filter, &summary)) {
+//       parse_tls_message(raw, size, &parsed);
+//   }
+typedef struct {
+    uint64_t types[4];                // Bit n is set if HandshakeType n is kept, none set keeps every type
+    uint16_t minVersion;              // 0x0301 (TLS 1.0) - 0x0304 (TLS 1.3), 0 for no bound
+    uint16_t maxVersion;
+    const char *serverNamePrefix;     // Only ClientHellos with a server_name starting with it (ignoring case), NULL for any
+    size_t serverNamePrefixLength;
+} MessageFilter;
+
+void init_message_filter(MessageFilter *filter);
+void add_filter_type(MessageFilter *filter, uint8_t type);
+void set_filter_server_name(MessageFilter *filter, const char *prefix);
+int is_message_filter_empty(const MessageFilter *filter);
+int match_message_filter(const MessageFilter *filter, const MessageSummary *summary);
+
+#endif
@@ -0,0 +1,239 @@
+#include "tls_parser.h"
+#include "hash.h"
+
+// JA3 is the MD5 of "SSLVersion,Ciphers,Extensions,EllipticCurves,EllipticCurvePointFormats" and JA3S
+// of "SSLVersion,Cipher,Extensions", with the values of a field written in decimal and joined by '-'.
+// The string is never built as a whole, the digits of each value go straight into the MD5 context.
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define RAW_FIELD_SEPARATOR 0x10000 // Outside of the range of the 16 bit values
+
+typedef struct {
+    int variants;
+    int text;                 // Decimal digits are needed (MD5 or string output)
+    int firstField;
+    int firstValue;
+    Md5Context md5;
+    char *buf;                // Output of format_ja3(s)_string, NULL when only hashing
+    size_t size;
+    size_t length;            // Length of the whole string, even the part that didn't fit into buf
+    uint64_t raw;
+} Ja3Writer;
+
+int is_grease_value(uint16_t value) {
+    // RFC 8701: 0x0a0a, 0x1a1a, ..., 0xfafa
+    return (value & 0x0f0f) == 0x0a0a && (value >> 8) == (value & 0xff);
+}
+
+static void ja3_init(Ja3Writer *writer, int variants, char *buf, size_t size) {
+    writer->variants = variants;
+    writer->text = (variants & JA3_MD5) || buf != NULL;
+    writer->firstField = 1;
+    writer->firstValue = 1;
+    writer->buf = buf;
+    writer->size = size;
+    writer->length = 0;
+    writer->raw = FNV_OFFSET_BASIS;
+
+    if (variants & JA3_MD5) {
+        md5_init(&writer->md5);
+    }
+}
+
+static void ja3_write(Ja3Writer *writer, const char *text, size_t length) {
+    if (writer->variants & JA3_MD5) {
+        md5_update(&writer->md5, (const unsigned char *)text, length);
+    }
+
+    if (writer->buf != NULL && writer->length < writer->size) {
+        size_t available = writer->size - writer->length;
+        memcpy(writer->buf + writer->length, text, length < available ? length : available);
+    }
+
+    writer->length += length;
+}
+
+static void ja3_mix(Ja3Writer *writer, uint32_t value) {
+    writer->raw = (writer->raw ^ value) * FNV_PRIME;
+}
+
+static void ja3_field(Ja3Writer *writer) {
+    if (!writer->firstField && writer->text) {
+        ja3_write(writer, ",", 1);
+    }
+
+    writer->firstField = 0;
+    writer->firstValue = 1;
+    ja3_mix(writer, RAW_FIELD_SEPARATOR);
+}
+
+static void ja3_value(Ja3Writer *writer, uint16_t value) {
+    ja3_mix(writer, value);
+
+    if (!writer->text) {
+        return;
+    }
+
+    // '-' followed by at most 5 digits, written backwards
+    char digits[6];
+    int pos = sizeof(digits);
+
+    do {
+        digits[--pos] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    if (!writer->firstValue) {
+        digits[--pos] = '-';
+    }
+
+    writer->firstValue = 0;
+    ja3_write(writer, digits + pos, sizeof(digits) - pos);
+}
+
+static void ja3_uint16_values(Ja3Writer *writer, const unsigned char *data, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        uint16_t value = (data[2 * i] << 8) | data[2 * i + 1];
+
+        if (!is_grease_value(value)) {
+            ja3_value(writer, value);
+        }
+    }
+}
+
+static void ja3_extension_types(Ja3Writer *writer, uint8_t has_extensions, const ExtensionIndex *index) {
+    if (!has_extensions) {
+        return;
+    }
+
+    // Walk the (already validated) block instead of the entries, they stop at MAX_INDEXED_EXTENSIONS
+    uint16_t pos = 0;
+    while (pos + 4 <= index->length) {
+        uint16_t type = (index->data[pos] << 8) | index->data[pos + 1];
+        uint16_t length = (index->data[pos + 2] << 8) | index->data[pos + 3];
+
+        if (!is_grease_value(type)) {
+            ja3_value(writer, type);
+        }
+
+        pos += 4 + length;
+    }
+}
+
+static void ja3_finish(Ja3Writer *writer, Fingerprint *fingerprint) {
+    if (fingerprint == NULL) {
+        return;
+    }
+
+    if (writer->variants & JA3_MD5) {
+        md5_final(&writer->md5, fingerprint->md5);
+    }
+
+    if (writer->variants & JA3_RAW) {
+        // FNV alone leaves the high bits poorly mixed for short inputs
+        uint64_t h = writer->raw;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        fingerprint->raw = h;
+    }
+}
+
+static void ja3_client_hello(Ja3Writer *writer, const ClientHello *client_hello) {
+    ja3_field(writer);
+    ja3_value(writer, (client_hello->version.major << 8) | client_hello->version.minor);
+
+    ja3_field(writer);
+    ja3_uint16_values(writer, client_hello->csCollection.cipherSuites, client_hello->csCollection.length / 2);
+
+    // An SSLv2 compatible hello has no cipher suite list, its TLS suites are among the CipherSpecs
+    uint16_t pos = 0, suite;
+    while (client_hello->sslv2 && next_sslv2_cipher_suite(client_hello, &pos, &suite)) {
+        if (!is_grease_value(suite)) {
+            ja3_value(writer, suite);
+        }
+    }
+
+    ja3_field(writer);
+    ja3_extension_types(writer, client_hello->hasExtensions, &client_hello->extensionIndex);
+
+    // Missing or malformed groups/point formats leave the field empty
+    Uint16List groups;
+    ja3_field(writer);
+    if (client_hello->hasExtensions && get_supported_groups(&client_hello->extensionIndex, &groups) == NO_ERROR) {
+        ja3_uint16_values(writer, groups.data, groups.count);
+    }
+
+    const unsigned char *formats;
+    uint8_t count;
+    ja3_field(writer);
+    if (client_hello->hasExtensions && get_ec_point_formats(&client_hello->extensionIndex, &formats, &count) == NO_ERROR) {
+        for (uint8_t i = 0; i < count; i++) {
+            ja3_value(writer, formats[i]);
+        }
+    }
+}
+
+static void ja3_server_hello(Ja3Writer *writer, const ServerHello *server_hello) {
+    ja3_field(writer);
+    ja3_value(writer, (server_hello->version.major << 8) | server_hello->version.minor);
+
+    ja3_field(writer);
+    ja3_value(writer, (server_hello->cipherSuite[0] << 8) | server_hello->cipherSuite[1]);
+
+    ja3_field(writer);
+    ja3_extension_types(writer, server_hello->hasExtensions, &server_hello->extensionIndex);
+}
+
+void compute_ja3(const ClientHello *client_hello, int variants, Fingerprint *fingerprint) {
+    Ja3Writer writer;
+    ja3_init(&writer, variants, NULL, 0);
+    ja3_client_hello(&writer, client_hello);
+    ja3_finish(&writer, fingerprint);
+}
+
+void compute_ja3s(const ServerHello *server_hello, int variants, Fingerprint *fingerprint) {
+    Ja3Writer writer;
+    ja3_init(&writer, variants, NULL, 0);
+    ja3_server_hello(&writer, server_hello);
+    ja3_finish(&writer, fingerprint);
+}
+
+// Like snprintf: returns the length of the whole string, buf is always terminated if size > 0
+size_t format_ja3_string(const ClientHello *client_hello, char *buf, size_t size) {
+    Ja3Writer writer;
+    ja3_init(&writer, 0, buf, size);
+    ja3_client_hello(&writer, client_hello);
+
+    if (size > 0) {
+        buf[writer.length < size ? writer.length : size - 1] = '\0';
+    }
+
+    return writer.length;
+}
+
+size_t format_ja3s_string(const ServerHello *server_hello, char *buf, size_t size) {
+    Ja3Writer writer;
+    ja3_init(&writer, 0, buf, size);
+    ja3_server_hello(&writer, server_hello);
+
+    if (size > 0) {
+        buf[writer.length < size ? writer.length : size - 1] = '\0';
+    }
+
+    return writer.length;
+}
+
+void format_ja3_digest(const Fingerprint *fingerprint, char buf[JA3_DIGEST_HEX_SIZE]) {
+    static const char hex[] = "0123456789abcdef";
+
+    for (int i = 0; i < JA3_DIGEST_SIZE; i++) {
+        buf[2 * i] = hex[fingerprint->md5[i] >> 4];
+        buf[2 * i + 1] = hex[fingerprint->md5[i] & 0x0f];
+    }
+
+    buf[2 * JA3_DIGEST_SIZE] = '\0';
+}
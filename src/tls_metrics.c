@@ -0,0 +1,229 @@
+#include "tls_metrics.h"
+
+#ifdef TLS_PARSER_METRICS
+
+#include <ctype.h>
+#include <pthread.h>
+
+_Thread_local ThreadMetrics *thread_metrics;
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadMetrics *metrics_list;
+
+// Counted into when a thread's block can't be allocated, it's never exported
+static ThreadMetrics discarded_metrics;
+
+// Ticks and nanoseconds at the first registration, get_metric_tick_seconds measures the tick rate from there
+static uint64_t anchor_ticks;
+static uint64_t anchor_nanoseconds;
+
+static const char *const stage_names[METRIC_STAGES] = {
+    [METRIC_STAGE_RECORD] = "record",
+    [METRIC_STAGE_PARSE] = "parse",
+    [METRIC_STAGE_COPY] = "copy",
+    [METRIC_STAGE_OUTPUT] = "output",
+};
+
+static uint64_t monotonic_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+ThreadMetrics *register_thread_metrics(void) {
+    ThreadMetrics *metrics = (ThreadMetrics *)calloc(1, sizeof(ThreadMetrics));
+
+    if (metrics == NULL) {
+        thread_metrics = &discarded_metrics;
+
+        return thread_metrics;
+    }
+
+    pthread_mutex_lock(&metrics_lock);
+    if (metrics_list == NULL && anchor_nanoseconds == 0) {
+        anchor_ticks = metric_ticks();
+        anchor_nanoseconds = monotonic_nanoseconds();
+    }
+    metrics->next = metrics_list;
+    metrics_list = metrics;
+    pthread_mutex_unlock(&metrics_lock);
+
+    thread_metrics = metrics;
+
+    return metrics;
+}
+
+// The counters of other threads are read while they may be written (see add_metric), which can
+// only make the snapshot a little stale
+static uint64_t load_counter(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+void collect_metrics(MetricCounters *total) {
+    memset(total, 0, sizeof(MetricCounters));
+
+    pthread_mutex_lock(&metrics_lock);
+    for (const ThreadMetrics *metrics = metrics_list; metrics != NULL; metrics = metrics->next) {
+        const MetricCounters *counters = &metrics->counters;
+
+        total->records += load_counter(&counters->records);
+        total->bytes += load_counter(&counters->bytes);
+
+        for (int i = 0; i < 256; i++) {
+            total->messages[i] += load_counter(&counters->messages[i]);
+        }
+
+        for (int i = 0; i < NUMBER_OF_ERROR_CODES; i++) {
+            total->errors[i] += load_counter(&counters->errors[i]);
+        }
+
+        for (int stage = 0; stage < METRIC_STAGES; stage++) {
+            total->stages[stage].count += load_counter(&counters->stages[stage].count);
+            total->stages[stage].ticks += load_counter(&counters->stages[stage].ticks);
+
+            for (int i = 0; i < METRIC_BUCKETS; i++) {
+                total->stages[stage].buckets[i] += load_counter(&counters->stages[stage].buckets[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+double get_metric_tick_seconds(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    pthread_mutex_lock(&metrics_lock);
+    uint64_t ticks = metric_ticks() - anchor_ticks;
+    uint64_t nanoseconds = monotonic_nanoseconds() - anchor_nanoseconds;
+    pthread_mutex_unlock(&metrics_lock);
+
+    // Nothing was measured yet, or not long enough to tell the rate
+    if (anchor_nanoseconds == 0 || ticks == 0 || nanoseconds < 1000) {
+        return 1e-9;
+    }
+
+    return nanoseconds / 1e9 / ticks;
+#else
+    return 1e-9;
+#endif
+}
+
+// The error label is the name from get_error_name in lower case, so there is no second list to keep in sync
+static const char *get_error_label(int err, char *label, size_t size) {
+    const char *name = get_error_name(err);
+    size_t i;
+
+    for (i = 0; i + 1 < size && name[i] != '\0'; i++) {
+        label[i] = (char)tolower((unsigned char)name[i]);
+    }
+    label[i] = '\0';
+
+    return label;
+}
+
+const char *get_metric_stage_name(int stage) {
+    return stage >= 0 && stage < METRIC_STAGES ? stage_names[stage] : "unknown";
+}
+
+int append_metrics_prometheus(OutputBuffer *out) {
+    MetricCounters total;
+    double tick_seconds = get_metric_tick_seconds();
+    char label[64];
+    int result = 0;
+
+    collect_metrics(&total);
+
+    result |= append_formatted(out, "# HELP tls_parser_records_total Records handed to the parser.\n"
+                                    "# TYPE tls_parser_records_total counter\n"
+                                    "tls_parser_records_total %llu\n", (unsigned long long)total.records);
+    result |= append_formatted(out, "# HELP tls_parser_bytes_total Size of those records in bytes.\n"
+                                    "# TYPE tls_parser_bytes_total counter\n"
+                                    "tls_parser_bytes_total %llu\n", (unsigned long long)total.bytes);
+
+    result |= append_formatted(out, "# HELP tls_parser_messages_total Handshake messages by type.\n"
+                                    "# TYPE tls_parser_messages_total counter\n");
+    for (int type = 0; type < 256; type++) {
+        if (total.messages[type] > 0) {
+            result |= append_formatted(out, "tls_parser_messages_total{type=\"%d\",name=\"%s\"} %llu\n", type,
+                                       get_handshake_type_name(type), (unsigned long long)total.messages[type]);
+        }
+    }
+
+    result |= append_formatted(out, "# HELP tls_parser_errors_total Messages rejected, by error.\n"
+                                    "# TYPE tls_parser_errors_total counter\n");
+    for (int err = 1; err < NUMBER_OF_ERROR_CODES; err++) {
+        result |= append_formatted(out, "tls_parser_errors_total{error=\"%s\"} %llu\n", get_error_label(err, label, sizeof(label)),
+                                   (unsigned long long)total.errors[err]);
+    }
+
+    result |= append_formatted(out, "# HELP tls_parser_stage_seconds Time spent in each stage of parsing a message.\n"
+                                    "# TYPE tls_parser_stage_seconds histogram\n");
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        const MetricHistogram *histogram = &total.stages[stage];
+        uint64_t cumulative = 0;
+
+        // Buckets beyond the longest duration seen are left out, +Inf covers them
+        int last = METRIC_BUCKETS - 1;
+        while (last > 0 && histogram->buckets[last] == 0) {
+            last--;
+        }
+
+        for (int i = 0; i <= last; i++) {
+            cumulative += histogram->buckets[i];
+            result |= append_formatted(out, "tls_parser_stage_seconds_bucket{stage=\"%s\",le=\"%.3g\"} %llu\n", stage_names[stage],
+                                       (double)((uint64_t)1 << i) * tick_seconds, (unsigned long long)cumulative);
+        }
+
+        result |= append_formatted(out, "tls_parser_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                                        "tls_parser_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+                                        "tls_parser_stage_seconds_count{stage=\"%s\"} %llu\n",
+                                   stage_names[stage], (unsigned long long)histogram->count, stage_names[stage],
+                                   histogram->ticks * tick_seconds, stage_names[stage], (unsigned long long)histogram->count);
+    }
+
+    return result == 0 ? 0 : -1;
+}
+
+int append_metrics_json(OutputBuffer *out) {
+    MetricCounters total;
+    double tick_seconds = get_metric_tick_seconds();
+    char label[64];
+    int result = 0;
+    int first = 1;
+
+    collect_metrics(&total);
+
+    result |= append_formatted(out, "{\"records\":%llu,\"bytes\":%llu,\"tick_seconds\":%.6g,\"messages\":{",
+                               (unsigned long long)total.records, (unsigned long long)total.bytes, tick_seconds);
+    for (int type = 0; type < 256; type++) {
+        if (total.messages[type] > 0) {
+            result |= append_formatted(out, "%s\"%d\":%llu", first ? "" : ",", type, (unsigned long long)total.messages[type]);
+            first = 0;
+        }
+    }
+
+    result |= append_output(out, "},\"errors\":{", 12);
+    for (int err = 1; err < NUMBER_OF_ERROR_CODES; err++) {
+        result |= append_formatted(out, "%s\"%s\":%llu", err == 1 ? "" : ",", get_error_label(err, label, sizeof(label)),
+                                   (unsigned long long)total.errors[err]);
+    }
+
+    // Buckets as in tls_metrics.h: the count of durations below 2^n ticks, not cumulative
+    result |= append_output(out, "},\"stages\":{", 12);
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        const MetricHistogram *histogram = &total.stages[stage];
+
+        result |= append_formatted(out, "%s\"%s\":{\"count\":%llu,\"seconds\":%.9f,\"buckets\":[", stage == 0 ? "" : ",",
+                                   stage_names[stage], (unsigned long long)histogram->count, histogram->ticks * tick_seconds);
+        for (int i = 0; i < METRIC_BUCKETS; i++) {
+            result |= append_formatted(out, "%s%llu", i == 0 ? "" : ",", (unsigned long long)histogram->buckets[i]);
+        }
+        result |= append_output(out, "]}", 2);
+    }
+
+    result |= append_output(out, "}}\n", 3);
+
+    return result == 0 ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef TLS_METRICS_H
+#define TLS_METRICS_H
+
+#include "tls_parser.h"
+
+// Built-in counters and per stage timings, compiled in with -DTLS_PARSER_METRICS (make METRICS=1).
+// Without it the METRIC_* macros expand to nothing and the parser has no trace of them.
+
+#ifdef TLS_PARSER_METRICS
+
+#include "tls_output.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define METRIC_BUCKETS 40 // Power of two buckets of the clock ticks spent in a stage
+
+typedef enum {
+    METRIC_STAGE_RECORD = 0,  // Record and handshake header (initialize_tls_structure, next_stream_message)
+    METRIC_STAGE_PARSE = 1,   // Message body (parse_handshake_body)
+    METRIC_STAGE_COPY = 2,    // copy_parsed_message
+    METRIC_STAGE_OUTPUT = 3,  // Formatting and writing the result, timed by the caller
+    METRIC_STAGES = 4,
+} MetricStage;
+
+typedef struct {
+    uint64_t count;
+    uint64_t ticks;
+    uint64_t buckets[METRIC_BUCKETS]; // Bucket n counts the durations of less than 2^n ticks (and not less than 2^(n-1))
+} MetricHistogram;
+
+typedef struct {
+    uint64_t records;                    // Records handed to initialize_tls_structure or read by a RecordStream
+    uint64_t bytes;                      // Size of those records
+    uint64_t messages[256];              // Handshake messages by HandshakeType, whether they parsed or not
+    uint64_t errors[NUMBER_OF_ERROR_CODES];
+    MetricHistogram stages[METRIC_STAGES];
+} MetricCounters;
+
+// Every thread counts into its own block, so counting needs no locked instruction. The blocks are
+// linked into a global list and kept after their thread exits, collect_metrics sums all of them.
+typedef struct ThreadMetrics {
+    struct ThreadMetrics *next;
+    MetricCounters counters;
+} ThreadMetrics;
+
+extern _Thread_local ThreadMetrics *thread_metrics;
+
+ThreadMetrics *register_thread_metrics(void);
+
+static inline MetricCounters *get_thread_metrics(void) {
+    ThreadMetrics *metrics = thread_metrics;
+
+    return metrics != NULL ? &metrics->counters : &register_thread_metrics()->counters;
+}
+
+// rdtsc where available, converted to seconds on export (get_metric_tick_seconds)
+static inline uint64_t metric_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+// Only the owning thread writes a counter, while collect_metrics may read it from another thread.
+// Relaxed atomic loads and stores make that well defined and still compile to plain moves, unlike
+// an atomic read-modify-write.
+static inline void add_metric(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline void record_metric_stage(int stage, uint64_t start) {
+    MetricHistogram *histogram = &get_thread_metrics()->stages[stage];
+    uint64_t ticks = metric_ticks() - start;
+    int bucket = ticks > 0 ? 64 - __builtin_clzll(ticks) : 0;
+
+    add_metric(&histogram->count, 1);
+    add_metric(&histogram->ticks, ticks);
+    add_metric(&histogram->buckets[bucket < METRIC_BUCKETS ? bucket : METRIC_BUCKETS - 1], 1);
+}
+
+static inline void record_metric_error(int err) {
+    if (err > 0 && err < NUMBER_OF_ERROR_CODES) {
+        add_metric(&get_thread_metrics()->errors[err], 1);
+    }
+}
+
+static inline void record_metric_record(uint64_t size) {
+    MetricCounters *counters = get_thread_metrics();
+
+    add_metric(&counters->records, 1);
+    add_metric(&counters->bytes, size);
+}
+
+#define METRIC_START(name) uint64_t name = metric_ticks()
+#define METRIC_STOP(stage, name) record_metric_stage(stage, name)
+#define METRIC_RECORD(size) record_metric_record(size)
+#define METRIC_MESSAGE(type) add_metric(&get_thread_metrics()->messages[(uint8_t)(type)], 1)
+#define METRIC_ERROR(err) record_metric_error(err)
+
+void collect_metrics(MetricCounters *total);
+double get_metric_tick_seconds(void);
+const char *get_metric_stage_name(int stage);
+
+// Prometheus text exposition format, or a single JSON object
+int append_metrics_prometheus(OutputBuffer *out);
+int append_metrics_json(OutputBuffer *out);
+
+#else
+
+#define METRIC_START(name)
+#define METRIC_STOP(stage, name)
+#define METRIC_RECORD(size)
+#define METRIC_MESSAGE(type)
+#define METRIC_ERROR(err)
+
+#endif
+
+#endif
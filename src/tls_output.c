@@ -0,0 +1,794 @@
+#include "tls_output.h"
+
+#include <stdarg.h>
+
+// Two characters per byte value, so encoding a byte is a single 2 byte copy
+#define HEX_ROW(h) h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7" h "8" h "9" h "a" h "b" h "c" h "d" h "e" h "f"
+
+static const char hex_pairs[513] =
+    HEX_ROW("0") HEX_ROW("1") HEX_ROW("2") HEX_ROW("3") HEX_ROW("4") HEX_ROW("5") HEX_ROW("6") HEX_ROW("7")
+    HEX_ROW("8") HEX_ROW("9") HEX_ROW("a") HEX_ROW("b") HEX_ROW("c") HEX_ROW("d") HEX_ROW("e") HEX_ROW("f");
+
+int init_output_buffer(OutputBuffer *out, size_t capacity) {
+    out->length = 0;
+    out->capacity = capacity > 0 ? capacity : DEFAULT_OUTPUT_CAPACITY;
+    out->data = (char *)malloc(out->capacity);
+
+    if (out->data == NULL) {
+        out->capacity = 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void free_output_buffer(OutputBuffer *out) {
+    free(out->data);
+
+    out->data = NULL;
+    out->length = 0;
+    out->capacity = 0;
+}
+
+void reset_output_buffer(OutputBuffer *out) {
+    out->length = 0;
+}
+
+int reserve_output_buffer(OutputBuffer *out, size_t length) {
+    if (out->capacity - out->length >= length) {
+        return 0;
+    }
+
+    size_t capacity = out->capacity > 0 ? out->capacity : DEFAULT_OUTPUT_CAPACITY;
+    while (capacity - out->length < length) {
+        capacity *= 2;
+    }
+
+    char *data = (char *)realloc(out->data, capacity);
+    if (data == NULL) {
+        return -1;
+    }
+
+    out->data = data;
+    out->capacity = capacity;
+
+    return 0;
+}
+
+int append_output(OutputBuffer *out, const void *data, size_t length) {
+    if (reserve_output_buffer(out, length) != 0) {
+        return -1;
+    }
+
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+
+    return 0;
+}
+
+void format_hex(const unsigned char *data, size_t length, char *hex) {
+    for (size_t i = 0; i < length; i++) {
+        memcpy(hex + 2 * i, hex_pairs + 2 * data[i], 2);
+    }
+}
+
+int append_hex(OutputBuffer *out, const unsigned char *data, size_t length) {
+    if (reserve_output_buffer(out, 2 * length) != 0) {
+        return -1;
+    }
+
+    format_hex(data, length, out->data + out->length);
+    out->length += 2 * length;
+
+    return 0;
+}
+
+// printf style, for the lines that aren't on a hot path. A single formatted piece is limited to 256 bytes.
+int append_formatted(OutputBuffer *out, const char *format, ...) {
+    char line[256];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length < 0 || (size_t)length >= sizeof(line)) {
+        return -1;
+    }
+
+    return append_output(out, line, length);
+}
+
+// The helpers below assume that enough space was reserved up front, so that a message only
+// checks the buffer size once for its fixed part and once for each variable length field
+
+static void put_text(OutputBuffer *out, const char *text) {
+    size_t length = strlen(text);
+
+    memcpy(out->data + out->length, text, length);
+    out->length += length;
+}
+
+static void put_unsigned(OutputBuffer *out, unsigned long value) {
+    char digits[20];
+    int pos = sizeof(digits);
+
+    do {
+        digits[--pos] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    memcpy(out->data + out->length, digits + pos, sizeof(digits) - pos);
+    out->length += sizeof(digits) - pos;
+}
+
+static void put_hex16(OutputBuffer *out, uint16_t value) {
+    char *p = out->data + out->length;
+
+    p[0] = '"';
+    p[1] = '0';
+    p[2] = 'x';
+    memcpy(p + 3, hex_pairs + 2 * (value >> 8), 2);
+    memcpy(p + 5, hex_pairs + 2 * (value & 0xff), 2);
+    p[7] = '"';
+    out->length += 8;
+}
+
+// JSON string with quotes, bytes above 0x7f are passed through unchanged
+static int put_json_string(OutputBuffer *out, const unsigned char *text, size_t length) {
+    if (reserve_output_buffer(out, 6 * length + 2) != 0) {
+        return -1;
+    }
+
+    char *p = out->data + out->length;
+    *p++ = '"';
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = text[i];
+
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c < 0x20 || c == 0x7f) {
+            memcpy(p, "\\u00", 4);
+            memcpy(p + 4, hex_pairs + 2 * c, 2);
+            p += 6;
+        } else {
+            *p++ = c;
+        }
+    }
+
+    *p++ = '"';
+    out->length = p - out->data;
+
+    return 0;
+}
+
+int append_json_string(OutputBuffer *out, const unsigned char *text, size_t length) {
+    return put_json_string(out, text, length);
+}
+
+static int put_json_hex(OutputBuffer *out, const unsigned char *data, size_t length) {
+    if (reserve_output_buffer(out, 2 * length + 2) != 0) {
+        return -1;
+    }
+
+    out->data[out->length++] = '"';
+    format_hex(data, length, out->data + out->length);
+    out->length += 2 * length;
+    out->data[out->length++] = '"';
+
+    return 0;
+}
+
+static int put_json_uint16_list(OutputBuffer *out, const unsigned char *data, size_t count) {
+    if (reserve_output_buffer(out, 9 * count + 2) != 0) {
+        return -1;
+    }
+
+    out->data[out->length++] = '[';
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            out->data[out->length++] = ',';
+        }
+
+        put_hex16(out, (data[2 * i] << 8) | data[2 * i + 1]);
+    }
+    out->data[out->length++] = ']';
+
+    return 0;
+}
+
+// The TLS cipher suites of an SSLv2 compatible hello, followed by all of its 3 bytes CipherSpecs
+static int put_json_sslv2_cipher_specs(OutputBuffer *out, const ClientHello *hello) {
+    size_t count = hello->cipherSpecsLength / SSLV2_CIPHER_SPEC_SIZE;
+    uint16_t pos = 0, suite;
+
+    if (reserve_output_buffer(out, 40 + 20 * count) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"cipher_suites\":[");
+    for (int first = 1; next_sslv2_cipher_suite(hello, &pos, &suite); first = 0) {
+        if (!first) {
+            out->data[out->length++] = ',';
+        }
+
+        put_hex16(out, suite);
+    }
+
+    put_text(out, "],\"cipher_specs\":[");
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            out->data[out->length++] = ',';
+        }
+
+        put_text(out, "\"0x");
+        format_hex(hello->cipherSpecs + SSLV2_CIPHER_SPEC_SIZE * i, SSLV2_CIPHER_SPEC_SIZE, out->data + out->length);
+        out->length += 2 * SSLV2_CIPHER_SPEC_SIZE;
+        out->data[out->length++] = '"';
+    }
+    out->data[out->length++] = ']';
+
+    return 0;
+}
+
+static int put_json_cipher_suite_classes(OutputBuffer *out, const ClientHello *hello) {
+    uint32_t classes = classify_client_hello_cipher_suites(hello);
+
+    if (reserve_output_buffer(out, 128) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"cipher_suite_classes\":[");
+    for (int i = 0, first = 1; i < CIPHER_SUITE_CLASSES; i++) {
+        if (classes & (1u << i)) {
+            put_text(out, first ? "\"" : ",\"");
+            put_text(out, get_cipher_suite_class_name(1u << i));
+            out->data[out->length++] = '"';
+            first = 0;
+        }
+    }
+    out->data[out->length++] = ']';
+
+    return 0;
+}
+
+static int put_json_extensions(OutputBuffer *out, const ExtensionIndex *index) {
+    const unsigned char *name;
+    uint16_t length;
+    ProtocolNameList protocols;
+    KeyShareList shares;
+
+    // "extensions":[...] with up to 5 digits and a comma per type
+    if (reserve_output_buffer(out, 16 + 6 * index->count) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"extensions\":[");
+    for (int i = 0; i < index->count; i++) {
+        if (i > 0) {
+            out->data[out->length++] = ',';
+        }
+
+        put_unsigned(out, index->entries[i].type);
+    }
+    out->data[out->length++] = ']';
+
+    if (get_server_name(index, &name, &length) == NO_ERROR) {
+        if (append_output(out, ",\"server_name\":", 15) != 0 || put_json_string(out, name, length) != 0) {
+            return -1;
+        }
+    }
+
+    if (get_alpn_protocols(index, &protocols) == NO_ERROR) {
+        if (append_output(out, ",\"alpn\":[", 9) != 0) {
+            return -1;
+        }
+
+        for (int i = 0; i < protocols.count; i++) {
+            if ((i > 0 && append_output(out, ",", 1) != 0) ||
+                put_json_string(out, protocols.names[i].name, protocols.names[i].length) != 0) {
+                return -1;
+            }
+        }
+
+        if (append_output(out, "]", 1) != 0) {
+            return -1;
+        }
+    }
+
+    // [{"group":n,"length":n},...], a HelloRetryRequest names the group only
+    if (get_key_shares(index, &shares) == NO_ERROR) {
+        if (reserve_output_buffer(out, 16 + 32 * shares.count) != 0) {
+            return -1;
+        }
+
+        put_text(out, ",\"key_shares\":[");
+        for (int i = 0; i < shares.count; i++) {
+            put_text(out, i > 0 ? ",{\"group\":" : "{\"group\":");
+            put_unsigned(out, shares.entries[i].group);
+
+            if (shares.entries[i].keyExchange != NULL) {
+                put_text(out, ",\"length\":");
+                put_unsigned(out, shares.entries[i].length);
+            }
+
+            out->data[out->length++] = '}';
+        }
+        out->data[out->length++] = ']';
+    }
+
+    return 0;
+}
+
+static int put_json_fingerprint(OutputBuffer *out, const char *name, const Fingerprint *fingerprint) {
+    char digest[JA3_DIGEST_HEX_SIZE];
+    unsigned char raw[8];
+
+    if (reserve_output_buffer(out, 80) != 0) {
+        return -1;
+    }
+
+    format_ja3_digest(fingerprint, digest);
+    for (int i = 0; i < 8; i++) {
+        raw[i] = (unsigned char)(fingerprint->raw >> (56 - 8 * i));
+    }
+
+    put_text(out, ",\"");
+    put_text(out, name);
+    put_text(out, "\":\"");
+    put_text(out, digest);
+    put_text(out, "\",\"");
+    put_text(out, name);
+    put_text(out, "_raw\":\"");
+    format_hex(raw, sizeof(raw), out->data + out->length);
+    out->length += 2 * sizeof(raw);
+    out->data[out->length++] = '"';
+
+    return 0;
+}
+
+static int put_json_client_hello(OutputBuffer *out, const ClientHello *hello, int flags) {
+    if (reserve_output_buffer(out, 64) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"version\":");
+    put_hex16(out, (hello->version.major << 8) | hello->version.minor);
+
+    if (hello->maxVersion.minor != hello->version.minor) {
+        put_text(out, ",\"max_version\":");
+        put_hex16(out, (hello->maxVersion.major << 8) | hello->maxVersion.minor);
+    }
+
+    if (hello->sslv2) {
+        put_text(out, ",\"sslv2\":true");
+
+        if (append_output(out, ",\"challenge\":", 13) != 0 ||
+            put_json_hex(out, hello->challenge, hello->challengeLength) != 0 ||
+            append_output(out, ",\"session_id\":", 14) != 0 ||
+            put_json_hex(out, hello->sessionId.sessionId, hello->sessionId.length) != 0 ||
+            put_json_sslv2_cipher_specs(out, hello) != 0 ||
+            put_json_cipher_suite_classes(out, hello) != 0) {
+            return -1;
+        }
+
+        if (flags & OUTPUT_FINGERPRINTS) {
+            Fingerprint fingerprint;
+            compute_ja3(hello, JA3_MD5 | JA3_RAW, &fingerprint);
+
+            return put_json_fingerprint(out, "ja3", &fingerprint);
+        }
+
+        return 0;
+    }
+
+    put_text(out, ",\"random\":");
+
+    // The random is 32 bytes on the wire, the first 4 of which were decoded into random.time
+    unsigned char time[4] = {
+        (unsigned char)(hello->random.time >> 24), (unsigned char)(hello->random.time >> 16),
+        (unsigned char)(hello->random.time >> 8), (unsigned char)hello->random.time
+    };
+
+    if (reserve_output_buffer(out, 2 * (4 + HELLO_RANDOM_BYTES_SIZE) + 2) != 0) {
+        return -1;
+    }
+
+    out->data[out->length++] = '"';
+    format_hex(time, sizeof(time), out->data + out->length);
+    out->length += 2 * sizeof(time);
+    format_hex(hello->random.random_bytes, HELLO_RANDOM_BYTES_SIZE, out->data + out->length);
+    out->length += 2 * HELLO_RANDOM_BYTES_SIZE;
+    out->data[out->length++] = '"';
+
+    if (append_output(out, ",\"session_id\":", 14) != 0 ||
+        put_json_hex(out, hello->sessionId.sessionId, hello->sessionId.length) != 0 ||
+        append_output(out, ",\"cipher_suites\":", 17) != 0 ||
+        put_json_uint16_list(out, hello->csCollection.cipherSuites, hello->csCollection.length / 2) != 0 ||
+        put_json_cipher_suite_classes(out, hello) != 0 ||
+        reserve_output_buffer(out, 64) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"compression\":");
+    put_unsigned(out, hello->compresionMethod.compresionMethod);
+
+    if (hello->hasExtensions) {
+        if (put_json_extensions(out, &hello->extensionIndex) != 0 ||
+            append_output(out, ",\"extensions_data\":", 19) != 0 ||
+            put_json_hex(out, hello->extensionIndex.data, hello->extensionIndex.length) != 0) {
+            return -1;
+        }
+    }
+
+    if (flags & OUTPUT_FINGERPRINTS) {
+        Fingerprint fingerprint;
+        compute_ja3(hello, JA3_MD5 | JA3_RAW, &fingerprint);
+
+        return put_json_fingerprint(out, "ja3", &fingerprint);
+    }
+
+    return 0;
+}
+
+static int put_json_server_hello(OutputBuffer *out, const ServerHello *hello, int flags) {
+    unsigned char time[4] = {
+        (unsigned char)(hello->random.time >> 24), (unsigned char)(hello->random.time >> 16),
+        (unsigned char)(hello->random.time >> 8), (unsigned char)hello->random.time
+    };
+
+    if (reserve_output_buffer(out, 2 * (4 + HELLO_RANDOM_BYTES_SIZE) + 128) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"version\":");
+    put_hex16(out, (hello->version.major << 8) | hello->version.minor);
+
+    if (hello->selectedVersion.minor != hello->version.minor) {
+        put_text(out, ",\"selected_version\":");
+        put_hex16(out, (hello->selectedVersion.major << 8) | hello->selectedVersion.minor);
+    }
+
+    if (hello->helloRetryRequest) {
+        put_text(out, ",\"hello_retry_request\":true");
+    }
+
+    put_text(out, ",\"random\":\"");
+    format_hex(time, sizeof(time), out->data + out->length);
+    out->length += 2 * sizeof(time);
+    format_hex(hello->random.random_bytes, HELLO_RANDOM_BYTES_SIZE, out->data + out->length);
+    out->length += 2 * HELLO_RANDOM_BYTES_SIZE;
+    out->data[out->length++] = '"';
+
+    if (append_output(out, ",\"session_id\":", 14) != 0 ||
+        put_json_hex(out, hello->sessionId.sessionId, hello->sessionId.length) != 0 ||
+        reserve_output_buffer(out, 64) != 0) {
+        return -1;
+    }
+
+    put_text(out, ",\"cipher_suite\":");
+    put_hex16(out, (hello->cipherSuite[0] << 8) | hello->cipherSuite[1]);
+    put_text(out, ",\"compression\":");
+    put_unsigned(out, hello->compresionMethod);
+
+    if (hello->hasExtensions) {
+        if (put_json_extensions(out, &hello->extensionIndex) != 0 ||
+            append_output(out, ",\"extensions_data\":", 19) != 0 ||
+            put_json_hex(out, hello->extensionIndex.data, hello->extensionIndex.length) != 0) {
+            return -1;
+        }
+    }
+
+    if (flags & OUTPUT_FINGERPRINTS) {
+        Fingerprint fingerprint;
+        compute_ja3s(hello, JA3_MD5 | JA3_RAW, &fingerprint);
+
+        return put_json_fingerprint(out, "ja3s", &fingerprint);
+    }
+
+    return 0;
+}
+
+// One line per message. On failure nothing of the message is left in the buffer.
+int append_json_message(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err, int flags) {
+    const HandshakeMessage *handshake = &parsed->handshake;
+    size_t start = out->length;
+    int result = -1;
+
+    if (append_output(out, "{\"source\":", 10) != 0 ||
+        put_json_string(out, (const unsigned char *)source, strlen(source)) != 0 ||
+        reserve_output_buffer(out, 256) != 0) {
+        goto done;
+    }
+
+    if (index > 0) {
+        put_text(out, ",\"index\":");
+        put_unsigned(out, index);
+    }
+
+    put_text(out, ",\"status\":");
+    put_text(out, err ? "\"error\",\"error\":\"" : "\"ok\"");
+    if (err) {
+        put_text(out, get_error_name(err));
+        out->data[out->length++] = '"';
+    }
+
+    put_text(out, ",\"content_type\":");
+    put_unsigned(out, handshake->cType);
+    put_text(out, ",\"record_version\":");
+    put_hex16(out, (handshake->version.major << 8) | handshake->version.minor);
+
+    // Without a body the handshake header wasn't (completely) parsed
+    if (handshake->body != NULL) {
+        put_text(out, ",\"type\":\"");
+        put_text(out, get_handshake_type_name(handshake->hsType));
+        put_text(out, "\",\"length\":");
+        put_unsigned(out, handshake->mLength);
+    }
+
+    if (handshake->fragments > 0) {
+        put_text(out, ",\"fragments\":");
+        put_unsigned(out, handshake->fragments);
+    }
+
+    if (!err && handshake->hsType == CLIENT_HELLO) {
+        if (put_json_client_hello(out, &parsed->clientHello, flags) != 0) {
+            goto done;
+        }
+    } else if (!err && handshake->hsType == SERVER_HELLO) {
+        if (put_json_server_hello(out, &parsed->serverHello, flags) != 0) {
+            goto done;
+        }
+    }
+
+    result = append_output(out, "}\n", 2);
+
+done:
+    if (result != 0) {
+        out->length = start;
+    }
+
+    return result;
+}
+
+static void put_be(OutputBuffer *out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out->data[out->length++] = (char)(value >> (8 * i));
+    }
+}
+
+static void put_bytes(OutputBuffer *out, const unsigned char *data, size_t length) {
+    // An empty session id has no data pointer
+    if (length == 0) {
+        return;
+    }
+
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+// An SSLv2 compatible hello is written as the TLS ClientHello it stands for (RFC 5246 appendix E.2):
+// the challenge right aligned in a zero padded random and only the specs that are TLS cipher suites
+static size_t count_sslv2_cipher_suites(const ClientHello *hello) {
+    uint16_t pos = 0, suite;
+    size_t count = 0;
+
+    while (next_sslv2_cipher_suite(hello, &pos, &suite)) {
+        count++;
+    }
+
+    return count;
+}
+
+static void put_sslv2_random_and_suites(OutputBuffer *out, const ClientHello *hello, size_t suites) {
+    uint16_t pos = 0, suite;
+
+    memset(out->data + out->length, 0, 32 - hello->challengeLength);
+    out->length += 32 - hello->challengeLength;
+    put_bytes(out, hello->challenge, hello->challengeLength);
+    put_be(out, hello->sessionId.length, 1);
+    put_bytes(out, hello->sessionId.sessionId, hello->sessionId.length);
+    put_be(out, 2 * suites, 2);
+
+    while (next_sslv2_cipher_suite(hello, &pos, &suite)) {
+        put_be(out, suite, 2);
+    }
+}
+
+int append_binary_message(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err) {
+    const HandshakeMessage *handshake = &parsed->handshake;
+    size_t source_length = strlen(source);
+    size_t body = 0;
+    size_t sslv2_suites = 0;
+
+    if (source_length > 0xffff) {
+        source_length = 0xffff;
+    }
+
+    // Everything is sized up front, so the record is written with a single reservation
+    if (!err && handshake->hsType == CLIENT_HELLO) {
+        const ClientHello *hello = &parsed->clientHello;
+        if (hello->sslv2) {
+            sslv2_suites = count_sslv2_cipher_suites(hello);
+        }
+
+        body = 2 + 32 + 1 + hello->sessionId.length + 2 + hello->csCollection.length + 2 * sslv2_suites + 1 + 1 + 2 +
+               (hello->hasExtensions ? hello->extensionIndex.length : 0);
+    } else if (!err && handshake->hsType == SERVER_HELLO) {
+        const ServerHello *hello = &parsed->serverHello;
+        body = 2 + 32 + 1 + hello->sessionId.length + 2 + 1 + 2 +
+               (hello->hasExtensions ? hello->extensionIndex.length : 0);
+    }
+
+    size_t length = 1 + 1 + 1 + 2 + 1 + 4 + 8 + 2 + source_length + body;
+    if (reserve_output_buffer(out, 4 + length) != 0) {
+        return -1;
+    }
+
+    put_be(out, length, 4);
+    put_be(out, BINARY_RECORD_VERSION, 1);
+    put_be(out, (uint64_t)err, 1);
+    put_be(out, handshake->cType, 1);
+    put_be(out, handshake->version.major, 1);
+    put_be(out, handshake->version.minor, 1);
+    put_be(out, handshake->body != NULL ? handshake->hsType : 0, 1);
+    put_be(out, handshake->body != NULL ? handshake->mLength : 0, 4);
+    put_be(out, index, 8);
+    put_be(out, source_length, 2);
+    put_bytes(out, (const unsigned char *)source, source_length);
+
+    if (!err && handshake->hsType == CLIENT_HELLO) {
+        const ClientHello *hello = &parsed->clientHello;
+
+        put_be(out, (hello->version.major << 8) | hello->version.minor, 2);
+        if (hello->sslv2) {
+            put_sslv2_random_and_suites(out, hello, sslv2_suites);
+        } else {
+            put_be(out, hello->random.time, 4);
+            put_bytes(out, hello->random.random_bytes, HELLO_RANDOM_BYTES_SIZE);
+            put_be(out, hello->sessionId.length, 1);
+            put_bytes(out, hello->sessionId.sessionId, hello->sessionId.length);
+            put_be(out, hello->csCollection.length, 2);
+            put_bytes(out, hello->csCollection.cipherSuites, hello->csCollection.length);
+        }
+        put_be(out, 1, 1);
+        put_be(out, hello->compresionMethod.compresionMethod, 1);
+        put_be(out, hello->hasExtensions ? hello->extensionIndex.length : 0, 2);
+        if (hello->hasExtensions) {
+            put_bytes(out, hello->extensionIndex.data, hello->extensionIndex.length);
+        }
+    } else if (!err && handshake->hsType == SERVER_HELLO) {
+        const ServerHello *hello = &parsed->serverHello;
+
+        put_be(out, (hello->version.major << 8) | hello->version.minor, 2);
+        put_be(out, hello->random.time, 4);
+        put_bytes(out, hello->random.random_bytes, HELLO_RANDOM_BYTES_SIZE);
+        put_be(out, hello->sessionId.length, 1);
+        put_bytes(out, hello->sessionId.sessionId, hello->sessionId.length);
+        put_bytes(out, hello->cipherSuite, 2);
+        put_be(out, hello->compresionMethod, 1);
+        put_be(out, hello->hasExtensions ? hello->extensionIndex.length : 0, 2);
+        if (hello->hasExtensions) {
+            put_bytes(out, hello->extensionIndex.data, hello->extensionIndex.length);
+        }
+    }
+
+    return 0;
+}
+
+// One line per reported handshake, the offsets of the stages that were seen are in microseconds
+int append_json_session(OutputBuffer *out, const char *source, const HandshakeSession *session) {
+    size_t start = out->length;
+
+    if (append_output(out, "{\"session\":", 11) != 0 ||
+        put_json_string(out, (const unsigned char *)source, strlen(source)) != 0 ||
+        reserve_output_buffer(out, 256 + HS_STAGES * 40) != 0) {
+        out->length = start;
+
+        return -1;
+    }
+
+    put_text(out, ",\"outcome\":\"");
+    put_text(out, get_session_outcome_name(session->outcome));
+    put_text(out, "\",\"state\":\"");
+    put_text(out, get_handshake_state_name(session->state));
+    put_text(out, "\",\"messages\":");
+    put_unsigned(out, session->messages);
+
+    if (session->partial) {
+        put_text(out, ",\"partial\":true");
+    }
+
+    if (session->error != NO_ERROR) {
+        put_text(out, ",\"error\":\"");
+        put_text(out, get_error_name(session->error));
+        out->data[out->length++] = '"';
+    }
+
+    if (session->offsets[HS_STATE_SERVER_HELLO] != SESSION_NOT_SEEN) {
+        put_text(out, ",\"version\":");
+        put_hex16(out, (session->version.major << 8) | session->version.minor);
+        put_text(out, ",\"cipher_suite\":");
+        put_hex16(out, session->cipherSuite);
+        put_text(out, ",\"cipher_suite_offered\":");
+        put_text(out, session->cipherSuiteOffered < 0 ? "null" : session->cipherSuiteOffered ? "true" : "false");
+    }
+
+    put_text(out, ",\"offsets\":{");
+    int first = 1;
+    for (int i = HS_STATE_CLIENT_HELLO; i < HS_STAGES; i++) {
+        if (session->offsets[i] == SESSION_NOT_SEEN) {
+            continue;
+        }
+
+        put_text(out, first ? "\"" : ",\"");
+        put_text(out, get_handshake_state_name(i));
+        put_text(out, "\":");
+        put_unsigned(out, session->offsets[i]);
+        first = 0;
+    }
+
+    put_text(out, "}}\n");
+
+    return 0;
+}
+
+// One line per certificate of a chain, position is the index within the chain (0 is the leaf)
+int append_json_certificate(OutputBuffer *out, const char *source, unsigned long index, int position, const CertificateSummary *summary) {
+    size_t start = out->length;
+    char time[32];
+
+    if (append_output(out, "{\"source\":", 10) != 0 ||
+        put_json_string(out, (const unsigned char *)source, strlen(source)) != 0 ||
+        reserve_output_buffer(out, 128 + 2 * CERTIFICATE_FINGERPRINT_SIZE) != 0) {
+        goto fail;
+    }
+
+    if (index > 0) {
+        put_text(out, ",\"index\":");
+        put_unsigned(out, index);
+    }
+
+    put_text(out, ",\"certificate\":");
+    put_unsigned(out, position);
+    put_text(out, ",\"sha256\":\"");
+    format_hex(summary->fingerprint, CERTIFICATE_FINGERPRINT_SIZE, out->data + out->length);
+    out->length += 2 * CERTIFICATE_FINGERPRINT_SIZE;
+    out->data[out->length++] = '"';
+
+    if (summary->error != NO_ERROR) {
+        put_text(out, ",\"error\":\"");
+        put_text(out, get_error_name(summary->error));
+        put_text(out, "\"}\n");
+
+        return 0;
+    }
+
+    if (append_output(out, ",\"subject\":", 11) != 0 ||
+        put_json_string(out, (const unsigned char *)summary->subject, strlen(summary->subject)) != 0 ||
+        append_output(out, ",\"issuer\":", 10) != 0 ||
+        put_json_string(out, (const unsigned char *)summary->issuer, strlen(summary->issuer)) != 0 ||
+        append_output(out, ",\"alt_names\":", 13) != 0 ||
+        put_json_string(out, (const unsigned char *)summary->altNames, strlen(summary->altNames)) != 0 ||
+        reserve_output_buffer(out, 96) != 0) {
+        goto fail;
+    }
+
+    format_x509_time(summary->notBefore, time, sizeof(time));
+    put_text(out, ",\"not_before\":\"");
+    put_text(out, time);
+    format_x509_time(summary->notAfter, time, sizeof(time));
+    put_text(out, "\",\"not_after\":\"");
+    put_text(out, time);
+    put_text(out, "\"}\n");
+
+    return 0;
+
+fail:
+    out->length = start;
+
+    return -1;
+}
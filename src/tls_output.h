@@ -0,0 +1,55 @@
+#ifndef TLS_OUTPUT_H
+#define TLS_OUTPUT_H
+
+#include "tls_parser.h"
+#include "tls_session.h"
+#include "tls_x509.h"
+
+#define DEFAULT_OUTPUT_CAPACITY 65536
+#define BINARY_RECORD_VERSION 1
+
+// Flags of append_json_message/append_binary_message
+#define OUTPUT_FINGERPRINTS 1 // Add JA3/JA3S to hello messages
+
+// Growable buffer the formatted messages are appended to. It's meant to be reused, the caller
+// writes data[0..length) out in one go and calls reset_output_buffer.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+// Binary records are big endian and length prefixed, so a reader can skip what it doesn't know:
+//
+//   uint32  length of everything below
+//   uint8   BINARY_RECORD_VERSION
+//   uint8   error code (NO_ERROR if the message was parsed)
+//   uint8   content type
+//   uint8   record version major, minor (2 bytes)
+//   uint8   handshake type
+//   uint32  message length
+//   uint64  index (0 if not known)
+//   uint16  source length, source
+//   ClientHello: version (2), random (32), session id length (1) + id, cipher suites length (2)
+//                + suites, compression methods length (1) + methods, extensions length (2) + data
+//   ServerHello: version (2), random (32), session id length (1) + id, cipher suite (2),
+//                compression method (1), extensions length (2) + data
+//
+// The hello fields are only present for messages without an error, the extensions data is the
+// extensions block without its own length prefix.
+
+int init_output_buffer(OutputBuffer *out, size_t capacity);
+void free_output_buffer(OutputBuffer *out);
+void reset_output_buffer(OutputBuffer *out);
+int reserve_output_buffer(OutputBuffer *out, size_t length);
+int append_output(OutputBuffer *out, const void *data, size_t length);
+int append_hex(OutputBuffer *out, const unsigned char *data, size_t length);
+int append_formatted(OutputBuffer *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int append_json_string(OutputBuffer *out, const unsigned char *text, size_t length);
+void format_hex(const unsigned char *data, size_t length, char *hex);
+int append_json_message(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err, int flags);
+int append_json_session(OutputBuffer *out, const char *source, const HandshakeSession *session);
+int append_json_certificate(OutputBuffer *out, const char *source, unsigned long index, int position, const CertificateSummary *summary);
+int append_binary_message(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err);
+
+#endif
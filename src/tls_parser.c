@@ -1,185 +1,340 @@
 #include "tls_parser.h"
+#include "tls_metrics.h"
 
 #define MIN_RECORD_LAYER_SIZE 3 // Has to be atleast (ContentType + TLS version)
 #define MIN_CLIENT_HELLO_SIZE 38 // A client hello has to be atleast 38 bytes
 #define MIN_SERVER_HELLO_SIZE 38 // A server hello has to be atleast 38 bytes
-#define HELLO_RANDOM_BYTES_SIZE 28 // As specified in RFC
-#define MAXIMUM_FILE_SIZE 20000000 // bytes => 20 MB
-
-int main(int argc, char* argv[]) {
-    int err = 0;
+#define MIN_CERTIFICATE_SIZE 3 // certificate_list length
+#define MIN_CERTIFICATE_REQUEST_SIZE 4 // One certificate type and the certificate_authorities length
+#define MIN_CERTIFICATE_VERIFY_SIZE 2 // signature length
+#define MIN_CLIENT_KEY_EXCHANGE_SIZE 1 // Length of the exchange parameters
+#define MIN_FINISHED_SIZE 12 // verify_data is 12 bytes, cipher suites may define longer ones
+#define MIN_SSLV2_CLIENT_HELLO_SIZE 8 // Version + cipher_spec_length + session_id_length + challenge_length
+
+// The random of a HelloRetryRequest is SHA-256("HelloRetryRequest") (RFC 8446 section 4.1.3)
+static const unsigned char hello_retry_request_random[32] = {
+    0xcf, 0x21, 0xad, 0x74, 0xe5, 0x9a, 0x61, 0x11, 0xbe, 0x1d, 0x8c, 0x02, 0x1e, 0x65, 0xb8, 0x91,
+    0xc2, 0xa2, 0x11, 0x16, 0x7a, 0xbb, 0x8c, 0x5e, 0x07, 0x9e, 0x09, 0xe2, 0xc8, 0xa8, 0x33, 0x9c
+};
+
+int is_hello_retry_request_random(const unsigned char *random) {
+    return memcmp(random, hello_retry_request_random, sizeof(hello_retry_request_random)) == 0;
+}
 
-    // Check command line parameters and print usages in case they are not valid
-    if (argc != 2) {
-        printf("usage: %s\n path_to_file", argv[0]);
+int parse_tls_message(const unsigned char *raw, int size, ParsedMessage *parsed) {
+    memset(parsed, 0, sizeof(*parsed));
 
-        return 0;
+    int err = initialize_tls_structure(raw, size, &parsed->handshake);
+    if (err) {
+        return err;
     }
 
-    unsigned char *buf;
-    int file_size = -1;
+    return parse_handshake_body(parsed);
+}
 
-    // Check whether the path provided links to a reguler file and checks it's size
-    if (((buf = get_safe_input_file(argv[1], &file_size)) == NULL) || (file_size == -1)) {
-        return 0;
+static int parse_record(const unsigned char *raw, int size, HandshakeMessage *tls_message) {
+    int err = parse_record_header(raw, size, tls_message);
+    if (err) {
+        return err;
     }
 
-    // Parse the record layer headers and save the actual handshake message into tls_message->body
-    HandshakeMessage tls_message;
-    memset(&tls_message, 0, sizeof(tls_message));
-    err = initialize_tls_structure(buf, file_size, &tls_message);
+    if (tls_message->sslv2) {
+        if (tls_message->fLength + SSLV2_HEADER_SIZE != size) {
+            return INVALID_FILE_LENGTH;
+        }
 
-    // Close the original buffer containing the file stream, as all data has to be in tls_message
-    if (buf) {
-        free(buf);
+        return parse_handshake_header(raw + SSLV2_HEADER_SIZE, tls_message->fLength, tls_message);
     }
 
-    // Stop processing in case there was an error
-    handle_errors(err);
-
-    print_tls_record_layer_info(&tls_message);
-
-    // Process the actual handshake message
-    switch (tls_message.hsType) {
-        case 1: 
-            err = parse_client_hello(tls_message.body, tls_message.mLength); break;
-        case 2:
-            err = parse_server_hello(tls_message.body, tls_message.mLength); break;
-        case 11:
-            err = parse_certificate(tls_message.mLength); break;
-        case 12: 
-            err = parse_server_key_exchange(tls_message.mLength); break;
-        case 14:
-            err = parse_server_hello_done(tls_message.mLength); break;
-        case 16:
-            err = parse_client_key_exchange(tls_message.body, tls_message.mLength); break;
-        default:
-            err = UNSUPPORTED_MESSAGE_TYPE; break;
+    // Check if the sizes are correct (record protocol headers + length == file size)
+    if (tls_message->fLength + RECORD_HEADER_SIZE != size) {
+        return INVALID_FILE_LENGTH;
     }
 
-    if (tls_message.body) {
-        free(tls_message.body);
+    err = parse_handshake_header(raw + RECORD_HEADER_SIZE, tls_message->fLength, tls_message);
+    if (err) {
+        return err;
     }
 
-    handle_errors(err);
+    // Check if the sizes are correct (fLength value == mLength value + HandshakeType (1 byte) + mLength (3 bytes))
+    if (tls_message->fLength != tls_message->mLength + HANDSHAKE_HEADER_SIZE) {
+        tls_message->body = NULL;
 
-    printf("\n[OK]: Finished parsing of message!\n");
+        return INVALID_FILE_LENGTH;
+    }
 
     return 0;
 }
 
-int initialize_tls_structure(unsigned char *raw, int size, HandshakeMessage *tls_message) {
+int parse_record_header(const unsigned char *raw, int size, HandshakeMessage *tls_message) {
     // Record layer
     if (size <= MIN_RECORD_LAYER_SIZE || raw == NULL) {
         return INVALID_FILE_LENGTH;
     }
 
-    int pos = 0;
+    // An SSLv2 compatible ClientHello (RFC 5246 appendix E.2) has a 2 bytes length with the high bit
+    // set in place of the record header, followed by the message type and the version. No content
+    // type has the high bit set, so this can't be mistaken for a TLS record.
+    if (size >= RECORD_HEADER_SIZE && (raw[0] & 0x80) && raw[2] == CLIENT_HELLO && raw[3] == 0x03) {
+        tls_message->cType = HANDSHAKE;
+        tls_message->version.major = raw[3];
+        tls_message->version.minor = raw[4];
+        tls_message->fLength = ((raw[0] & 0x7f) << 8) | raw[1];
+        tls_message->sslv2 = 1;
+
+        return is_valid_tls_version(raw[3], raw[4]) ? 0 : INVALID_VERSION;
+    }
+
+    // The fields are filled even for records that are rejected below, so that
+    // stream readers are able to skip over records of other content types
+    tls_message->sslv2 = 0;
+    tls_message->cType = raw[0];
+    tls_message->version.major = raw[1];
+    tls_message->version.minor = raw[2];
+
+    if (size >= RECORD_HEADER_SIZE) {
+        // Convert raw[3] and raw[4] to uint16_t number
+        tls_message->fLength = (raw[3] << 8) + raw[4];
+    }
 
     // Only handshake messages of TLS version 1.0 - 1.2 are allowed
-    if (raw[pos++] != HANDSHAKE) {
+    if (raw[0] != HANDSHAKE) {
         return INVALID_CONTENT_TYPE;
     }
 
-    if (!is_valid_tls_version(raw[pos], raw[pos + 1])) {
+    if (!is_valid_tls_version(raw[1], raw[2])) {
         return INVALID_VERSION;
     }
 
-    // Values are safe to assign to our structure
-    tls_message->cType = HANDSHAKE;
-    tls_message->version.major = raw[1];
-    tls_message->version.minor = raw[2];
+    if (size < RECORD_HEADER_SIZE) {
+        return INVALID_FILE_LENGTH;
+    }
 
-    pos += 2;
+    return 0;
+}
 
-    // Convert raw[3] and raw[4] to uint16_t number
-    tls_message->fLength = (raw[pos] << 8) + raw[pos + 1];
-    pos += 2;
+int parse_handshake_header(const unsigned char *raw, int size, HandshakeMessage *tls_message) {
+    // Only the type byte precedes an SSLv2 compatible ClientHello, the rest of the record is its body
+    if (tls_message->sslv2) {
+        if (size < 1) {
+            return INVALID_FILE_LENGTH;
+        }
 
-    // Check if the sizes are correct (record protocol headers + length == file size)
-    if (tls_message->fLength + pos != size) {
+        tls_message->hsType = raw[0];
+        tls_message->mLength = size - 1;
+        tls_message->body = raw + 1;
+
+        return 0;
+    }
+
+    if (size < HANDSHAKE_HEADER_SIZE) {
         return INVALID_FILE_LENGTH;
     }
 
     // Does not need to check this value as the parser will not continue if this is not a supported handshake message type
-    tls_message->hsType = raw[pos++];
+    tls_message->hsType = raw[0];
 
-    // Convert raw[6], raw[7] and raw[8] into uint24_t number
+    // Convert raw[1], raw[2] and raw[3] into uint24_t number
     // It's actually uint24_t but thats not defined
-    tls_message->mLength = (0x00 << 24) + (raw[pos] << 16) + (raw[pos + 1] << 8) + raw[pos + 2];
-    pos += 3;
+    tls_message->mLength = (raw[1] << 16) + (raw[2] << 8) + raw[3];
 
-    // Check if the sizes are correct (fLength value == mLength value + HandshakeType (1 byte) + mLength (3 bytes))
-    if (tls_message->fLength != tls_message->mLength + 4) {
+    if (tls_message->mLength > (uint32_t)(size - HANDSHAKE_HEADER_SIZE)) {
         return INVALID_FILE_LENGTH;
     }
 
-    // Copy the rest of the message into our structure, so we can close the raw stream
-    tls_message->body = (unsigned char *)malloc(tls_message->mLength);
-    memcpy(tls_message->body, raw + pos, tls_message->mLength);
+    // The body is not copied, the structure just points to the rest of the raw buffer
+    tls_message->body = raw + HANDSHAKE_HEADER_SIZE;
 
     return 0;
 }
 
-void print_tls_record_layer_info(HandshakeMessage *tls_message) {
-    printf("Identified the following TLS message:\n\n");
-    printf("TLS Version: ");
+int initialize_tls_structure(const unsigned char *raw, int size, HandshakeMessage *tls_message) {
+    METRIC_START(start);
+    int err = parse_record(raw, size, tls_message);
+    METRIC_STOP(METRIC_STAGE_RECORD, start);
+    METRIC_RECORD(size);
+    METRIC_ERROR(err);
+
+    return err;
+}
+
+static int parse_body(ParsedMessage *parsed, int validate_only) {
+    // Its layout has nothing in common with the TLS ClientHello, so it bypasses the registry
+    if (parsed->handshake.sslv2) {
+        return parse_sslv2_client_hello(parsed->handshake.body, parsed->handshake.mLength, &parsed->clientHello);
+    }
+
+    const MessageDescriptor *descriptor = get_message_descriptor(parsed->handshake.hsType);
+
+    if (parsed->handshake.mLength < descriptor->minLength) {
+        return INVALID_FILE_LENGTH;
+    }
+
+    if (!(descriptor->versions & MESSAGE_VERSION(parsed->handshake.version.minor))) {
+        return INVALID_VERSION;
+    }
+
+    return validate_only ? descriptor->validate(parsed) : descriptor->parse(parsed);
+}
+
+int parse_handshake_body(ParsedMessage *parsed) {
+    METRIC_START(start);
+    int err = parse_body(parsed, 0);
+    METRIC_STOP(METRIC_STAGE_PARSE, start);
+    METRIC_MESSAGE(parsed->handshake.sslv2 ? CLIENT_HELLO : parsed->handshake.hsType);
+    METRIC_ERROR(err);
+
+    return err;
+}
+
+int validate_tls_message(const unsigned char *raw, int size, MessageSummary *summary) {
+    memset(&summary->handshake, 0, sizeof(summary->handshake));
+
+    int err = parse_record(raw, size, &summary->handshake);
+    if (err) {
+        summary->version = summary->handshake.version;
+        summary->serverName = NULL;
+        summary->serverNameLength = 0;
+
+        return err;
+    }
+
+    return validate_handshake_body(summary);
+}
+
+int validate_handshake_body(MessageSummary *summary) {
+    // Not cleared, the validators only read back what they have written
+    ParsedMessage scratch;
+
+    scratch.handshake = summary->handshake;
+    summary->version = summary->handshake.version;
+    summary->serverName = NULL;
+    summary->serverNameLength = 0;
+
+    int err = parse_body(&scratch, 1);
+    if (err) {
+        return err;
+    }
+
+    if (summary->handshake.hsType == CLIENT_HELLO) {
+        summary->version = scratch.clientHello.maxVersion;
+
+        // Like the accessor, a malformed server_name doesn't make the message invalid, it just has none
+        if (!summary->handshake.sslv2 && scratch.clientHello.hasExtensions) {
+            get_server_name(&scratch.clientHello.extensionIndex, &summary->serverName, &summary->serverNameLength);
+        }
+    } else if (summary->handshake.hsType == SERVER_HELLO) {
+        summary->version = scratch.serverHello.selectedVersion;
+    }
+
+    return NO_ERROR;
+}
+
+// Versions that may be negotiated through supported_versions, which TLS 1.3 uses because the
+// legacy version fields stay at 1.2
+static int is_known_tls_version(uint16_t version) {
+    return version >= 0x0301 && version <= 0x0304;
+}
+
+// Leaves version alone if the client doesn't send supported_versions. GREASE, draft and DTLS
+// versions in the list are skipped.
+static int get_max_supported_version(const ExtensionIndex *index, ProtocolVersion *version) {
+    Uint16List versions;
+    int err = get_supported_versions(index, &versions);
+
+    if (err) {
+        return err == EXTENSION_NOT_PRESENT ? NO_ERROR : err;
+    }
+
+    uint16_t max = 0;
+    for (int i = 0; i < versions.count; i++) {
+        uint16_t value = get_uint16_list_value(&versions, i);
+
+        if (is_known_tls_version(value) && value > max) {
+            max = value;
+        }
+    }
+
+    if (max != 0) {
+        version->major = max >> 8;
+        version->minor = max & 0xff;
+    }
+
+    return NO_ERROR;
+}
+
+static int get_selected_version(const ExtensionIndex *index, ProtocolVersion *version) {
+    Uint16List versions;
+    int err = get_supported_versions(index, &versions);
+
+    if (err) {
+        return err == EXTENSION_NOT_PRESENT ? NO_ERROR : err;
+    }
+
+    uint16_t selected = get_uint16_list_value(&versions, 0);
+    if (!is_known_tls_version(selected)) {
+        return INVALID_VERSION;
+    }
 
-    print_tls_version(tls_message->version.minor);
+    version->major = selected >> 8;
+    version->minor = selected & 0xff;
 
-    printf("Protocol type: %d\n", tls_message->cType);
-    printf("Fragment length: %d\n", tls_message->fLength);
-    printf("Handshake message type: %d\n\n", tls_message->hsType);
+    return NO_ERROR;
 }
 
-int parse_client_hello(unsigned char *message, uint16_t size) {
+// Shared by parsing and validation. The latter only indexes the extensions validate_tls_message
+// reports and doesn't clear the rest of the structure, which it never reads.
+static int read_client_hello(const unsigned char *message, uint32_t size, int index_all, ClientHello *client_hello) {
     if (size < MIN_CLIENT_HELLO_SIZE || message == NULL) {
         return INVALID_FILE_LENGTH;
     }
 
-    int pos = 0;
+    uint32_t pos = 0;
 
-    ClientHello client_hello;
-    memset(&client_hello, 0, sizeof(client_hello));
+    if (index_all) {
+        memset(client_hello, 0, sizeof(*client_hello));
+    } else {
+        client_hello->hasExtensions = 0;
+    }
 
     // Check if the versions are valid
     if (!is_valid_tls_version(message[pos], message[pos + 1])) {
             return INVALID_VERSION;
     }
 
-    client_hello.version.major = message[pos];
-    client_hello.version.minor = message[pos + 1];
+    client_hello->version.major = message[pos];
+    client_hello->version.minor = message[pos + 1];
+    client_hello->maxVersion = client_hello->version;
     pos += 2;
 
     // The Random structure    
-    client_hello.random.time = (message[pos] << 24) + (message[pos + 1] << 16) + (message[pos + 2] << 8) + message[pos + 3];
+    client_hello->random.time = ((uint32_t)message[pos] << 24) | (message[pos + 1] << 16) | (message[pos + 2] << 8) | message[pos + 3];
     pos += 4;
-    memcpy(client_hello.random.random_bytes, message + pos, HELLO_RANDOM_BYTES_SIZE);
+    client_hello->random.random_bytes = message + pos;
     pos += HELLO_RANDOM_BYTES_SIZE;
 
     // The SessionID structure
-    client_hello.sessionId.length = message[pos++];
-    if (client_hello.sessionId.length > 0) {
-        if (size < client_hello.sessionId.length + HELLO_RANDOM_BYTES_SIZE + 4 + 2) {
+    // The session id has to leave room for the cipher suites length
+    client_hello->sessionId.length = message[pos++];
+    if (client_hello->sessionId.length > 0) {
+        if (size < pos + client_hello->sessionId.length + 2) {
             return INVALID_FILE_LENGTH;
         }
 
-        client_hello.sessionId.sessionId = (unsigned char *)malloc(client_hello.sessionId.length);
-        memcpy(client_hello.sessionId.sessionId, message + pos, client_hello.sessionId.length);
-        pos += client_hello.sessionId.length;
+        client_hello->sessionId.sessionId = message + pos;
+        pos += client_hello->sessionId.length;
     }
 
     // The CipherSuitesStructure
-    client_hello.csCollection.length = (message[pos] << 8) + message[pos + 1];
+    client_hello->csCollection.length = (message[pos] << 8) + message[pos + 1];
     pos += 2;
-    if (client_hello.csCollection.length > 0) {
-        if (size < pos + client_hello.csCollection.length) {
+    if (client_hello->csCollection.length > 0) {
+        if (size < pos + client_hello->csCollection.length) {
             return INVALID_FILE_LENGTH;
         }
 
-        client_hello.csCollection.cipherSuites = (unsigned char *)malloc(client_hello.csCollection.length);
-        memcpy(client_hello.csCollection.cipherSuites, message + pos, client_hello.csCollection.length);
-        pos += client_hello.csCollection.length;
+        client_hello->csCollection.cipherSuites = message + pos;
+        pos += client_hello->csCollection.length;
     }
 
     // CompresionMethod 2 bytes and Extensions 1 at least
@@ -188,123 +343,82 @@ int parse_client_hello(unsigned char *message, uint16_t size) {
     }
 
     // The CompresionMethodStructure
-    client_hello.compresionMethod.length = message[pos++];
-    if (client_hello.compresionMethod.length != 1) {
-            printf("%x", client_hello.compresionMethod.length);
+    client_hello->compresionMethod.length = message[pos++];
+    if (client_hello->compresionMethod.length != 1) {
             return INVALID_FILE_LENGTH;
     }
 
-    client_hello.compresionMethod.compresionMethod = message[pos++];
+    client_hello->compresionMethod.compresionMethod = message[pos++];
 
     if (size != pos) {
         // Extensions are present.
-        // Save to rest of the data to our structue. No more checks about it,
-        // we will just print it out as extensions are not in scope. 
-        client_hello.hasExtensions = 1; 
-        client_hello.extensions = (unsigned char *)malloc(size - pos);
-        memcpy(client_hello.extensions, message + pos, size - pos);
-    }
-
-    print_client_hello_message(&client_hello, size - pos);
-
-    clean_client_hello(client_hello);
-
-    return 0;
-}
-
-void print_client_hello_message(ClientHello *message, int extensions_length) {
-    printf("Details of ClientHello:\n\n");
-    printf("TLS Version: ");
-
-    print_tls_version(message->version.minor);
-
-    // Time in human-readable format
-    time_t raw_time = (time_t) message->random.time;
-    struct tm *timeinfo = localtime(&raw_time);
-    char buf[25];
-
-    strftime(buf, 25, "Timestamp: %c.", timeinfo);
-    puts(buf);
-
-    printf("Random data: ");
-    int i;
-    for (i = 0; i < HELLO_RANDOM_BYTES_SIZE; i++) {        
-        printf("%x", message->random.random_bytes[i]);
-    }
-    printf("\n");
-
-    printf("SessionID: ");
-    if ( message->sessionId.length != 0) {
-        for (i = 0; i < message->sessionId.length; i++) { 
-            printf("%x", message->sessionId.sessionId[i]);
+        // Point to the rest of the data and index the individual extensions,
+        // their content is only decoded when one of the accessors asks for it.
+        client_hello->hasExtensions = 1; 
+        client_hello->extensionsLength = size - pos;
+        client_hello->extensions = message + pos;
+
+        int err = index_all ? build_extension_index(message + pos, size - pos, 0, &client_hello->extensionIndex)
+                            : scan_extension_block(message + pos, size - pos, 0, &client_hello->extensionIndex);
+        if (err) {
+            return err;
         }
-    } else {
-        printf("N/A");
-    }
 
-    printf("\n");
-
-    printf("Choosen cipher suites:\n");
-    for (i = 0; i < message->csCollection.length; i++) {
-        if (i % 2) {
-            printf("%x ", message->csCollection.cipherSuites[i]); 
-        } else {
-            printf("0x%x", message->csCollection.cipherSuites[i]);
-        }
+        return get_max_supported_version(&client_hello->extensionIndex, &client_hello->maxVersion);
     }
-    printf("\n");
-
-    printf("Compresion method: %d\n", message->compresionMethod.compresionMethod);
-    printf("Has extensions: %s\n", message->hasExtensions ? "true" : "false");
 
-    printf("Raw extensions data:\n\n");
-    for (i = 0; i < extensions_length; i++) {
-        printf("%x", message->extensions[i]);
-    }
+    return 0;
+}
 
-    printf("\n");
+int parse_client_hello(const unsigned char *message, uint32_t size, ClientHello *client_hello) {
+    return read_client_hello(message, size, 1, client_hello);
 }
 
-int parse_server_hello(unsigned char *message, uint16_t size) {
+static int read_server_hello(const unsigned char *message, uint32_t size, int index_all, ServerHello *server_hello) {
     if (size < MIN_SERVER_HELLO_SIZE || message == NULL) {
         return INVALID_FILE_LENGTH;
     }
 
-    int pos = 0;
+    uint32_t pos = 0;
 
-    ServerHello server_hello;
-    memset(&server_hello, 0, sizeof(server_hello));
+    if (index_all) {
+        memset(server_hello, 0, sizeof(*server_hello));
+    } else {
+        server_hello->hasExtensions = 0;
+    }
 
     // Check if the versions are valid
     if (!is_valid_tls_version(message[pos], message[pos + 1])) {
             return INVALID_VERSION;
     }
 
-    server_hello.version.major = message[pos];
-    server_hello.version.minor = message[pos + 1];
+    server_hello->version.major = message[pos];
+    server_hello->version.minor = message[pos + 1];
+    server_hello->selectedVersion = server_hello->version;
+    server_hello->helloRetryRequest = is_hello_retry_request_random(message + pos + 2);
     pos += 2;
 
     // The Random structure    
-    server_hello.random.time = (message[pos] << 24) + (message[pos + 1] << 16) + (message[pos + 2] << 8) + message[pos + 3];
+    server_hello->random.time = ((uint32_t)message[pos] << 24) | (message[pos + 1] << 16) | (message[pos + 2] << 8) | message[pos + 3];
     pos += 4;
-    memcpy(server_hello.random.random_bytes, message + pos, HELLO_RANDOM_BYTES_SIZE);
+    server_hello->random.random_bytes = message + pos;
     pos += HELLO_RANDOM_BYTES_SIZE;
 
     // The SessionID structure
-    server_hello.sessionId.length = message[pos++];
-    if (server_hello.sessionId.length > 0) {
-        if (size < server_hello.sessionId.length + HELLO_RANDOM_BYTES_SIZE + 4 + 2) {
+    // The session id has to leave room for the cipher suite and the compression method
+    server_hello->sessionId.length = message[pos++];
+    if (server_hello->sessionId.length > 0) {
+        if (size < pos + server_hello->sessionId.length + 3) {
             return INVALID_FILE_LENGTH;
         }
 
-        server_hello.sessionId.sessionId = (unsigned char *)malloc(server_hello.sessionId.length);
-        memcpy(server_hello.sessionId.sessionId, message + pos, server_hello.sessionId.length);
-        pos += server_hello.sessionId.length;
+        server_hello->sessionId.sessionId = message + pos;
+        pos += server_hello->sessionId.length;
     }
 
     // The choosen cipher suite
-    server_hello.cipherSuite[0] = message[pos++];
-    server_hello.cipherSuite[1] = message[pos++];
+    server_hello->cipherSuite[0] = message[pos++];
+    server_hello->cipherSuite[1] = message[pos++];
 
     // CompresionMethod needs to be present
     if (size < pos + 1) {
@@ -312,104 +426,151 @@ int parse_server_hello(unsigned char *message, uint16_t size) {
     }
 
     // The CompresionMethodStructure
-    server_hello.compresionMethod = message[pos++];
+    server_hello->compresionMethod = message[pos++];
    
     if (size != pos) {
         // Extensions are present.
-        // Save to rest of the data to our structue. No more checks about it,
-        // we will just print it out as extensions are not in scope. 
-        server_hello.hasExtensions = 1; 
-        server_hello.extensions = (unsigned char *)malloc(size - pos);
-        memcpy(server_hello.extensions, message + pos, size - pos);
-    }
+        // Point to the rest of the data and index the individual extensions,
+        // their content is only decoded when one of the accessors asks for it.
+        server_hello->hasExtensions = 1; 
+        server_hello->extensionsLength = size - pos;
+        server_hello->extensions = message + pos;
+
+        int err = index_all ? build_extension_index(message + pos, size - pos, 1, &server_hello->extensionIndex)
+                            : scan_extension_block(message + pos, size - pos, 1, &server_hello->extensionIndex);
+        if (err) {
+            return err;
+        }
 
-    print_server_hello_message(&server_hello, size - pos);
+        server_hello->extensionIndex.helloRetryRequest = server_hello->helloRetryRequest;
 
-    clean_server_hello(server_hello);
+        return get_selected_version(&server_hello->extensionIndex, &server_hello->selectedVersion);
+    }
 
     return 0;
 }
 
-void print_server_hello_message(ServerHello *message, int extensions_length) {
-    printf("Details of ServerHello:\n\n");
-    printf("TLS Version: ");
+int parse_server_hello(const unsigned char *message, uint32_t size, ServerHello *server_hello) {
+    return read_server_hello(message, size, 1, server_hello);
+}
 
-    print_tls_version(message->version.minor);
+int parse_sslv2_client_hello(const unsigned char *message, uint32_t size, ClientHello *client_hello) {
+    memset(client_hello, 0, sizeof(*client_hello));
 
-    // Time in human-readable format
-    time_t raw_time = (time_t) message->random.time;
-    struct tm *timeinfo = localtime(&raw_time);
-    printf ("Timestamp: %s", asctime(timeinfo));
+    if (size < MIN_SSLV2_CLIENT_HELLO_SIZE || message == NULL) {
+        return INVALID_FILE_LENGTH;
+    }
 
-    printf("Random data: ");
-    int i;
-    for (i = 0; i < HELLO_RANDOM_BYTES_SIZE; i++) {        
-        printf("%x", message->random.random_bytes[i]);
+    // The highest version the client supports, the record itself has none
+    if (!is_valid_tls_version(message[0], message[1])) {
+        return INVALID_VERSION;
     }
-    printf("\n");
 
-    printf("SessionID: ");
-    if ( message->sessionId.length != 0) {
-        for (i = 0; i < message->sessionId.length; i++) { 
-            printf("%x", message->sessionId.sessionId[i]);
-        }
-    } else {
-        printf("N/A");
+    client_hello->version.major = message[0];
+    client_hello->version.minor = message[1];
+    client_hello->maxVersion = client_hello->version;
+    client_hello->sslv2 = 1;
+
+    uint16_t specs_length = (message[2] << 8) | message[3];
+    uint16_t session_id_length = (message[4] << 8) | message[5];
+    uint16_t challenge_length = (message[6] << 8) | message[7];
+
+    // The session id is empty or 16 bytes, the challenge 16 - 32 bytes
+    if (specs_length == 0 || specs_length % SSLV2_CIPHER_SPEC_SIZE != 0 ||
+        (session_id_length != 0 && session_id_length != 16) || challenge_length < 16 || challenge_length > 32 ||
+        (uint32_t)specs_length + session_id_length + challenge_length != size - MIN_SSLV2_CLIENT_HELLO_SIZE) {
+        return INVALID_FILE_LENGTH;
     }
 
-    printf("\n");
+    uint32_t pos = MIN_SSLV2_CLIENT_HELLO_SIZE;
 
-    printf("Choosen cipher suite: 0x");
-    printf("%x", message->cipherSuite[0]); 
-    printf("%x\n", message->cipherSuite[1]);
+    client_hello->cipherSpecs = message + pos;
+    client_hello->cipherSpecsLength = specs_length;
+    pos += specs_length;
 
-    printf("Compresion method: %d\n", message->compresionMethod);
-    if (message->hasExtensions) {
-        printf("Has extensions: true\n");
-        printf("Raw extensions data:\n\n");
-        for (i = 0; i < extensions_length; i++) {
-            printf("%x", message->extensions[i]);
-        }
-    } else {
-        printf("Has extensions: false");
-    } 
+    client_hello->sessionId.length = session_id_length;
+    if (session_id_length > 0) {
+        client_hello->sessionId.sessionId = message + pos;
+        pos += session_id_length;
+    }
+
+    client_hello->challenge = message + pos;
+    client_hello->challengeLength = challenge_length;
 
-    printf("\n");
+    // There is no compression in SSLv2, the hello stands for a TLS one with the null method only
+    client_hello->compresionMethod.length = 1;
+
+    return 0;
 }
 
-void print_tls_version(uint8_t minor) {
-    switch (minor) {
-        case 0x01: printf("1.0\n"); break;
-        case 0x02: printf("1.1\n"); break;
-        case 0x03: printf("1.2\n"); break;
-        default: printf("unknown\n"); break;
+int next_sslv2_cipher_suite(const ClientHello *client_hello, uint16_t *pos, uint16_t *suite) {
+    while (*pos + SSLV2_CIPHER_SPEC_SIZE <= client_hello->cipherSpecsLength) {
+        const unsigned char *spec = client_hello->cipherSpecs + *pos;
+        *pos += SSLV2_CIPHER_SPEC_SIZE;
+
+        // The others are SSLv2 ciphers, which have no TLS equivalent
+        if (spec[0] == 0) {
+            *suite = (spec[1] << 8) | spec[2];
+
+            return 1;
+        }
     }
+
+    return 0;
 }
 
-int parse_certificate(uint16_t size) {
-    // The Certificate message contains only a chain of certificates. 
-    // The only thing to do is to verify, that the chain is not empty 
-    // as we are not able to (and not supposed to) say anything about the data.
-    if (size == 0) {
+int parse_certificate(const unsigned char *message, uint32_t size, CertificateChain *chain) {
+    // certificate_list (3 bytes length) of certificates, each with its own 3 bytes length.
+    // The certificates are only located here, decoding them is up to tls_x509.c.
+    chain->count = 0;
+    chain->truncated = 0;
+
+    if (size < MIN_CERTIFICATE_SIZE || message == NULL) {
         return INVALID_FILE_LENGTH;
     }
 
-    printf("The certificate chain provided is %d bytes long.\n", size);
-    
-    return 0;
+    uint32_t list_length = (message[0] << 16) | (message[1] << 8) | message[2];
+    if (list_length != size - 3) {
+        return INVALID_FILE_LENGTH;
+    }
+
+    uint32_t pos = 3;
+    while (pos < size) {
+        if (size - pos < 3) {
+            return INVALID_CERTIFICATE;
+        }
+
+        uint32_t length = (message[pos] << 16) | (message[pos + 1] << 8) | message[pos + 2];
+        pos += 3;
+
+        if (length == 0 || length > size - pos) {
+            return INVALID_CERTIFICATE;
+        }
+
+        if (chain->count < MAX_CHAIN_CERTIFICATES) {
+            chain->entries[chain->count].data = message + pos;
+            chain->entries[chain->count].length = length;
+            chain->count++;
+        } else {
+            chain->truncated = 1;
+        }
+
+        pos += length;
+    }
+
+    return NO_ERROR;
 }
 
-int parse_server_key_exchange( uint16_t size) {
+int parse_server_key_exchange(uint32_t size) {
     // The actual algorithm and other stuff like digital signatures of params
     // are not in scope as their presence is determined by extensions in hello messages
     // and the used certificate (which are both ignored).
-    printf("The key exchange parameters provided are %d bytes long.\n", size);
-
+    (void)size;
 
     return 0;
 }
 
-int parse_server_hello_done(uint16_t size) {
+int parse_server_hello_done(uint32_t size) {
     // The ServerHelloDone is empty. Just check if thats true.
     if (size != 0) {
         return INVALID_FILE_LENGTH;
@@ -418,127 +579,305 @@ int parse_server_hello_done(uint16_t size) {
     return 0;
 }
 
-int parse_client_key_exchange(unsigned char *message, uint16_t size) {
+int parse_client_key_exchange(const unsigned char *message, uint32_t size) {
     // We only check until we get to the exchange parameters, whose
     // type is specified similiary as server key exchange parameters
     // in earlier messages.
+    if (size < MIN_CLIENT_KEY_EXCHANGE_SIZE || message == NULL) {
+        return INVALID_FILE_LENGTH;
+    }
+
     uint8_t length = message[0];
 
     if (length != size - 1) {
         return INVALID_FILE_LENGTH_FOR_CLIENT_KEY_EXCHANGE;
     }
 
-    printf("The key exchange parameters provided are %d bytes long.\n", size);
+    return 0;
+}
+
+int parse_hello_request(uint32_t size) {
+    // Like the ServerHelloDone it has no content
+    if (size != 0) {
+        return INVALID_FILE_LENGTH;
+    }
 
     return 0;
 }
 
-void clean_client_hello(ClientHello message) {
-    if (message.sessionId.sessionId) {
-        free(message.sessionId.sessionId);
+int parse_certificate_request(const unsigned char *message, uint32_t size, int tls12, CertificateRequest *request) {
+    uint32_t pos = 0;
+
+    memset(request, 0, sizeof(*request));
+
+    if (size < MIN_CERTIFICATE_REQUEST_SIZE || message == NULL) {
+        return INVALID_FILE_LENGTH;
     }
 
-    if (message.csCollection.cipherSuites) {
-        free(message.csCollection.cipherSuites);
+    // ClientCertificateType certificate_types<1..2^8-1>
+    request->certificateTypesCount = message[pos++];
+    if (request->certificateTypesCount == 0 || size - pos < request->certificateTypesCount + 2u) {
+        return INVALID_FILE_LENGTH;
     }
 
-    if (message.extensions) {
-        free(message.extensions);
+    request->certificateTypes = message + pos;
+    pos += request->certificateTypesCount;
+
+    // SignatureAndHashAlgorithm supported_signature_algorithms<2..2^16-2>, TLS 1.2 only
+    if (tls12) {
+        uint16_t length = (message[pos] << 8) | message[pos + 1];
+        pos += 2;
+
+        if (length < 2 || length % 2 != 0 || size - pos < length + 2u) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        request->signatureAlgorithms.data = message + pos;
+        request->signatureAlgorithms.count = length / 2;
+        pos += length;
     }
-}
 
-void clean_server_hello(ServerHello message) {
-    if (message.sessionId.sessionId) {
-        free(message.sessionId.sessionId);
+    // DistinguishedName certificate_authorities<0..2^16-1>, each name with its own 2 bytes length
+    request->authoritiesLength = (message[pos] << 8) | message[pos + 1];
+    pos += 2;
+
+    if (request->authoritiesLength != size - pos) {
+        return INVALID_FILE_LENGTH;
     }
 
-    if (message.extensions) {
-        free(message.extensions);
+    request->authorities = message + pos;
+
+    while (pos < size) {
+        if (size - pos < 2) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        uint16_t length = (message[pos] << 8) | message[pos + 1];
+        pos += 2;
+
+        if (length == 0 || length > size - pos) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        request->authorityCount++;
+        pos += length;
     }
-}
 
-int is_valid_tls_version(unsigned char major, unsigned char minor) {
-    return major == 0x03 && (minor == 0x01 || minor == 0x02 || minor == 0x03);
+    return 0;
 }
 
-unsigned char* get_safe_input_file(char *path, int *file_size) {
-    struct stat sb;
+int parse_certificate_verify(const unsigned char *message, uint32_t size, int tls12, CertificateVerify *verify) {
+    uint32_t pos = 0;
 
-    // Only regular files are processed. No symbolic links, sockets, dirs, etc.
-    if (lstat(path, &sb) == 0 && !S_ISREG(sb.st_mode))
-    {
-        printf("The path '%s' is not a regular file.\n", path);
+    memset(verify, 0, sizeof(*verify));
 
-        return NULL;
+    if (size < MIN_CERTIFICATE_VERIFY_SIZE + (tls12 ? 2u : 0u) || message == NULL) {
+        return INVALID_FILE_LENGTH;
     }
 
-    // Try to open provided file
-    FILE *stream;
-    stream = fopen(path, "rb");
-
-    if (stream == NULL) {
-        printf("The file '%s' couldn't be opened.\n", path);
-        return NULL;
+    if (tls12) {
+        verify->hasAlgorithm = 1;
+        verify->algorithm = (message[0] << 8) | message[1];
+        pos += 2;
     }
 
-    // Get the actual file length
-    if (fseeko(stream, 0, SEEK_END) != 0) {
-        printf("Couldn't read the file '%s' (fseeko).\n", path);
-        fclose_safe(stream);
+    // opaque signature<0..2^16-1>
+    verify->signatureLength = (message[pos] << 8) | message[pos + 1];
+    pos += 2;
 
-        return NULL;
+    if (verify->signatureLength != size - pos) {
+        return INVALID_FILE_LENGTH;
     }
 
-    *file_size = ftello(stream);
-    if (*file_size == -1) {
-        printf("Couldn't read the file '%s' (ftello).\n", path);
-        fclose_safe(stream);
+    verify->signature = message + pos;
 
-        return NULL;
-    }
+    return 0;
+}
 
-    // Prevent hangs when a very large file is given by the user
-    if (*file_size > MAXIMUM_FILE_SIZE) {
-        printf("The file '%s' is larger then 20 MB.\n", path);
-        fclose_safe(stream);
+int parse_finished(const unsigned char *message, uint32_t size, Finished *finished) {
+    // The verify_data can't be checked without the keys, only its length
+    finished->verifyData = message;
+    finished->length = size;
 
-        return NULL;
+    if (size < MIN_FINISHED_SIZE || message == NULL) {
+        return INVALID_FILE_LENGTH;
     }
 
-    fseek(stream, 0, SEEK_SET);
+    return 0;
+}
+
+// Message registry. Every handshake message is one line of HANDSHAKE_MESSAGES, which expands into
+// its slot in message_slots (indexed by the type byte) and its MessageDescriptor. Types without a
+// line stay in slot 0, the descriptor that rejects them. Dispatching a message is two loads and an
+// indirect call, without a range check or a switch.
 
-    // Copy file content into buffer and close file stream
-    unsigned char *buf = (unsigned char *)malloc(*file_size);
-    fread(buf, *file_size, 1, stream);
+static int parse_hello_request_body(ParsedMessage *parsed) {
+    return parse_hello_request(parsed->handshake.mLength);
+}
 
-    fclose_safe(stream);
+static int parse_client_hello_body(ParsedMessage *parsed) {
+    return parse_client_hello(parsed->handshake.body, parsed->handshake.mLength, &parsed->clientHello);
+}
 
-    return buf;
+static int parse_server_hello_body(ParsedMessage *parsed) {
+    return parse_server_hello(parsed->handshake.body, parsed->handshake.mLength, &parsed->serverHello);
 }
 
-void fclose_safe(FILE * stream) {
-    if (stream != NULL) {
-        fclose(stream);
-    }
+static int validate_client_hello_body(ParsedMessage *parsed) {
+    return read_client_hello(parsed->handshake.body, parsed->handshake.mLength, 0, &parsed->clientHello);
+}
+
+static int validate_server_hello_body(ParsedMessage *parsed) {
+    return read_server_hello(parsed->handshake.body, parsed->handshake.mLength, 0, &parsed->serverHello);
+}
+
+static int parse_certificate_body(ParsedMessage *parsed) {
+    return parse_certificate(parsed->handshake.body, parsed->handshake.mLength, &parsed->certificate);
+}
+
+static int parse_server_key_exchange_body(ParsedMessage *parsed) {
+    return parse_server_key_exchange(parsed->handshake.mLength);
+}
+
+static int parse_certificate_request_body(ParsedMessage *parsed) {
+    return parse_certificate_request(parsed->handshake.body, parsed->handshake.mLength, parsed->handshake.version.minor >= 3, &parsed->certificateRequest);
+}
+
+static int parse_server_hello_done_body(ParsedMessage *parsed) {
+    return parse_server_hello_done(parsed->handshake.mLength);
+}
+
+static int parse_certificate_verify_body(ParsedMessage *parsed) {
+    return parse_certificate_verify(parsed->handshake.body, parsed->handshake.mLength, parsed->handshake.version.minor >= 3, &parsed->certificateVerify);
+}
+
+static int parse_client_key_exchange_body(ParsedMessage *parsed) {
+    return parse_client_key_exchange(parsed->handshake.body, parsed->handshake.mLength);
+}
+
+static int parse_finished_body(ParsedMessage *parsed) {
+    return parse_finished(parsed->handshake.body, parsed->handshake.mLength, &parsed->finished);
+}
+
+static int parse_unsupported_body(ParsedMessage *parsed) {
+    (void)parsed;
+
+    return UNSUPPORTED_MESSAGE_TYPE;
 }
 
-void handle_errors(int error_code) {
-    if (!error_code) {
-        // In case there is no error, continue.
-        return;
+static void print_client_hello_body(ParsedMessage *parsed) {
+    print_client_hello_message(&parsed->clientHello);
+}
+
+static void print_server_hello_body(ParsedMessage *parsed) {
+    print_server_hello_message(&parsed->serverHello);
+}
+
+static void print_certificate_body(ParsedMessage *parsed) {
+    printf("The certificate chain provided is %d bytes long.\n", parsed->handshake.mLength);
+    print_certificate_chain(&parsed->certificate);
+}
+
+static void print_key_exchange_body(ParsedMessage *parsed) {
+    print_key_exchange_message(&parsed->handshake);
+}
+
+static void print_certificate_request_body(ParsedMessage *parsed) {
+    print_certificate_request_message(&parsed->certificateRequest);
+}
+
+static void print_certificate_verify_body(ParsedMessage *parsed) {
+    print_certificate_verify_message(&parsed->certificateVerify);
+}
+
+static void print_finished_body(ParsedMessage *parsed) {
+    print_finished_message(&parsed->finished);
+}
+
+static void print_nothing(ParsedMessage *parsed) {
+    (void)parsed;
+}
+
+#define ALL_VERSIONS MESSAGE_VERSIONS_TLS_1_0_TO_1_2
+
+//   type, name, minimum body length, record versions, parser, validator, printer
+#define HANDSHAKE_MESSAGES(X) \
+    X(HELLO_REQUEST, "HelloRequest", 0, ALL_VERSIONS, parse_hello_request_body, parse_hello_request_body, print_nothing) \
+    X(CLIENT_HELLO, "ClientHello", MIN_CLIENT_HELLO_SIZE, ALL_VERSIONS, parse_client_hello_body, validate_client_hello_body, print_client_hello_body) \
+    X(SERVER_HELLO, "ServerHello", MIN_SERVER_HELLO_SIZE, ALL_VERSIONS, parse_server_hello_body, validate_server_hello_body, print_server_hello_body) \
+    X(CERTIFICATE, "Certificate", MIN_CERTIFICATE_SIZE, ALL_VERSIONS, parse_certificate_body, parse_certificate_body, print_certificate_body) \
+    X(SERVER_KEY_EXCHANGE, "ServerKeyExchange", 0, ALL_VERSIONS, parse_server_key_exchange_body, parse_server_key_exchange_body, print_key_exchange_body) \
+    X(CERTIFICATE_REQUEST, "CertificateRequest", MIN_CERTIFICATE_REQUEST_SIZE, ALL_VERSIONS, parse_certificate_request_body, parse_certificate_request_body, print_certificate_request_body) \
+    X(SERVER_HELLO_DONE, "ServerHelloDone", 0, ALL_VERSIONS, parse_server_hello_done_body, parse_server_hello_done_body, print_nothing) \
+    X(CERTIFICATE_VERIFY, "CertificateVerify", MIN_CERTIFICATE_VERIFY_SIZE, ALL_VERSIONS, parse_certificate_verify_body, parse_certificate_verify_body, print_certificate_verify_body) \
+    X(CLIENT_KEY_EXCHANGE, "ClientKeyExchange", MIN_CLIENT_KEY_EXCHANGE_SIZE, ALL_VERSIONS, parse_client_key_exchange_body, parse_client_key_exchange_body, print_key_exchange_body) \
+    X(FINISHED, "Finished", MIN_FINISHED_SIZE, ALL_VERSIONS, parse_finished_body, parse_finished_body, print_finished_body)
+
+#define MESSAGE_SLOT(type, ...) SLOT_##type,
+#define MESSAGE_SLOT_INDEX(type, ...) [type] = SLOT_##type,
+#define MESSAGE_DESCRIPTOR(type, name, min_length, versions, parse, validate, print) [SLOT_##type] = { name, min_length, versions, parse, validate, print },
+
+enum { SLOT_UNSUPPORTED, HANDSHAKE_MESSAGES(MESSAGE_SLOT) MESSAGE_SLOTS };
+
+static const uint8_t message_slots[256] = { HANDSHAKE_MESSAGES(MESSAGE_SLOT_INDEX) };
+
+static const MessageDescriptor message_descriptors[MESSAGE_SLOTS] = {
+    [SLOT_UNSUPPORTED] = { "unknown", 0, ~0u, parse_unsupported_body, parse_unsupported_body, print_nothing },
+    HANDSHAKE_MESSAGES(MESSAGE_DESCRIPTOR)
+};
+
+const MessageDescriptor *get_message_descriptor(uint8_t hs_type) {
+    return &message_descriptors[message_slots[hs_type]];
+}
+
+int is_valid_tls_version(unsigned char major, unsigned char minor) {
+    return major == 0x03 && (minor == 0x01 || minor == 0x02 || minor == 0x03);
+}
+
+typedef struct {
+    const char *name;
+    const char *description;
+} ErrorCode;
+
+#define ERROR_CODE(code, description) [code] = { #code, description }
+
+static const ErrorCode error_codes[NUMBER_OF_ERROR_CODES] = {
+    ERROR_CODE(NO_ERROR, "No error."),
+    ERROR_CODE(INVALID_FILE_LENGTH, "The lengths specified in the input file are not valid."),
+    ERROR_CODE(INVALID_CONTENT_TYPE, "The input file is not an TLS handshake message."),
+    ERROR_CODE(INVALID_VERSION, "The message is not of a supported version (TLS 1.0 - TLS 1.3)."),
+    ERROR_CODE(UNSUPPORTED_MESSAGE_TYPE, "Unsupported handshake message type."),
+    ERROR_CODE(INVALID_FILE_LENGTH_FOR_CLIENT_KEY_EXCHANGE, "The lengths specified in the input file are not valid for client_key_exchange message."),
+    ERROR_CODE(RECORD_TOO_LARGE, "The record is larger than the stream buffer."),
+    ERROR_CODE(INVALID_CAPTURE_FILE, "The input file is not a valid pcap or pcapng capture."),
+    ERROR_CODE(INVALID_EXTENSIONS, "The extensions of the hello message are malformed."),
+    ERROR_CODE(EXTENSION_NOT_PRESENT, "The requested extension is not present."),
+    ERROR_CODE(UNEXPECTED_HANDSHAKE_MESSAGE, "The handshake message is not allowed at this point of the handshake."),
+    ERROR_CODE(CIPHER_SUITE_NOT_OFFERED, "The server chose a cipher suite the client didn't offer."),
+    ERROR_CODE(INVALID_CERTIFICATE, "The certificate is malformed."),
+    ERROR_CODE(MESSAGE_TOO_LARGE, "The handshake message is larger than the stream reassembles."),
+};
+
+const char *get_error_description(int error_code) {
+    if (error_code < 0 || error_code >= NUMBER_OF_ERROR_CODES) {
+        return "Something truly unexpected happend.";
+    }
+
+    return error_codes[error_code].description;
+}
+
+const char *get_error_name(int error_code) {
+    if (error_code < 0 || error_code >= NUMBER_OF_ERROR_CODES) {
+        return "UNKNOWN";
     }
 
-    printf("[ERROR]: ");
+    return error_codes[error_code].name;
+}
 
-    switch (error_code) {
-        case 1: printf("The lengths specified in the input file are not valid.\n"); break;
-        case 2: printf("The input file is not an TLS handshake message.\n"); break;
-        case 3: printf("The message is not of a supported version (TLS 1.0 - TLS 1.2).\n"); break;
-        case 4: printf("Unsupported handshake message type.\n"); break;
-	case 5: printf("The lengths specified in the input file are not valid for client_key_exchange message.\n"); break;
-        default:
-            printf("Something truly unexpected happend.\n"); break;
+const char *get_handshake_type_name(int hs_type) {
+    if (hs_type < 0 || hs_type > 255) {
+        return "unknown";
     }
 
-    exit(0);
+    return get_message_descriptor(hs_type)->name;
 }
@@ -1,8 +1,10 @@
+#ifndef TLS_PARSER_H
+#define TLS_PARSER_H
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <time.h>
 
 
@@ -12,25 +14,62 @@
 #define INVALID_VERSION 3
 #define UNSUPPORTED_MESSAGE_TYPE 4
 #define INVALID_FILE_LENGTH_FOR_CLIENT_KEY_EXCHANGE 5
+#define RECORD_TOO_LARGE 6
+#define INVALID_CAPTURE_FILE 7
+#define INVALID_EXTENSIONS 8
+#define EXTENSION_NOT_PRESENT 9
+#define UNEXPECTED_HANDSHAKE_MESSAGE 10
+#define CIPHER_SUITE_NOT_OFFERED 11
+#define INVALID_CERTIFICATE 12
+#define MESSAGE_TOO_LARGE 13
+#define NUMBER_OF_ERROR_CODES 14 // Keep in sync with the error codes above
+
+#define RECORD_HEADER_SIZE 5 // ContentType (1 byte) + ProtocolVersion (2 bytes) + fLength (2 bytes)
+#define HANDSHAKE_HEADER_SIZE 4 // HandshakeType (1 byte) + mLength (3 bytes)
+#define SSLV2_HEADER_SIZE 2 // Record length with the high bit set, replaces the record header of an SSLv2 compatible ClientHello
+#define SSLV2_CIPHER_SPEC_SIZE 3 // SSLv2 CipherSpecs are 3 bytes, the TLS cipher suites among them start with 0
+#define HELLO_RANDOM_BYTES_SIZE 28 // As specified in RFC
+#define MAX_INDEXED_EXTENSIONS 64 // Further extensions are validated but not indexed
+#define MAX_PROTOCOL_NAMES 16 // ALPN protocols returned by get_alpn_protocols
+#define MAX_CHAIN_CERTIFICATES 16 // Certificates of a chain that are indexed, further ones are only validated
+#define MAX_KEY_SHARES 8 // Key shares returned by get_key_shares
+#define JA3_DIGEST_SIZE 16 // MD5
+#define JA3_DIGEST_HEX_SIZE 33 // Hex digest + NUL
+
+// Classes returned by classify_cipher_suite(s)
+#define CIPHER_SUITE_WEAK 0x01               // NULL cipher or authentication, anonymous, RC4, RC2, DES, 3DES, IDEA or export grade
+#define CIPHER_SUITE_EXPORT 0x02             // Export grade (40/56 bit), always weak as well
+#define CIPHER_SUITE_CBC 0x04                // Block cipher in CBC mode
+#define CIPHER_SUITE_GREASE 0x08             // RFC 8701 GREASE value
+#define CIPHER_SUITE_FALLBACK_SCSV 0x10      // TLS_FALLBACK_SCSV (RFC 7507), the client retried with a lower version
+#define CIPHER_SUITE_RENEGOTIATION_SCSV 0x20 // TLS_EMPTY_RENEGOTIATION_INFO_SCSV (RFC 5746)
+#define CIPHER_SUITE_CLASSES 6
+
+// Which variants compute_ja3/compute_ja3s should produce
+#define JA3_MD5 1 // The standard MD5 over the JA3 string
+#define JA3_RAW 2 // 64 bit hash over the binary fields, no string formatting and no MD5
 
 typedef struct {
     uint8_t major;
     uint8_t minor;
 } ProtocolVersion;
 
+// All pointers in the structures below are views into the caller's buffer, nothing is copied
+// or allocated by the parser. They stay valid only as long as the buffer passed to
+// initialize_tls_structure is alive.
 typedef struct {
     uint32_t time;
-    unsigned char random_bytes[28];
+    const unsigned char *random_bytes; // Always 28 bytes long, NULL for SSLv2 compatible hellos (see ClientHello.challenge)
 } Random;
 
 typedef struct {
     uint8_t length;
-    unsigned char *sessionId;
+    const unsigned char *sessionId;
 } SessionID;
 
 typedef struct {
     uint16_t length;
-    unsigned char *cipherSuites; // The individual suites are not in scope of the parser
+    const unsigned char *cipherSuites; // The individual suites are not in scope of the parser
 } CipherSuiteCollection;
 
 typedef struct {
@@ -47,7 +86,7 @@ typedef enum {
     APPLICATION_DATA = 23,    // 0x17
 } ContentType;
 
-// This parser is capable of parsing messages 1, 2, 11, 12, 14 and 16
+// This parser is capable of parsing all of the messages below (see the registry in tls_parser.c)
 // Any other message is considered invalid
 typedef enum {
     HELLO_REQUEST = 0,        // 0x00
@@ -62,14 +101,74 @@ typedef enum {
     FINISHED = 20,            // 0x14
 } HandshakeType;
 
+// Extensions that have typed accessors, any other type can still be looked up with get_extension
+typedef enum {
+    SERVER_NAME = 0,              // 0x0000
+    SUPPORTED_GROUPS = 10,        // 0x000A
+    EC_POINT_FORMATS = 11,        // 0x000B
+    SIGNATURE_ALGORITHMS = 13,    // 0x000D
+    APPLICATION_LAYER_PROTOCOL_NEGOTIATION = 16, // 0x0010
+    SUPPORTED_VERSIONS = 43,      // 0x002B
+    KEY_SHARE = 51,               // 0x0033
+} ExtensionType;
+
+typedef struct {
+    uint16_t type;
+    uint16_t offset;          // Offset of the extension data within ExtensionIndex.data
+    uint16_t length;          // Length of the extension data
+} ExtensionEntry;
+
+// Built in a single pass while parsing a hello message. It only records where each extension
+// is, the content is decoded by the accessors below when (and if) somebody asks for it.
+typedef struct {
+    const unsigned char *data; // Extensions block without its 2 bytes length prefix
+    uint16_t length;
+    uint16_t count;           // Number of indexed entries
+    uint8_t truncated;        // There were more than MAX_INDEXED_EXTENSIONS extensions
+    uint8_t fromServer;       // Some extensions have a different format in the ServerHello
+    uint8_t helloRetryRequest; // And again a different one in a HelloRetryRequest
+    uint64_t present;         // Bit n is set if an extension of type n < 64 is indexed
+    ExtensionEntry entries[MAX_INDEXED_EXTENSIONS];
+} ExtensionIndex;
+
+// A list of big endian 16 bit values (groups, versions, signature schemes, ...), not copied
+typedef struct {
+    const unsigned char *data;
+    uint16_t count;
+} Uint16List;
+
+typedef struct {
+    uint16_t group;
+    uint16_t length;
+    const unsigned char *keyExchange; // NULL in a HelloRetryRequest, which only names the group
+} KeyShareEntry;
+
+typedef struct {
+    uint8_t count;
+    uint8_t truncated;        // There were more than MAX_KEY_SHARES shares
+    KeyShareEntry entries[MAX_KEY_SHARES];
+} KeyShareList;
+
+typedef struct {
+    const unsigned char *name;
+    uint8_t length;
+} ProtocolName;
+
+typedef struct {
+    uint8_t count;
+    ProtocolName names[MAX_PROTOCOL_NAMES];
+} ProtocolNameList;
+
 // This is how the message looks like as a whole (record layer + actual message)
 typedef struct {
     ContentType cType;
     ProtocolVersion version;
-    uint16_t fLength;         // Length of body + type (1 byte) + mLength (3 bytes)
+    uint16_t fLength;         // Length of body + type (1 byte) + mLength (3 bytes), body + type (1 byte) for SSLv2
     HandshakeType hsType;
     uint32_t mLength;         // Length of body
-    unsigned char *body;      // We need to allocate "length" bytes at runtime
+    const unsigned char *body; // Points right after the handshake header in the raw record
+    uint8_t sslv2;            // SSLv2 compatible ClientHello (RFC 5246 appendix E.2), always the only message of its record
+    uint16_t fragments;       // Records a RecordStream reassembled the message from, 0 if it came in one
 } HandshakeMessage;
 
 
@@ -80,7 +179,15 @@ typedef struct {
     CipherSuiteCollection csCollection;
     CompresionMethod compresionMethod;
     uint8_t hasExtensions;
-    unsigned char *extensions; // We need to calculate correct size runtime
+    uint32_t extensionsLength;
+    const unsigned char *extensions; // Raw extensions data including the 2 bytes length prefix
+    ExtensionIndex extensionIndex;
+    ProtocolVersion maxVersion;       // Highest known supported_versions entry (TLS 1.3), otherwise version
+    uint8_t sslv2;                    // SSLv2 compatible hello, csCollection is empty and random not set
+    uint16_t cipherSpecsLength;
+    const unsigned char *cipherSpecs; // SSLV2_CIPHER_SPEC_SIZE bytes each, see next_sslv2_cipher_suite
+    uint8_t challengeLength;          // 16 - 32 bytes, takes the place of the random
+    const unsigned char *challenge;
 } ClientHello;
 
 typedef struct {
@@ -90,29 +197,167 @@ typedef struct {
     unsigned char cipherSuite[2];
     uint8_t compresionMethod;
     uint8_t hasExtensions;
-    unsigned char *extensions; // We need to calculate correct size runtime
+    uint32_t extensionsLength;
+    const unsigned char *extensions; // Raw extensions data including the 2 bytes length prefix
+    ExtensionIndex extensionIndex;
+    ProtocolVersion selectedVersion;  // From supported_versions (TLS 1.3), otherwise version
+    uint8_t helloRetryRequest;        // TLS 1.3 HelloRetryRequest, a ServerHello with a fixed random
 } ServerHello;
 
-typedef struct { } Certificate;       // This message contains only a chain of certificates, which is not subject of parsing
+typedef struct {
+    const unsigned char *data; // DER encoded certificate
+    uint32_t length;
+} CertificateEntry;
+
+// The certificate_list of a Certificate message split into the individual certificates. The
+// certificates themselves are only decoded on request (tls_x509.h).
+typedef struct {
+    uint16_t count;           // Number of indexed certificates, 0 for an empty list
+    uint8_t truncated;        // There were more than MAX_CHAIN_CERTIFICATES certificates
+    CertificateEntry entries[MAX_CHAIN_CERTIFICATES];
+} CertificateChain;
+
+// The certificate types and authorities (DER encoded Names, each with a 2 bytes length) the server
+// accepts for a client certificate. The signature algorithms only exist from TLS 1.2 on.
+typedef struct {
+    const unsigned char *certificateTypes;
+    uint8_t certificateTypesCount;
+    Uint16List signatureAlgorithms;   // Empty before TLS 1.2
+    const unsigned char *authorities;
+    uint16_t authoritiesLength;
+    uint16_t authorityCount;
+} CertificateRequest;
+
+typedef struct {
+    uint8_t hasAlgorithm;             // TLS 1.2 names the SignatureAndHashAlgorithm, earlier versions don't
+    uint16_t algorithm;
+    const unsigned char *signature;
+    uint16_t signatureLength;
+} CertificateVerify;
+
+typedef struct {
+    const unsigned char *verifyData;  // 12 bytes unless the cipher suite says otherwise
+    uint32_t length;
+} Finished;
+
+typedef struct { } HelloRequest;      // Empty, the server asks the client to start over with a new ClientHello
 typedef struct { } ServerKeyExchange; // Contains KeyExchangeAlgorithm parameters, which are not subject of parsing
 typedef struct { } ClientKeyExchange; // Contains either a PreMasterSecret or DH Client Parameters like (key) and is not subject of parsing
 typedef struct { } ServerHelloDone;   // This message contains nothing, it's defined just for the sake of complentness
 
-int initialize_tls_structure(unsigned char *raw, int size, HandshakeMessage *tls_message);
-void print_tls_record_layer_info(HandshakeMessage *tls_message);
+// Result of parsing a single record. Only the structure matching handshake.hsType is filled,
+// everything points into the buffer given to parse_tls_message/initialize_tls_structure.
+typedef struct {
+    HandshakeMessage handshake;
+    union {
+        ClientHello clientHello;
+        ServerHello serverHello;
+        CertificateChain certificate;
+        CertificateRequest certificateRequest;
+        CertificateVerify certificateVerify;
+        Finished finished;
+    };
+} ParsedMessage;
 
-int parse_client_hello(unsigned char *message, uint16_t size);
-void print_client_hello_message(ClientHello *client_hello, int size);
-int parse_server_hello(unsigned char *message, uint16_t size);
-void print_server_hello_message(ServerHello *message, int extensions_length);
-void print_tls_version(uint8_t minor);
-int parse_certificate(uint16_t size);
-int parse_server_key_exchange(uint16_t size);
-int parse_server_hello_done(uint16_t size);
-int parse_client_key_exchange(unsigned char *message, uint16_t size);
-void clean_client_hello(ClientHello message);
-void clean_server_hello(ServerHello message);
+// Record versions a handshake message is defined for, bit n stands for the minor version n (3.n)
+#define MESSAGE_VERSION(minor) (1u << ((minor) & 31))
+#define MESSAGE_VERSIONS_TLS_1_0_TO_1_2 (MESSAGE_VERSION(1) | MESSAGE_VERSION(2) | MESSAGE_VERSION(3))
+
+// Entry of the message registry in tls_parser.c, which parse_handshake_body, print_handshake_details
+// and get_handshake_type_name dispatch through. Unknown types get a descriptor whose parser fails
+// with UNSUPPORTED_MESSAGE_TYPE.
+typedef struct {
+    const char *name;
+    uint32_t minLength;               // Shorter bodies fail with INVALID_FILE_LENGTH before the parser runs
+    uint32_t versions;                // MESSAGE_VERSION bits, other record versions fail with INVALID_VERSION
+    int (*parse)(ParsedMessage *parsed);
+    int (*validate)(ParsedMessage *parsed); // Same checks as parse, only fills what validate_handshake_body reports
+    void (*print)(ParsedMessage *parsed);
+} MessageDescriptor;
+
+// Result of validate_tls_message: the headers and the few fields a MessageFilter (tls_filter.h)
+// selects on, found without extracting the rest of the message
+typedef struct {
+    HandshakeMessage handshake;
+    ProtocolVersion version;          // Negotiated (or highest offered) version of a hello, else the record version
+    const unsigned char *serverName;  // host_name of a ClientHello's server_name, NULL if there is none
+    uint16_t serverNameLength;
+} MessageSummary;
+
+// JA3 (ClientHello) or JA3S (ServerHello) fingerprint. GREASE values are left out of both variants,
+// so the same client always gets the same values.
+typedef struct {
+    unsigned char md5[JA3_DIGEST_SIZE]; // Only set with JA3_MD5
+    uint64_t raw;                       // Only set with JA3_RAW, meant as a hash table key
+} Fingerprint;
+
+// Library API. None of these functions allocate memory, print anything or terminate
+// the process, errors are reported through the return value (NO_ERROR on success).
+int parse_tls_message(const unsigned char *raw, int size, ParsedMessage *parsed);
+int initialize_tls_structure(const unsigned char *raw, int size, HandshakeMessage *tls_message);
+int parse_record_header(const unsigned char *raw, int size, HandshakeMessage *tls_message);
+int parse_handshake_header(const unsigned char *raw, int size, HandshakeMessage *tls_message);
+int parse_handshake_body(ParsedMessage *parsed);
+int validate_tls_message(const unsigned char *raw, int size, MessageSummary *summary);
+int validate_handshake_body(MessageSummary *summary);
+int parse_client_hello(const unsigned char *message, uint32_t size, ClientHello *client_hello);
+int parse_server_hello(const unsigned char *message, uint32_t size, ServerHello *server_hello);
+int parse_sslv2_client_hello(const unsigned char *message, uint32_t size, ClientHello *client_hello);
+int next_sslv2_cipher_suite(const ClientHello *client_hello, uint16_t *pos, uint16_t *suite);
+int is_hello_retry_request_random(const unsigned char *random);
+int parse_certificate(const unsigned char *message, uint32_t size, CertificateChain *chain);
+int parse_server_key_exchange(uint32_t size);
+int parse_server_hello_done(uint32_t size);
+int parse_client_key_exchange(const unsigned char *message, uint32_t size);
+int parse_hello_request(uint32_t size);
+int parse_certificate_request(const unsigned char *message, uint32_t size, int tls12, CertificateRequest *request);
+int parse_certificate_verify(const unsigned char *message, uint32_t size, int tls12, CertificateVerify *verify);
+int parse_finished(const unsigned char *message, uint32_t size, Finished *finished);
+const MessageDescriptor *get_message_descriptor(uint8_t hs_type);
 int is_valid_tls_version(unsigned char major, unsigned char minor);
-unsigned char* get_safe_input_file(char *path, int *file_size);
-void fclose_safe(FILE * stream);
-void handle_errors(int error_code);
+const char *get_error_description(int error_code);
+
+// Extension index and lazy accessors (tls_extensions.c)
+int build_extension_index(const unsigned char *extensions, uint32_t length, int from_server, ExtensionIndex *index);
+int scan_extension_block(const unsigned char *extensions, uint32_t length, int from_server, ExtensionIndex *index);
+int get_extension(const ExtensionIndex *index, uint16_t type, const unsigned char **data, uint16_t *length);
+int get_server_name(const ExtensionIndex *index, const unsigned char **name, uint16_t *length);
+int get_alpn_protocols(const ExtensionIndex *index, ProtocolNameList *protocols);
+int get_supported_versions(const ExtensionIndex *index, Uint16List *versions);
+int get_supported_groups(const ExtensionIndex *index, Uint16List *groups);
+int get_signature_algorithms(const ExtensionIndex *index, Uint16List *algorithms);
+int get_ec_point_formats(const ExtensionIndex *index, const unsigned char **formats, uint8_t *count);
+int get_key_shares(const ExtensionIndex *index, KeyShareList *shares);
+uint16_t get_uint16_list_value(const Uint16List *list, int i);
+const char *get_error_name(int error_code);
+const char *get_handshake_type_name(int hs_type);
+
+// JA3/JA3S fingerprints (tls_fingerprint.c)
+void compute_ja3(const ClientHello *client_hello, int variants, Fingerprint *fingerprint);
+void compute_ja3s(const ServerHello *server_hello, int variants, Fingerprint *fingerprint);
+size_t format_ja3_string(const ClientHello *client_hello, char *buf, size_t size);
+size_t format_ja3s_string(const ServerHello *server_hello, char *buf, size_t size);
+void format_ja3_digest(const Fingerprint *fingerprint, char buf[JA3_DIGEST_HEX_SIZE]);
+int is_grease_value(uint16_t value);
+
+// Cipher suite classification (tls_cipher_suites.c)
+uint32_t classify_cipher_suite(uint16_t suite);
+uint32_t classify_cipher_suites(const unsigned char *suites, uint16_t length);
+uint32_t classify_client_hello_cipher_suites(const ClientHello *client_hello);
+const char *get_cipher_suite_class_name(uint32_t class);
+
+// Human readable output of the parsed structures (stdout)
+void print_tls_record_layer_info(HandshakeMessage *tls_message);
+void print_client_hello_message(ClientHello *message);
+void print_server_hello_message(ServerHello *message);
+void print_handshake_details(ParsedMessage *parsed);
+void print_extension_details(ExtensionIndex *index);
+void print_certificate_chain(CertificateChain *chain);
+void print_certificate_request_message(CertificateRequest *request);
+void print_certificate_verify_message(CertificateVerify *verify);
+void print_finished_message(Finished *finished);
+void print_key_exchange_message(HandshakeMessage *tls_message);
+void print_tls_version(uint8_t minor);
+void format_hello_timestamp(uint32_t timestamp, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef TLS_PARSER_CLI_H
+#define TLS_PARSER_CLI_H
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "tls_parser.h"
+#include "tls_stream.h"
+#include "tls_pcap.h"
+#include "tls_output.h"
+#include "tls_session.h"
+#include "tls_metrics.h"
+#include "tls_filter.h"
+#include "tls_cache.h"
+#include "tls_stats.h"
+
+#define MAXIMUM_FILE_SIZE 20000000 // bytes => 20 MB
+
+// Reusable buffer for reading input files, only ever grows
+typedef struct {
+    unsigned char *data;
+    size_t capacity;
+} InputBuffer;
+
+// Input file mapped into memory instead of being read into a buffer
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t released;  // Pages below this offset were already given back by release_mapped_pages
+} MappedFile;
+
+// Counters reported at the end of a batch run
+typedef struct {
+    unsigned long files;                                  // Files that were read and parsed
+    unsigned long ok;
+    unsigned long skipped;                                // Files that couldn't be read at all
+    unsigned long errors[NUMBER_OF_ERROR_CODES + 1];      // Indexed by error code, the last one counts unknown codes
+    unsigned long typeOk[256];                            // Indexed by HandshakeType
+    unsigned long typeErrors[256];
+    unsigned long noTypeErrors;                           // Failed before the handshake type was known
+    unsigned long filtered;                               // Valid messages the filter didn't select, not counted above
+} BatchSummary;
+
+// Paths collected for a parallel batch run, stored back to back in a single buffer
+typedef struct {
+    char *paths;
+    size_t pathsLength;
+    size_t pathsCapacity;
+    size_t *offsets;
+    size_t count;
+    size_t capacity;
+} JobList;
+
+#define BATCH_OUTPUT_SIZE 65536
+#define FINGERPRINT_SUFFIX_SIZE 80 // " ja3s=<32 hex digits> raw=<16 hex digits>"
+
+// Output formats selected with --format
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSON 1
+#define OUTPUT_BINARY 2
+
+// Set from the command line options, only read afterwards
+extern int output_format;
+extern int show_fingerprints;
+extern int show_certificates;
+extern int validate_only;
+extern int screen_messages;         // --validate or a filter is set, messages are validated before they are parsed
+extern size_t message_cache_size;    // --cache, 0 if the message cache is off
+extern int aggregate_stats;          // --aggregate
+extern const char *stats_path;       // --stats-out
+extern MessageFilter message_filter;
+
+// State of a batch run (or of one worker of a parallel run)
+typedef struct {
+    InputBuffer input;
+    BatchSummary summary;
+    JobList *jobs;                  // If set, files are only collected into this list instead of being parsed
+    int useMmap;                    // Map the files instead of reading them into input
+    char output[BATCH_OUTPUT_SIZE]; // Result lines waiting to be written to stdout
+    size_t outputLength;
+    OutputBuffer records;           // JSON/binary records waiting to be written to stdout
+    TlsStats *stats;                // --aggregate, every worker has its own
+} BatchContext;
+
+int run_batch(char **paths, int count, const char *list_path, int workers, int use_mmap, int use_uring);
+void batch_write(BatchContext *ctx, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void flush_batch_output(BatchContext *ctx);
+void free_batch_context(BatchContext *ctx);
+void batch_process_list(FILE *list, BatchContext *ctx);
+void batch_process_path(const char *path, BatchContext *ctx);
+void batch_process_file(const char *path, BatchContext *ctx);
+void batch_process_data(const char *path, const unsigned char *data, int file_size, BatchContext *ctx);
+void record_batch_result(BatchSummary *summary, const HandshakeMessage *handshake, int err);
+void merge_batch_summary(BatchSummary *into, const BatchSummary *from);
+void print_batch_summary(BatchSummary *summary);
+const char *read_input_file(const char *path, InputBuffer *input, int *file_size);
+
+int add_job(JobList *jobs, const char *path);
+void free_job_list(JobList *jobs);
+int run_parallel_batch(JobList *jobs, int count, int use_mmap, BatchSummary *summary, TlsStats *stats);
+int run_uring_batch(JobList *jobs, BatchContext *ctx);
+
+const char *map_input_file(const char *path, MappedFile *file, int advice);
+void release_mapped_pages(MappedFile *file, size_t offset);
+void unmap_input_file(MappedFile *file);
+
+int run_stream(char **paths, int count, int use_mmap);
+int run_capture(char **paths, int count, int track_sessions);
+int run_daemon(const char *socket_path);
+int run_daemon_client(const char *socket_path, char **paths, int count, int raw);
+int stream_process_fd(int fd, const char *name, RecordStream *stream, BatchSummary *summary);
+
+unsigned char* get_safe_input_file(char *path, int *file_size);
+void fclose_safe(FILE * stream);
+int handle_errors(int error_code);
+
+int parse_output_format(const char *name);
+int parse_filter_types(char *list);
+int parse_filter_versions(const char *range);
+int screen_message(BatchSummary *summary, const MessageSummary *message, int err);
+FILE *report_stream(void);
+int append_message_record(OutputBuffer *out, const char *source, unsigned long index, const ParsedMessage *parsed, int err);
+int emit_message_record(const char *source, unsigned long index, const ParsedMessage *parsed, int err);
+void emit_session_record(const char *source, const HandshakeSession *session);
+int parse_message_body(ParsedMessage *parsed);
+void format_fingerprint_suffix(const ParsedMessage *parsed, char buf[FINGERPRINT_SUFFIX_SIZE]);
+void emit_certificate_records(const char *source, unsigned long index, const ParsedMessage *parsed, int err);
+void print_certificate_cache_stats(void);
+void print_message_cache_stats(void);
+TlsStats *get_message_stats(void);
+void record_message_stats(TlsStats *stats, const ParsedMessage *parsed, int err);
+void print_message_stats(void);
+int run_stats_merge(char **paths, int count);
+#ifdef TLS_PARSER_METRICS
+void write_metrics_file(const char *path);
+#endif
+
+#endif
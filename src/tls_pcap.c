@@ -0,0 +1,868 @@
+#include "tls_pcap.h"
+
+#include <arpa/inet.h>
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_GLOBAL_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION 0x00000001
+#define PCAPNG_SIMPLE_PACKET 0x00000003
+#define PCAPNG_ENHANCED_PACKET 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_MAX_INTERFACES 64
+
+#define LRU_NONE UINT32_MAX
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+typedef struct {
+    int linkType;
+    uint32_t snapLength;
+    uint64_t unitsPerSecond;  // Timestamp resolution (if_tsresol), microseconds by default
+} CaptureInterface;
+
+static uint16_t read16(const unsigned char *p, int swapped) {
+    return swapped ? (uint16_t)(p[0] | (p[1] << 8)) : (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t read32(const unsigned char *p, int swapped) {
+    if (swapped) {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint32_t hash_flow_key(const FlowKey *key) {
+    // FNV-1a over the fields that identify the direction
+    const unsigned char *p = (const unsigned char *)key;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+int init_flow_table(FlowTable *table, size_t max_flows, size_t stream_capacity, uint64_t timeout, FlowMessageCallback on_message, void *user) {
+    memset(table, 0, sizeof(*table));
+
+    // Keep the load factor below 3/4 so the linear probing stays short
+    size_t capacity = 16;
+    while (capacity * 3 / 4 < max_flows) {
+        capacity <<= 1;
+    }
+
+    if (capacity > LRU_NONE) {
+        return -1;
+    }
+
+    table->flows = (TcpFlow *)calloc(capacity, sizeof(TcpFlow));
+    if (table->flows == NULL) {
+        return -1;
+    }
+
+    // Rounded up the same way as the ring of a RecordStream, so that the charge of a flow is exact
+    size_t rounded = 1024;
+    while (rounded < stream_capacity) {
+        rounded <<= 1;
+    }
+
+    table->capacity = capacity;
+    table->maxFlows = max_flows;
+    table->lruHead = LRU_NONE;
+    table->lruTail = LRU_NONE;
+    table->bufferHead = LRU_NONE;
+    table->bufferTail = LRU_NONE;
+    table->streamCapacity = rounded;
+    table->memoryBudget = DEFAULT_FLOW_MEMORY_BUDGET;
+    table->timeout = timeout;
+    table->onMessage = on_message;
+    table->user = user;
+
+    return 0;
+}
+
+static void lru_unlink(FlowTable *table, uint32_t index) {
+    TcpFlow *flow = &table->flows[index];
+
+    if (flow->lruPrev != LRU_NONE) {
+        table->flows[flow->lruPrev].lruNext = flow->lruNext;
+    } else {
+        table->lruHead = flow->lruNext;
+    }
+
+    if (flow->lruNext != LRU_NONE) {
+        table->flows[flow->lruNext].lruPrev = flow->lruPrev;
+    } else {
+        table->lruTail = flow->lruPrev;
+    }
+}
+
+static void lru_push_front(FlowTable *table, uint32_t index) {
+    TcpFlow *flow = &table->flows[index];
+
+    flow->lruPrev = LRU_NONE;
+    flow->lruNext = table->lruHead;
+
+    if (table->lruHead != LRU_NONE) {
+        table->flows[table->lruHead].lruPrev = index;
+    } else {
+        table->lruTail = index;
+    }
+
+    table->lruHead = index;
+}
+
+static void buffer_unlink(FlowTable *table, uint32_t index) {
+    TcpFlow *flow = &table->flows[index];
+
+    if (flow->bufferPrev != LRU_NONE) {
+        table->flows[flow->bufferPrev].bufferNext = flow->bufferNext;
+    } else {
+        table->bufferHead = flow->bufferNext;
+    }
+
+    if (flow->bufferNext != LRU_NONE) {
+        table->flows[flow->bufferNext].bufferPrev = flow->bufferPrev;
+    } else {
+        table->bufferTail = flow->bufferPrev;
+    }
+}
+
+static void buffer_push_front(FlowTable *table, uint32_t index) {
+    TcpFlow *flow = &table->flows[index];
+
+    flow->bufferPrev = LRU_NONE;
+    flow->bufferNext = table->bufferHead;
+
+    if (table->bufferHead != LRU_NONE) {
+        table->flows[table->bufferHead].bufferPrev = index;
+    } else {
+        table->bufferTail = index;
+    }
+
+    table->bufferHead = index;
+}
+
+static void credit_flow(FlowTable *table, TcpFlow *flow, size_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+
+    table->memoryUsed -= bytes;
+    flow->memory -= (uint32_t)bytes;
+
+    if (flow->memory == 0) {
+        buffer_unlink(table, (uint32_t)(flow - table->flows));
+    }
+}
+
+static void release_flow_buffers(FlowTable *table, TcpFlow *flow) {
+    int i;
+
+    for (i = 0; i < flow->pendingCount; i++) {
+        free(flow->pending[i].data);
+    }
+
+    flow->pendingCount = 0;
+    flow->pendingBytes = 0;
+    free_record_stream(&flow->stream);
+    credit_flow(table, flow, flow->memory);
+}
+
+// Returns -1 if the memory budget of the table doesn't cover the bytes, even after the buffers of
+// all other flows were given up
+static int charge_flow(FlowTable *table, TcpFlow *flow, size_t bytes) {
+    uint32_t index = (uint32_t)(flow - table->flows);
+
+    // The tail is the flow that holds buffers and was idle the longest, the slot is kept so that the
+    // rest of its segments are skipped
+    while (table->memoryUsed + bytes > table->memoryBudget) {
+        uint32_t victim = table->bufferTail;
+
+        if (victim == LRU_NONE || victim == index) {
+            return -1;
+        }
+
+        table->flows[victim].state = FLOW_IGNORED;
+        release_flow_buffers(table, &table->flows[victim]);
+        table->flowsEvicted++;
+    }
+
+    if (flow->memory == 0 && bytes > 0) {
+        buffer_push_front(table, index);
+    }
+
+    table->memoryUsed += bytes;
+    flow->memory += (uint32_t)bytes;
+
+    return 0;
+}
+
+// Moves the flow in slot from to the empty slot to, keeping its neighbours in the LRU list pointed at it
+static void move_flow(FlowTable *table, uint32_t from, uint32_t to) {
+    TcpFlow *flow = &table->flows[from];
+
+    if (flow->lruPrev != LRU_NONE) {
+        table->flows[flow->lruPrev].lruNext = to;
+    } else {
+        table->lruHead = to;
+    }
+
+    if (flow->lruNext != LRU_NONE) {
+        table->flows[flow->lruNext].lruPrev = to;
+    } else {
+        table->lruTail = to;
+    }
+
+    if (flow->memory > 0) {
+        if (flow->bufferPrev != LRU_NONE) {
+            table->flows[flow->bufferPrev].bufferNext = to;
+        } else {
+            table->bufferHead = to;
+        }
+
+        if (flow->bufferNext != LRU_NONE) {
+            table->flows[flow->bufferNext].bufferPrev = to;
+        } else {
+            table->bufferTail = to;
+        }
+    }
+
+    table->flows[to] = *flow;
+    memset(flow, 0, sizeof(*flow));
+}
+
+static void remove_flow(FlowTable *table, size_t index) {
+    lru_unlink(table, index);
+    release_flow_buffers(table, &table->flows[index]);
+    memset(&table->flows[index], 0, sizeof(TcpFlow));
+    table->count--;
+    table->flowsEvicted++;
+
+    // Backward shift deletion: move following entries of the probe sequence into the hole
+    size_t mask = table->capacity - 1;
+    size_t hole = index;
+    size_t i = (index + 1) & mask;
+
+    while (table->flows[i].used) {
+        size_t home = table->flows[i].hash & mask;
+
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            move_flow(table, i, hole);
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+void free_flow_table(FlowTable *table) {
+    size_t i;
+
+    for (i = 0; i < table->capacity; i++) {
+        if (table->flows[i].used) {
+            release_flow_buffers(table, &table->flows[i]);
+        }
+    }
+
+    free(table->flows);
+    table->flows = NULL;
+}
+
+static void expire_flows(FlowTable *table, uint64_t now) {
+    // The tail is the least recently active flow, everything before it is newer
+    while (table->lruTail != LRU_NONE && table->flows[table->lruTail].lastSeen + table->timeout < now) {
+        remove_flow(table, table->lruTail);
+    }
+}
+
+// Marks the flow as active at now, it moves to the front of the LRU list
+static void touch_flow(FlowTable *table, TcpFlow *flow, uint64_t now) {
+    uint32_t index = (uint32_t)(flow - table->flows);
+
+    flow->lastSeen = now;
+
+    if (table->lruHead != index) {
+        lru_unlink(table, index);
+        lru_push_front(table, index);
+    }
+
+    if (flow->memory > 0 && table->bufferHead != index) {
+        buffer_unlink(table, index);
+        buffer_push_front(table, index);
+    }
+}
+
+static size_t find_flow(FlowTable *table, const FlowKey *key, uint32_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+
+    while (table->flows[i].used) {
+        if (table->flows[i].hash == hash && memcmp(&table->flows[i].key, key, sizeof(*key)) == 0) {
+            return i;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static TcpFlow *get_flow(FlowTable *table, const FlowKey *key, uint64_t now, int create) {
+    uint32_t hash = hash_flow_key(key);
+    size_t index = find_flow(table, key, hash);
+
+    if (table->flows[index].used) {
+        return &table->flows[index];
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (table->count >= table->maxFlows && table->timeout) {
+        expire_flows(table, now);
+    }
+
+    // Still full, evict the flow that was idle the longest
+    if (table->count >= table->maxFlows) {
+        if (table->lruTail == LRU_NONE) {
+            return NULL;
+        }
+
+        remove_flow(table, table->lruTail);
+    }
+
+    index = find_flow(table, key, hash);
+
+    TcpFlow *flow = &table->flows[index];
+    memset(flow, 0, sizeof(*flow));
+    flow->key = *key;
+    flow->hash = hash;
+    flow->used = 1;
+    flow->firstSeen = now;
+    flow->lastSeen = now;
+
+    lru_push_front(table, index);
+    table->count++;
+    table->flowsCreated++;
+
+    return flow;
+}
+
+static void stop_flow(FlowTable *table, TcpFlow *flow, int state) {
+    if (state == FLOW_IGNORED && flow->messages == 0) {
+        table->flowsIgnored++;
+    }
+
+    // Nothing more will be parsed on this flow, so the buffers are given back right away
+    flow->state = state;
+    release_flow_buffers(table, flow);
+}
+
+static void drain_flow(FlowTable *table, TcpFlow *flow, uint64_t timestamp) {
+    HandshakeMessage tls_message;
+    int err;
+
+    while ((err = next_stream_message(&flow->stream, &tls_message)) != STREAM_NEED_MORE_DATA) {
+        if (flow->stream.error) {
+            // Traffic that never produced a record is simply not TLS, anything else is reported
+            if (flow->messages > 0 && table->onMessage) {
+                table->onMessage(table->user, flow, &tls_message, err, timestamp);
+            }
+
+            stop_flow(table, flow, FLOW_IGNORED);
+
+            return;
+        }
+
+        if (err == INVALID_CONTENT_TYPE) {
+            // Everything after ChangeCipherSpec is encrypted, other records (alerts, ...) are skipped
+            if (tls_message.cType == CHANGE_CIPHER_SPEC) {
+                stop_flow(table, flow, FLOW_ENCRYPTED);
+
+                return;
+            }
+
+            continue;
+        }
+
+        flow->messages++;
+
+        if (table->onMessage) {
+            table->onMessage(table->user, flow, &tls_message, err, timestamp);
+        }
+    }
+}
+
+static void deliver_payload(FlowTable *table, TcpFlow *flow, const unsigned char *data, size_t length, uint64_t timestamp) {
+    flow->nextSeq += (uint32_t)length;
+
+    if (flow->stream.ring == NULL) {
+        if (charge_flow(table, flow, 2 * table->streamCapacity + FLOW_MAX_MESSAGE_SIZE) != 0) {
+            table->segmentsDropped++;
+            stop_flow(table, flow, FLOW_IGNORED);
+
+            return;
+        }
+
+        if (init_record_stream(&flow->stream, table->streamCapacity) != 0) {
+            stop_flow(table, flow, FLOW_IGNORED);
+
+            return;
+        }
+
+        flow->stream.maxMessageSize = FLOW_MAX_MESSAGE_SIZE;
+    }
+
+    size_t done = 0;
+    while (done < length && flow->state == FLOW_ACTIVE) {
+        done += feed_record_stream(&flow->stream, data + done, length - done);
+        drain_flow(table, flow, timestamp);
+    }
+}
+
+static void flow_payload(FlowTable *table, TcpFlow *flow, uint32_t seq, const unsigned char *data, size_t length, uint64_t timestamp) {
+    if (flow->state != FLOW_ACTIVE || length == 0) {
+        return;
+    }
+
+    table->segments++;
+
+    // Capture started in the middle of the connection, take the first segment as the start
+    if (!flow->seqKnown) {
+        flow->nextSeq = seq;
+        flow->seqKnown = 1;
+    }
+
+    int32_t offset = (int32_t)(seq - flow->nextSeq);
+
+    if (offset > 0) {
+        // A gap, keep a copy of the segment until the missing bytes arrive
+        if (flow->pendingCount == MAX_PENDING_SEGMENTS || flow->pendingBytes + length > table->streamCapacity ||
+            charge_flow(table, flow, length) != 0) {
+            table->segmentsDropped++;
+            stop_flow(table, flow, FLOW_IGNORED);
+
+            return;
+        }
+
+        PendingSegment *pending = &flow->pending[flow->pendingCount];
+        pending->data = (unsigned char *)malloc(length);
+        if (pending->data == NULL) {
+            credit_flow(table, flow, length);
+            table->segmentsDropped++;
+            return;
+        }
+
+        memcpy(pending->data, data, length);
+        pending->seq = seq;
+        pending->length = (uint32_t)length;
+        flow->pendingCount++;
+        flow->pendingBytes += (uint32_t)length;
+
+        return;
+    }
+
+    // Retransmitted bytes that were already delivered are cut off
+    if ((size_t)(-offset) >= length) {
+        return;
+    }
+
+    deliver_payload(table, flow, data - offset, length + offset, timestamp);
+
+    // The new bytes may have closed the gap in front of some of the pending segments
+    int progress = 1;
+    while (progress && flow->state == FLOW_ACTIVE) {
+        int i;
+        progress = 0;
+
+        for (i = 0; i < flow->pendingCount; i++) {
+            PendingSegment segment = flow->pending[i];
+            int32_t pending_offset = (int32_t)(segment.seq - flow->nextSeq);
+
+            if (pending_offset > 0) {
+                continue;
+            }
+
+            flow->pending[i] = flow->pending[--flow->pendingCount];
+            flow->pendingBytes -= segment.length;
+            credit_flow(table, flow, segment.length);
+
+            if ((uint32_t)(-pending_offset) < segment.length) {
+                deliver_payload(table, flow, segment.data - pending_offset, segment.length + pending_offset, timestamp);
+            }
+
+            free(segment.data);
+            progress = 1;
+
+            break;
+        }
+    }
+}
+
+static int decode_tcp(FlowTable *table, FlowKey *key, const unsigned char *segment, size_t length, uint64_t timestamp) {
+    if (length < 20) {
+        return INVALID_FILE_LENGTH;
+    }
+
+    size_t header_length = (segment[12] >> 4) * 4;
+    if (header_length < 20 || header_length > length) {
+        return INVALID_FILE_LENGTH;
+    }
+
+    key->srcPort = read16(segment, 0);
+    key->dstPort = read16(segment + 2, 0);
+
+    uint32_t seq = read32(segment + 4, 0);
+    uint8_t flags = segment[13];
+
+    TcpFlow *flow = get_flow(table, key, timestamp, !(flags & TCP_RST));
+    if (flow == NULL) {
+        return NO_ERROR;
+    }
+
+    touch_flow(table, flow, timestamp);
+
+    // The SYN occupies one sequence number, data starts right after it
+    if (flags & TCP_SYN) {
+        flow->nextSeq = seq + 1;
+        flow->seqKnown = 1;
+    }
+
+    flow_payload(table, flow, (flags & TCP_SYN) ? seq + 1 : seq, segment + header_length, length - header_length, timestamp);
+
+    if (flags & (TCP_FIN | TCP_RST)) {
+        remove_flow(table, flow - table->flows);
+
+        // A reset tears down both directions
+        if (flags & TCP_RST) {
+            FlowKey reverse = *key;
+            memcpy(reverse.srcAddr, key->dstAddr, sizeof(reverse.srcAddr));
+            memcpy(reverse.dstAddr, key->srcAddr, sizeof(reverse.dstAddr));
+            reverse.srcPort = key->dstPort;
+            reverse.dstPort = key->srcPort;
+
+            TcpFlow *other = get_flow(table, &reverse, timestamp, 0);
+            if (other != NULL) {
+                remove_flow(table, other - table->flows);
+            }
+        }
+    }
+
+    return NO_ERROR;
+}
+
+static int decode_ip(FlowTable *table, const unsigned char *packet, size_t length, uint64_t timestamp) {
+    FlowKey key;
+    memset(&key, 0, sizeof(key));
+
+    if (length < 1) {
+        return INVALID_FILE_LENGTH;
+    }
+
+    int version = packet[0] >> 4;
+
+    if (version == 4) {
+        if (length < 20) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        size_t header_length = (packet[0] & 0x0f) * 4;
+        size_t total_length = read16(packet + 2, 0);
+
+        if (header_length < 20 || total_length < header_length || total_length > length) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        // Fragments are not reassembled, handshakes practically never get fragmented on the IP level
+        if ((read16(packet + 6, 0) & 0x3fff) != 0 || packet[9] != 6) {
+            return NO_ERROR;
+        }
+
+        key.family = 4;
+        memcpy(key.srcAddr, packet + 12, 4);
+        memcpy(key.dstAddr, packet + 16, 4);
+
+        return decode_tcp(table, &key, packet + header_length, total_length - header_length, timestamp);
+    }
+
+    if (version == 6) {
+        if (length < 40) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        size_t payload_length = read16(packet + 4, 0);
+        if (40 + payload_length > length) {
+            return INVALID_FILE_LENGTH;
+        }
+
+        uint8_t next = packet[6];
+        size_t pos = 40;
+        size_t end = 40 + payload_length;
+
+        // Skip the extension headers that may precede TCP
+        while (next == 0 || next == 43 || next == 60) {
+            if (pos + 8 > end) {
+                return INVALID_FILE_LENGTH;
+            }
+
+            next = packet[pos];
+            pos += (packet[pos + 1] + 1) * 8;
+        }
+
+        if (next != 6 || pos > end) {
+            return NO_ERROR;
+        }
+
+        key.family = 6;
+        memcpy(key.srcAddr, packet + 8, 16);
+        memcpy(key.dstAddr, packet + 24, 16);
+
+        return decode_tcp(table, &key, packet + pos, end - pos, timestamp);
+    }
+
+    return NO_ERROR;
+}
+
+int process_packet(FlowTable *table, int link_type, const unsigned char *packet, size_t length, uint64_t timestamp) {
+    uint16_t ether_type;
+    size_t pos;
+
+    table->packets++;
+
+    if (table->timeout) {
+        expire_flows(table, timestamp);
+    }
+
+    switch (link_type) {
+        case LINKTYPE_ETHERNET:
+            if (length < 14) {
+                return INVALID_FILE_LENGTH;
+            }
+
+            ether_type = read16(packet + 12, 0);
+            pos = 14;
+
+            // 802.1Q and 802.1ad tags
+            while ((ether_type == 0x8100 || ether_type == 0x88a8) && pos + 4 <= length) {
+                ether_type = read16(packet + pos + 2, 0);
+                pos += 4;
+            }
+
+            if (ether_type != 0x0800 && ether_type != 0x86dd) {
+                return NO_ERROR;
+            }
+
+            return decode_ip(table, packet + pos, length - pos, timestamp);
+        case LINKTYPE_LINUX_SLL:
+            if (length < 16) {
+                return INVALID_FILE_LENGTH;
+            }
+
+            return decode_ip(table, packet + 16, length - 16, timestamp);
+        case LINKTYPE_LINUX_SLL2:
+            if (length < 20) {
+                return INVALID_FILE_LENGTH;
+            }
+
+            return decode_ip(table, packet + 20, length - 20, timestamp);
+        case LINKTYPE_NULL:
+            // 4 bytes of address family in the byte order of the capturing host
+            if (length < 4) {
+                return INVALID_FILE_LENGTH;
+            }
+
+            return decode_ip(table, packet + 4, length - 4, timestamp);
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            return decode_ip(table, packet, length, timestamp);
+        default:
+            return NO_ERROR;
+    }
+}
+
+static uint64_t to_microseconds(uint64_t value, uint64_t units_per_second) {
+    if (units_per_second == 1000000) {
+        return value;
+    }
+
+    return (value / units_per_second) * 1000000 + (value % units_per_second) * 1000000 / units_per_second;
+}
+
+static int read_pcap(const unsigned char *data, size_t size, FlowTable *table) {
+    uint32_t magic = read32(data, 0);
+    int swapped = 0;
+    uint64_t units = 1000000;
+
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC) {
+        units = magic == PCAP_MAGIC_NSEC ? 1000000000 : 1000000;
+    } else {
+        swapped = 1;
+        units = read32(data, 1) == PCAP_MAGIC_NSEC ? 1000000000 : 1000000;
+    }
+
+    if (size < PCAP_GLOBAL_HEADER_SIZE) {
+        return INVALID_CAPTURE_FILE;
+    }
+
+    int link_type = (int)(read32(data + 20, swapped) & 0xffff);
+    size_t pos = PCAP_GLOBAL_HEADER_SIZE;
+
+    while (pos + PCAP_RECORD_HEADER_SIZE <= size) {
+        uint64_t seconds = read32(data + pos, swapped);
+        uint64_t fraction = read32(data + pos + 4, swapped);
+        uint32_t captured = read32(data + pos + 8, swapped);
+
+        pos += PCAP_RECORD_HEADER_SIZE;
+
+        if (captured > size - pos) {
+            return INVALID_CAPTURE_FILE;
+        }
+
+        process_packet(table, link_type, data + pos, captured, seconds * 1000000 + to_microseconds(fraction, units));
+        pos += captured;
+    }
+
+    return pos == size ? NO_ERROR : INVALID_CAPTURE_FILE;
+}
+
+static void read_interface_options(const unsigned char *options, size_t length, int swapped, CaptureInterface *interface) {
+    size_t pos = 0;
+
+    while (pos + 4 <= length) {
+        uint16_t code = read16(options + pos, swapped);
+        uint16_t option_length = read16(options + pos + 2, swapped);
+
+        if (code == 0 || pos + 4 + option_length > length) {
+            return;
+        }
+
+        // if_tsresol, the high bit selects a power of two instead of a power of ten
+        if (code == 9 && option_length >= 1) {
+            uint8_t resolution = options[pos + 4];
+            uint64_t units = 1;
+            int i;
+
+            for (i = 0; i < (resolution & 0x7f) && units < 1000000000000000000ULL; i++) {
+                units *= (resolution & 0x80) ? 2 : 10;
+            }
+
+            interface->unitsPerSecond = units;
+        }
+
+        pos += 4 + ((option_length + 3) & ~3u);
+    }
+}
+
+static int read_pcapng(const unsigned char *data, size_t size, FlowTable *table) {
+    CaptureInterface interfaces[PCAPNG_MAX_INTERFACES];
+    int interface_count = 0;
+    int swapped = 0;
+    size_t pos = 0;
+    uint64_t last_timestamp = 0;
+
+    while (pos + 12 <= size) {
+        uint32_t type = read32(data + pos, swapped);
+
+        // Each section starts with its own byte order magic
+        if (read32(data + pos, 0) == PCAPNG_SECTION_HEADER) {
+            type = PCAPNG_SECTION_HEADER;
+            swapped = read32(data + pos + 8, 0) != PCAPNG_BYTE_ORDER_MAGIC;
+            interface_count = 0;
+        }
+
+        uint32_t length = read32(data + pos + 4, swapped);
+        if (length < 12 || length % 4 != 0 || length > size - pos) {
+            return INVALID_CAPTURE_FILE;
+        }
+
+        const unsigned char *body = data + pos + 8;
+        size_t body_length = length - 12;
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION && body_length >= 8) {
+            if (interface_count < PCAPNG_MAX_INTERFACES) {
+                CaptureInterface *interface = &interfaces[interface_count++];
+                interface->linkType = read16(body, swapped);
+                interface->snapLength = read32(body + 4, swapped);
+                interface->unitsPerSecond = 1000000;
+
+                read_interface_options(body + 8, body_length - 8, swapped, interface);
+            }
+        } else if (type == PCAPNG_ENHANCED_PACKET && body_length >= 20) {
+            uint32_t id = read32(body, swapped);
+            uint64_t ts = ((uint64_t)read32(body + 4, swapped) << 32) | read32(body + 8, swapped);
+            uint32_t captured = read32(body + 12, swapped);
+
+            if (captured > body_length - 20) {
+                return INVALID_CAPTURE_FILE;
+            }
+
+            if (id < (uint32_t)interface_count) {
+                last_timestamp = to_microseconds(ts, interfaces[id].unitsPerSecond);
+                process_packet(table, interfaces[id].linkType, body + 20, captured, last_timestamp);
+            }
+        } else if (type == PCAPNG_SIMPLE_PACKET && body_length >= 4 && interface_count > 0) {
+            // No timestamp in simple packets (the last one seen is used), the captured length is implied by the block length
+            uint32_t original = read32(body, swapped);
+            size_t captured = body_length - 4;
+
+            if (original < captured) {
+                captured = original;
+            }
+
+            if (interfaces[0].snapLength && interfaces[0].snapLength < captured) {
+                captured = interfaces[0].snapLength;
+            }
+
+            process_packet(table, interfaces[0].linkType, body + 4, captured, last_timestamp);
+        }
+
+        pos += length;
+    }
+
+    return pos == size ? NO_ERROR : INVALID_CAPTURE_FILE;
+}
+
+int read_capture(const unsigned char *data, size_t size, FlowTable *table) {
+    if (data == NULL || size < 12) {
+        return INVALID_CAPTURE_FILE;
+    }
+
+    uint32_t magic = read32(data, 0);
+
+    if (magic == PCAPNG_SECTION_HEADER) {
+        return read_pcapng(data, size, table);
+    }
+
+    if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC || read32(data, 1) == PCAP_MAGIC_USEC || read32(data, 1) == PCAP_MAGIC_NSEC) {
+        return read_pcap(data, size, table);
+    }
+
+    return INVALID_CAPTURE_FILE;
+}
+
+void format_flow_key(const FlowKey *key, char *buf, size_t size) {
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+    int family = key->family == 6 ? AF_INET6 : AF_INET;
+
+    inet_ntop(family, key->srcAddr, src, sizeof(src));
+    inet_ntop(family, key->dstAddr, dst, sizeof(dst));
+
+    if (family == AF_INET6) {
+        snprintf(buf, size, "[%s]:%u -> [%s]:%u", src, key->srcPort, dst, key->dstPort);
+    } else {
+        snprintf(buf, size, "%s:%u -> %s:%u", src, key->srcPort, dst, key->dstPort);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef TLS_PCAP_H
+#define TLS_PCAP_H
+
+#include "tls_parser.h"
+#include "tls_stream.h"
+
+#define DEFAULT_MAX_FLOWS 65536
+#define DEFAULT_FLOW_STREAM_CAPACITY 32768 // Per direction, fits any record of up to 2^15 bytes
+#define DEFAULT_FLOW_TIMEOUT 120000000ULL  // Microseconds of inactivity until a flow is evicted
+#define MAX_PENDING_SEGMENTS 8             // Out of order segments kept per flow direction
+#define FLOW_MAX_MESSAGE_SIZE 65536        // Larger handshake messages of a flow are skipped as MESSAGE_TOO_LARGE
+#define DEFAULT_FLOW_MEMORY_BUDGET (256 * 1024 * 1024) // Bytes of rings and pending segments of all flows
+
+// Link layer types (as used in pcap and pcapng)
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+// One direction of a TCP connection
+typedef struct {
+    uint8_t family;           // 4 or 6
+    uint8_t srcAddr[16];      // IPv4 addresses only use the first 4 bytes
+    uint8_t dstAddr[16];
+    uint16_t srcPort;
+    uint16_t dstPort;
+} FlowKey;
+
+typedef enum {
+    FLOW_ACTIVE = 0,          // Payload is fed into the record stream
+    FLOW_ENCRYPTED = 1,       // ChangeCipherSpec was seen, the rest can't be parsed
+    FLOW_IGNORED = 2,         // Not TLS or the stream got out of sync
+} FlowState;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t length;
+    unsigned char *data;
+} PendingSegment;
+
+typedef struct {
+    FlowKey key;
+    uint32_t hash;
+    uint32_t lruPrev;         // Slot indexes, most recently active first
+    uint32_t lruNext;
+    uint32_t bufferPrev;      // Same for the flows that hold buffers (memory > 0)
+    uint32_t bufferNext;
+    uint8_t used;
+    uint8_t seqKnown;
+    uint8_t state;
+    uint32_t nextSeq;         // Sequence number of the next in order byte
+    uint64_t firstSeen;       // Microseconds since the epoch
+    uint64_t lastSeen;
+    unsigned long messages;   // Handshake messages reported for this flow
+    RecordStream stream;      // The ring is only allocated once the flow carries payload
+    int pendingCount;
+    uint32_t pendingBytes;    // At most the stream capacity
+    uint32_t memory;          // Charged against the memory budget of the table
+    PendingSegment pending[MAX_PENDING_SEGMENTS];
+} TcpFlow;
+
+typedef void (*FlowMessageCallback)(void *user, const TcpFlow *flow, HandshakeMessage *tls_message, int err, uint64_t timestamp);
+
+// Open addressed table of TCP flows (one entry per direction) with their reassembly state and two
+// LRU lists through the slots, one of all flows and one of the flows that hold buffers. Flows are
+// evicted on FIN/RST, after a period of inactivity or, when the table is full, least recently
+// active first.
+// The buffers of the flows are charged against memoryBudget (DEFAULT_FLOW_MEMORY_BUDGET, can be
+// changed after init_flow_table): a flow that starts to carry payload is charged its ring and
+// scratch buffer plus a message reassembled from several records (2 * streamCapacity +
+// FLOW_MAX_MESSAGE_SIZE), every out of order segment its length. Once the budget is spent, the
+// buffers of the least recently active flows are given up first and these flows are no longer
+// parsed (counted in flowsEvicted, their slots stay until they are evicted as above). Only if the
+// charge still doesn't fit, the flow itself stops being parsed and its segment is counted in
+// segmentsDropped. So the table takes at most
+// memoryBudget plus its slots (capacity * sizeof(TcpFlow), about 50 MB for DEFAULT_MAX_FLOWS, of
+// which only the pages in use are mapped). The buffers are given back at the ChangeCipherSpec.
+typedef struct {
+    TcpFlow *flows;
+    size_t capacity;          // Number of slots, power of two
+    size_t maxFlows;
+    size_t count;
+    size_t streamCapacity;    // Power of two
+    size_t memoryBudget;
+    size_t memoryUsed;
+    uint32_t lruHead;
+    uint32_t lruTail;
+    uint32_t bufferHead;
+    uint32_t bufferTail;
+    uint64_t timeout;
+    FlowMessageCallback onMessage;
+    void *user;
+
+    unsigned long packets;
+    unsigned long segments;       // TCP segments with payload
+    unsigned long flowsCreated;
+    unsigned long flowsEvicted;   // Including the flows whose buffers were given up for the budget
+    unsigned long flowsIgnored;   // Flows that turned out not to be TLS
+    unsigned long segmentsDropped;
+} FlowTable;
+
+int init_flow_table(FlowTable *table, size_t max_flows, size_t stream_capacity, uint64_t timeout, FlowMessageCallback on_message, void *user);
+void free_flow_table(FlowTable *table);
+int read_capture(const unsigned char *data, size_t size, FlowTable *table);
+int process_packet(FlowTable *table, int link_type, const unsigned char *packet, size_t length, uint64_t timestamp);
+void format_flow_key(const FlowKey *key, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,347 @@
+#include "tls_parser.h"
+#include "tls_output.h"
+#include "tls_x509.h"
+
+// Zero padded hex, encoded in chunks instead of one printf per byte
+static void print_hex(const unsigned char *data, size_t length) {
+    char hex[512];
+
+    while (length > 0) {
+        size_t chunk = length < sizeof(hex) / 2 ? length : sizeof(hex) / 2;
+
+        format_hex(data, chunk, hex);
+        fwrite(hex, 1, 2 * chunk, stdout);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+// Cipher suites (2 bytes) or SSLv2 CipherSpecs (3 bytes)
+static void print_cipher_suites(const unsigned char *suites, uint16_t length, size_t size) {
+    char line[9 * 64];
+    size_t pos = 0;
+    size_t entry = 2 * size + 3;
+
+    // "0x" + hex digits + ' ' per suite
+    for (uint16_t i = 0; i + size <= length; i += size) {
+        if (pos + entry > sizeof(line)) {
+            fwrite(line, 1, pos, stdout);
+            pos = 0;
+        }
+
+        line[pos] = '0';
+        line[pos + 1] = 'x';
+        format_hex(suites + i, size, line + pos + 2);
+        line[pos + entry - 1] = ' ';
+        pos += entry;
+    }
+
+    fwrite(line, 1, pos, stdout);
+}
+
+void print_tls_record_layer_info(HandshakeMessage *tls_message) {
+    printf("Identified the following TLS message:\n\n");
+    if (tls_message->sslv2) {
+        printf("Record format: SSLv2 compatible\n");
+    }
+
+    printf("TLS Version: ");
+
+    print_tls_version(tls_message->version.minor);
+
+    printf("Protocol type: %d\n", tls_message->cType);
+    printf("Fragment length: %d\n", tls_message->fLength);
+    printf("Handshake message type: %d\n\n", tls_message->hsType);
+}
+
+void print_client_hello_message(ClientHello *message) {
+    printf("Details of ClientHello:\n\n");
+    printf("TLS Version: ");
+
+    print_tls_version(message->version.minor);
+
+    if (message->maxVersion.minor != message->version.minor) {
+        printf("Highest supported version: ");
+        print_tls_version(message->maxVersion.minor);
+    }
+
+    if (message->sslv2) {
+        printf("Challenge: ");
+        print_hex(message->challenge, message->challengeLength);
+        printf("\n");
+    } else {
+        // Time in human-readable format
+        char buf[32];
+        format_hello_timestamp(message->random.time, buf, sizeof(buf));
+        printf("Timestamp: %s\n", buf);
+
+        printf("Random data: ");
+        print_hex(message->random.random_bytes, HELLO_RANDOM_BYTES_SIZE);
+        printf("\n");
+    }
+
+    printf("SessionID: ");
+    if ( message->sessionId.length != 0) {
+        print_hex(message->sessionId.sessionId, message->sessionId.length);
+    } else {
+        printf("N/A");
+    }
+
+    printf("\n");
+
+    if (message->sslv2) {
+        printf("Cipher specs:\n");
+        print_cipher_suites(message->cipherSpecs, message->cipherSpecsLength, SSLV2_CIPHER_SPEC_SIZE);
+    } else {
+        printf("Choosen cipher suites:\n");
+        print_cipher_suites(message->csCollection.cipherSuites, message->csCollection.length, 2);
+    }
+    printf("\n");
+
+    uint32_t classes = classify_client_hello_cipher_suites(message);
+    if (classes != 0) {
+        printf("Cipher suite classes:");
+        for (int i = 0; i < CIPHER_SUITE_CLASSES; i++) {
+            if (classes & (1u << i)) {
+                printf(" %s", get_cipher_suite_class_name(1u << i));
+            }
+        }
+        printf("\n");
+    }
+
+    printf("Compresion method: %d\n", message->compresionMethod.compresionMethod);
+    printf("Has extensions: %s\n", message->hasExtensions ? "true" : "false");
+
+    if (message->hasExtensions) {
+        print_extension_details(&message->extensionIndex);
+    }
+
+    printf("Raw extensions data:\n\n");
+    print_hex(message->extensions, message->extensionsLength);
+
+    printf("\n");
+}
+
+void print_server_hello_message(ServerHello *message) {
+    printf("Details of ServerHello:\n\n");
+    printf("TLS Version: ");
+
+    print_tls_version(message->version.minor);
+
+    if (message->selectedVersion.minor != message->version.minor) {
+        printf("Selected version: ");
+        print_tls_version(message->selectedVersion.minor);
+    }
+
+    if (message->helloRetryRequest) {
+        printf("HelloRetryRequest: true\n");
+    }
+
+    // Time in human-readable format
+    char buf[32];
+    format_hello_timestamp(message->random.time, buf, sizeof(buf));
+    printf("Timestamp: %s\n", buf);
+
+    printf("Random data: ");
+    print_hex(message->random.random_bytes, HELLO_RANDOM_BYTES_SIZE);
+    printf("\n");
+
+    printf("SessionID: ");
+    if ( message->sessionId.length != 0) {
+        print_hex(message->sessionId.sessionId, message->sessionId.length);
+    } else {
+        printf("N/A");
+    }
+
+    printf("\n");
+
+    printf("Choosen cipher suite: 0x");
+    print_hex(message->cipherSuite, 2);
+    printf("\n");
+
+    printf("Compresion method: %d\n", message->compresionMethod);
+    if (message->hasExtensions) {
+        printf("Has extensions: true\n");
+        print_extension_details(&message->extensionIndex);
+        printf("Raw extensions data:\n\n");
+        print_hex(message->extensions, message->extensionsLength);
+    } else {
+        printf("Has extensions: false");
+    } 
+
+    printf("\n");
+}
+
+void print_extension_details(ExtensionIndex *index) {
+    const unsigned char *name;
+    uint16_t length;
+    ProtocolNameList protocols;
+    KeyShareList shares;
+    Uint16List list;
+    int i;
+
+    printf("Extension types:");
+    for (i = 0; i < index->count; i++) {
+        printf(" %u", index->entries[i].type);
+    }
+    printf("\n");
+
+    if (get_server_name(index, &name, &length) == NO_ERROR) {
+        printf("Server name: %.*s\n", length, name);
+    }
+
+    if (get_alpn_protocols(index, &protocols) == NO_ERROR) {
+        printf("ALPN protocols:");
+        for (i = 0; i < protocols.count; i++) {
+            printf(" %.*s", protocols.names[i].length, protocols.names[i].name);
+        }
+        printf("\n");
+    }
+
+    if (get_supported_versions(index, &list) == NO_ERROR) {
+        printf("Supported versions:");
+        for (i = 0; i < list.count; i++) {
+            printf(" 0x%04x", get_uint16_list_value(&list, i));
+        }
+        printf("\n");
+    }
+
+    if (get_supported_groups(index, &list) == NO_ERROR) {
+        printf("Supported groups:");
+        for (i = 0; i < list.count; i++) {
+            printf(" %u", get_uint16_list_value(&list, i));
+        }
+        printf("\n");
+    }
+
+    if (get_signature_algorithms(index, &list) == NO_ERROR) {
+        printf("Signature algorithms:");
+        for (i = 0; i < list.count; i++) {
+            printf(" 0x%04x", get_uint16_list_value(&list, i));
+        }
+        printf("\n");
+    }
+
+    if (get_key_shares(index, &shares) == NO_ERROR) {
+        printf("Key shares:");
+        for (i = 0; i < shares.count; i++) {
+            if (shares.entries[i].keyExchange != NULL) {
+                printf(" %u (%u bytes)", shares.entries[i].group, shares.entries[i].length);
+            } else {
+                printf(" %u", shares.entries[i].group);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void print_certificate_chain(CertificateChain *chain) {
+    CertificateSummary summary;
+    char not_before[32], not_after[32];
+    int i;
+
+    for (i = 0; i < chain->count; i++) {
+        printf("\nCertificate %d (%u bytes):\n", i, chain->entries[i].length);
+
+        if (summarize_certificate(chain->entries[i].data, chain->entries[i].length, &summary) != NO_ERROR) {
+            printf("Could not be decoded: %s\n", get_error_description(summary.error));
+        } else {
+            format_x509_time(summary.notBefore, not_before, sizeof(not_before));
+            format_x509_time(summary.notAfter, not_after, sizeof(not_after));
+
+            printf("Subject: %s\n", summary.subject);
+            printf("Issuer: %s\n", summary.issuer);
+            printf("Validity: %s - %s\n", not_before, not_after);
+            if (summary.altNames[0] != '\0') {
+                printf("Alternative names: %s\n", summary.altNames);
+            }
+        }
+
+        printf("SHA-256 fingerprint: ");
+        print_hex(summary.fingerprint, CERTIFICATE_FINGERPRINT_SIZE);
+        printf("\n");
+    }
+
+    if (chain->truncated) {
+        printf("\nFurther certificates were not decoded.\n");
+    }
+}
+
+void format_hello_timestamp(uint32_t timestamp, char *buf, size_t size) {
+    // localtime_r/strftime instead of localtime/asctime, which share static buffers between threads
+    time_t raw_time = (time_t) timestamp;
+    struct tm timeinfo;
+
+    if (size == 0) {
+        return;
+    }
+
+    if (localtime_r(&raw_time, &timeinfo) == NULL || strftime(buf, size, "%a %b %e %H:%M:%S %Y", &timeinfo) == 0) {
+        snprintf(buf, size, "%u", timestamp);
+    }
+}
+
+void print_tls_version(uint8_t minor) {
+    static const char *const names[] = { "unknown", "1.0", "1.1", "1.2", "1.3" };
+
+    printf("%s\n", names[minor < sizeof(names) / sizeof(names[0]) ? minor : 0]);
+}
+
+void print_key_exchange_message(HandshakeMessage *tls_message) {
+    printf("The key exchange parameters provided are %d bytes long.\n", tls_message->mLength);
+}
+
+void print_certificate_request_message(CertificateRequest *request) {
+    int i;
+
+    printf("Details of CertificateRequest:\n\n");
+
+    printf("Certificate types:");
+    for (i = 0; i < request->certificateTypesCount; i++) {
+        printf(" %u", request->certificateTypes[i]);
+    }
+    printf("\n");
+
+    if (request->signatureAlgorithms.count > 0) {
+        printf("Signature algorithms:");
+        for (i = 0; i < request->signatureAlgorithms.count; i++) {
+            printf(" 0x%04x", get_uint16_list_value(&request->signatureAlgorithms, i));
+        }
+        printf("\n");
+    }
+
+    printf("Certificate authorities: %u\n", request->authorityCount);
+
+    // Each authority is a DER encoded Name behind its 2 bytes length
+    uint32_t pos = 0;
+    while (pos + 2 <= request->authoritiesLength) {
+        uint16_t length = (request->authorities[pos] << 8) | request->authorities[pos + 1];
+        char name[CERTIFICATE_NAME_SIZE];
+
+        format_x509_name(request->authorities + pos + 2, length, name, sizeof(name));
+        printf("  %s\n", name[0] != '\0' ? name : "(malformed name)");
+        pos += 2 + length;
+    }
+}
+
+void print_certificate_verify_message(CertificateVerify *verify) {
+    printf("Details of CertificateVerify:\n\n");
+
+    if (verify->hasAlgorithm) {
+        printf("Signature algorithm: 0x%04x\n", verify->algorithm);
+    }
+
+    printf("Signature (%u bytes): ", verify->signatureLength);
+    print_hex(verify->signature, verify->signatureLength);
+    printf("\n");
+}
+
+void print_finished_message(Finished *finished) {
+    printf("Verify data: ");
+    print_hex(finished->verifyData, finished->length);
+    printf("\n");
+}
+
+void print_handshake_details(ParsedMessage *parsed) {
+    get_message_descriptor(parsed->handshake.hsType)->print(parsed);
+}
@@ -0,0 +1,498 @@
+#include "tls_session.h"
+
+#define LRU_NONE UINT32_MAX
+
+typedef struct {
+    uint8_t state;
+    uint8_t hsType;
+    uint8_t fromClient;
+    uint8_t next;
+} HandshakeTransition;
+
+// Every message a TLS 1.0 - 1.2 handshake may contain at a given point, in the order of RFC 5246
+// section 7.3. HelloRequest can come at any time and is not part of the sequence. A TLS 1.3
+// handshake is encrypted after the ServerHello, a HelloRetryRequest starts it over (see
+// track_handshake_message).
+static const HandshakeTransition transitions[] = {
+    { HS_STATE_START, CLIENT_HELLO, 1, HS_STATE_CLIENT_HELLO },
+    { HS_STATE_CLIENT_HELLO, SERVER_HELLO, 0, HS_STATE_SERVER_HELLO },
+    { HS_STATE_SERVER_HELLO, CERTIFICATE, 0, HS_STATE_SERVER_CERTIFICATE },
+    { HS_STATE_SERVER_HELLO, SERVER_KEY_EXCHANGE, 0, HS_STATE_SERVER_KEY_EXCHANGE },  // Anonymous and PSK suites
+    { HS_STATE_SERVER_HELLO, SERVER_HELLO_DONE, 0, HS_STATE_SERVER_HELLO_DONE },
+    { HS_STATE_SERVER_CERTIFICATE, SERVER_KEY_EXCHANGE, 0, HS_STATE_SERVER_KEY_EXCHANGE },
+    { HS_STATE_SERVER_CERTIFICATE, CERTIFICATE_REQUEST, 0, HS_STATE_CERTIFICATE_REQUEST },
+    { HS_STATE_SERVER_CERTIFICATE, SERVER_HELLO_DONE, 0, HS_STATE_SERVER_HELLO_DONE },
+    { HS_STATE_SERVER_KEY_EXCHANGE, CERTIFICATE_REQUEST, 0, HS_STATE_CERTIFICATE_REQUEST },
+    { HS_STATE_SERVER_KEY_EXCHANGE, SERVER_HELLO_DONE, 0, HS_STATE_SERVER_HELLO_DONE },
+    { HS_STATE_CERTIFICATE_REQUEST, SERVER_HELLO_DONE, 0, HS_STATE_SERVER_HELLO_DONE },
+    { HS_STATE_SERVER_HELLO_DONE, CERTIFICATE, 1, HS_STATE_CLIENT_CERTIFICATE },
+    { HS_STATE_SERVER_HELLO_DONE, CLIENT_KEY_EXCHANGE, 1, HS_STATE_CLIENT_KEY_EXCHANGE },
+    { HS_STATE_CLIENT_CERTIFICATE, CLIENT_KEY_EXCHANGE, 1, HS_STATE_CLIENT_KEY_EXCHANGE },
+    { HS_STATE_CLIENT_KEY_EXCHANGE, CERTIFICATE_VERIFY, 1, HS_STATE_CERTIFICATE_VERIFY },
+};
+
+static int next_handshake_state(int state, int hs_type, int from_client) {
+    size_t i;
+
+    for (i = 0; i < sizeof(transitions) / sizeof(transitions[0]); i++) {
+        if (transitions[i].state == state && transitions[i].hsType == hs_type && transitions[i].fromClient == from_client) {
+            return transitions[i].next;
+        }
+    }
+
+    return HS_STATE_FAILED;
+}
+
+static uint32_t hash_session_key(const FlowKey *key) {
+    // FNV-1a, like the flow table
+    const unsigned char *p = (const unsigned char *)key;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(*key); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+// Puts the smaller endpoint first, returns whether the sender ended up as src
+static int normalize_key(const FlowKey *key, FlowKey *normalized) {
+    size_t length = key->family == 6 ? 16 : 4;
+    int order = memcmp(key->srcAddr, key->dstAddr, length);
+
+    memset(normalized, 0, sizeof(*normalized));
+    normalized->family = key->family;
+
+    if (order < 0 || (order == 0 && key->srcPort <= key->dstPort)) {
+        memcpy(normalized->srcAddr, key->srcAddr, length);
+        memcpy(normalized->dstAddr, key->dstAddr, length);
+        normalized->srcPort = key->srcPort;
+        normalized->dstPort = key->dstPort;
+
+        return 1;
+    }
+
+    memcpy(normalized->srcAddr, key->dstAddr, length);
+    memcpy(normalized->dstAddr, key->srcAddr, length);
+    normalized->srcPort = key->dstPort;
+    normalized->dstPort = key->srcPort;
+
+    return 0;
+}
+
+int init_session_table(SessionTable *table, size_t max_sessions, uint64_t timeout, SessionCallback on_session, void *user) {
+    memset(table, 0, sizeof(*table));
+
+    // Load factor below 3/4 as in the flow table. calloc leaves untouched pages unmapped, so a
+    // large table only costs memory for the slots that are actually used.
+    size_t capacity = 16;
+    while (capacity * 3 / 4 < max_sessions) {
+        capacity <<= 1;
+    }
+
+    if (capacity > LRU_NONE) {
+        return -1;
+    }
+
+    table->sessions = (HandshakeSession *)calloc(capacity, sizeof(HandshakeSession));
+    if (table->sessions == NULL) {
+        return -1;
+    }
+
+    table->capacity = capacity;
+    table->maxSessions = max_sessions;
+    table->lruHead = LRU_NONE;
+    table->lruTail = LRU_NONE;
+    table->timeout = timeout;
+    table->onSession = on_session;
+    table->user = user;
+
+    return 0;
+}
+
+void free_session_table(SessionTable *table) {
+    free(table->sessions);
+    table->sessions = NULL;
+    table->count = 0;
+}
+
+static void lru_unlink(SessionTable *table, uint32_t index) {
+    HandshakeSession *session = &table->sessions[index];
+
+    if (session->lruPrev != LRU_NONE) {
+        table->sessions[session->lruPrev].lruNext = session->lruNext;
+    } else {
+        table->lruHead = session->lruNext;
+    }
+
+    if (session->lruNext != LRU_NONE) {
+        table->sessions[session->lruNext].lruPrev = session->lruPrev;
+    } else {
+        table->lruTail = session->lruPrev;
+    }
+}
+
+static void lru_push_front(SessionTable *table, uint32_t index) {
+    HandshakeSession *session = &table->sessions[index];
+
+    session->lruPrev = LRU_NONE;
+    session->lruNext = table->lruHead;
+
+    if (table->lruHead != LRU_NONE) {
+        table->sessions[table->lruHead].lruPrev = index;
+    } else {
+        table->lruTail = index;
+    }
+
+    table->lruHead = index;
+}
+
+// Moves the entry in slot from to the empty slot to, keeping its neighbours in the LRU list pointed at it
+static void move_session(SessionTable *table, uint32_t from, uint32_t to) {
+    HandshakeSession *session = &table->sessions[from];
+
+    if (session->lruPrev != LRU_NONE) {
+        table->sessions[session->lruPrev].lruNext = to;
+    } else {
+        table->lruHead = to;
+    }
+
+    if (session->lruNext != LRU_NONE) {
+        table->sessions[session->lruNext].lruPrev = to;
+    } else {
+        table->lruTail = to;
+    }
+
+    table->sessions[to] = *session;
+    memset(session, 0, sizeof(*session));
+}
+
+static void remove_session(SessionTable *table, uint32_t index) {
+    lru_unlink(table, index);
+    memset(&table->sessions[index], 0, sizeof(HandshakeSession));
+    table->count--;
+
+    // Backward shift deletion, see remove_flow
+    uint32_t mask = table->capacity - 1;
+    uint32_t hole = index;
+    uint32_t i = (index + 1) & mask;
+
+    while (table->sessions[i].used) {
+        uint32_t home = table->sessions[i].hash & mask;
+
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            move_session(table, i, hole);
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+static void report_session(SessionTable *table, uint32_t index, int outcome) {
+    HandshakeSession *session = &table->sessions[index];
+
+    session->outcome = outcome;
+    table->reported[outcome]++;
+
+    if (table->onSession) {
+        table->onSession(table->user, session);
+    }
+
+    remove_session(table, index);
+}
+
+static void expire_sessions(SessionTable *table, uint64_t now) {
+    // The tail is the least recently used session, everything before it is newer
+    while (table->lruTail != LRU_NONE && table->sessions[table->lruTail].lastSeen + table->timeout < now) {
+        report_session(table, table->lruTail, SESSION_INCOMPLETE);
+    }
+}
+
+void flush_session_table(SessionTable *table) {
+    while (table->lruTail != LRU_NONE) {
+        report_session(table, table->lruTail, SESSION_INCOMPLETE);
+    }
+}
+
+static uint32_t find_session(SessionTable *table, const FlowKey *key, uint32_t hash) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (table->sessions[i].used) {
+        if (table->sessions[i].hash == hash && memcmp(&table->sessions[i].key, key, sizeof(*key)) == 0) {
+            return i;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static uint32_t create_session(SessionTable *table, const FlowKey *key, uint32_t hash, uint64_t now) {
+    if (table->count >= table->maxSessions) {
+        table->evicted++;
+        report_session(table, table->lruTail, SESSION_INCOMPLETE);
+    }
+
+    uint32_t index = find_session(table, key, hash);
+    HandshakeSession *session = &table->sessions[index];
+    int i;
+
+    memset(session, 0, sizeof(*session));
+    session->key = *key;
+    session->hash = hash;
+    session->used = 1;
+    session->started = now;
+    session->lastSeen = now;
+    session->cipherSuiteOffered = -1;
+
+    for (i = 0; i < HS_STAGES; i++) {
+        session->offsets[i] = SESSION_NOT_SEEN;
+    }
+
+    lru_push_front(table, index);
+    table->count++;
+
+    return index;
+}
+
+static void record_client_hello(HandshakeSession *session, const ClientHello *hello) {
+    uint16_t i, pos = 0, suite;
+
+    session->clientHelloParsed = 1;
+    session->offeredVersion = hello->maxVersion;
+    session->offeredCount = 0;
+    session->offeredTruncated = 0;
+    session->sessionIdLength = hello->sessionId.length <= 32 ? hello->sessionId.length : 32;
+    if (session->sessionIdLength > 0) {
+        memcpy(session->sessionId, hello->sessionId.sessionId, session->sessionIdLength);
+    }
+
+    for (i = 0; i + 1 < hello->csCollection.length; i += 2) {
+        suite = (hello->csCollection.cipherSuites[i] << 8) | hello->csCollection.cipherSuites[i + 1];
+
+        if (is_grease_value(suite)) {
+            continue;
+        }
+
+        if (session->offeredCount == MAX_OFFERED_CIPHER_SUITES) {
+            session->offeredTruncated = 1;
+            break;
+        }
+
+        session->offered[session->offeredCount++] = suite;
+    }
+
+    while (hello->sslv2 && next_sslv2_cipher_suite(hello, &pos, &suite)) {
+        if (session->offeredCount == MAX_OFFERED_CIPHER_SUITES) {
+            session->offeredTruncated = 1;
+            break;
+        }
+
+        session->offered[session->offeredCount++] = suite;
+    }
+}
+
+// Returns whether the server resumed the session the client offered
+static int record_server_hello(SessionTable *table, HandshakeSession *session, const ServerHello *hello) {
+    int i;
+
+    session->version = hello->selectedVersion;
+    session->cipherSuite = (hello->cipherSuite[0] << 8) | hello->cipherSuite[1];
+    session->compression = hello->compresionMethod;
+
+    session->cipherSuiteOffered = -1;
+
+    // Nothing to check against if the capture started after the ClientHello or it didn't parse
+    if (session->clientHelloParsed) {
+        session->cipherSuiteOffered = 0;
+
+        for (i = 0; i < session->offeredCount; i++) {
+            if (session->offered[i] == session->cipherSuite) {
+                session->cipherSuiteOffered = 1;
+                break;
+            }
+        }
+
+        // Not in the part that was kept, so it may still have been offered
+        if (!session->cipherSuiteOffered && session->offeredTruncated) {
+            session->cipherSuiteOffered = -1;
+        }
+
+        if (session->cipherSuiteOffered == 0) {
+            table->cipherSuitesNotOffered++;
+
+            if (session->error == NO_ERROR) {
+                session->error = CIPHER_SUITE_NOT_OFFERED;
+            }
+        }
+    }
+
+    // TLS 1.3 echoes the legacy session id in any case, resumption uses a pre_shared_key instead
+    return !session->partial && hello->selectedVersion.minor < 4 && session->sessionIdLength > 0 && hello->sessionId.length == session->sessionIdLength &&
+           memcmp(hello->sessionId.sessionId, session->sessionId, session->sessionIdLength) == 0;
+}
+
+int track_handshake_message(SessionTable *table, const FlowKey *key, const ParsedMessage *parsed, int err, uint64_t timestamp) {
+    const HandshakeMessage *handshake = &parsed->handshake;
+
+    // Without a body the message type isn't known, a HelloRequest doesn't change anything
+    if (handshake->body == NULL || handshake->hsType == HELLO_REQUEST) {
+        return NO_ERROR;
+    }
+
+    expire_sessions(table, timestamp);
+
+    FlowKey normalized;
+    int sender_is_src = normalize_key(key, &normalized);
+    uint32_t hash = hash_session_key(&normalized);
+    uint32_t index = find_session(table, &normalized, hash);
+    HandshakeSession *session = &table->sessions[index];
+
+    // After a HelloRetryRequest the client sends a second ClientHello on the same connection
+    if (session->used && handshake->hsType == CLIENT_HELLO && !(session->helloRetryRequest && session->state == HS_STATE_START)) {
+        // A new connection on the same ports, the previous one never finished
+        report_session(table, index, SESSION_INCOMPLETE);
+        session = NULL;
+    } else if (!session->used) {
+        session = NULL;
+    }
+
+    if (session == NULL) {
+        // A connection is only followed from its ClientHello, or from the ServerHello if the
+        // capture started in between. Anything else can't be validated.
+        if (handshake->hsType != CLIENT_HELLO && handshake->hsType != SERVER_HELLO) {
+            return NO_ERROR;
+        }
+
+        index = create_session(table, &normalized, hash, timestamp);
+        session = &table->sessions[index];
+        session->clientIsSrc = handshake->hsType == CLIENT_HELLO ? sender_is_src : !sender_is_src;
+
+        if (handshake->hsType == SERVER_HELLO) {
+            session->partial = 1;
+            session->state = HS_STATE_CLIENT_HELLO;
+        }
+    } else {
+        lru_unlink(table, index);
+        lru_push_front(table, index);
+    }
+
+    int from_client = sender_is_src == session->clientIsSrc;
+    int next = next_handshake_state(session->state, handshake->hsType, from_client);
+
+    session->messages++;
+    session->lastType = handshake->hsType;
+    session->lastSeen = timestamp;
+
+    if (next == HS_STATE_FAILED) {
+        session->state = HS_STATE_FAILED;
+        session->error = UNEXPECTED_HANDSHAKE_MESSAGE;
+        report_session(table, index, SESSION_INVALID);
+
+        return UNEXPECTED_HANDSHAKE_MESSAGE;
+    }
+
+    session->state = next;
+
+    uint64_t offset = timestamp >= session->started ? timestamp - session->started : 0;
+    session->offsets[next] = offset < SESSION_NOT_SEEN ? (uint32_t)offset : SESSION_NOT_SEEN - 1;
+
+    // Unsupported types are still valid steps of the sequence, anything else is a broken message
+    if (err != NO_ERROR) {
+        if (err != UNSUPPORTED_MESSAGE_TYPE && session->error == NO_ERROR) {
+            session->error = err;
+        }
+
+        // The suites of a ClientHello before a HelloRetryRequest don't apply to the second one
+        if (next == HS_STATE_CLIENT_HELLO) {
+            session->clientHelloParsed = 0;
+        }
+    } else if (next == HS_STATE_CLIENT_HELLO) {
+        record_client_hello(session, &parsed->clientHello);
+    } else if (next == HS_STATE_SERVER_HELLO) {
+        const ServerHello *hello = &parsed->serverHello;
+        int cipher_error = session->error;
+
+        // Only one HelloRetryRequest is allowed per handshake (RFC 8446 section 4.1.4)
+        if (hello->helloRetryRequest && session->helloRetryRequest) {
+            session->state = HS_STATE_FAILED;
+            session->error = UNEXPECTED_HANDSHAKE_MESSAGE;
+            report_session(table, index, SESSION_INVALID);
+
+            return UNEXPECTED_HANDSHAKE_MESSAGE;
+        }
+
+        if (record_server_hello(table, session, hello)) {
+            report_session(table, index, SESSION_RESUMED);
+
+            return NO_ERROR;
+        }
+
+        int result = cipher_error == NO_ERROR && session->error == CIPHER_SUITE_NOT_OFFERED ? CIPHER_SUITE_NOT_OFFERED : NO_ERROR;
+
+        if (hello->helloRetryRequest) {
+            session->helloRetryRequest = 1;
+            session->state = HS_STATE_START;
+        } else if (hello->selectedVersion.minor >= 4) {
+            // Everything after a TLS 1.3 ServerHello is encrypted
+            report_session(table, index, SESSION_COMPLETE);
+        }
+
+        return result;
+    }
+
+    if (next == HS_STATE_CERTIFICATE_REQUEST) {
+        session->certificateRequested = 1;
+    } else if (next == HS_STATE_CLIENT_CERTIFICATE && handshake->mLength > 3) {
+        // More than the empty certificate_list, the client has to prove it owns the key
+        session->clientCertificate = 1;
+    }
+
+    if ((next == HS_STATE_CLIENT_KEY_EXCHANGE && !session->clientCertificate) || next == HS_STATE_CERTIFICATE_VERIFY) {
+        report_session(table, index, SESSION_COMPLETE);
+    }
+
+    return NO_ERROR;
+}
+
+void get_session_client_key(const HandshakeSession *session, FlowKey *key) {
+    *key = session->key;
+
+    if (!session->clientIsSrc) {
+        memcpy(key->srcAddr, session->key.dstAddr, sizeof(key->srcAddr));
+        memcpy(key->dstAddr, session->key.srcAddr, sizeof(key->dstAddr));
+        key->srcPort = session->key.dstPort;
+        key->dstPort = session->key.srcPort;
+    }
+}
+
+const char *get_handshake_state_name(int state) {
+    switch (state) {
+        case HS_STATE_START: return "Start";
+        case HS_STATE_CLIENT_HELLO: return "ClientHello";
+        case HS_STATE_SERVER_HELLO: return "ServerHello";
+        case HS_STATE_SERVER_CERTIFICATE: return "Certificate";
+        case HS_STATE_SERVER_KEY_EXCHANGE: return "ServerKeyExchange";
+        case HS_STATE_CERTIFICATE_REQUEST: return "CertificateRequest";
+        case HS_STATE_SERVER_HELLO_DONE: return "ServerHelloDone";
+        case HS_STATE_CLIENT_CERTIFICATE: return "ClientCertificate";
+        case HS_STATE_CLIENT_KEY_EXCHANGE: return "ClientKeyExchange";
+        case HS_STATE_CERTIFICATE_VERIFY: return "CertificateVerify";
+        case HS_STATE_FAILED: return "Failed";
+        default: return "unknown";
+    }
+}
+
+const char *get_session_outcome_name(int outcome) {
+    switch (outcome) {
+        case SESSION_COMPLETE: return "complete";
+        case SESSION_RESUMED: return "resumed";
+        case SESSION_INCOMPLETE: return "incomplete";
+        case SESSION_INVALID: return "invalid";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include "tls_parser.h"
+#include "tls_pcap.h"
+
+#define DEFAULT_MAX_SESSIONS 262144
+#define DEFAULT_SESSION_TIMEOUT 120000000ULL // Microseconds without a message until a handshake is given up
+#define MAX_OFFERED_CIPHER_SUITES 32         // Offered suites kept per session, GREASE values not counted
+#define SESSION_NOT_SEEN UINT32_MAX          // Stage offset of a message that wasn't seen
+
+// Position in the (TLS 1.0 - 1.2) handshake, named after the last accepted message. The values
+// 1 - 9 double as indexes into HandshakeSession.offsets.
+typedef enum {
+    HS_STATE_START = 0,
+    HS_STATE_CLIENT_HELLO = 1,
+    HS_STATE_SERVER_HELLO = 2,
+    HS_STATE_SERVER_CERTIFICATE = 3,
+    HS_STATE_SERVER_KEY_EXCHANGE = 4,
+    HS_STATE_CERTIFICATE_REQUEST = 5,
+    HS_STATE_SERVER_HELLO_DONE = 6,
+    HS_STATE_CLIENT_CERTIFICATE = 7,
+    HS_STATE_CLIENT_KEY_EXCHANGE = 8,
+    HS_STATE_CERTIFICATE_VERIFY = 9,
+    HS_STATE_FAILED = 10,
+} HandshakeState;
+
+#define HS_STAGES 10
+
+typedef enum {
+    SESSION_COMPLETE = 0,     // Full handshake up to the client's key exchange (and CertificateVerify), TLS 1.3 up to the ServerHello
+    SESSION_RESUMED = 1,      // The ServerHello echoed the session id offered by the client
+    SESSION_INCOMPLETE = 2,   // Evicted, timed out or still open when the table was flushed
+    SESSION_INVALID = 3,      // A message arrived out of order, see HandshakeSession.error
+} SessionOutcome;
+
+// Handshake of one TCP connection. key is normalized (the smaller endpoint is src), so both
+// directions map to the same entry; clientIsSrc tells which endpoint is the client.
+typedef struct {
+    FlowKey key;
+    uint32_t hash;
+    uint32_t lruPrev;         // Slot indexes, most recently used first
+    uint32_t lruNext;
+    uint8_t used;
+    uint8_t clientIsSrc;
+    uint8_t state;            // HandshakeState
+    uint8_t outcome;          // SessionOutcome, set when the session is reported
+    uint8_t partial;          // Joined after the ClientHello, nothing to validate the ServerHello against
+    uint8_t clientHelloParsed; // The cipher suites of the (last) ClientHello are known
+    uint8_t certificateRequested;
+    uint8_t clientCertificate; // The client sent a non-empty certificate, so a CertificateVerify follows
+    uint8_t helloRetryRequest; // The server asked for a second ClientHello (TLS 1.3)
+    uint8_t lastType;         // HandshakeType of the last message
+    int error;                // First error of the session (parse error, ordering, cipher suite)
+    uint16_t messages;
+    ProtocolVersion offeredVersion;
+    ProtocolVersion version;
+    uint16_t cipherSuite;
+    int8_t cipherSuiteOffered; // 1 yes, 0 no, -1 unknown (no parsed ClientHello or too many offered)
+    uint8_t compression;
+    uint8_t offeredTruncated;
+    uint8_t offeredCount;
+    uint16_t offered[MAX_OFFERED_CIPHER_SUITES];
+    uint8_t sessionIdLength;
+    unsigned char sessionId[32];
+    uint64_t started;         // Timestamp of the first message (microseconds)
+    uint64_t lastSeen;
+    uint32_t offsets[HS_STAGES]; // Microseconds from started until the message of each stage
+} HandshakeSession;
+
+typedef void (*SessionCallback)(void *user, const HandshakeSession *session);
+
+// Open addressed table of the handshakes in progress, with a LRU list through the slots. A session
+// is reported through onSession once it completes, fails or is evicted (least recently used first
+// when the table is full, or after timeout) and removed right away. Memory is fixed at init time.
+typedef struct {
+    HandshakeSession *sessions;
+    size_t capacity;          // Power of two
+    size_t maxSessions;
+    size_t count;
+    uint32_t lruHead;
+    uint32_t lruTail;
+    uint64_t timeout;
+    SessionCallback onSession;
+    void *user;
+
+    unsigned long reported[SESSION_INVALID + 1];  // By SessionOutcome
+    unsigned long cipherSuitesNotOffered;
+    unsigned long evicted;    // Incomplete sessions pushed out by newer ones
+} SessionTable;
+
+int init_session_table(SessionTable *table, size_t max_sessions, uint64_t timeout, SessionCallback on_session, void *user);
+void free_session_table(SessionTable *table);
+void flush_session_table(SessionTable *table);
+int track_handshake_message(SessionTable *table, const FlowKey *key, const ParsedMessage *parsed, int err, uint64_t timestamp);
+void get_session_client_key(const HandshakeSession *session, FlowKey *key);
+const char *get_handshake_state_name(int state);
+const char *get_session_outcome_name(int outcome);
+
+#endif
@@ -0,0 +1,867 @@
+#include "tls_stats.h"
+#include "hash.h"
+
+#define STATS_SUITES 65536
+#define STATS_MAGIC "TLSSTATS"
+#define STATS_MAGIC_SIZE 8
+
+static const char *const dimension_names[STATS_DISTINCT] = {
+    [STATS_SNI] = "sni",
+    [STATS_JA3] = "ja3",
+    [STATS_JA3S] = "ja3s",
+    [STATS_CLIENTS] = "clients",
+};
+
+static const char *const version_names[STATS_VERSIONS] = {
+    "SSL 3.0", "TLS 1.0", "TLS 1.1", "TLS 1.2", "TLS 1.3", "other",
+};
+
+int init_tls_stats(TlsStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    // Calloc'ed, so the pages of suites that never occur aren't even touched
+    stats->offeredSuites = (uint64_t *)calloc(STATS_SUITES, sizeof(uint64_t));
+    stats->chosenSuites = (uint64_t *)calloc(STATS_SUITES, sizeof(uint64_t));
+    stats->top = (HeavyHitters *)calloc(STATS_DIMENSIONS, sizeof(HeavyHitters));
+    stats->distinct = (DistinctCounter *)calloc(STATS_DISTINCT, sizeof(DistinctCounter));
+
+    if (stats->offeredSuites == NULL || stats->chosenSuites == NULL || stats->top == NULL || stats->distinct == NULL) {
+        free_tls_stats(stats);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void free_tls_stats(TlsStats *stats) {
+    free(stats->offeredSuites);
+    free(stats->chosenSuites);
+    free(stats->top);
+    free(stats->distinct);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+void reset_tls_stats(TlsStats *stats) {
+    uint64_t *offered = stats->offeredSuites;
+    uint64_t *chosen = stats->chosenSuites;
+    HeavyHitters *top = stats->top;
+    DistinctCounter *distinct = stats->distinct;
+
+    memset(stats, 0, sizeof(*stats));
+    memset(offered, 0, STATS_SUITES * sizeof(uint64_t));
+    memset(chosen, 0, STATS_SUITES * sizeof(uint64_t));
+    memset(top, 0, STATS_DIMENSIONS * sizeof(HeavyHitters));
+    memset(distinct, 0, STATS_DISTINCT * sizeof(DistinctCounter));
+
+    stats->offeredSuites = offered;
+    stats->chosenSuites = chosen;
+    stats->top = top;
+    stats->distinct = distinct;
+}
+
+static int get_version_slot(ProtocolVersion version) {
+    return version.major == 3 && version.minor < STATS_OTHER_VERSION ? version.minor : STATS_OTHER_VERSION;
+}
+
+// The keys (label hashes, JA3 raw hashes) are spread once more, the sketch rows and the distinct
+// counter take different bits of the result
+static uint64_t mix_stats_key(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+
+    return key;
+}
+
+// Row i uses h1 + i * h2 (Kirsch-Mitzenmacher), so a single hash serves all rows
+static uint32_t get_sketch_index(uint64_t mixed, int row) {
+    uint32_t h1 = (uint32_t)mixed;
+    uint32_t h2 = (uint32_t)(mixed >> 32) | 1;
+
+    return (h1 + (uint32_t)row * h2) & (STATS_SKETCH_WIDTH - 1);
+}
+
+static uint64_t estimate_sketch(const HeavyHitters *top, uint64_t key) {
+    uint64_t mixed = mix_stats_key(key);
+    uint64_t estimate = UINT64_MAX;
+
+    for (int row = 0; row < STATS_SKETCH_DEPTH; row++) {
+        uint64_t count = top->sketch[row][get_sketch_index(mixed, row)];
+
+        if (count < estimate) {
+            estimate = count;
+        }
+    }
+
+    return estimate;
+}
+
+static void add_distinct(DistinctCounter *counter, uint64_t mixed) {
+    uint32_t index = (uint32_t)(mixed >> (64 - STATS_HLL_PRECISION));
+    uint64_t rest = (mixed << STATS_HLL_PRECISION) | ((uint64_t)1 << (STATS_HLL_PRECISION - 1)); // Caps the rank
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+
+    if (rank > counter->registers[index]) {
+        counter->registers[index] = rank;
+    }
+}
+
+static int find_top_key(const HeavyHitters *top, uint64_t key) {
+    for (uint32_t i = 0; i < top->used; i++) {
+        if (top->keys[i] == key) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static void swap_heap_entries(HeavyHitters *top, uint32_t a, uint32_t b) {
+    uint8_t entry = top->heap[a];
+
+    top->heap[a] = top->heap[b];
+    top->heap[b] = entry;
+    top->heapPositions[top->heap[a]] = (uint8_t)a;
+    top->heapPositions[top->heap[b]] = (uint8_t)b;
+}
+
+// Counts only ever grow, so an entry only moves down
+static void sift_heap_down(HeavyHitters *top, uint32_t pos) {
+    for (;;) {
+        uint32_t smallest = pos;
+        uint32_t child = 2 * pos + 1;
+
+        if (child < top->used && top->counts[top->heap[child]] < top->counts[top->heap[smallest]]) {
+            smallest = child;
+        }
+
+        if (child + 1 < top->used && top->counts[top->heap[child + 1]] < top->counts[top->heap[smallest]]) {
+            smallest = child + 1;
+        }
+
+        if (smallest == pos) {
+            return;
+        }
+
+        swap_heap_entries(top, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static void sift_heap_up(HeavyHitters *top, uint32_t pos) {
+    while (pos > 0 && top->counts[top->heap[pos]] < top->counts[top->heap[(pos - 1) / 2]]) {
+        swap_heap_entries(top, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+// After the entries were replaced as a whole (merge, deserialization)
+static void rebuild_heap(HeavyHitters *top) {
+    for (uint32_t i = 0; i < top->used; i++) {
+        top->heap[i] = (uint8_t)i;
+        top->heapPositions[i] = (uint8_t)i;
+    }
+
+    for (uint32_t i = top->used / 2; i-- > 0;) {
+        sift_heap_down(top, i);
+    }
+}
+
+// Counts the key in the sketch, the distinct counter and the summary. Returns the entry that was
+// given to the key, whose label the caller has to set, or -1 if the key was monitored already.
+static int add_key(TlsStats *stats, int dimension, uint64_t key) {
+    HeavyHitters *top = &stats->top[dimension];
+    uint64_t mixed = mix_stats_key(key);
+
+    top->total++;
+    for (int row = 0; row < STATS_SKETCH_DEPTH; row++) {
+        top->sketch[row][get_sketch_index(mixed, row)]++;
+    }
+
+    add_distinct(&stats->distinct[dimension], mixed);
+
+    int i = find_top_key(top, key);
+    if (i >= 0) {
+        top->counts[i]++;
+        sift_heap_down(top, top->heapPositions[i]);
+
+        return -1;
+    }
+
+    if (top->used < STATS_TOP_ENTRIES) {
+        i = (int)top->used++;
+        top->counts[i] = 1;
+        top->errors[i] = 0;
+        top->heap[i] = (uint8_t)i;
+        top->heapPositions[i] = (uint8_t)i;
+        sift_heap_up(top, i);
+    } else {
+        // Space-Saving: the new key takes over the smallest count, which bounds how often it
+        // could have occurred before
+        i = top->heap[0];
+        top->errors[i] = top->counts[i];
+        top->counts[i]++;
+        sift_heap_down(top, 0);
+    }
+
+    top->keys[i] = key;
+
+    return i;
+}
+
+static void set_top_label(HeavyHitters *top, int i, const char *label, size_t length) {
+    memcpy(top->labels[i], label, length);
+    top->labels[i][length] = '\0';
+    top->labelLengths[i] = (uint8_t)length;
+}
+
+static void add_server_name(TlsStats *stats, const unsigned char *name, uint16_t length) {
+    char label[STATS_LABEL_SIZE];
+    FastHash hash;
+
+    // Host names are case insensitive
+    if (length > STATS_LABEL_SIZE - 1) {
+        length = STATS_LABEL_SIZE - 1;
+    }
+
+    for (uint16_t i = 0; i < length; i++) {
+        label[i] = (char)(name[i] >= 'A' && name[i] <= 'Z' ? name[i] + ('a' - 'A') : name[i]);
+    }
+
+    fast_hash_init(&hash, length);
+    fast_hash_update(&hash, (const unsigned char *)label, length);
+
+    int i = add_key(stats, STATS_SNI, fast_hash_final(&hash));
+    if (i >= 0) {
+        set_top_label(&stats->top[STATS_SNI], i, label, length);
+    }
+}
+
+// The raw JA3 hash is the key, the MD5 digest is only computed for the label of a key that gets
+// into the summary, unless the caller had it already
+static void add_fingerprint(TlsStats *stats, const ParsedMessage *parsed, const Fingerprint *fingerprint) {
+    int client = parsed->handshake.hsType == CLIENT_HELLO;
+    int dimension = client ? STATS_JA3 : STATS_JA3S;
+    Fingerprint computed;
+    char digest[JA3_DIGEST_HEX_SIZE];
+
+    if (fingerprint == NULL) {
+        if (client) {
+            compute_ja3(&parsed->clientHello, JA3_RAW, &computed);
+        } else {
+            compute_ja3s(&parsed->serverHello, JA3_RAW, &computed);
+        }
+    }
+
+    int i = add_key(stats, dimension, fingerprint != NULL ? fingerprint->raw : computed.raw);
+    if (i < 0) {
+        return;
+    }
+
+    if (fingerprint == NULL) {
+        if (client) {
+            compute_ja3(&parsed->clientHello, JA3_MD5, &computed);
+        } else {
+            compute_ja3s(&parsed->serverHello, JA3_MD5, &computed);
+        }
+
+        fingerprint = &computed;
+    }
+
+    format_ja3_digest(fingerprint, digest);
+    set_top_label(&stats->top[dimension], i, digest, JA3_DIGEST_HEX_SIZE - 1);
+}
+
+static void add_offered_suites(TlsStats *stats, const ClientHello *hello) {
+    uint16_t suite;
+
+    if (hello->sslv2) {
+        uint16_t pos = 0;
+
+        while (next_sslv2_cipher_suite(hello, &pos, &suite)) {
+            if (!is_grease_value(suite)) {
+                stats->offeredSuites[suite]++;
+            }
+        }
+
+        return;
+    }
+
+    const unsigned char *suites = hello->csCollection.cipherSuites;
+
+    for (uint16_t i = 0; i + 1 < hello->csCollection.length; i += 2) {
+        suite = (suites[i] << 8) | suites[i + 1];
+
+        if (!is_grease_value(suite)) {
+            stats->offeredSuites[suite]++;
+        }
+    }
+}
+
+// Only ClientHellos and ServerHellos that parsed without an error are counted, anything else is
+// ignored. fingerprint is the JA3/JA3S of the message (JA3_MD5 | JA3_RAW) if the caller has it,
+// otherwise NULL. A HelloRetryRequest is only counted as such, the ServerHello that follows it
+// has the version and the cipher suite of the connection.
+void add_hello_stats(TlsStats *stats, const ParsedMessage *parsed, const Fingerprint *fingerprint) {
+    const unsigned char *name;
+    uint16_t length;
+
+    if (parsed->handshake.hsType == CLIENT_HELLO) {
+        const ClientHello *hello = &parsed->clientHello;
+
+        stats->clientHellos++;
+        stats->sslv2Hellos += hello->sslv2;
+        stats->clientVersions[get_version_slot(hello->maxVersion)]++;
+        add_offered_suites(stats, hello);
+
+        if (hello->hasExtensions && get_server_name(&hello->extensionIndex, &name, &length) == NO_ERROR && length > 0) {
+            add_server_name(stats, name, length);
+        } else {
+            stats->noServerName++;
+        }
+    } else if (parsed->handshake.hsType == SERVER_HELLO) {
+        const ServerHello *hello = &parsed->serverHello;
+
+        if (hello->helloRetryRequest) {
+            stats->helloRetryRequests++;
+
+            return;
+        }
+
+        stats->serverHellos++;
+        stats->serverVersions[get_version_slot(hello->selectedVersion)]++;
+        stats->chosenSuites[(hello->cipherSuite[0] << 8) | hello->cipherSuite[1]]++;
+    } else {
+        return;
+    }
+
+    add_fingerprint(stats, parsed, fingerprint);
+}
+
+// Any stable identifier of a client, e.g. its address
+void add_stats_client(TlsStats *stats, const void *id, size_t length) {
+    FastHash hash;
+
+    fast_hash_init(&hash, length);
+    fast_hash_update(&hash, (const unsigned char *)id, length);
+    add_distinct(&stats->distinct[STATS_CLIENTS], mix_stats_key(fast_hash_final(&hash)));
+}
+
+typedef struct {
+    uint64_t key;
+    uint64_t count;
+    uint64_t error;
+    const char *label;
+    uint8_t labelLength;
+} TopCandidate;
+
+static int compare_candidates(const void *a, const void *b) {
+    const TopCandidate *x = (const TopCandidate *)a;
+    const TopCandidate *y = (const TopCandidate *)b;
+
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+
+    return x->key < y->key ? -1 : x->key > y->key;
+}
+
+// Mergeable summaries (Agarwal et al.): a key missing from a full summary may have occurred as
+// often as that summary's smallest count, so that is added to both its count and its error.
+// The largest STATS_TOP_ENTRIES of the union are kept.
+static void merge_heavy_hitters(HeavyHitters *into, const HeavyHitters *from) {
+    TopCandidate candidates[2 * STATS_TOP_ENTRIES];
+    char labels[STATS_TOP_ENTRIES][STATS_LABEL_SIZE];
+    uint64_t into_smallest = into->used == STATS_TOP_ENTRIES ? into->counts[into->heap[0]] : 0;
+    uint64_t from_smallest = from->used == STATS_TOP_ENTRIES ? from->counts[from->heap[0]] : 0;
+    int count = 0;
+
+    // The entries of into are overwritten below, their labels are read from the copy
+    memcpy(labels, into->labels, sizeof(labels));
+
+    for (uint32_t i = 0; i < into->used; i++) {
+        int j = find_top_key(from, into->keys[i]);
+        TopCandidate *candidate = &candidates[count++];
+
+        candidate->key = into->keys[i];
+        candidate->count = into->counts[i] + (j >= 0 ? from->counts[j] : from_smallest);
+        candidate->error = into->errors[i] + (j >= 0 ? from->errors[j] : from_smallest);
+        candidate->label = labels[i];
+        candidate->labelLength = into->labelLengths[i];
+    }
+
+    for (uint32_t i = 0; i < from->used; i++) {
+        if (find_top_key(into, from->keys[i]) >= 0) {
+            continue;
+        }
+
+        TopCandidate *candidate = &candidates[count++];
+
+        candidate->key = from->keys[i];
+        candidate->count = from->counts[i] + into_smallest;
+        candidate->error = from->errors[i] + into_smallest;
+        candidate->label = from->labels[i];
+        candidate->labelLength = from->labelLengths[i];
+    }
+
+    qsort(candidates, count, sizeof(TopCandidate), compare_candidates);
+
+    into->used = count < STATS_TOP_ENTRIES ? count : STATS_TOP_ENTRIES;
+    for (uint32_t i = 0; i < into->used; i++) {
+        into->keys[i] = candidates[i].key;
+        into->counts[i] = candidates[i].count;
+        into->errors[i] = candidates[i].error;
+        set_top_label(into, (int)i, candidates[i].label, candidates[i].labelLength);
+    }
+
+    rebuild_heap(into);
+
+    into->total += from->total;
+    for (int row = 0; row < STATS_SKETCH_DEPTH; row++) {
+        for (int i = 0; i < STATS_SKETCH_WIDTH; i++) {
+            into->sketch[row][i] += from->sketch[row][i];
+        }
+    }
+}
+
+void merge_tls_stats(TlsStats *into, const TlsStats *from) {
+    int i;
+
+    into->clientHellos += from->clientHellos;
+    into->serverHellos += from->serverHellos;
+    into->helloRetryRequests += from->helloRetryRequests;
+    into->sslv2Hellos += from->sslv2Hellos;
+    into->noServerName += from->noServerName;
+
+    for (i = 0; i < STATS_VERSIONS; i++) {
+        into->clientVersions[i] += from->clientVersions[i];
+        into->serverVersions[i] += from->serverVersions[i];
+    }
+
+    for (i = 0; i < STATS_SUITES; i++) {
+        into->offeredSuites[i] += from->offeredSuites[i];
+        into->chosenSuites[i] += from->chosenSuites[i];
+    }
+
+    for (i = 0; i < STATS_DIMENSIONS; i++) {
+        merge_heavy_hitters(&into->top[i], &from->top[i]);
+    }
+
+    for (i = 0; i < STATS_DISTINCT; i++) {
+        uint8_t *registers = into->distinct[i].registers;
+        const uint8_t *other = from->distinct[i].registers;
+
+        for (int j = 0; j < STATS_HLL_REGISTERS; j++) {
+            registers[j] = other[j] > registers[j] ? other[j] : registers[j];
+        }
+    }
+}
+
+static int compare_top_keys(const void *a, const void *b) {
+    const StatsTopKey *x = (const StatsTopKey *)a;
+    const StatsTopKey *y = (const StatsTopKey *)b;
+
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+
+    return strcmp(x->label, y->label);
+}
+
+// The max most frequent keys of a dimension, most frequent first. Returns how many were stored.
+int get_stats_top_keys(const TlsStats *stats, int dimension, StatsTopKey *keys, int max) {
+    StatsTopKey sorted[STATS_TOP_ENTRIES];
+    const HeavyHitters *top;
+    int count = 0;
+
+    if (dimension < 0 || dimension >= STATS_DIMENSIONS) {
+        return 0;
+    }
+
+    top = &stats->top[dimension];
+
+    for (uint32_t i = 0; i < top->used; i++) {
+        uint64_t sketched = estimate_sketch(top, top->keys[i]);
+        uint64_t minimum = top->counts[i] - top->errors[i];
+
+        sorted[count].label = top->labels[i];
+        sorted[count].count = sketched < top->counts[i] ? sketched : top->counts[i];
+        sorted[count].minimum = minimum < sorted[count].count ? minimum : sorted[count].count;
+        count++;
+    }
+
+    qsort(sorted, count, sizeof(StatsTopKey), compare_top_keys);
+
+    count = count < max ? count : max;
+    memcpy(keys, sorted, count * sizeof(StatsTopKey));
+
+    return count;
+}
+
+// Natural logarithm of x >= 1 without libm: halved into [1, 2), then the atanh series
+static double log_ratio(double x) {
+    double result = 0;
+
+    while (x >= 2) {
+        x /= 2;
+        result += 0.6931471805599453;
+    }
+
+    double y = (x - 1) / (x + 1);
+    double term = y;
+    double sum = 0;
+
+    for (int k = 1; k < 40; k += 2) {
+        sum += term / k;
+        term *= y * y;
+    }
+
+    return result + 2 * sum;
+}
+
+// HyperLogLog estimate, with linear counting for the small range. The hashes are 64 bit, so the
+// large range needs no correction.
+double estimate_stats_distinct(const TlsStats *stats, int counter) {
+    const uint8_t *registers;
+    double m = STATS_HLL_REGISTERS;
+    double sum = 0;
+    int zeros = 0;
+
+    if (counter < 0 || counter >= STATS_DISTINCT) {
+        return 0;
+    }
+
+    registers = stats->distinct[counter].registers;
+
+    for (int i = 0; i < STATS_HLL_REGISTERS; i++) {
+        sum += 1.0 / (double)((uint64_t)1 << registers[i]);
+        zeros += registers[i] == 0;
+    }
+
+    double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log_ratio(m / zeros);
+    }
+
+    return estimate;
+}
+
+const char *get_stats_dimension_name(int dimension) {
+    return dimension >= 0 && dimension < STATS_DISTINCT ? dimension_names[dimension] : "unknown";
+}
+
+const char *get_stats_version_name(int slot) {
+    return slot >= 0 && slot < STATS_VERSIONS ? version_names[slot] : "unknown";
+}
+
+static int append_json_versions(OutputBuffer *out, const char *name, const uint64_t *versions) {
+    int result = append_formatted(out, ",\"%s\":{", name);
+    int first = 1;
+
+    for (int i = 0; i < STATS_VERSIONS; i++) {
+        if (versions[i] > 0) {
+            result |= append_formatted(out, "%s\"%s\":%llu", first ? "" : ",", version_names[i], (unsigned long long)versions[i]);
+            first = 0;
+        }
+    }
+
+    return result | append_output(out, "}", 1);
+}
+
+static int append_json_suites(OutputBuffer *out, const char *name, const uint64_t *suites) {
+    int result = append_formatted(out, ",\"%s\":{", name);
+    int first = 1;
+
+    for (int i = 0; i < STATS_SUITES; i++) {
+        if (suites[i] > 0) {
+            result |= append_formatted(out, "%s\"0x%04x\":%llu", first ? "" : ",", i, (unsigned long long)suites[i]);
+            first = 0;
+        }
+    }
+
+    return result | append_output(out, "}", 1);
+}
+
+// A single JSON object (and a newline) with the exact counters, the top keys with their bounds
+// and the distinct counts
+int append_stats_json(OutputBuffer *out, const TlsStats *stats) {
+    StatsTopKey keys[STATS_TOP_ENTRIES];
+    int result;
+
+    result = append_formatted(out, "{\"clientHellos\":%llu,\"serverHellos\":%llu,\"helloRetryRequests\":%llu,\"sslv2Hellos\":%llu,\"noServerName\":%llu",
+                              (unsigned long long)stats->clientHellos, (unsigned long long)stats->serverHellos,
+                              (unsigned long long)stats->helloRetryRequests, (unsigned long long)stats->sslv2Hellos,
+                              (unsigned long long)stats->noServerName);
+    result |= append_json_versions(out, "clientVersions", stats->clientVersions);
+    result |= append_json_versions(out, "serverVersions", stats->serverVersions);
+    result |= append_json_suites(out, "offeredSuites", stats->offeredSuites);
+    result |= append_json_suites(out, "chosenSuites", stats->chosenSuites);
+
+    for (int dimension = 0; dimension < STATS_DIMENSIONS; dimension++) {
+        int count = get_stats_top_keys(stats, dimension, keys, STATS_TOP_ENTRIES);
+
+        result |= append_formatted(out, ",\"%s\":{\"total\":%llu,\"distinct\":%.0f,\"top\":[", dimension_names[dimension],
+                                   (unsigned long long)stats->top[dimension].total, estimate_stats_distinct(stats, dimension));
+
+        for (int i = 0; i < count; i++) {
+            result |= append_output(out, i > 0 ? ",{\"key\":" : "{\"key\":", i > 0 ? 8 : 7);
+            result |= append_json_string(out, (const unsigned char *)keys[i].label, strlen(keys[i].label));
+            result |= append_formatted(out, ",\"count\":%llu,\"min\":%llu}", (unsigned long long)keys[i].count,
+                                       (unsigned long long)keys[i].minimum);
+        }
+
+        result |= append_output(out, "]}", 2);
+    }
+
+    result |= append_formatted(out, ",\"clients\":{\"distinct\":%.0f}}\n", estimate_stats_distinct(stats, STATS_CLIENTS));
+
+    return result != 0 ? -1 : 0;
+}
+
+static void put_be(OutputBuffer *out, uint64_t value, int size) {
+    for (int i = size - 1; i >= 0; i--) {
+        out->data[out->length++] = (char)(value >> (8 * i));
+    }
+}
+
+static size_t count_suites(const uint64_t *suites) {
+    size_t count = 0;
+
+    for (int i = 0; i < STATS_SUITES; i++) {
+        count += suites[i] > 0;
+    }
+
+    return count;
+}
+
+static void put_suites(OutputBuffer *out, const uint64_t *suites, size_t count) {
+    put_be(out, count, 4);
+
+    for (int i = 0; i < STATS_SUITES; i++) {
+        if (suites[i] > 0) {
+            put_be(out, i, 2);
+            put_be(out, suites[i], 8);
+        }
+    }
+}
+
+int serialize_tls_stats(OutputBuffer *out, const TlsStats *stats) {
+    size_t offered = count_suites(stats->offeredSuites);
+    size_t chosen = count_suites(stats->chosenSuites);
+    size_t size = STATS_MAGIC_SIZE + 4 + 4 + 5 * 8 + 2 * STATS_VERSIONS * 8 + 4 + 10 * offered + 4 + 10 * chosen +
+                  STATS_DISTINCT * STATS_HLL_REGISTERS;
+    int i;
+
+    for (i = 0; i < STATS_DIMENSIONS; i++) {
+        const HeavyHitters *top = &stats->top[i];
+
+        size += 8 + 1 + STATS_SKETCH_DEPTH * STATS_SKETCH_WIDTH * 8;
+        for (uint32_t j = 0; j < top->used; j++) {
+            size += 3 * 8 + 1 + top->labelLengths[j];
+        }
+    }
+
+    // Everything is sized up front, so the aggregate is written with a single reservation
+    if (reserve_output_buffer(out, size) != 0) {
+        return -1;
+    }
+
+    memcpy(out->data + out->length, STATS_MAGIC, STATS_MAGIC_SIZE);
+    out->length += STATS_MAGIC_SIZE;
+    put_be(out, STATS_FORMAT_VERSION, 1);
+    put_be(out, STATS_TOP_ENTRIES, 1);
+    put_be(out, STATS_SKETCH_DEPTH, 1);
+    put_be(out, STATS_HLL_PRECISION, 1);
+    put_be(out, STATS_SKETCH_WIDTH, 4);
+
+    put_be(out, stats->clientHellos, 8);
+    put_be(out, stats->serverHellos, 8);
+    put_be(out, stats->helloRetryRequests, 8);
+    put_be(out, stats->sslv2Hellos, 8);
+    put_be(out, stats->noServerName, 8);
+
+    for (i = 0; i < STATS_VERSIONS; i++) {
+        put_be(out, stats->clientVersions[i], 8);
+    }
+
+    for (i = 0; i < STATS_VERSIONS; i++) {
+        put_be(out, stats->serverVersions[i], 8);
+    }
+
+    put_suites(out, stats->offeredSuites, offered);
+    put_suites(out, stats->chosenSuites, chosen);
+
+    for (i = 0; i < STATS_DIMENSIONS; i++) {
+        const HeavyHitters *top = &stats->top[i];
+
+        put_be(out, top->total, 8);
+        put_be(out, top->used, 1);
+
+        for (uint32_t j = 0; j < top->used; j++) {
+            put_be(out, top->keys[j], 8);
+            put_be(out, top->counts[j], 8);
+            put_be(out, top->errors[j], 8);
+            put_be(out, top->labelLengths[j], 1);
+            memcpy(out->data + out->length, top->labels[j], top->labelLengths[j]);
+            out->length += top->labelLengths[j];
+        }
+
+        for (int row = 0; row < STATS_SKETCH_DEPTH; row++) {
+            for (int j = 0; j < STATS_SKETCH_WIDTH; j++) {
+                put_be(out, top->sketch[row][j], 8);
+            }
+        }
+    }
+
+    for (i = 0; i < STATS_DISTINCT; i++) {
+        memcpy(out->data + out->length, stats->distinct[i].registers, STATS_HLL_REGISTERS);
+        out->length += STATS_HLL_REGISTERS;
+    }
+
+    return 0;
+}
+
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    int error;                        // Set once a read went past the end, every later read returns 0
+} StatsReader;
+
+static uint64_t get_be(StatsReader *reader, int size) {
+    uint64_t value = 0;
+
+    if (reader->error || reader->size - reader->pos < (size_t)size) {
+        reader->error = 1;
+
+        return 0;
+    }
+
+    for (int i = 0; i < size; i++) {
+        value = (value << 8) | reader->data[reader->pos++];
+    }
+
+    return value;
+}
+
+static const unsigned char *get_bytes(StatsReader *reader, size_t length) {
+    if (reader->error || reader->size - reader->pos < length) {
+        reader->error = 1;
+
+        return NULL;
+    }
+
+    reader->pos += length;
+
+    return reader->data + reader->pos - length;
+}
+
+static void get_suites(StatsReader *reader, uint64_t *suites) {
+    uint64_t count = get_be(reader, 4);
+
+    for (uint64_t i = 0; i < count && !reader->error; i++) {
+        uint16_t suite = (uint16_t)get_be(reader, 2);
+
+        suites[suite] = get_be(reader, 8);
+    }
+}
+
+// Replaces the content of an initialized stats structure. Returns -1 if the data is truncated,
+// malformed or was written with different parameters, stats is reset in that case.
+int deserialize_tls_stats(TlsStats *stats, const unsigned char *data, size_t size) {
+    StatsReader reader = { data, size, 0, 0 };
+    const unsigned char *magic = get_bytes(&reader, STATS_MAGIC_SIZE);
+    int i;
+
+    reset_tls_stats(stats);
+
+    if (magic == NULL || memcmp(magic, STATS_MAGIC, STATS_MAGIC_SIZE) != 0 ||
+        get_be(&reader, 1) != STATS_FORMAT_VERSION || get_be(&reader, 1) != STATS_TOP_ENTRIES ||
+        get_be(&reader, 1) != STATS_SKETCH_DEPTH || get_be(&reader, 1) != STATS_HLL_PRECISION ||
+        get_be(&reader, 4) != STATS_SKETCH_WIDTH) {
+        return -1;
+    }
+
+    stats->clientHellos = get_be(&reader, 8);
+    stats->serverHellos = get_be(&reader, 8);
+    stats->helloRetryRequests = get_be(&reader, 8);
+    stats->sslv2Hellos = get_be(&reader, 8);
+    stats->noServerName = get_be(&reader, 8);
+
+    for (i = 0; i < STATS_VERSIONS; i++) {
+        stats->clientVersions[i] = get_be(&reader, 8);
+    }
+
+    for (i = 0; i < STATS_VERSIONS; i++) {
+        stats->serverVersions[i] = get_be(&reader, 8);
+    }
+
+    get_suites(&reader, stats->offeredSuites);
+    get_suites(&reader, stats->chosenSuites);
+
+    for (i = 0; i < STATS_DIMENSIONS && !reader.error; i++) {
+        HeavyHitters *top = &stats->top[i];
+
+        top->total = get_be(&reader, 8);
+        top->used = (uint32_t)get_be(&reader, 1);
+        if (top->used > STATS_TOP_ENTRIES) {
+            reader.error = 1;
+            break;
+        }
+
+        for (uint32_t j = 0; j < top->used && !reader.error; j++) {
+            top->keys[j] = get_be(&reader, 8);
+            top->counts[j] = get_be(&reader, 8);
+            top->errors[j] = get_be(&reader, 8);
+
+            // The error never exceeds the count, the lower bound would wrap around otherwise
+            if (top->errors[j] > top->counts[j]) {
+                reader.error = 1;
+            }
+
+            uint8_t length = (uint8_t)get_be(&reader, 1);
+            const unsigned char *label = get_bytes(&reader, length);
+            if (label != NULL) {
+                set_top_label(top, (int)j, (const char *)label, length);
+            }
+        }
+
+        for (int row = 0; row < STATS_SKETCH_DEPTH; row++) {
+            for (int j = 0; j < STATS_SKETCH_WIDTH; j++) {
+                top->sketch[row][j] = get_be(&reader, 8);
+            }
+        }
+
+        rebuild_heap(top);
+    }
+
+    for (i = 0; i < STATS_DISTINCT && !reader.error; i++) {
+        const unsigned char *registers = get_bytes(&reader, STATS_HLL_REGISTERS);
+
+        if (registers == NULL) {
+            break;
+        }
+
+        // A rank is at most the number of hash bits left after the register index, plus one
+        for (int j = 0; j < STATS_HLL_REGISTERS; j++) {
+            if (registers[j] > 64 - STATS_HLL_PRECISION + 1) {
+                reader.error = 1;
+            }
+        }
+
+        memcpy(stats->distinct[i].registers, registers, STATS_HLL_REGISTERS);
+    }
+
+    if (reader.error || reader.pos != reader.size) {
+        reset_tls_stats(stats);
+
+        return -1;
+    }
+
+    return 0;
+}
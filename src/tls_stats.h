@@ -0,0 +1,108 @@
+#ifndef TLS_STATS_H
+#define TLS_STATS_H
+
+#include "tls_parser.h"
+#include "tls_output.h"
+
+#define STATS_FORMAT_VERSION 1
+#define STATS_TOP_ENTRIES 64          // Heavy hitters kept per dimension
+#define STATS_SKETCH_DEPTH 4          // Count-Min rows
+#define STATS_SKETCH_WIDTH 4096       // Count-Min counters per row, power of two
+#define STATS_HLL_PRECISION 14        // 2^14 registers, about 0.8% standard error
+#define STATS_HLL_REGISTERS (1 << STATS_HLL_PRECISION)
+#define STATS_LABEL_SIZE 256          // A host name of up to 255 bytes + NUL
+
+// Exact version counters: SSL 3.0 and TLS 1.0 - 1.3 by their minor version, then everything else
+#define STATS_VERSIONS 6
+#define STATS_OTHER_VERSION 5
+
+// Unbounded keys, each with a heavy hitter summary and a distinct counter
+typedef enum {
+    STATS_SNI = 0,                    // host_name of a ClientHello, lowercased
+    STATS_JA3 = 1,
+    STATS_JA3S = 2,
+    STATS_DIMENSIONS = 3,
+} StatsDimension;
+
+#define STATS_CLIENTS STATS_DIMENSIONS // Distinct counter of the client ids given to add_stats_client
+#define STATS_DISTINCT (STATS_DIMENSIONS + 1)
+
+// Space-Saving summary of the most frequent keys of a dimension plus a Count-Min sketch of all of
+// them. A monitored key's count is an upper bound of its true count, count - error a lower bound,
+// and a key that isn't monitored occurred at most as often as the smallest count. The sketch
+// bounds every key from above as well, get_stats_top_keys reports the smaller of the two.
+typedef struct {
+    uint64_t total;                   // Keys added, the N of the error bounds
+    uint32_t used;
+    uint64_t keys[STATS_TOP_ENTRIES]; // Hash of the label, scanned on every update
+    uint64_t counts[STATS_TOP_ENTRIES];
+    uint64_t errors[STATS_TOP_ENTRIES];
+    uint8_t labelLengths[STATS_TOP_ENTRIES];
+    uint8_t heap[STATS_TOP_ENTRIES];  // Entries as a binary min-heap on their count, so the smallest is heap[0]
+    uint8_t heapPositions[STATS_TOP_ENTRIES]; // Where each entry is in the heap
+    char labels[STATS_TOP_ENTRIES][STATS_LABEL_SIZE];
+    uint64_t sketch[STATS_SKETCH_DEPTH][STATS_SKETCH_WIDTH];
+} HeavyHitters;
+
+// HyperLogLog
+typedef struct {
+    uint8_t registers[STATS_HLL_REGISTERS];
+} DistinctCounter;
+
+// Aggregate of the hellos of a run, fed with add_hello_stats. Small domains (versions, cipher
+// suites) are counted exactly, the unbounded ones (server names, fingerprints, clients) go into
+// sketches of a fixed size, so the whole structure takes about 1.5 MB however many messages were
+// added. Not thread safe: every thread aggregates into its own, merge_tls_stats combines them and
+// serialize_tls_stats/deserialize_tls_stats move them between processes. Two aggregates can only
+// be merged if they were built with the same STATS_* parameters.
+typedef struct {
+    uint64_t clientHellos;
+    uint64_t serverHellos;
+    uint64_t helloRetryRequests;
+    uint64_t sslv2Hellos;
+    uint64_t noServerName;            // ClientHellos without a host_name
+    uint64_t clientVersions[STATS_VERSIONS]; // Highest version offered
+    uint64_t serverVersions[STATS_VERSIONS]; // Version selected
+    uint64_t *offeredSuites;          // 65536 counters, indexed by cipher suite, GREASE left out
+    uint64_t *chosenSuites;
+    HeavyHitters *top;                // STATS_DIMENSIONS
+    DistinctCounter *distinct;        // STATS_DISTINCT
+} TlsStats;
+
+// Entry returned by get_stats_top_keys
+typedef struct {
+    const char *label;                // Points into the TlsStats, NUL terminated
+    uint64_t count;                   // Upper bound
+    uint64_t minimum;                 // Lower bound
+} StatsTopKey;
+
+int init_tls_stats(TlsStats *stats);
+void free_tls_stats(TlsStats *stats);
+void reset_tls_stats(TlsStats *stats);
+void add_hello_stats(TlsStats *stats, const ParsedMessage *parsed, const Fingerprint *fingerprint);
+void add_stats_client(TlsStats *stats, const void *id, size_t length);
+void merge_tls_stats(TlsStats *into, const TlsStats *from);
+int get_stats_top_keys(const TlsStats *stats, int dimension, StatsTopKey *keys, int max);
+double estimate_stats_distinct(const TlsStats *stats, int counter);
+const char *get_stats_dimension_name(int dimension);
+const char *get_stats_version_name(int slot);
+
+// Serialized aggregates are big endian:
+//
+//   8 bytes  "TLSSTATS"
+//   uint8    STATS_FORMAT_VERSION
+//   uint8    STATS_TOP_ENTRIES, STATS_SKETCH_DEPTH, STATS_HLL_PRECISION (1 byte each)
+//   uint32   STATS_SKETCH_WIDTH
+//   uint64   clientHellos, serverHellos, helloRetryRequests, sslv2Hellos, noServerName
+//   uint64   clientVersions, then serverVersions (STATS_VERSIONS each)
+//   uint32   number of offered suites, then for each: uint16 suite + uint64 count
+//   uint32   number of chosen suites, same as above
+//   per dimension: uint64 total, uint8 used, then for each entry: uint64 key, uint64 count,
+//            uint64 error, uint8 label length + label, then the sketch row by row (uint64 counters)
+//   the registers of every distinct counter (STATS_DISTINCT * STATS_HLL_REGISTERS bytes)
+
+int append_stats_json(OutputBuffer *out, const TlsStats *stats);
+int serialize_tls_stats(OutputBuffer *out, const TlsStats *stats);
+int deserialize_tls_stats(TlsStats *stats, const unsigned char *data, size_t size);
+
+#endif
@@ -0,0 +1,344 @@
+#include "tls_stream.h"
+#include "tls_metrics.h"
+
+#define STREAM_FRAGMENT_INTERRUPTED -2 // Internal, a record that can't continue the message being reassembled is next
+
+static void copy_from_ring(RecordStream *stream, size_t offset, unsigned char *dst, size_t length) {
+    size_t index = offset & (stream->capacity - 1);
+    size_t first = stream->capacity - index;
+
+    if (first >= length) {
+        memcpy(dst, stream->ring + index, length);
+    } else {
+        memcpy(dst, stream->ring + index, first);
+        memcpy(dst + first, stream->ring, length - first);
+    }
+}
+
+int init_record_stream(RecordStream *stream, size_t capacity) {
+    memset(stream, 0, sizeof(*stream));
+
+    // The ring indexes with a mask, so round the capacity up to a power of two
+    size_t rounded = 1024;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    stream->ring = (unsigned char *)malloc(rounded);
+    stream->scratch = (unsigned char *)malloc(rounded);
+    if (stream->ring == NULL || stream->scratch == NULL) {
+        free_record_stream(stream);
+
+        return -1;
+    }
+
+    stream->capacity = rounded;
+
+    return 0;
+}
+
+void free_record_stream(RecordStream *stream) {
+    free(stream->ring);
+    free(stream->scratch);
+    free(stream->message);
+
+    stream->ring = NULL;
+    stream->scratch = NULL;
+    stream->message = NULL;
+    stream->capacity = 0;
+    stream->messageCapacity = 0;
+}
+
+void reset_record_stream(RecordStream *stream) {
+    stream->input = NULL;
+    stream->head = 0;
+    stream->tail = 0;
+    stream->record = NULL;
+    stream->recordLength = 0;
+    stream->recordPos = 0;
+    stream->error = 0;
+    stream->records = 0;
+    stream->reassembling = 0;
+}
+
+void attach_record_stream(RecordStream *stream, const unsigned char *data, size_t size) {
+    // A ring allocated by init_record_stream is kept, it's used again after reset_record_stream
+    reset_record_stream(stream);
+
+    stream->input = data;
+    stream->tail = size;
+}
+
+size_t feed_record_stream(RecordStream *stream, const unsigned char *data, size_t length) {
+    if (stream->input != NULL) {
+        return 0;
+    }
+
+    // Only as much as fits is accepted, the caller has to pull messages before feeding the rest
+    size_t space = stream->capacity - (stream->tail - stream->head);
+    if (length > space) {
+        length = space;
+    }
+
+    size_t index = stream->tail & (stream->capacity - 1);
+    size_t first = stream->capacity - index;
+
+    if (first >= length) {
+        memcpy(stream->ring + index, data, length);
+    } else {
+        memcpy(stream->ring + index, data, first);
+        memcpy(stream->ring, data + first, length - first);
+    }
+
+    stream->tail += length;
+
+    return length;
+}
+
+static int load_next_record(RecordStream *stream) {
+    size_t available = stream->tail - stream->head;
+    unsigned char header[RECORD_HEADER_SIZE];
+
+    if (available < RECORD_HEADER_SIZE) {
+        return STREAM_NEED_MORE_DATA;
+    }
+
+    if (stream->input != NULL) {
+        memcpy(header, stream->input + stream->head, RECORD_HEADER_SIZE);
+    } else {
+        copy_from_ring(stream, stream->head, header, RECORD_HEADER_SIZE);
+    }
+
+    memset(&stream->recordHeader, 0, sizeof(stream->recordHeader));
+    int err = parse_record_header(header, RECORD_HEADER_SIZE, &stream->recordHeader);
+
+    // Without a valid version there is no way to tell whether the length is real, so the framing is lost
+    if (!is_valid_tls_version(stream->recordHeader.version.major, stream->recordHeader.version.minor)) {
+        stream->error = INVALID_VERSION;
+
+        return stream->error;
+    }
+
+    // The fragments of a handshake message come in consecutive handshake records. The record is left
+    // in place, it's loaded again once the incomplete message was reported.
+    if (stream->reassembling && (err || stream->recordHeader.sslv2)) {
+        return STREAM_FRAGMENT_INTERRUPTED;
+    }
+
+    int header_size = stream->recordHeader.sslv2 ? SSLV2_HEADER_SIZE : RECORD_HEADER_SIZE;
+    int length = header_size + stream->recordHeader.fLength;
+    if (stream->input == NULL && (size_t)length > stream->capacity) {
+        stream->error = RECORD_TOO_LARGE;
+
+        return stream->error;
+    }
+
+    if (available < (size_t)length) {
+        return STREAM_NEED_MORE_DATA;
+    }
+
+    size_t index = stream->head & (stream->capacity - 1);
+    if (stream->input != NULL) {
+        stream->record = stream->input + stream->head;
+    } else if (index + length <= stream->capacity) {
+        stream->record = stream->ring + index;
+    } else {
+        copy_from_ring(stream, stream->head, stream->scratch, length);
+        stream->record = stream->scratch;
+    }
+
+    stream->recordLength = length;
+    stream->recordPos = header_size;
+    stream->records++;
+    METRIC_RECORD(length);
+
+    // Records of other content types (alerts, application data, ...) are reported and skipped as a whole
+    if (err) {
+        stream->recordPos = length;
+
+        return err;
+    }
+
+    return NO_ERROR;
+}
+
+static void set_record_fields(const HandshakeMessage *record, HandshakeMessage *tls_message) {
+    tls_message->cType = record->cType;
+    tls_message->version = record->version;
+    tls_message->fLength = record->fLength;
+    tls_message->sslv2 = record->sslv2;
+}
+
+// Makes room for a message of the given size, which was checked against the limit already
+static int reserve_message(RecordStream *stream, uint32_t size) {
+    if (size <= stream->messageCapacity) {
+        return 0;
+    }
+
+    uint32_t capacity = stream->messageCapacity ? stream->messageCapacity : 4096;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    unsigned char *grown = (unsigned char *)realloc(stream->message, capacity);
+    if (grown == NULL) {
+        return -1;
+    }
+
+    stream->message = grown;
+    stream->messageCapacity = capacity;
+
+    return 0;
+}
+
+// Adds as much of the current record as belongs to the message being reassembled. Once its header
+// is complete the size is known, a message above the limit is only counted down, not copied.
+static void collect_fragment(RecordStream *stream) {
+    uint32_t available = stream->recordLength - stream->recordPos;
+    const unsigned char *data = stream->record + stream->recordPos;
+    uint32_t needed, length;
+
+    if (stream->messageLength < HANDSHAKE_HEADER_SIZE) {
+        length = HANDSHAKE_HEADER_SIZE - stream->messageLength;
+        length = length < available ? length : available;
+
+        memcpy(stream->messageHeader + stream->messageLength, data, length);
+        stream->messageLength += length;
+        stream->recordPos += length;
+        data += length;
+        available -= length;
+
+        if (stream->messageLength < HANDSHAKE_HEADER_SIZE) {
+            return;
+        }
+
+        uint32_t limit = stream->maxMessageSize ? stream->maxMessageSize : DEFAULT_MAX_MESSAGE_SIZE;
+        stream->messageSize = HANDSHAKE_HEADER_SIZE + ((stream->messageHeader[1] << 16) | (stream->messageHeader[2] << 8) | stream->messageHeader[3]);
+        stream->messageDiscarded = stream->messageSize > limit || reserve_message(stream, stream->messageSize) != 0;
+
+        if (!stream->messageDiscarded) {
+            memcpy(stream->message, stream->messageHeader, HANDSHAKE_HEADER_SIZE);
+        }
+    }
+
+    needed = stream->messageSize - stream->messageLength;
+    length = needed < available ? needed : available;
+
+    if (!stream->messageDiscarded) {
+        memcpy(stream->message + stream->messageLength, data, length);
+    }
+
+    stream->messageLength += length;
+    stream->recordPos += length;
+}
+
+static int next_message(RecordStream *stream, HandshakeMessage *tls_message) {
+    for (;;) {
+        // Release the previous record only now, so the views handed out for it stay valid until this call
+        if (stream->record != NULL && stream->recordPos >= stream->recordLength) {
+            stream->head += stream->recordLength;
+            stream->record = NULL;
+        }
+
+        memset(tls_message, 0, sizeof(*tls_message));
+
+        if (stream->record == NULL) {
+            int err = load_next_record(stream);
+
+            // The message can't be completed, report what is known about it
+            if (err == STREAM_FRAGMENT_INTERRUPTED) {
+                set_record_fields(&stream->messageRecord, tls_message);
+                tls_message->fragments = stream->messageFragments;
+                if (stream->messageLength >= HANDSHAKE_HEADER_SIZE) {
+                    tls_message->hsType = stream->messageHeader[0];
+                    tls_message->mLength = stream->messageSize - HANDSHAKE_HEADER_SIZE;
+                }
+
+                stream->reassembling = 0;
+
+                return INVALID_FILE_LENGTH;
+            }
+
+            if (err) {
+                set_record_fields(&stream->recordHeader, tls_message);
+
+                return err;
+            }
+
+            if (stream->reassembling) {
+                stream->messageFragments++;
+            }
+        }
+
+        set_record_fields(&stream->recordHeader, tls_message);
+
+        if (stream->reassembling) {
+            collect_fragment(stream);
+
+            if (stream->messageSize == 0 || stream->messageLength < stream->messageSize) {
+                continue;
+            }
+
+            // Complete, the message is reported with the record header of its first fragment
+            stream->reassembling = 0;
+            set_record_fields(&stream->messageRecord, tls_message);
+            tls_message->fragments = stream->messageFragments;
+            tls_message->hsType = stream->messageHeader[0];
+            tls_message->mLength = stream->messageSize - HANDSHAKE_HEADER_SIZE;
+
+            if (stream->messageDiscarded) {
+                return MESSAGE_TOO_LARGE;
+            }
+
+            tls_message->body = stream->message + HANDSHAKE_HEADER_SIZE;
+
+            return NO_ERROR;
+        }
+
+        // A single record may carry several handshake messages, they are returned one by one
+        int remaining = stream->recordLength - stream->recordPos;
+        const unsigned char *data = stream->record + stream->recordPos;
+
+        // A message (or even its header) that continues in the next records is collected from them,
+        // only then it's copied. Messages within one record stay views into it.
+        if (!tls_message->sslv2 && remaining > 0 &&
+            (remaining < HANDSHAKE_HEADER_SIZE || ((uint32_t)(data[1] << 16) | (data[2] << 8) | data[3]) > (uint32_t)remaining - HANDSHAKE_HEADER_SIZE)) {
+            stream->reassembling = 1;
+            stream->messageRecord = stream->recordHeader;
+            stream->messageLength = 0;
+            stream->messageSize = 0;
+            stream->messageFragments = 1;
+            stream->messageDiscarded = 0;
+            collect_fragment(stream);
+
+            continue;
+        }
+
+        int err = parse_handshake_header(data, remaining, tls_message);
+
+        if (err) {
+            // An empty handshake record, nothing to report but the record itself
+            stream->recordPos = stream->recordLength;
+
+            return err;
+        }
+
+        // An SSLv2 compatible ClientHello takes up the whole record
+        stream->recordPos = tls_message->sslv2 ? stream->recordLength : stream->recordPos + HANDSHAKE_HEADER_SIZE + (int)tls_message->mLength;
+
+        return NO_ERROR;
+    }
+}
+
+int next_stream_message(RecordStream *stream, HandshakeMessage *tls_message) {
+    if (stream->error) {
+        return stream->error;
+    }
+
+    METRIC_START(start);
+    int err = next_message(stream, tls_message);
+    METRIC_STOP(METRIC_STAGE_RECORD, start);
+    METRIC_ERROR(err);
+
+    return err;
+}
@@ -0,0 +1,51 @@
+#ifndef TLS_STREAM_H
+#define TLS_STREAM_H
+
+#include "tls_parser.h"
+
+#define STREAM_NEED_MORE_DATA -1 // Returned by next_stream_message when no complete message is buffered
+#define DEFAULT_STREAM_CAPACITY 131072 // Fits the largest possible record (5 + 65535 bytes)
+#define DEFAULT_MAX_MESSAGE_SIZE 1048576 // Largest handshake message reassembled from several records
+
+// Incremental reader for a byte stream of concatenated TLS records. The caller feeds chunks of
+// any size and pulls handshake messages out as soon as their record is complete. The data is
+// kept in a ring buffer of a fixed capacity, a record is only copied (into scratch) when it
+// wraps around the end of the ring.
+// A stream can also be attached to a complete buffer that is already in memory (e.g. a mapped
+// file), in that case nothing is ever copied and there is no limit on the size of the input.
+// Handshake messages that span several records (large certificate chains) are reassembled into a
+// buffer of their own, which is the only case where a message is copied. Several messages in one
+// record are returned one by one.
+typedef struct {
+    unsigned char *ring;
+    const unsigned char *input;   // Attached buffer, replaces the ring when set
+    unsigned char *scratch;       // Linear copy of the current record if it wraps around the ring
+    size_t capacity;              // Power of two, also the largest record that is accepted
+    size_t head;                  // Stream offset of the first unconsumed byte
+    size_t tail;                  // Stream offset right after the last buffered byte
+    const unsigned char *record;  // Current record (ring or scratch), NULL if there is none
+    int recordLength;             // Including the record header
+    int recordPos;                // Offset of the next handshake message inside the record
+    HandshakeMessage recordHeader;
+    int error;                    // Set once the record framing is lost, the stream can't continue
+    unsigned long records;        // Number of complete records seen so far
+    unsigned char *message;       // Message being reassembled from several records, grown on demand
+    uint32_t messageCapacity;
+    uint32_t messageLength;       // Bytes collected so far, including the handshake header
+    uint32_t messageSize;         // Including the handshake header, 0 until the header is complete
+    uint32_t maxMessageSize;      // Larger messages are skipped and reported as MESSAGE_TOO_LARGE, 0 for DEFAULT_MAX_MESSAGE_SIZE
+    uint16_t messageFragments;    // Records the message was collected from so far
+    uint8_t reassembling;
+    uint8_t messageDiscarded;     // Above maxMessageSize, only counted down
+    unsigned char messageHeader[HANDSHAKE_HEADER_SIZE];
+    HandshakeMessage messageRecord; // Record header of the first fragment
+} RecordStream;
+
+int init_record_stream(RecordStream *stream, size_t capacity);
+void free_record_stream(RecordStream *stream);
+void reset_record_stream(RecordStream *stream);
+void attach_record_stream(RecordStream *stream, const unsigned char *data, size_t size);
+size_t feed_record_stream(RecordStream *stream, const unsigned char *data, size_t length);
+int next_stream_message(RecordStream *stream, HandshakeMessage *tls_message);
+
+#endif
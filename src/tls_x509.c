@@ -0,0 +1,629 @@
+#include "tls_x509.h"
+#include "hash.h"
+
+#include <arpa/inet.h>
+
+#define LRU_NONE UINT32_MAX
+
+#define DER_INTEGER 0x02
+#define DER_OCTET_STRING 0x04
+#define DER_OID 0x06
+#define DER_UTC_TIME 0x17
+#define DER_GENERALIZED_TIME 0x18
+#define DER_SEQUENCE 0x30
+#define DER_SET 0x31
+#define DER_BOOLEAN 0x01
+#define DER_EXPLICIT_0 0xa0
+#define DER_EXPLICIT_3 0xa3
+
+typedef struct {
+    uint8_t tag;
+    const unsigned char *value;
+    uint32_t length;
+} DerItem;
+
+// Reads the item at *pos and moves *pos behind it. Only single byte tags and definite lengths
+// of up to 4 bytes exist in DER certificates, anything else is rejected.
+static int der_next(const unsigned char *data, uint32_t size, uint32_t *pos, DerItem *item) {
+    uint32_t p = *pos;
+
+    if (size - p < 2 || (data[p] & 0x1f) == 0x1f) {
+        return 0;
+    }
+
+    item->tag = data[p++];
+
+    uint32_t length = data[p++];
+    if (length & 0x80) {
+        uint32_t bytes = length & 0x7f;
+
+        if (bytes == 0 || bytes > 4 || size - p < bytes) {
+            return 0;
+        }
+
+        length = 0;
+        while (bytes-- > 0) {
+            length = (length << 8) | data[p++];
+        }
+    }
+
+    if (length > size - p) {
+        return 0;
+    }
+
+    item->value = data + p;
+    item->length = length;
+    *pos = p + length;
+
+    return 1;
+}
+
+static int der_expect(const unsigned char *data, uint32_t size, uint32_t *pos, uint8_t tag, DerItem *item) {
+    return der_next(data, size, pos, item) && item->tag == tag;
+}
+
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    // Howard Hinnant's algorithm, proleptic Gregorian calendar
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+static int parse_digits(const unsigned char *p, int count, int *value) {
+    *value = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return 0;
+        }
+
+        *value = *value * 10 + (p[i] - '0');
+    }
+
+    return 1;
+}
+
+// UTCTime (YYMMDDHHMMSSZ) or GeneralizedTime (YYYYMMDDHHMMSSZ), the only forms allowed in DER
+static int parse_der_time(const DerItem *item, int64_t *time) {
+    const unsigned char *p = item->value;
+    int year, month, day, hour, minute, second;
+
+    if (item->tag == DER_UTC_TIME && item->length == 13 && p[12] == 'Z') {
+        if (!parse_digits(p, 2, &year)) {
+            return 0;
+        }
+
+        year += year < 50 ? 2000 : 1900;
+        p += 2;
+    } else if (item->tag == DER_GENERALIZED_TIME && item->length == 15 && p[14] == 'Z') {
+        if (!parse_digits(p, 4, &year)) {
+            return 0;
+        }
+
+        p += 4;
+    } else {
+        return 0;
+    }
+
+    if (!parse_digits(p, 2, &month) || !parse_digits(p + 2, 2, &day) || !parse_digits(p + 4, 2, &hour) ||
+        !parse_digits(p + 6, 2, &minute) || !parse_digits(p + 8, 2, &second) ||
+        month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return 0;
+    }
+
+    *time = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+
+    return 1;
+}
+
+static int is_subject_alt_name_oid(const DerItem *oid) {
+    // 2.5.29.17
+    return oid->length == 3 && oid->value[0] == 0x55 && oid->value[1] == 0x1d && oid->value[2] == 0x11;
+}
+
+static int find_subject_alt_names(const DerItem *extensions, X509Certificate *certificate) {
+    DerItem list, extension, item;
+    uint32_t pos = 0;
+
+    if (!der_expect(extensions->value, extensions->length, &pos, DER_SEQUENCE, &list)) {
+        return 0;
+    }
+
+    pos = 0;
+    while (pos < list.length) {
+        uint32_t inner = 0;
+
+        if (!der_expect(list.value, list.length, &pos, DER_SEQUENCE, &extension) ||
+            !der_expect(extension.value, extension.length, &inner, DER_OID, &item)) {
+            return 0;
+        }
+
+        if (!is_subject_alt_name_oid(&item)) {
+            continue;
+        }
+
+        // critical is optional
+        DerItem value;
+        if (!der_next(extension.value, extension.length, &inner, &value)) {
+            return 0;
+        }
+
+        if (value.tag == DER_BOOLEAN && !der_next(extension.value, extension.length, &inner, &value)) {
+            return 0;
+        }
+
+        uint32_t names_pos = 0;
+        if (value.tag != DER_OCTET_STRING || !der_expect(value.value, value.length, &names_pos, DER_SEQUENCE, &item)) {
+            return 0;
+        }
+
+        certificate->altNames = item.value;
+        certificate->altNamesLength = item.length;
+    }
+
+    return 1;
+}
+
+int decode_x509_certificate(const unsigned char *der, uint32_t length, X509Certificate *certificate) {
+    DerItem outer, tbs, item;
+    uint32_t pos = 0;
+
+    memset(certificate, 0, sizeof(*certificate));
+    certificate->der = der;
+    certificate->length = length;
+
+    if (!der_expect(der, length, &pos, DER_SEQUENCE, &outer) ||
+        !der_expect(outer.value, outer.length, &(uint32_t){0}, DER_SEQUENCE, &tbs)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    pos = 0;
+    const unsigned char *t = tbs.value;
+    uint32_t size = tbs.length;
+
+    if (!der_next(t, size, &pos, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    // [0] version is optional (v1 certificates)
+    if (item.tag == DER_EXPLICIT_0 && !der_next(t, size, &pos, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    if (item.tag != DER_INTEGER) {
+        return INVALID_CERTIFICATE;
+    }
+
+    certificate->serial = item.value;
+    certificate->serialLength = item.length;
+
+    // signature AlgorithmIdentifier, then issuer
+    if (!der_expect(t, size, &pos, DER_SEQUENCE, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    uint32_t name_start = pos;
+    if (!der_expect(t, size, &pos, DER_SEQUENCE, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    certificate->issuer = t + name_start;
+    certificate->issuerLength = pos - name_start;
+
+    DerItem validity, time;
+    uint32_t validity_pos = 0;
+    if (!der_expect(t, size, &pos, DER_SEQUENCE, &validity) ||
+        !der_next(validity.value, validity.length, &validity_pos, &time) || !parse_der_time(&time, &certificate->notBefore) ||
+        !der_next(validity.value, validity.length, &validity_pos, &time) || !parse_der_time(&time, &certificate->notAfter)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    name_start = pos;
+    if (!der_expect(t, size, &pos, DER_SEQUENCE, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    certificate->subject = t + name_start;
+    certificate->subjectLength = pos - name_start;
+
+    // subjectPublicKeyInfo
+    if (!der_expect(t, size, &pos, DER_SEQUENCE, &item)) {
+        return INVALID_CERTIFICATE;
+    }
+
+    // Optional unique ids ([1], [2]) and the extensions ([3])
+    while (pos < size) {
+        if (!der_next(t, size, &pos, &item)) {
+            return INVALID_CERTIFICATE;
+        }
+
+        if (item.tag == DER_EXPLICIT_3 && !find_subject_alt_names(&item, certificate)) {
+            return INVALID_CERTIFICATE;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+int next_subject_alt_name(const X509Certificate *certificate, uint32_t *pos, int *type, const unsigned char **value, uint32_t *length) {
+    DerItem item;
+
+    if (certificate->altNames == NULL || *pos >= certificate->altNamesLength ||
+        !der_next(certificate->altNames, certificate->altNamesLength, pos, &item)) {
+        return 0;
+    }
+
+    *type = item.tag & 0x1f;
+    *value = item.value;
+    *length = item.length;
+
+    return 1;
+}
+
+// Appends to buf[*used..size), always keeping it terminated. *used keeps counting past the end.
+static void append_text(char *buf, size_t size, size_t *used, const char *text, size_t length) {
+    if (*used < size) {
+        size_t available = size - *used - 1;
+        size_t take = length < available ? length : available;
+
+        memcpy(buf + *used, text, take);
+        buf[*used + take] = '\0';
+    }
+
+    *used += length;
+}
+
+// Printable ASCII is copied, everything else (and the separators) escaped as \xx
+static void append_escaped(char *buf, size_t size, size_t *used, const unsigned char *text, uint32_t length, int step) {
+    static const char hex[] = "0123456789abcdef";
+
+    for (uint32_t i = step - 1; i < length; i += step) {
+        unsigned char c = text[i];
+
+        // BMPString: the high byte of a character outside of ASCII isn't zero
+        if (step == 2 && text[i - 1] != 0) {
+            c = '?';
+        }
+
+        if (c >= 0x20 && c < 0x7f && c != '\\' && c != ',') {
+            append_text(buf, size, used, (const char *)&c, 1);
+        } else {
+            char escaped[3] = { '\\', hex[c >> 4], hex[c & 0x0f] };
+            append_text(buf, size, used, escaped, 3);
+        }
+    }
+}
+
+static const char *get_attribute_name(const DerItem *oid) {
+    // 2.5.4.x
+    if (oid->length != 3 || oid->value[0] != 0x55 || oid->value[1] != 0x04) {
+        return NULL;
+    }
+
+    switch (oid->value[2]) {
+        case 3: return "CN";
+        case 5: return "serialNumber";
+        case 6: return "C";
+        case 7: return "L";
+        case 8: return "ST";
+        case 10: return "O";
+        case 11: return "OU";
+        default: return NULL;
+    }
+}
+
+static void append_oid(char *buf, size_t size, size_t *used, const DerItem *oid) {
+    char number[24];
+    uint64_t value = 0;
+    int first = 1;
+
+    for (uint32_t i = 0; i < oid->length; i++) {
+        value = (value << 7) | (oid->value[i] & 0x7f);
+
+        if (oid->value[i] & 0x80) {
+            continue;
+        }
+
+        int length;
+        if (first) {
+            unsigned top = value < 80 ? (unsigned)(value / 40) : 2;
+            length = snprintf(number, sizeof(number), "%u.%llu", top, (unsigned long long)(value - top * 40));
+            first = 0;
+        } else {
+            length = snprintf(number, sizeof(number), ".%llu", (unsigned long long)value);
+        }
+
+        append_text(buf, size, used, number, length);
+        value = 0;
+    }
+}
+
+// "C=US, O=Example, CN=www.example.com" in the order of the encoding. Returns the length of the
+// whole string like snprintf, or 0 if the name is malformed.
+size_t format_x509_name(const unsigned char *name, uint32_t length, char *buf, size_t size) {
+    DerItem sequence, set, attribute, oid, value;
+    uint32_t pos = 0;
+    size_t used = 0;
+
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+
+    if (!der_expect(name, length, &pos, DER_SEQUENCE, &sequence)) {
+        return 0;
+    }
+
+    pos = 0;
+    while (pos < sequence.length) {
+        uint32_t set_pos = 0;
+
+        if (!der_expect(sequence.value, sequence.length, &pos, DER_SET, &set)) {
+            return 0;
+        }
+
+        while (set_pos < set.length) {
+            uint32_t attribute_pos = 0;
+
+            if (!der_expect(set.value, set.length, &set_pos, DER_SEQUENCE, &attribute) ||
+                !der_expect(attribute.value, attribute.length, &attribute_pos, DER_OID, &oid) ||
+                !der_next(attribute.value, attribute.length, &attribute_pos, &value)) {
+                return 0;
+            }
+
+            if (used > 0) {
+                append_text(buf, size, &used, ", ", 2);
+            }
+
+            const char *attribute_name = get_attribute_name(&oid);
+            if (attribute_name != NULL) {
+                append_text(buf, size, &used, attribute_name, strlen(attribute_name));
+            } else {
+                append_oid(buf, size, &used, &oid);
+            }
+
+            append_text(buf, size, &used, "=", 1);
+
+            // BMPString has 2 bytes per character, every other string type is taken byte by byte
+            append_escaped(buf, size, &used, value.value, value.length, value.tag == 0x1e ? 2 : 1);
+        }
+    }
+
+    return used;
+}
+
+size_t format_subject_alt_names(const X509Certificate *certificate, char *buf, size_t size) {
+    const unsigned char *value;
+    uint32_t length;
+    uint32_t pos = 0;
+    size_t used = 0;
+    int type;
+
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+
+    while (next_subject_alt_name(certificate, &pos, &type, &value, &length)) {
+        char address[INET6_ADDRSTRLEN];
+
+        if (type == ALT_NAME_DNS) {
+            if (used > 0) {
+                append_text(buf, size, &used, ", ", 2);
+            }
+
+            append_escaped(buf, size, &used, value, length, 1);
+        } else if (type == ALT_NAME_IP && (length == 4 || length == 16)) {
+            if (used > 0) {
+                append_text(buf, size, &used, ", ", 2);
+            }
+
+            inet_ntop(length == 4 ? AF_INET : AF_INET6, value, address, sizeof(address));
+            append_text(buf, size, &used, address, strlen(address));
+        }
+    }
+
+    return used;
+}
+
+void format_x509_time(int64_t time, char *buf, size_t size) {
+    time_t value = (time_t)time;
+    struct tm tm;
+
+    if (gmtime_r(&value, &tm) == NULL || strftime(buf, size, "%Y-%m-%dT%H:%M:%SZ", &tm) == 0) {
+        snprintf(buf, size, "%lld", (long long)time);
+    }
+}
+
+void get_certificate_fingerprint(const unsigned char *der, uint32_t length, unsigned char fingerprint[CERTIFICATE_FINGERPRINT_SIZE]) {
+    sha256(der, length, fingerprint);
+}
+
+int summarize_certificate(const unsigned char *der, uint32_t length, CertificateSummary *summary) {
+    X509Certificate certificate;
+
+    memset(summary, 0, sizeof(*summary));
+    get_certificate_fingerprint(der, length, summary->fingerprint);
+
+    summary->error = decode_x509_certificate(der, length, &certificate);
+    if (summary->error != NO_ERROR) {
+        return summary->error;
+    }
+
+    format_x509_name(certificate.subject, certificate.subjectLength, summary->subject, sizeof(summary->subject));
+    format_x509_name(certificate.issuer, certificate.issuerLength, summary->issuer, sizeof(summary->issuer));
+    format_subject_alt_names(&certificate, summary->altNames, sizeof(summary->altNames));
+    summary->notBefore = certificate.notBefore;
+    summary->notAfter = certificate.notAfter;
+
+    return NO_ERROR;
+}
+
+// Cache
+
+static uint64_t hash_certificate(const unsigned char *der, uint32_t length) {
+    // The result only picks the slot, hits are confirmed with memcmp
+    FastHash hash;
+
+    fast_hash_init(&hash, length);
+    fast_hash_update(&hash, der, length);
+
+    return fast_hash_final(&hash);
+}
+
+int init_certificate_cache(CertificateCache *cache, size_t max_entries) {
+    memset(cache, 0, sizeof(*cache));
+
+    size_t capacity = 16;
+    while (capacity * 3 / 4 < max_entries) {
+        capacity <<= 1;
+    }
+
+    cache->entries = (CertificateCacheEntry *)calloc(capacity, sizeof(CertificateCacheEntry));
+    if (cache->entries == NULL) {
+        return -1;
+    }
+
+    cache->capacity = capacity;
+    cache->maxEntries = max_entries > 0 ? max_entries : 1;
+    cache->lruHead = LRU_NONE;
+    cache->lruTail = LRU_NONE;
+
+    return 0;
+}
+
+void free_certificate_cache(CertificateCache *cache) {
+    size_t i;
+
+    for (i = 0; i < cache->capacity; i++) {
+        free(cache->entries[i].der);
+    }
+
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->count = 0;
+}
+
+static void cache_unlink(CertificateCache *cache, uint32_t index) {
+    CertificateCacheEntry *entry = &cache->entries[index];
+
+    if (entry->lruPrev != LRU_NONE) {
+        cache->entries[entry->lruPrev].lruNext = entry->lruNext;
+    } else {
+        cache->lruHead = entry->lruNext;
+    }
+
+    if (entry->lruNext != LRU_NONE) {
+        cache->entries[entry->lruNext].lruPrev = entry->lruPrev;
+    } else {
+        cache->lruTail = entry->lruPrev;
+    }
+}
+
+static void cache_push_front(CertificateCache *cache, uint32_t index) {
+    CertificateCacheEntry *entry = &cache->entries[index];
+
+    entry->lruPrev = LRU_NONE;
+    entry->lruNext = cache->lruHead;
+
+    if (cache->lruHead != LRU_NONE) {
+        cache->entries[cache->lruHead].lruPrev = index;
+    } else {
+        cache->lruTail = index;
+    }
+
+    cache->lruHead = index;
+}
+
+static void cache_remove(CertificateCache *cache, uint32_t index) {
+    uint32_t mask = cache->capacity - 1;
+    uint32_t hole = index;
+    uint32_t i = (index + 1) & mask;
+
+    cache_unlink(cache, index);
+    free(cache->entries[index].der);
+    memset(&cache->entries[index], 0, sizeof(CertificateCacheEntry));
+    cache->count--;
+
+    // Backward shift deletion, the moved entries keep their place in the LRU list
+    while (cache->entries[i].used) {
+        uint32_t home = cache->entries[i].hash & mask;
+
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            CertificateCacheEntry *entry = &cache->entries[i];
+
+            if (entry->lruPrev != LRU_NONE) {
+                cache->entries[entry->lruPrev].lruNext = hole;
+            } else {
+                cache->lruHead = hole;
+            }
+
+            if (entry->lruNext != LRU_NONE) {
+                cache->entries[entry->lruNext].lruPrev = hole;
+            } else {
+                cache->lruTail = hole;
+            }
+
+            cache->entries[hole] = *entry;
+            memset(entry, 0, sizeof(*entry));
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+// The result stays valid until the next call. NULL only if memory for a new entry couldn't be allocated.
+const CertificateSummary *get_certificate_summary(CertificateCache *cache, const unsigned char *der, uint32_t length) {
+    uint64_t hash = hash_certificate(der, length);
+    uint32_t mask = cache->capacity - 1;
+    uint32_t i = hash & mask;
+
+    while (cache->entries[i].used) {
+        CertificateCacheEntry *entry = &cache->entries[i];
+
+        if (entry->hash == hash && entry->length == length && memcmp(entry->der, der, length) == 0) {
+            cache->hits++;
+            cache_unlink(cache, i);
+            cache_push_front(cache, i);
+
+            return &entry->summary;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    cache->misses++;
+
+    unsigned char *copy = (unsigned char *)malloc(length);
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    memcpy(copy, der, length);
+
+    if (cache->count >= cache->maxEntries) {
+        cache->evictions++;
+        cache_remove(cache, cache->lruTail);
+
+        // The removal may have shifted entries into the probe sequence
+        i = hash & mask;
+        while (cache->entries[i].used) {
+            i = (i + 1) & mask;
+        }
+    }
+
+    CertificateCacheEntry *entry = &cache->entries[i];
+    entry->hash = hash;
+    entry->used = 1;
+    entry->length = length;
+    entry->der = copy;
+    summarize_certificate(der, length, &entry->summary);
+
+    cache_push_front(cache, i);
+    cache->count++;
+
+    return &entry->summary;
+}
@@ -0,0 +1,83 @@
+#ifndef TLS_X509_H
+#define TLS_X509_H
+
+#include "tls_parser.h"
+
+#define CERTIFICATE_FINGERPRINT_SIZE 32 // SHA-256
+#define CERTIFICATE_NAME_SIZE 256
+#define CERTIFICATE_ALT_NAMES_SIZE 512
+#define DEFAULT_CERTIFICATE_CACHE_SIZE 4096
+
+// General name types of the subjectAltName extension (context specific tags of GeneralName)
+#define ALT_NAME_EMAIL 1
+#define ALT_NAME_DNS 2
+#define ALT_NAME_URI 6
+#define ALT_NAME_IP 7
+
+// The fields of a DER encoded X.509 certificate that the parser cares about. Like everything else
+// these are views into the certificate, names are the DER encoded Name including its header.
+typedef struct {
+    const unsigned char *der;
+    uint32_t length;
+    const unsigned char *serial;
+    uint32_t serialLength;
+    const unsigned char *issuer;
+    uint32_t issuerLength;
+    const unsigned char *subject;
+    uint32_t subjectLength;
+    int64_t notBefore;        // Seconds since the epoch
+    int64_t notAfter;
+    const unsigned char *altNames; // Content of the GeneralNames sequence, NULL without subjectAltName
+    uint32_t altNamesLength;
+} X509Certificate;
+
+// Decoded certificate with its own copies of the formatted fields, as kept by the cache
+typedef struct {
+    unsigned char fingerprint[CERTIFICATE_FINGERPRINT_SIZE];
+    char subject[CERTIFICATE_NAME_SIZE];
+    char issuer[CERTIFICATE_NAME_SIZE];
+    char altNames[CERTIFICATE_ALT_NAMES_SIZE]; // DNS names and IP addresses separated by ", "
+    int64_t notBefore;
+    int64_t notAfter;
+    int error;                // NO_ERROR, or INVALID_CERTIFICATE if only the fingerprint is known
+} CertificateSummary;
+
+typedef struct {
+    uint64_t hash;            // Fast hash of the DER, the DER itself is compared on a hit
+    uint32_t lruPrev;
+    uint32_t lruNext;
+    uint8_t used;
+    uint32_t length;
+    unsigned char *der;       // Copy of the certificate
+    CertificateSummary summary;
+} CertificateCacheEntry;
+
+// Decoded certificates keyed by their DER encoding, least recently used first out. A certificate
+// seen before costs one hash over the DER and a memcmp, no decoding and no SHA-256. Not thread safe,
+// every thread needs its own cache.
+typedef struct {
+    CertificateCacheEntry *entries;
+    size_t capacity;          // Power of two
+    size_t maxEntries;
+    size_t count;
+    uint32_t lruHead;
+    uint32_t lruTail;
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} CertificateCache;
+
+int decode_x509_certificate(const unsigned char *der, uint32_t length, X509Certificate *certificate);
+int next_subject_alt_name(const X509Certificate *certificate, uint32_t *pos, int *type, const unsigned char **value, uint32_t *length);
+size_t format_x509_name(const unsigned char *name, uint32_t length, char *buf, size_t size);
+size_t format_subject_alt_names(const X509Certificate *certificate, char *buf, size_t size);
+void format_x509_time(int64_t time, char *buf, size_t size);
+void get_certificate_fingerprint(const unsigned char *der, uint32_t length, unsigned char fingerprint[CERTIFICATE_FINGERPRINT_SIZE]);
+int summarize_certificate(const unsigned char *der, uint32_t length, CertificateSummary *summary);
+
+int init_certificate_cache(CertificateCache *cache, size_t max_entries);
+void free_certificate_cache(CertificateCache *cache);
+const CertificateSummary *get_certificate_summary(CertificateCache *cache, const unsigned char *der, uint32_t length);
+
+#endif
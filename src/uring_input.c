@@ -0,0 +1,455 @@
+#include "tls_parser_cli.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+// OPENAT and STATX came with 5.6, FAST_POLL with 5.7, so older headers can't build the backend
+#if defined(IORING_FEAT_FAST_POLL) && defined(__NR_io_uring_setup)
+
+// Only declared by fcntl.h with _GNU_SOURCE
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+#define URING_SLOTS 64               // Files in flight
+#define URING_BUFFER_SIZE 65536      // Per slot, larger files finish with a synchronous read
+
+// Completions name the slot and the operation that completed
+#define URING_OPEN 1
+#define URING_STATX 2
+#define URING_READ 3
+#define URING_USER_DATA(slot, op) (((uint64_t)(slot) << 8) | (op))
+
+typedef struct {
+    const char *path;
+    int fd;
+    int pending;                     // Operations submitted and not completed yet
+    int statxResult;
+    int readResult;
+    struct statx statx;
+    unsigned char *buffer;           // Registered with the ring unless registration failed
+} UringSlot;
+
+typedef struct {
+    int fd;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+    unsigned sqeTail;                // Entries up to here are filled, the kernel sees them after flush_sq
+    unsigned toSubmit;
+    int fixedBuffers;                // READ_FIXED into the registered slot buffers
+} Uring;
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static void close_uring(Uring *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+// The kernel has to know every operation the backend uses, otherwise the caller falls back
+static int probe_operations(int fd) {
+    static const int required[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_READ_FIXED };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, size);
+    int result = -1;
+
+    if (probe != NULL && uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        result = 0;
+
+        for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++) {
+            if (required[i] > probe->last_op || !(probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED)) {
+                result = -1;
+            }
+        }
+    }
+
+    free(probe);
+
+    return result;
+}
+
+static int open_uring(Uring *ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    if (probe_operations(ring->fd) != 0) {
+        close_uring(ring);
+
+        return -1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Both rings share one mapping on kernels that support it
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        close_uring(ring);
+
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    }
+
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close_uring(ring);
+
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)ring->sqRing;
+    unsigned char *cq = (unsigned char *)ring->cqRing;
+
+    ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+    ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sqeTail = *ring->sqTail;
+
+    return 0;
+}
+
+// The ring has twice as many entries as there are slots, and a slot has at most two operations
+// in flight, so there is always room. The entry is only handed to the kernel by flush_sq, once
+// the caller filled it in.
+static struct io_uring_sqe *next_sqe(Uring *ring) {
+    unsigned index = ring->sqeTail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqeTail++;
+    ring->toSubmit++;
+
+    return sqe;
+}
+
+// Publishes the filled entries, the release store orders them before the new tail
+static void flush_sq(Uring *ring) {
+    __atomic_store_n(ring->sqTail, ring->sqeTail, __ATOMIC_RELEASE);
+}
+
+static void submit_open(Uring *ring, UringSlot *slots, int slot) {
+    struct io_uring_sqe *sqe = next_sqe(ring);
+
+    // Same rules as read_input_file: no symbolic links, only regular files
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)slots[slot].path;
+    sqe->open_flags = O_RDONLY | O_NOFOLLOW;
+    sqe->user_data = URING_USER_DATA(slot, URING_OPEN);
+
+    slots[slot].pending = 1;
+}
+
+// The descriptor is known now, its type and size are looked up while the first block is read
+static void submit_statx_and_read(Uring *ring, UringSlot *slots, int slot) {
+    UringSlot *s = &slots[slot];
+    struct io_uring_sqe *sqe = next_sqe(ring);
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)"";
+    sqe->len = STATX_TYPE | STATX_SIZE;
+    sqe->statx_flags = AT_EMPTY_PATH;
+    sqe->off = (uint64_t)(uintptr_t)&s->statx;
+    sqe->user_data = URING_USER_DATA(slot, URING_STATX);
+
+    sqe = next_sqe(ring);
+    sqe->opcode = ring->fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)s->buffer;
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->off = 0;
+    sqe->buf_index = ring->fixedBuffers ? slot : 0;
+    sqe->user_data = URING_USER_DATA(slot, URING_READ);
+
+    s->pending = 2;
+}
+
+// A file larger than the slot buffer (or read short) is completed with plain reads into the
+// context's input buffer
+static const char *finish_large_file(UringSlot *slot, size_t size, BatchContext *ctx, const unsigned char **data, int *file_size) {
+    InputBuffer *input = &ctx->input;
+    size_t done = slot->readResult;
+
+    if (size > input->capacity) {
+        size_t capacity = input->capacity ? input->capacity : 4096;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+
+        unsigned char *grown = (unsigned char *)realloc(input->data, capacity);
+        if (grown == NULL) {
+            return "Out of memory.";
+        }
+
+        input->data = grown;
+        input->capacity = capacity;
+    }
+
+    memcpy(input->data, slot->buffer, done);
+
+    while (done < size) {
+        ssize_t n = pread(slot->fd, input->data + done, size - done, done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            break;
+        }
+
+        done += n;
+    }
+
+    *data = input->data;
+    *file_size = (int)done;
+
+    return NULL;
+}
+
+// Both the statx and the read of a slot completed, the file is reported and the slot freed
+static void finish_slot(UringSlot *slot, BatchContext *ctx) {
+    const char *reason = NULL;
+    const unsigned char *data = slot->buffer;
+    int file_size = slot->readResult > 0 ? slot->readResult : 0;
+
+    if (slot->statxResult < 0 || !S_ISREG(slot->statx.stx_mode)) {
+        reason = "The path is not a regular file.";
+    } else if (slot->statx.stx_size > MAXIMUM_FILE_SIZE) {
+        reason = "The file is larger then 20 MB.";
+    } else if (slot->readResult >= 0 && (uint64_t)slot->readResult < slot->statx.stx_size) {
+        reason = finish_large_file(slot, slot->statx.stx_size, ctx, &data, &file_size);
+    }
+
+    if (reason != NULL) {
+        batch_write(ctx, "%s: [SKIPPED] %s\n", slot->path, reason);
+        ctx->summary.skipped++;
+    } else {
+        batch_process_data(slot->path, data, file_size, ctx);
+    }
+
+    close(slot->fd);
+    slot->fd = -1;
+    slot->path = NULL;
+}
+
+// Returns 1 if the slot is free again
+static int complete_operation(Uring *ring, UringSlot *slots, const struct io_uring_cqe *cqe, BatchContext *ctx) {
+    int slot = (int)(cqe->user_data >> 8);
+    UringSlot *s = &slots[slot];
+
+    s->pending--;
+
+    switch (cqe->user_data & 0xff) {
+    case URING_OPEN:
+        if (cqe->res < 0) {
+            batch_write(ctx, "%s: [SKIPPED] The file couldn't be opened.\n", s->path);
+            ctx->summary.skipped++;
+            s->path = NULL;
+
+            return 1;
+        }
+
+        s->fd = cqe->res;
+        submit_statx_and_read(ring, slots, slot);
+
+        return 0;
+    case URING_STATX:
+        s->statxResult = cqe->res;
+        break;
+    case URING_READ:
+        s->readResult = cqe->res;
+        break;
+    }
+
+    if (s->pending > 0) {
+        return 0;
+    }
+
+    finish_slot(s, ctx);
+
+    return 1;
+}
+
+static void register_buffers(Uring *ring, UringSlot *slots, unsigned char *buffers) {
+    struct iovec iov[URING_SLOTS];
+
+    for (int i = 0; i < URING_SLOTS; i++) {
+        slots[i].buffer = buffers + (size_t)i * URING_BUFFER_SIZE;
+        slots[i].fd = -1;
+        iov[i].iov_base = slots[i].buffer;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+
+    // Pinning the buffers may exceed RLIMIT_MEMLOCK on older kernels, plain reads work as well
+    ring->fixedBuffers = uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, URING_SLOTS) == 0;
+}
+
+int run_uring_batch(JobList *jobs, BatchContext *ctx) {
+    Uring ring;
+    UringSlot slots[URING_SLOTS];
+    int free_slots[URING_SLOTS];
+    int free_count = URING_SLOTS;
+    size_t next = 0;
+
+    if (open_uring(&ring, 2 * URING_SLOTS) != 0) {
+        return -1;
+    }
+
+    unsigned char *buffers = (unsigned char *)mmap(NULL, (size_t)URING_SLOTS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        close_uring(&ring);
+
+        return -1;
+    }
+
+    memset(slots, 0, sizeof(slots));
+    register_buffers(&ring, slots, buffers);
+
+    for (int i = 0; i < URING_SLOTS; i++) {
+        free_slots[i] = URING_SLOTS - 1 - i;
+    }
+
+    while (next < jobs->count || free_count < URING_SLOTS) {
+        // Every free slot starts on the next file, then the completions are reaped in one go
+        while (free_count > 0 && next < jobs->count) {
+            int slot = free_slots[--free_count];
+
+            slots[slot].path = jobs->paths + jobs->offsets[next++];
+            submit_open(&ring, slots, slot);
+        }
+
+        flush_sq(&ring);
+
+        int submitted = uring_enter(ring.fd, ring.toSubmit, 1, IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // The files in flight and the ones not started yet are read the usual way
+            for (int i = 0; i < URING_SLOTS; i++) {
+                if (slots[i].path != NULL) {
+                    batch_process_file(slots[i].path, ctx);
+                }
+            }
+
+            while (next < jobs->count) {
+                batch_process_file(jobs->paths + jobs->offsets[next++], ctx);
+            }
+
+            break;
+        }
+
+        ring.toSubmit -= submitted;
+
+        unsigned head = *ring.cqHead;
+        unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+
+            if (complete_operation(&ring, slots, cqe, ctx)) {
+                free_slots[free_count++] = (int)(cqe->user_data >> 8);
+            }
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < URING_SLOTS; i++) {
+        if (slots[i].fd >= 0) {
+            close(slots[i].fd);
+        }
+    }
+
+    close_uring(&ring);
+    munmap(buffers, (size_t)URING_SLOTS * URING_BUFFER_SIZE);
+
+    return 0;
+}
+
+#else
+
+int run_uring_batch(JobList *jobs, BatchContext *ctx) {
+    (void)jobs;
+    (void)ctx;
+
+    return -1;
+}
+
+#endif